@@ -0,0 +1,134 @@
+// Heap allocations per file during a backup.
+//
+// Usage: bench_backup_allocations <scratch-dir> [directories] [files-per-directory]
+//
+// Creates a tree of empty files under <scratch-dir>/source, backs it up to
+// <scratch-dir>/backups and counts the malloc, calloc and realloc calls made
+// by every thread while the backup runs. The scratch directory must be empty
+// or missing. 1000 x 1000 gives the one-million-file tree.
+
+#include "utm/backup_engine.hpp"
+#include "utm/logging.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+}
+
+namespace {
+
+std::atomic<bool> counting{false};
+std::atomic<std::uint64_t> allocations{0};
+
+void countAllocation() {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool createTree(const std::filesystem::path& root, unsigned directories, unsigned files) {
+    std::error_code ec;
+    for (unsigned d = 0; d < directories; d++) {
+        const std::filesystem::path directory = root / ("dir" + std::to_string(d));
+        if (!std::filesystem::create_directories(directory, ec) && ec) {
+            std::fprintf(stderr, "Failed to create %s: %s\n", directory.c_str(), ec.message().c_str());
+            return false;
+        }
+        for (unsigned f = 0; f < files; f++) {
+            const std::string file = (directory / ("file" + std::to_string(f))).string();
+            int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                std::perror(file.c_str());
+                return false;
+            }
+            ::close(fd);
+        }
+    }
+    return true;
+}
+
+bool finished(utm::BackupStatus status) {
+    return status == utm::BackupStatus::COMPLETED || status == utm::BackupStatus::FAILED ||
+           status == utm::BackupStatus::CANCELLED;
+}
+
+} // namespace
+
+// Interpose the allocator; operator new and every library in the process go through these
+extern "C" void* malloc(std::size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t count, std::size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, std::size_t size) {
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <scratch-dir> [directories] [files-per-directory]\n", argv[0]);
+        return 2;
+    }
+    const std::filesystem::path scratch = argv[1];
+    const unsigned directories = argc > 2 ? std::atoi(argv[2]) : 100;
+    const unsigned files = argc > 3 ? std::atoi(argv[3]) : 1000;
+    const std::uint64_t totalFiles = std::uint64_t(directories) * files;
+
+    utm::getLogger().setConsoleLevel(utm::LogLevel::WARNING);
+
+    if (!createTree(scratch / "source", directories, files)) {
+        return 1;
+    }
+
+    utm::BackupEngine engine;
+    if (!engine.initialize(scratch / "metadata")) {
+        return 1;
+    }
+
+    utm::BackupConfig config;
+    config.sourcePaths = {scratch / "source"};
+    config.destinationPath = scratch / "backups";
+    config.verifyBackup = false;
+
+    std::atomic<bool> done{false};
+    const auto start = std::chrono::steady_clock::now();
+    counting = true;
+    if (!engine.startBackup(config, [&done](utm::BackupStatus status, const utm::BackupStats&) {
+            if (finished(status)) {
+                done = true;
+            }
+        })) {
+        return 1;
+    }
+    while (!done && !finished(engine.getStatus())) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    counting = false;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (engine.getStatus() != utm::BackupStatus::COMPLETED) {
+        std::fprintf(stderr, "Backup did not complete\n");
+        return 1;
+    }
+    const std::uint64_t count = allocations.load();
+    std::printf("files=%llu allocations=%llu per-file=%.2f time=%.2f s\n", static_cast<unsigned long long>(totalFiles),
+                static_cast<unsigned long long>(count), totalFiles ? double(count) / totalFiles : 0.0, seconds);
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Logging latency while utm.log is rotated and compressed.
+//
+// Usage: bench_log_rotation <scratch-dir> [messages] [max-log-size]
+//
+// Logs into a small size limit so the log rotates many times, and reports
+// the latency percentiles of the logging calls. Run it again with a
+// max-log-size larger than the output to compare against no rotation.
+
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <scratch-dir> [messages] [max-log-size]\n", argv[0]);
+        return 2;
+    }
+    const std::size_t messages = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200000;
+    const std::size_t maxSize = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 256 * 1024;
+
+    utm::Logger& logger = utm::getLogger();
+    if (!logger.initialize(argv[1], maxSize, 3)) {
+        return 1;
+    }
+    logger.setConsoleLevel(utm::LogLevel::OFF);
+    logger.setFileLevel(utm::LogLevel::INFO);
+    logger.setOverflowPolicy(utm::LogOverflow::BLOCK);
+
+    std::vector<double> latencies;
+    latencies.reserve(messages);
+    for (std::size_t i = 0; i < messages; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        logger.info("message number " + std::to_string(i) + " with some padding to make lines longer ..........");
+        latencies.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+
+        // Let the writer and compressor catch up now and then, as between real bursts
+        if (i % 20000 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    logger.flush();
+
+    if (latencies.empty()) {
+        return 0;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](std::size_t perMille) {
+        return latencies[std::min(latencies.size() - 1, latencies.size() * perMille / 1000)];
+    };
+    std::printf("p50=%.0f p99=%.0f p999=%.0f max=%.0f ns dropped=%llu\n", percentile(500), percentile(990),
+                percentile(999), latencies.back(), static_cast<unsigned long long>(logger.getDroppedMessages()));
+    return 0;
+}
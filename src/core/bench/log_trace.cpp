@@ -0,0 +1,60 @@
+// Cost of a TRACE call on a per-file path when TRACE is disabled.
+//
+// Usage: bench_log_trace <scratch-dir> [iterations]
+//
+// Compares an empty loop, an eagerly built trace() message and the
+// UTM_TRACE macro with TRACE filtered out at run time. Configure with
+// -DUTM_MIN_LOG_LEVEL=INFO to measure UTM_TRACE compiled out.
+
+#include "utm/logging.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+volatile long sink;
+
+template <typename F>
+double nanosecondsPerCall(long iterations, F&& body) {
+    const auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        body(i);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <scratch-dir> [iterations]\n", argv[0]);
+        return 2;
+    }
+    const long iterations = argc > 2 ? std::atol(argv[2]) : 10000000;
+
+    utm::Logger& logger = utm::getLogger();
+    if (!logger.initialize(argv[1])) {
+        return 1;
+    }
+    logger.setConsoleLevel(utm::LogLevel::INFO);
+    logger.setFileLevel(utm::LogLevel::INFO);
+
+    const std::string path = "/home/user/Documents/some/deeply/nested/file.txt";
+    std::printf("UTM_MIN_LOG_LEVEL: %d\n", UTM_MIN_LOG_LEVEL);
+    std::printf("empty loop:        %.2f ns\n", nanosecondsPerCall(iterations, [&](long i) {
+        sink = i;
+    }));
+    std::printf("eager trace():     %.2f ns\n", nanosecondsPerCall(iterations, [&](long i) {
+        sink = i;
+        logger.trace("Copied " + path + " (" + std::to_string(i) + " bytes)");
+    }));
+    std::printf("UTM_TRACE:         %.2f ns\n", nanosecondsPerCall(iterations, [&](long i) {
+        sink = i;
+        UTM_TRACE("Copied {} ({} bytes)", path, i);
+    }));
+
+    logger.flush();
+    return 0;
+}
@@ -18,6 +18,11 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include "utm/snapshot_diff.hpp"
+#include "utm/snapshot_catalog.hpp"
+#include "utm/config.hpp"
+#include "utm/io_limiter.hpp"
 
 namespace utm {
 
@@ -29,6 +34,7 @@ enum class BackupStatus {
     SCANNING,
     BACKING_UP,
     VERIFYING,
+    RESTORING,
     COMPLETED,
     FAILED,
     CANCELLED
@@ -47,6 +53,9 @@ struct BackupConfig {
     bool useHardLinks = true;                            ///< Whether to use hard links for deduplication
     int compressionLevel = 6;                            ///< Compression level (0-9)
     int threadCount = 0;                                 ///< Thread count (0 = auto)
+    IoLimits ioLimits;                                   ///< Bandwidth, IOPS and I/O priority limits
+    std::filesystem::path eventLogPath;                  ///< Binary per-file event log (empty = none)
+    std::size_t eventLogRecords = 1024 * 1024;           ///< Events the event log keeps
 };
 
 /**
@@ -66,6 +75,120 @@ struct BackupStats {
     std::optional<std::chrono::system_clock::time_point> endTime; ///< End time
     double compressionRatio = 1.0;                       ///< Compression ratio achieved
     size_t dedupSavings = 0;                             ///< Storage saved by deduplication
+    std::chrono::milliseconds ioThrottledTime{0};        ///< Time spent waiting for the I/O limits
+    double filesPerSecond = 0.0;                         ///< Recent rate of processed files
+    double bytesPerSecond = 0.0;                         ///< Recent rate of processed bytes
+    std::optional<std::chrono::seconds> remainingTime;   ///< Estimated time left (unknown until there is a rate)
+};
+
+/**
+ * @brief Order in which a restore reads files from the backup medium
+ */
+enum class RestoreReadOrder {
+    DIRECTORY,   ///< Snapshot walk order
+    INODE,       ///< Inode number, a cheap proxy for on-disk placement
+    PHYSICAL     ///< Physical offset of the first extent (FIEMAP), falling back to inode order
+};
+
+/**
+ * @brief Options for a restore operation
+ */
+struct RestoreOptions {
+    int threadCount = 0;                                 ///< Worker threads (0 = auto)
+    std::uintmax_t largeFileThreshold = 64 * 1024 * 1024; ///< Files at least this large are split into ranges
+    std::uintmax_t rangeSize = 16 * 1024 * 1024;         ///< Size of each concurrently restored range
+    bool useReflinks = true;                             ///< Clone extents when backup and target share a filesystem
+    RestoreReadOrder readOrder = RestoreReadOrder::PHYSICAL; ///< Read order, to avoid seeking on rotating media
+    std::uintmax_t readaheadBatch = 32 * 1024 * 1024;    ///< Small files are read ahead and written in batches of about this size (0 = off)
+    bool incremental = false;                            ///< Only transfer files that differ from the target
+    bool compareContents = true;                         ///< Hash same-sized files with differing times instead of assuming a change
+    bool deleteExtraneous = false;                       ///< Remove target entries that are not in the snapshot (incremental only)
+    bool dryRun = false;                                 ///< Only plan the restore; see RestoreEngine::getLastPlan()
+    IoLimits ioLimits;                                   ///< Bandwidth, IOPS and I/O priority limits
+};
+
+/**
+ * @brief Action planned for one entry of the restore target
+ */
+enum class RestoreAction {
+    CREATE,            ///< Missing from the target; copied from the snapshot
+    REPLACE,           ///< Content differs; rewritten from the snapshot
+    UPDATE_METADATA,   ///< Content identical; only permissions and times are restored
+    UNCHANGED,         ///< Identical to the snapshot; left alone
+    REMOVE             ///< Not in the snapshot (or of the wrong type); deleted from the target
+};
+
+/**
+ * @brief One planned change to the restore target
+ */
+struct RestorePlanEntry {
+    std::filesystem::path path;                          ///< Path relative to the restore target
+    RestoreAction action = RestoreAction::CREATE;        ///< Planned action
+    std::uintmax_t size = 0;                             ///< Bytes written (CREATE/REPLACE) or freed (REMOVE)
+};
+
+/**
+ * @brief Summary of what a restore writes to its target
+ */
+struct RestorePlan {
+    size_t createFiles = 0;                              ///< Files missing from the target
+    size_t replaceFiles = 0;                             ///< Files whose content differs
+    size_t metadataFiles = 0;                            ///< Files that only need permissions or times restored
+    size_t unchangedFiles = 0;                           ///< Files already identical
+    size_t removeEntries = 0;                            ///< Target entries to delete
+    std::uintmax_t transferBytes = 0;                    ///< Bytes copied from the snapshot
+    std::uintmax_t unchangedBytes = 0;                   ///< Bytes already in place
+    std::uintmax_t removeBytes = 0;                      ///< Bytes of file data deleted from the target
+    std::vector<RestorePlanEntry> entries;               ///< Every change except UNCHANGED (dry runs only)
+};
+
+/**
+ * @brief An entry of a directory in a backup
+ */
+struct SnapshotEntry {
+    std::string name;                                    ///< Entry name
+    std::filesystem::file_type type = std::filesystem::file_type::none; ///< Entry type
+    std::uintmax_t size = 0;                             ///< Size in bytes (0 for directories)
+    std::chrono::system_clock::time_point modified;      ///< Modification time
+};
+
+/**
+ * @brief One page of a directory listing
+ */
+struct DirectoryPage {
+    std::vector<SnapshotEntry> entries;                  ///< Entries of this page, sorted by name
+    size_t totalEntries = 0;                             ///< Entries in the whole directory
+    std::string nextCursor;                              ///< Cursor for the next page; empty after the last page
+};
+
+/**
+ * @brief Why a snapshot is pruned
+ */
+enum class PruneReason {
+    RETENTION,    ///< Not kept by the daily, weekly, monthly or yearly rules
+    FAILED,       ///< Snapshot of a failed or cancelled backup
+    FREE_SPACE    ///< Kept by the rules, but deleted to reach the free space target
+};
+
+/**
+ * @brief One snapshot selected by a prune
+ */
+struct PruneCandidate {
+    std::chrono::system_clock::time_point timestamp;     ///< Snapshot time
+    PruneReason reason = PruneReason::RETENTION;         ///< Why it is pruned
+    std::uintmax_t reclaimableBytes = 0;                 ///< Bytes freed when deleted after the candidates before it
+    std::uintmax_t exclusiveBytes = 0;                   ///< Bytes of file data no other snapshot links to
+};
+
+/**
+ * @brief What a prune deletes, and what that frees
+ */
+struct PrunePlan {
+    std::vector<PruneCandidate> snapshots;               ///< Pruned snapshots, in deletion order
+    size_t keptSnapshots = 0;                            ///< Snapshots left at the destination
+    std::uintmax_t reclaimableBytes = 0;                 ///< Bytes freed by the whole prune
+    std::uintmax_t freeBytesBefore = 0;                  ///< Space available at the destination before pruning
+    bool accounted = true;                               ///< Whether the byte counts are known
 };
 
 /**
@@ -121,6 +244,15 @@ public:
      */
     BackupStats getStats() const;
 
+    /**
+     * @brief Change the I/O limits of the running backup
+     *
+     * Also the limits of the next backup until startBackup() sets its own.
+     *
+     * @param limits New limits
+     */
+    void setIoLimits(const IoLimits& limits);
+
     /**
      * @brief Lists available backups
      * @param destination Backup destination path
@@ -129,6 +261,18 @@ public:
     std::vector<std::chrono::system_clock::time_point> listBackups(
         const std::filesystem::path& destination) const;
 
+    /**
+     * @brief Lists all snapshots with their summaries
+     *
+     * Read from the destination's snapshot catalog; includes snapshots of
+     * failed backups that have not been pruned yet.
+     *
+     * @param destination Backup destination path
+     * @return Snapshot summaries, newest first
+     */
+    std::vector<SnapshotSummary> listSnapshots(
+        const std::filesystem::path& destination) const;
+
     /**
      * @brief Removes old backups according to retention policy
      * @param destination Backup destination path
@@ -143,6 +287,42 @@ public:
         int keepWeekly,
         int keepMonthly);
 
+    /**
+     * @brief Removes old backups according to a retention policy
+     *
+     * Keeps the newest backup of each of the newest keepDaily days,
+     * keepWeekly weeks, keepMonthly months and keepYearly years, and removes
+     * the rest along with snapshots of failed backups. With a free space
+     * target, kept backups are removed oldest first until the target is met;
+     * the latest backup is never removed. The plan, with the bytes each
+     * snapshot frees, is available from getLastPrunePlan().
+     *
+     * @param destination Backup destination path
+     * @param policy Retention policy
+     * @param dryRun Only plan the prune
+     * @return true if pruning succeeded, false otherwise
+     */
+    bool pruneBackups(
+        const std::filesystem::path& destination,
+        const RetentionPolicy& policy,
+        bool dryRun = false);
+
+    /**
+     * @brief Gets the plan of the most recent prune
+     * @return Plan of the last prune
+     */
+    PrunePlan getLastPrunePlan() const;
+
+    /**
+     * @brief Deletes what pruning left in the destination's trash and waits for it
+     *
+     * Pruned snapshots are otherwise deleted in the background.
+     *
+     * @param destination Backup destination path
+     * @return true if the trash is empty
+     */
+    bool collectTrash(const std::filesystem::path& destination);
+
 private:
     class Impl;
     std::unique_ptr<Impl> pImpl;
@@ -184,6 +364,44 @@ public:
         const std::chrono::system_clock::time_point& timestamp,
         ProgressCallback progressCallback);
 
+    /**
+     * @brief Restore files from a backup with explicit options
+     * @param sourcePaths Paths within the backup to restore (empty = everything)
+     * @param destinationPath Destination to restore to
+     * @param timestamp Timestamp of the backup to restore from
+     * @param progressCallback Callback for progress updates
+     * @param options Restore options
+     * @return true if restore succeeded, false otherwise
+     */
+    bool restore(
+        const std::vector<std::filesystem::path>& sourcePaths,
+        const std::filesystem::path& destinationPath,
+        const std::chrono::system_clock::time_point& timestamp,
+        ProgressCallback progressCallback,
+        const RestoreOptions& options);
+
+    /**
+     * @brief Cancels the current restore operation
+     * @return true if cancellation was requested, false if no restore is running
+     */
+    bool cancelRestore();
+
+    /**
+     * @brief Change the I/O limits of the running restore
+     * @param limits New limits
+     */
+    void setIoLimits(const IoLimits& limits);
+
+    /**
+     * @brief Gets the plan of the most recent restore
+     *
+     * After a dry run the plan includes the individual entries; otherwise
+     * only the totals are kept.
+     *
+     * @return Plan of the last restore
+     */
+    RestorePlan getLastPlan() const;
+
     /**
      * @brief List files in a backup
      * @param path Path within the backup
@@ -194,6 +412,42 @@ public:
         const std::filesystem::path& path,
         const std::chrono::system_clock::time_point& timestamp);
 
+    /**
+     * @brief List one page of a directory in a backup
+     *
+     * Served from the snapshot's index (built on first use for older
+     * snapshots), so the cost of a page does not depend on the size of the
+     * directory or the snapshot.
+     *
+     * @param path Directory within the backup
+     * @param timestamp Timestamp of the backup
+     * @param cursor Cursor returned with the previous page; empty for the first page
+     * @param limit Maximum number of entries to return
+     * @return The page, or nullopt if the backup or directory does not exist
+     */
+    std::optional<DirectoryPage> listDirectory(
+        const std::filesystem::path& path,
+        const std::chrono::system_clock::time_point& timestamp,
+        const std::string& cursor = std::string(),
+        size_t limit = 1000);
+
+    /**
+     * @brief Compare two backups
+     *
+     * Merges the indexes of both snapshots (building them for older
+     * snapshots), so the cost depends on the number of entries, not on
+     * walking either tree. See diffSnapshots() for how changes are classified.
+     *
+     * @param from Timestamp of the older backup
+     * @param to Timestamp of the newer backup
+     * @param callback Called for every changed entry
+     * @return Totals of the diff, or nullopt if either backup cannot be read
+     */
+    std::optional<DiffSummary> diffBackups(
+        const std::chrono::system_clock::time_point& from,
+        const std::chrono::system_clock::time_point& to,
+        const DiffCallback& callback);
+
 private:
     class Impl;
     std::unique_ptr<Impl> pImpl;
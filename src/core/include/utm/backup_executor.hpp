@@ -0,0 +1,108 @@
+/**
+ * @file backup_executor.hpp
+ * @brief Runs the backups of several profiles at once, queued per device
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include "utm/backup_engine.hpp"
+#include <filesystem>
+#include <string>
+#include <memory>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief Options for running backups concurrently
+ */
+struct ExecutorOptions {
+    int maxConcurrentJobs = 4;                           ///< Backups running at once
+    int jobsPerSolidStateDevice = 2;                     ///< Backups sharing an SSD or network filesystem at once
+    std::filesystem::path lockDirectory;                 ///< Device locks shared with other processes (empty = device-locks in the metadata path)
+};
+
+/**
+ * @brief Runs profile backups concurrently without overloading any disk
+ *
+ * Each backup is queued on every physical device it touches, its sources
+ * and its destination, as found by system::getMountpointInfo(). A backup
+ * starts once all of its devices have room: a rotational disk serves one
+ * backup at a time so concurrent backups don't make it seek between them,
+ * while SSDs and network filesystems serve a few. Backups that touch
+ * different disks run in parallel. A device's queue is first come, first
+ * served, so a waiting backup is never overtaken on its devices.
+ *
+ * Rotational disks and destinations are also locked across processes with
+ * flock(), so separate utm-core processes take turns as well.
+ */
+class BackupExecutor {
+public:
+    /**
+     * @brief Constructor
+     * @param metadataPath Metadata path for the engines running the backups
+     * @param options Executor options
+     */
+    explicit BackupExecutor(const std::filesystem::path& metadataPath,
+                            const ExecutorOptions& options = ExecutorOptions());
+
+    /**
+     * @brief Destructor; cancels queued and running backups and waits for them
+     */
+    ~BackupExecutor();
+
+    BackupExecutor(const BackupExecutor&) = delete;
+    BackupExecutor& operator=(const BackupExecutor&) = delete;
+
+    /**
+     * @brief Queue a backup
+     * @param name Name of the job, usually the profile name
+     * @param config Backup configuration
+     * @param progressCallback Callback for progress updates, called on the job's thread
+     * @return false if a job of that name is already queued or running
+     */
+    bool submit(const std::string& name, const BackupConfig& config, ProgressCallback progressCallback = nullptr);
+
+    /**
+     * @brief Cancel a queued or running backup
+     * @param name Name of the job
+     * @return true if the job was found
+     */
+    bool cancel(const std::string& name);
+
+    /**
+     * @brief Cancel every queued and running backup
+     */
+    void cancelAll();
+
+    /**
+     * @brief Block until no backup is queued or running
+     */
+    void wait();
+
+    /**
+     * @brief Whether no backup is queued or running
+     * @return true if idle
+     */
+    bool isIdle() const;
+
+    /**
+     * @brief Number of running backups
+     * @return Running jobs
+     */
+    size_t runningJobs() const;
+
+    /**
+     * @brief Number of backups waiting for their devices
+     * @return Queued jobs
+     */
+    size_t queuedJobs() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
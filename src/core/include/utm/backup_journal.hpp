@@ -0,0 +1,158 @@
+/**
+ * @file backup_journal.hpp
+ * @brief Checkpoint journal of a backup that is built in a staging directory
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace utm {
+
+/**
+ * @brief Counters of a completed subtree, added to the stats when a resumed backup skips it
+ */
+struct SubtreeTotals {
+    std::uint64_t files = 0;                             ///< Files backed up
+    std::uint64_t size = 0;                              ///< Bytes backed up
+    std::uint64_t newFiles = 0;                          ///< New files
+    std::uint64_t modifiedFiles = 0;                     ///< Modified files
+    std::uint64_t unchangedFiles = 0;                    ///< Unchanged (hard-linked) files
+    std::uint64_t skippedFiles = 0;                      ///< Excluded files
+};
+
+/**
+ * @brief What a backup session was started with
+ */
+struct JournalHeader {
+    std::chrono::system_clock::time_point started;      ///< When the session was started
+    std::int64_t catalogSession = 0;                    ///< Its session in the file catalog (0 = none)
+    std::vector<std::string> excludePatterns;           ///< Exclude patterns it was started with
+};
+
+/**
+ * @brief Journal of the subtrees a backup session has completed
+ *
+ * A backup is written to `backups/.utm-staging-<key>`, where the key
+ * identifies its source paths, and only renamed to its timestamped name once
+ * it is complete. Next to the staging directory the session keeps
+ * `.utm-staging-<key>.journal`: a header, then one line per completed
+ * subtree. Completed subtrees are collected in memory and written by
+ * checkpoint(), which first flushes the destination file system, so every
+ * subtree in the journal is on disk. A backup of the same sources that finds
+ * the journal after a crash or a cancel skips those subtrees.
+ *
+ * The journal is locked while open, so two backups of the same sources
+ * cannot share a staging directory.
+ */
+class BackupJournal {
+public:
+    /**
+     * @brief Prefix of staging directory names in the backups directory
+     */
+    static constexpr const char* STAGING_PREFIX = ".utm-staging-";
+
+    /**
+     * @brief Staging directory of a backup
+     * @param backupsDir Backups directory of the destination
+     * @param sourcePaths Source paths of the backup
+     * @return `<backupsDir>/.utm-staging-<key>`
+     */
+    static std::filesystem::path stagingDirectory(
+        const std::filesystem::path& backupsDir,
+        const std::vector<std::filesystem::path>& sourcePaths);
+
+    /**
+     * @brief Constructor
+     */
+    BackupJournal();
+
+    /**
+     * @brief Destructor; closes the journal and leaves it for the next session
+     */
+    ~BackupJournal();
+
+    BackupJournal(const BackupJournal&) = delete;
+    BackupJournal& operator=(const BackupJournal&) = delete;
+
+    /**
+     * @brief Open and lock the journal of a staging directory, reading what an earlier session left
+     * @param stagingDir Staging directory
+     * @return false if the journal cannot be opened or another backup holds it
+     */
+    bool open(const std::filesystem::path& stagingDir);
+
+    /**
+     * @brief Header of the earlier session
+     * @return The header, or nullopt if there was no readable journal
+     */
+    const std::optional<JournalHeader>& previous() const noexcept;
+
+    /**
+     * @brief Start a new session: forget the earlier one and write a new header
+     * @param header Header of the new session
+     * @return true if the header is on disk
+     */
+    bool start(const JournalHeader& header);
+
+    /**
+     * @brief Whether the session continues an earlier one
+     * @return true if open() found a journal and start() was not called since
+     */
+    bool resuming() const noexcept;
+
+    /**
+     * @brief Look up a subtree completed by the earlier session
+     * @param source Index of the source path
+     * @param relative Path of the subtree relative to the source ("" for the whole source)
+     * @return Its totals, or nullopt if it has to be backed up
+     */
+    std::optional<SubtreeTotals> completed(std::size_t source, std::string_view relative) const;
+
+    /**
+     * @brief Record a completed subtree; written by the next checkpoint
+     * @param source Index of the source path
+     * @param relative Path of the subtree relative to the source
+     * @param totals Its totals
+     */
+    void complete(std::size_t source, std::string_view relative, const SubtreeTotals& totals);
+
+    /**
+     * @brief Whether it is time for a checkpoint
+     * @return true if there are new subtrees and the last checkpoint is older than the interval
+     */
+    bool checkpointDue() const;
+
+    /**
+     * @brief Flush the destination file system, then append the completed subtrees to the journal
+     * @param stagingFd Open descriptor on the staging directory
+     * @return true if the journal is on disk
+     */
+    bool checkpoint(int stagingFd);
+
+    /**
+     * @brief Delete the journal once the snapshot is published
+     */
+    void remove();
+
+    /**
+     * @brief Close the journal, leaving it for the next session
+     */
+    void close();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
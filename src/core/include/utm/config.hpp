@@ -17,6 +17,7 @@
 #include <any>
 #include <functional>
 #include "logging.hpp"  // Include the logging header for LogLevel type
+#include "io_limiter.hpp"
 
 namespace utm {
 
@@ -51,6 +52,7 @@ struct RetentionPolicy {
     int keepWeekly = 4;                                   ///< Keep weekly backups for 4 weeks
     int keepMonthly = 12;                                 ///< Keep monthly backups for 12 months
     int keepYearly = 5;                                   ///< Keep yearly backups for 5 years
+    int targetFreeGB = 0;                                 ///< Prune the oldest backups until this many GB are free (0 = off)
     bool autoDelete = true;                               ///< Automatically delete old backups
 };
 
@@ -69,6 +71,7 @@ struct BackupProfile {
     bool verifyBackup = true;                             ///< Whether to verify backups
     bool useHardLinks = true;                             ///< Whether to use hard links
     int threadCount = 0;                                  ///< Thread count (0 = auto)
+    IoLimits ioLimits;                                    ///< Bandwidth, IOPS and I/O priority limits
     ScheduleConfig schedule;                              ///< Backup schedule
     RetentionPolicy retention;                            ///< Retention policy
 };
@@ -88,10 +91,16 @@ struct ApplicationConfig {
     bool autoStart = false;                               ///< Whether to start on boot
     bool limitCpuUsage = true;                            ///< Whether to limit CPU usage
     int maxCpuPercentage = 50;                            ///< Maximum CPU percentage
+    bool adaptToPressure = true;                          ///< Whether to slow down while other tasks stall
+    int pressureTargetPercentage = 10;                    ///< Stall percentage of other tasks to stay under
     bool pauseOnBattery = true;                           ///< Whether to pause on battery
     bool pauseOnMeteredConnection = true;                 ///< Whether to pause on metered connection
     size_t maxLogSize = 10 * 1024 * 1024;                 ///< Maximum log size (10 MB)
     int maxLogFiles = 5;                                  ///< Maximum number of log files
+    bool blockOnLogOverflow = false;                      ///< Whether logging waits instead of dropping when its queue is full
+    int logFlushIntervalMs = 200;                         ///< Longest delay before queued log messages are written
+    bool eventLog = false;                                ///< Whether backups record per-file events next to the log
+    size_t eventLogRecords = 1024 * 1024;                 ///< Events each event log keeps (32 bytes each)
 };
 
 /**
@@ -176,6 +185,13 @@ public:
      */
     bool deleteBackupProfile(const std::string& name);
 
+    /**
+     * @brief Reload the backup profiles from the profiles directory
+     *
+     * Picks up profiles written by other processes, such as the GUI.
+     */
+    void reloadProfiles();
+
     /**
      * @brief Get a configuration value
      * @tparam T Value type
@@ -0,0 +1,136 @@
+/**
+ * @file control_server.hpp
+ * @brief Local control socket of the daemon: requests, responses and progress events
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <map>
+#include <memory>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief Parameters of a request; nested values are not supported
+ */
+using RpcParams = std::map<std::string, std::string>;
+
+/**
+ * @brief Handler of a request method
+ *
+ * On success the handler stores a JSON value in result and returns true;
+ * on failure it stores an error message and returns false.
+ */
+using RpcHandler = std::function<bool(const RpcParams& params, std::string& result)>;
+
+/**
+ * @brief Options of the control server
+ */
+struct ControlServerOptions {
+    std::filesystem::path socketPath;                    ///< Socket path (empty = defaultSocketPath())
+    std::chrono::milliseconds eventInterval{100};        ///< Events are sent at most this often per topic and key
+    std::size_t maxClients = 32;                         ///< Connections served at once
+    std::size_t maxFrameSize = 1024 * 1024;              ///< Largest request accepted
+    std::size_t maxPendingOutput = 8 * 1024 * 1024;      ///< Unsent output after which a client is dropped
+};
+
+/**
+ * @brief Quote a string for JSON output
+ * @param text Text
+ * @return The text as a JSON string, quotes included
+ */
+std::string jsonString(std::string_view text);
+
+/**
+ * @brief Serves requests and events to local clients over a Unix-domain socket
+ *
+ * Every message is a frame: a 32-bit little-endian length followed by that
+ * many bytes of JSON. Clients send requests and get one response each, in
+ * order:
+ *
+ *     {"id": 1, "method": "listSnapshots", "params": {"profile": "home"}}
+ *     {"id": 1, "result": {...}}          or   {"id": 1, "error": "message"}
+ *
+ * The built-in methods "subscribe" and "unsubscribe" take a "topic"
+ * parameter. Subscribers of a topic receive its events as
+ *
+ *     {"event": "progress", "key": "home", "data": {...}}
+ *
+ * publish() only stores the latest event per topic and key; the server
+ * thread sends what changed at most every eventInterval, so a fast
+ * producer costs clients nothing and a slow client never holds it up. A new
+ * subscriber first gets the latest event of every key of the topic.
+ *
+ * One thread serves all clients with poll(). Handlers run on that thread
+ * and should not block. Only processes of the same user (or root) may
+ * connect; the socket is created with mode 0600 and a second server on the
+ * same path fails to start while the first one is alive.
+ */
+class ControlServer {
+public:
+    /**
+     * @brief Socket path used by the daemon and the GUI
+     * @return `$XDG_RUNTIME_DIR/ubuntu-time-machine.sock`, or `core.sock` in the application data directory
+     */
+    static std::filesystem::path defaultSocketPath();
+
+    /**
+     * @brief Constructor
+     * @param options Server options
+     */
+    explicit ControlServer(const ControlServerOptions& options = ControlServerOptions());
+
+    /**
+     * @brief Destructor; stops the server
+     */
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    /**
+     * @brief Register a request method; call before start()
+     * @param method Method name
+     * @param handler Handler of the method
+     */
+    void registerMethod(const std::string& method, RpcHandler handler);
+
+    /**
+     * @brief Create the socket and start serving
+     * @return false if the socket cannot be created or another server is listening on it
+     */
+    bool start();
+
+    /**
+     * @brief Disconnect every client, remove the socket and stop the server thread
+     */
+    void stop();
+
+    /**
+     * @brief Publish an event; may be called from any thread
+     * @param topic Topic of the event
+     * @param key What the event is about, such as a profile name; later events replace earlier ones of the same key
+     * @param data Event data as a JSON value
+     */
+    void publish(const std::string& topic, const std::string& key, const std::string& data);
+
+    /**
+     * @brief Number of connected clients
+     * @return Clients
+     */
+    std::size_t clientCount() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
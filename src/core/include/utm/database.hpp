@@ -13,7 +13,9 @@
 #include <chrono>
 #include <filesystem>
 #include <optional>
+#include <string_view>
 #include <mutex>
+#include <cstdint>
 
 namespace utm {
 
@@ -34,6 +36,19 @@ struct FileRecord {
     bool isEncrypted = false;                            ///< Whether it's encrypted
 };
 
+/**
+ * @brief A file backed up in a session, recorded in bulk with Database::recordFiles()
+ *
+ * The strings are not owned; they must stay valid until recordFiles() returns.
+ */
+struct FileRecordEntry {
+    std::string_view path;                               ///< Normalized path relative to the backup root
+    std::string_view checksum;                           ///< Content checksum (unused for unchanged files)
+    std::uintmax_t size = 0;                             ///< File size in bytes
+    std::filesystem::file_time_type modificationTime;    ///< Modification time
+    bool unchanged = false;                              ///< Same content as in the previous session
+};
+
 /**
  * @brief Backup session record
  */
@@ -49,8 +64,28 @@ struct BackupSession {
     std::uintmax_t totalSize = 0;                         ///< Total size in bytes
 };
 
+/**
+ * @brief One version of a file: a run of consecutive sessions with the same content
+ *
+ * Sessions are counted per destination, so a version spans every backup of
+ * its destination from the one where the content first appeared to the last
+ * one that still contained it.
+ */
+struct FileVersion {
+    FileRecord record;                                    ///< Content and metadata (backupTime = first session)
+    std::int64_t firstSessionId = 0;                      ///< First session containing this version
+    std::int64_t lastSessionId = 0;                       ///< Last session containing this version
+    std::chrono::system_clock::time_point firstSeen;      ///< Start time of the first session
+    std::chrono::system_clock::time_point lastSeen;       ///< Start time of the last session
+};
+
 /**
  * @brief Database manager for the backup system
+ *
+ * Files are not stored once per session. The version index keeps one row per
+ * file and content with the interval of sessions in which that content was
+ * live, so an unchanged file costs nothing per backup and the history of a
+ * path is a single index range scan regardless of the number of sessions.
  */
 class Database {
 public:
@@ -129,6 +164,51 @@ public:
      */
     std::int64_t addFileRecord(const FileRecord& record, std::int64_t sessionId);
 
+    /**
+     * @brief Record that a file is unchanged since the previous session of the same destination
+     *
+     * Extends the live interval of the file's current version without
+     * touching its content columns.
+     *
+     * @param path File path
+     * @param sessionId Session ID
+     * @return true if the file had a version in the previous session; false if a full record is needed
+     */
+    bool carryForwardFile(const std::filesystem::path& path, std::int64_t sessionId);
+
+    /**
+     * @brief Undo what a session recorded for a file, so a resumed session can record it again
+     *
+     * Versions added by the session are removed and versions it extended
+     * end at the previous session again.
+     *
+     * @param path File path
+     * @param sessionId Session ID
+     * @return true if successful, false otherwise
+     */
+    bool forgetFileRecord(const std::filesystem::path& path, std::int64_t sessionId);
+
+    /**
+     * @brief Record many files of a session at once
+     *
+     * Equivalent to forgetFileRecord() (if replace is set) followed by
+     * carryForwardFile() for unchanged files and addFileRecord() for the
+     * others, but with the statements and the previous session looked up
+     * once for the whole batch. Call it inside a transaction.
+     *
+     * @param entries Files to record
+     * @param sessionId Session ID
+     * @param replace Whether to forget what the session recorded for the files first
+     * @param missing Receives the indexes of unchanged files without a version in the
+     *                previous session; they need addFileRecord() with a checksum
+     * @return true if successful, false otherwise
+     */
+    bool recordFiles(
+        const std::vector<FileRecordEntry>& entries,
+        std::int64_t sessionId,
+        bool replace,
+        std::vector<std::size_t>& missing);
+
     /**
      * @brief Get a file record by path and session
      * @param path File path
@@ -160,6 +240,49 @@ public:
      */
     std::vector<FileRecord> getFileHistory(const std::filesystem::path& path);
 
+    /**
+     * @brief Get every version of a file
+     * @param path File path
+     * @param destinationPath Only versions backed up to this destination (empty = all)
+     * @return Versions ordered by the session they first appeared in
+     */
+    std::vector<FileVersion> getFileVersions(
+        const std::filesystem::path& path,
+        const std::filesystem::path& destinationPath = {});
+
+    /**
+     * @brief Get the versions that first appeared in sessions started in (from, to]
+     *
+     * New and modified files of the sessions in the range; unchanged files are not reported.
+     *
+     * @param from Exclusive start of the range
+     * @param to Inclusive end of the range
+     * @param destinationPath Only sessions of this destination (empty = all)
+     * @return Versions ordered by session, then path
+     */
+    std::vector<FileVersion> getVersionsChangedBetween(
+        const std::chrono::system_clock::time_point& from,
+        const std::chrono::system_clock::time_point& to,
+        const std::filesystem::path& destinationPath = {});
+
+    /**
+     * @brief Find files by name across all sessions
+     *
+     * A pattern containing '*', '?' or '[' is a case-sensitive glob over the
+     * whole file name (e.g. "budget_2023*.xlsx"); any other pattern matches
+     * file names containing it, ignoring ASCII case. Names are looked up in a
+     * trigram index kept up to date as sessions are recorded and deleted.
+     *
+     * @param pattern Glob or substring to match against file names
+     * @param destinationPath Only versions backed up to this destination (empty = all)
+     * @param limit Maximum number of distinct paths to return
+     * @return Versions of the matching paths, ordered by path, then session
+     */
+    std::vector<FileVersion> findFiles(
+        const std::string& pattern,
+        const std::filesystem::path& destinationPath = {},
+        std::size_t limit = 1000);
+
     /**
      * @brief Delete a backup session and all associated files
      * @param sessionId Session ID
@@ -0,0 +1,335 @@
+/**
+ * @file dir_handle.hpp
+ * @brief Directory-fd relative filesystem access for the backup and restore engines
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+
+namespace utm {
+
+class IoLimiter;
+
+namespace fs {
+
+/**
+ * @brief Owning wrapper around a file descriptor
+ */
+class FileHandle {
+public:
+    FileHandle() noexcept = default;
+    explicit FileHandle(int fd) noexcept : fd(fd) {}
+    ~FileHandle();
+
+    FileHandle(FileHandle&& other) noexcept;
+    FileHandle& operator=(FileHandle&& other) noexcept;
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    /**
+     * @brief Get the raw descriptor
+     * @return Descriptor, or -1 if none is held
+     */
+    int get() const noexcept { return fd; }
+
+    /**
+     * @brief Whether a descriptor is held
+     * @return true if the handle is open
+     */
+    bool valid() const noexcept { return fd >= 0; }
+
+    /**
+     * @brief Give up ownership of the descriptor
+     * @return The descriptor
+     */
+    int release() noexcept;
+
+    /**
+     * @brief Close the descriptor
+     * @return true if close succeeded or nothing was open
+     */
+    bool close() noexcept;
+
+private:
+    int fd = -1;
+};
+
+/**
+ * @brief Subset of statx() results used by the engines
+ */
+struct FileStat {
+    mode_t mode = 0;                 ///< File type and permissions
+    std::uintmax_t size = 0;         ///< Size in bytes
+    ino_t inode = 0;                 ///< Inode number
+    dev_t device = 0;                ///< Device containing the file
+    nlink_t linkCount = 0;           ///< Number of hard links
+    std::timespec modified{};        ///< Modification time
+};
+
+/**
+ * @brief Stat a name relative to a directory descriptor
+ * @param dirFd Directory descriptor (or AT_FDCWD)
+ * @param name Name relative to dirFd
+ * @param out Receives the result
+ * @param followSymlinks Whether to follow a trailing symlink
+ * @return true on success; errno is set on failure
+ */
+bool statAt(int dirFd, const char* name, FileStat& out, bool followSymlinks = true);
+
+/**
+ * @brief Stat an open descriptor
+ * @param fd Descriptor
+ * @param out Receives the result
+ * @return true on success; errno is set on failure
+ */
+bool statFd(int fd, FileStat& out);
+
+/**
+ * @brief Open a directory relative to a directory descriptor
+ * @param dirFd Directory descriptor (or AT_FDCWD)
+ * @param name Name relative to dirFd
+ * @return Handle, invalid on failure
+ */
+FileHandle openDirectoryAt(int dirFd, const char* name);
+
+/**
+ * @brief Open a file relative to a directory descriptor
+ * @param dirFd Directory descriptor (or AT_FDCWD)
+ * @param name Name relative to dirFd
+ * @param flags open(2) flags; O_CLOEXEC is always added
+ * @param mode Mode for newly created files
+ * @return Handle, invalid on failure
+ */
+FileHandle openAt(int dirFd, const char* name, int flags, mode_t mode = 0);
+
+/**
+ * @brief Create a directory relative to a directory descriptor
+ * @param dirFd Directory descriptor
+ * @param name Name relative to dirFd
+ * @param mode Mode for the new directory
+ * @return true if the directory was created or already exists
+ */
+bool mkdirAt(int dirFd, const char* name, mode_t mode = 0777);
+
+/**
+ * @brief Create a hard link between two directory descriptors
+ * @param fromDirFd Directory containing the existing file
+ * @param fromName Existing file name
+ * @param toDirFd Directory to create the link in
+ * @param toName New link name
+ * @return true on success; errno is set on failure
+ */
+bool linkAt(int fromDirFd, const char* fromName, int toDirFd, const char* toName);
+
+/**
+ * @brief Rename an entry between two directory descriptors
+ * @param fromDirFd Directory containing the entry
+ * @param fromName Entry name
+ * @param toDirFd Target directory
+ * @param toName Target name
+ * @return true on success; errno is set on failure
+ */
+bool renameAt(int fromDirFd, const char* fromName, int toDirFd, const char* toName);
+
+/**
+ * @brief Copy the remaining contents of one descriptor to another
+ *
+ * Uses copy_file_range() so the kernel can copy (or share extents) without
+ * a round trip through user space, and falls back to read/write when the
+ * descriptors are on different filesystems or the call is unsupported.
+ *
+ * @param in Source descriptor
+ * @param out Destination descriptor
+ * @param buffer Scratch buffer for the fallback path
+ * @param limiter Optional limiter the transfer is accounted to, in small steps
+ * @return true on success; errno is set on failure
+ */
+bool copyContents(int in, int out, std::vector<char>& buffer, IoLimiter* limiter = nullptr);
+
+/**
+ * @brief Copy the remaining contents of one descriptor to another, passing every block to a consumer
+ *
+ * Always copies with read/write so the caller sees the data, for instance
+ * to checksum it without reading the file a second time.
+ *
+ * @param in Source descriptor
+ * @param out Destination descriptor
+ * @param buffer Scratch buffer
+ * @param limiter Optional limiter the transfer is accounted to
+ * @param consume Called with every block read, in order
+ * @return true on success; errno is set on failure
+ */
+bool copyContents(int in, int out, std::vector<char>& buffer, IoLimiter* limiter,
+                  const std::function<void(const char* data, std::size_t size)>& consume);
+
+/**
+ * @brief Copy a byte range between two descriptors at the same offset
+ *
+ * Does not move the file offsets, so several ranges of one file can be
+ * copied concurrently from different threads.
+ *
+ * @param in Source descriptor
+ * @param out Destination descriptor
+ * @param offset Offset of the range in both files
+ * @param length Length of the range in bytes
+ * @param buffer Scratch buffer for the fallback path
+ * @param limiter Optional limiter the transfer is accounted to, in small steps
+ * @return true on success; errno is set on failure
+ */
+bool copyRange(int in, int out, off_t offset, std::uintmax_t length, std::vector<char>& buffer,
+               IoLimiter* limiter = nullptr);
+
+/**
+ * @brief Make the destination share the source's extents (reflink)
+ * @param in Source descriptor
+ * @param out Destination descriptor, opened for writing
+ * @return true if the filesystem cloned the file; false if unsupported
+ */
+bool cloneFile(int in, int out);
+
+/**
+ * @brief Physical location of the start of a file on its device (FIEMAP)
+ *
+ * Used to order reads by on-disk placement; files without data report 0.
+ *
+ * @param fd File descriptor
+ * @param offset Receives the physical byte offset of the first extent
+ * @return true on success; false with errno set (EOPNOTSUPP/ENOTTY if the filesystem cannot map extents)
+ */
+bool physicalOffset(int fd, std::uint64_t& offset);
+
+/**
+ * @brief File type of a stat mode
+ * @param mode st_mode value
+ * @return The type, or file_type::unknown for unrecognized modes
+ */
+std::filesystem::file_type fileType(mode_t mode);
+
+/**
+ * @brief Join a relative directory and a name with '/'
+ * @param directory Relative directory, empty for the root
+ * @param name Entry name, may be empty
+ * @return The joined path, without a separator next to an empty part
+ */
+std::string joinRelative(std::string_view directory, std::string_view name);
+
+/**
+ * @brief Whether a top-level snapshot entry was written by the engine itself
+ *
+ * These files (backup-info.json and the .utm-* index, catalog and staging
+ * entries) are not part of the user's data and are skipped when a snapshot
+ * is indexed or restored.
+ *
+ * @param name Entry name in the snapshot root
+ * @return true for snapshot metadata
+ */
+bool isSnapshotMetadata(std::string_view name);
+
+/**
+ * @brief Thread-safe cache of created, open directories below a root
+ *
+ * Used where files are accessed in arbitrary order (e.g. by the restore
+ * workers): each directory is created with mkdirat and opened once, its
+ * descriptor is kept for later files, and the least recently used
+ * descriptors are closed when the cache is full.
+ */
+class DirectoryCache {
+public:
+    /**
+     * @brief Constructor
+     * @param root Root directory
+     * @param maxOpen Maximum number of cached descriptors
+     * @param create Whether missing directories (including the root) are created;
+     *               a read-only cache only opens existing ones
+     */
+    explicit DirectoryCache(const std::filesystem::path& root, std::size_t maxOpen = 256, bool create = true);
+    ~DirectoryCache();
+
+    DirectoryCache(const DirectoryCache&) = delete;
+    DirectoryCache& operator=(const DirectoryCache&) = delete;
+
+    /**
+     * @brief Get (creating as needed) a directory below the root
+     * @param relativeDir Directory relative to the root, '/' separated; empty for the root
+     * @return Shared handle, invalid on failure; errno is set on failure
+     */
+    std::shared_ptr<FileHandle> get(std::string_view relativeDir);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+/**
+ * @brief Stack of open directory descriptors that mirrors a recursive walk
+ *
+ * The engines keep one stack per tree (source, destination, previous
+ * snapshot) and push/pop in lockstep while walking, so every file operation
+ * resolves a single name against an already open directory instead of the
+ * kernel walking the full absolute path again. Entering a directory that
+ * does not exist in an optional tree (e.g. the previous snapshot) pushes an
+ * invalid level, keeping depths aligned.
+ */
+class DirStack {
+public:
+    /**
+     * @brief Open the root of the tree
+     * @param root Root directory
+     * @param create Whether to create the root if it is missing
+     * @return true if the root is open
+     */
+    bool openRoot(const std::filesystem::path& root, bool create = false);
+
+    /**
+     * @brief Descend into a child directory
+     * @param name Child name
+     * @param create Whether to create the child if it is missing
+     * @return true if the child is open; an invalid level is pushed otherwise
+     */
+    bool enter(const char* name, bool create = false);
+
+    /**
+     * @brief Return to the parent directory
+     */
+    void leave() noexcept;
+
+    /**
+     * @brief Close every level, including the root
+     */
+    void clear() noexcept;
+
+    /**
+     * @brief Descriptor of the current directory
+     * @return Descriptor, or -1 if the current level is not open
+     */
+    int fd() const noexcept;
+
+    /**
+     * @brief Whether the current level is open
+     * @return true if operations relative to fd() are possible
+     */
+    bool valid() const noexcept { return fd() >= 0; }
+
+    /**
+     * @brief Current depth below the root
+     * @return Depth (0 at the root)
+     */
+    std::size_t depth() const noexcept { return levels.empty() ? 0 : levels.size() - 1; }
+
+private:
+    std::vector<FileHandle> levels;
+};
+
+} // namespace fs
+} // namespace utm
@@ -0,0 +1,183 @@
+/**
+ * @file event_log.hpp
+ * @brief Binary per-file event log for tracing slow backups
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief What an event was spent on
+ */
+enum class EventPhase : std::uint8_t {
+    READ_DIRECTORY,   ///< Listing a source directory
+    COPY,             ///< Copying a new or modified file
+    LINK              ///< Linking an unchanged file from the previous backup
+};
+
+/**
+ * @brief Convert an event phase to string
+ * @param phase Event phase
+ * @return String representation
+ */
+const char* eventPhaseToString(EventPhase phase);
+
+/**
+ * @brief One event; this is also its layout in the file
+ */
+struct EventRecord {
+    std::uint64_t time = 0;          ///< Start in nanoseconds since the log was opened
+    std::uint64_t bytes = 0;         ///< Bytes copied or linked, or entries for READ_DIRECTORY
+    std::uint32_t latency = 0;       ///< Duration in microseconds
+    std::uint32_t directory = 0;     ///< Path id of the directory
+    std::uint32_t file = 0;          ///< Path id of the file for slow operations, 0 otherwise
+    EventPhase phase = EventPhase::COPY;
+    std::uint8_t failed = 0;         ///< Non-zero if the operation failed
+    std::uint16_t reserved = 0;
+};
+
+static_assert(sizeof(EventRecord) == 32, "EventRecord is the on-disk record format");
+
+/**
+ * @brief Ring of fixed-size event records in a memory-mapped file
+ *
+ * Recording an event claims a slot with one atomic increment and stores
+ * 32 bytes into the mapping; there is no formatting and no system call.
+ * Once the ring is full the oldest events are overwritten. Paths are
+ * written once each to a text file next to the ring (`.paths`), and
+ * records refer to them by id.
+ */
+class EventLog {
+public:
+    /**
+     * @brief Path id meaning "no path"
+     */
+    static constexpr std::uint32_t NO_PATH = 0;
+
+    /**
+     * @brief Operations at least this slow record the file's own path
+     */
+    static constexpr std::chrono::milliseconds SLOW_EVENT{10};
+
+    EventLog();
+    ~EventLog();
+
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+
+    /**
+     * @brief Create the log, replacing an existing one
+     *
+     * The file stays locked until close(); a log another EventLog has open
+     * is left alone.
+     * @param file Ring file; paths go to the same name with extension .paths
+     * @param capacity Number of records the ring holds
+     * @return true if the log was created, false if it failed or is in use
+     */
+    bool open(const std::filesystem::path& file, std::size_t capacity);
+
+    /**
+     * @brief Close the log, trimming the file to the records written
+     */
+    void close();
+
+    /**
+     * @brief Whether events are being recorded
+     * @return true if the log is open
+     */
+    bool isOpen() const noexcept;
+
+    /**
+     * @brief Start timing an operation
+     * @return The current time, or a zero time point without reading the clock if the log is closed
+     */
+    std::chrono::steady_clock::time_point start() const noexcept;
+
+    /**
+     * @brief Register a path
+     * @param path Path to register
+     * @return Path id, or NO_PATH if the log is not open
+     */
+    std::uint32_t addPath(std::string_view path);
+
+    /**
+     * @brief Record an event
+     * @param phase What the time was spent on
+     * @param directory Path id of the directory
+     * @param bytes Bytes copied or linked, or entries read
+     * @param started When the operation started, as returned by start()
+     * @param failed Whether the operation failed
+     * @param file Path of the file, registered only if the operation was slow
+     */
+    void record(
+        EventPhase phase,
+        std::uint32_t directory,
+        std::uint64_t bytes,
+        std::chrono::steady_clock::time_point started,
+        bool failed = false,
+        std::string_view file = {});
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+/**
+ * @brief Contents of an event log file
+ */
+struct EventLogContents {
+    std::chrono::system_clock::time_point opened;   ///< When the log was opened
+    std::uint64_t totalEvents = 0;                  ///< Events recorded, including overwritten ones
+    std::vector<EventRecord> records;               ///< Events still in the ring, oldest first
+    std::vector<std::string> paths;                 ///< Paths by id (index 0 is unused)
+
+    /**
+     * @brief Path of an id
+     * @param id Path id
+     * @return The path, or an empty string for NO_PATH and unknown ids
+     */
+    const std::string& path(std::uint32_t id) const;
+};
+
+/**
+ * @brief Time spent in one directory
+ */
+struct EventDirectorySummary {
+    std::uint32_t directory = 0;                    ///< Path id of the directory
+    std::uint64_t events = 0;                       ///< Events in the directory
+    std::uint64_t failed = 0;                       ///< Failed events
+    std::uint64_t bytes = 0;                        ///< Bytes copied or linked
+    std::uint64_t totalLatency = 0;                 ///< Sum of the event durations in microseconds
+    std::uint32_t maxLatency = 0;                   ///< Slowest event in microseconds
+    std::uint32_t slowestFile = 0;                  ///< Path id of the slowest file, if it was recorded
+};
+
+/**
+ * @brief Read an event log
+ * @param file Ring file written by EventLog
+ * @return The contents, or nullopt if the file is missing or not an event log
+ */
+std::optional<EventLogContents> readEventLog(const std::filesystem::path& file);
+
+/**
+ * @brief Find the directories that took longest
+ * @param contents Event log contents
+ * @param top Number of directories to return
+ * @return Directories by total duration, slowest first
+ */
+std::vector<EventDirectorySummary> summarizeEventLog(const EventLogContents& contents, std::size_t top);
+
+} // namespace utm
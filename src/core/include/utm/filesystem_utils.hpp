@@ -12,9 +12,14 @@
 #include <vector>
 #include <optional>
 #include <functional>
+#include <memory>
 #include <chrono>
+#include <cstddef>
 
 namespace utm {
+
+class IoLimiter;
+
 namespace fs {
 
 /**
@@ -61,11 +66,72 @@ bool isExcluded(
  * @brief Calculates the checksum of a file
  * @param path Path to the file
  * @param algorithm Algorithm to use ("sha256", "md5", etc.)
+ * @param limiter Optional limiter the reads are accounted to
  * @return Checksum of the file
  */
 std::string calculateChecksum(
     const std::filesystem::path& path,
-    const std::string& algorithm = "sha256");
+    const std::string& algorithm = "sha256",
+    IoLimiter* limiter = nullptr);
+
+/**
+ * @brief Calculates the checksum of an open file, reading from its current offset
+ * @param fd File descriptor open for reading
+ * @param algorithm Algorithm to use ("sha256", "md5", etc.)
+ * @param limiter Optional limiter the reads are accounted to
+ * @return Checksum of the file, empty on error
+ */
+std::string calculateChecksum(int fd, const std::string& algorithm = "sha256", IoLimiter* limiter = nullptr);
+
+/**
+ * @brief Checksum of data passed in piece by piece, such as the blocks of a copy
+ *
+ * finish() starts the next checksum, so one builder can hash many files
+ * without setting up the digest again for each.
+ */
+class ChecksumBuilder {
+public:
+    /**
+     * @brief Constructor
+     * @param algorithm Algorithm to use ("sha256", "md5", etc.)
+     */
+    explicit ChecksumBuilder(const std::string& algorithm = "sha256");
+
+    /**
+     * @brief Destructor
+     */
+    ~ChecksumBuilder();
+
+    ChecksumBuilder(const ChecksumBuilder&) = delete;
+    ChecksumBuilder& operator=(const ChecksumBuilder&) = delete;
+
+    /**
+     * @brief Add the next piece of data
+     * @param data Data
+     * @param size Size of the data in bytes
+     */
+    void update(const char* data, std::size_t size);
+
+    /**
+     * @brief Finish the checksum and start the next one
+     * @return Checksum of the data since the last finish(), empty on error
+     */
+    std::string finish();
+
+    /**
+     * @brief Finish the checksum into an existing string and start the next one
+     *
+     * Reusing the string keeps a stream of checksums from allocating.
+     *
+     * @param checksum Receives the checksum of the data since the last finish(), empty on error
+     * @return true if successful, false otherwise
+     */
+    bool finish(std::string& checksum);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
 
 /**
  * @brief Creates a hardlink if possible, falls back to copy if not
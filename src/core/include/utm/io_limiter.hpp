@@ -0,0 +1,145 @@
+/**
+ * @file io_limiter.hpp
+ * @brief Bandwidth, IOPS and I/O priority limits for backups and restores
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace utm {
+
+/**
+ * @brief I/O scheduling class of the threads doing a backup or restore
+ */
+enum class IoPriority {
+    NORMAL,    ///< Best effort at the default level
+    LOW,       ///< Best effort at the lowest level
+    IDLE       ///< Only when no other process uses the disk
+};
+
+/**
+ * @brief I/O limits of a backup or restore
+ */
+struct IoLimits {
+    std::uint64_t readBytesPerSecond = 0;                ///< Read bandwidth (0 = unlimited)
+    std::uint64_t writeBytesPerSecond = 0;               ///< Write bandwidth (0 = unlimited)
+    std::uint32_t operationsPerSecond = 0;               ///< Reads, writes and metadata updates per second (0 = unlimited)
+    IoPriority priority = IoPriority::NORMAL;            ///< I/O scheduling class
+};
+
+/**
+ * @brief Convert an I/O priority to its configuration name
+ * @param priority I/O priority
+ * @return "NORMAL", "LOW" or "IDLE"
+ */
+const char* ioPriorityToString(IoPriority priority);
+
+/**
+ * @brief Parse an I/O priority from its configuration name
+ * @param name "NORMAL", "LOW" or "IDLE"
+ * @return The priority, NORMAL for unknown names
+ */
+IoPriority stringToIoPriority(const std::string& name);
+
+/**
+ * @brief Token buckets for read bytes, write bytes and operations
+ *
+ * I/O is accounted after it happened: every call adds the work to its
+ * buckets and sleeps while a bucket is ahead of its rate. The buckets keep a
+ * short burst allowance, so a limited transfer runs at the configured rate
+ * on average without stalling small files. One limiter may be shared by
+ * several threads; the rates are their combined rates.
+ *
+ * While the resource governor reports I/O pressure from other tasks, every
+ * rate is scaled by its ioScale(); buckets without a configured rate scale
+ * the rate they recently reached on their own.
+ *
+ * Every accounting call also moves the calling thread to the configured I/O
+ * scheduling class with ioprio_set(), which the BFQ and CFQ schedulers honor.
+ * Limits can be changed at any time and apply from the next call on.
+ */
+class IoLimiter {
+public:
+    /**
+     * @brief Preferred size of one read or write while limited
+     */
+    static constexpr std::size_t LIMITED_CHUNK_SIZE = 256 * 1024;
+
+    /**
+     * @brief Constructor
+     * @param limits Initial limits
+     */
+    explicit IoLimiter(const IoLimits& limits = IoLimits());
+
+    /**
+     * @brief Destructor
+     */
+    ~IoLimiter();
+
+    IoLimiter(const IoLimiter&) = delete;
+    IoLimiter& operator=(const IoLimiter&) = delete;
+
+    /**
+     * @brief Change the limits
+     * @param limits New limits
+     */
+    void setLimits(const IoLimits& limits);
+
+    /**
+     * @brief Get the limits
+     * @return Current limits
+     */
+    IoLimits getLimits() const;
+
+    /**
+     * @brief Whether any bandwidth or IOPS limit is set, or pressure scales the rates
+     * @return true if accounting calls may sleep
+     */
+    bool isLimited() const noexcept;
+
+    /**
+     * @brief Size for the next read or write of a transfer
+     * @param unlimited Size to use when no limit is set
+     * @return unlimited, or a smaller size that keeps sleeps short
+     */
+    std::size_t chunkSize(std::size_t unlimited) const noexcept;
+
+    /**
+     * @brief Account bytes read
+     * @param bytes Bytes read
+     * @param operations Read calls it took
+     */
+    void read(std::uint64_t bytes, std::uint32_t operations = 1);
+
+    /**
+     * @brief Account bytes written
+     * @param bytes Bytes written
+     * @param operations Write calls it took
+     */
+    void write(std::uint64_t bytes, std::uint32_t operations = 1);
+
+    /**
+     * @brief Account operations without data, such as directory reads, creates and links
+     * @param operations Number of operations
+     */
+    void operations(std::uint32_t operations = 1);
+
+    /**
+     * @brief Time threads spent waiting for the limits
+     * @return Total since construction
+     */
+    std::chrono::milliseconds throttledTime() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
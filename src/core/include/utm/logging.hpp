@@ -8,10 +8,30 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
+#include <atomic>
 #include <filesystem>
 #include <chrono>
+#include <cstdint>
 #include <source_location>
+#include <version>
+
+#if defined(__cpp_lib_format)
+#include <format>
+#else
+#include <sstream>
+#endif
+
+/**
+ * @brief Lowest log level compiled in, as the index of a LogLevel
+ *
+ * Set through the UTM_MIN_LOG_LEVEL CMake option. UTM_* macro calls
+ * below it are removed at compile time, arguments included.
+ */
+#ifndef UTM_MIN_LOG_LEVEL
+#define UTM_MIN_LOG_LEVEL 0
+#endif
 
 namespace utm {
 
@@ -28,6 +48,14 @@ enum class LogLevel {
     OFF
 };
 
+/**
+ * @brief What a thread does when its message queue is full
+ */
+enum class LogOverflow {
+    DROP,   ///< Discard the message and count it
+    BLOCK   ///< Wait until the writer thread has made room
+};
+
 /**
  * @brief Convert log level to string
  * @param level Log level
@@ -40,11 +68,66 @@ std::string logLevelToString(LogLevel level);
  */
 LogLevel stringToLogLevel(const std::string& level);
 
+/**
+ * @brief Format string of a log message and where it was logged
+ *
+ * Converting to LogFormat captures the caller's source location, which a
+ * defaulted parameter cannot do after a parameter pack.
+ */
+struct LogFormat {
+    LogFormat(const char* text, const std::source_location& location = std::source_location::current())
+        : text(text), location(location) {}
+    LogFormat(std::string_view text, const std::source_location& location = std::source_location::current())
+        : text(text), location(location) {}
+    LogFormat(const std::string& text, const std::source_location& location = std::source_location::current())
+        : text(text), location(location) {}
+
+    std::string_view text;
+    std::source_location location;
+};
+
+namespace detail {
+
+#if defined(__cpp_lib_format)
+template<typename... Args>
+std::string formatLogMessage(std::string_view fmt, const Args&... args) {
+    return std::vformat(fmt, std::make_format_args(args...));
+}
+#else
+/**
+ * @brief Replace each {} in a format string with the next argument
+ * @param fmt Format string; {{ and }} stand for literal braces
+ * @param args Arguments already converted to text
+ * @param count Number of arguments
+ * @return Formatted message
+ */
+std::string substituteLogArguments(std::string_view fmt, const std::string* args, std::size_t count);
+
+template<typename T>
+std::string logArgumentToString(const T& value) {
+    std::ostringstream out;
+    out << std::boolalpha << value;
+    return out.str();
+}
+
+// Standard libraries without <format> get positional {} substitution only
+template<typename... Args>
+std::string formatLogMessage(std::string_view fmt, const Args&... args) {
+    const std::string strings[] = {logArgumentToString(args)..., std::string()};
+    return substituteLogArguments(fmt, strings, sizeof...(Args));
+}
+#endif
+
+} // namespace detail
+
 // Forward declaration of helper class
 class LoggerCreator;
 
 /**
  * @brief Central logging facility
+ *
+ * Messages are queued per thread and written in batches by a background
+ * thread, so logging never waits for the disk.
  */
 class Logger {
 public:
@@ -83,6 +166,12 @@ public:
      */
     void setConsoleLevel(LogLevel level);
 
+    /**
+     * @brief Send all console output to stderr
+     * @param enabled true to keep stdout free for machine-readable output
+     */
+    void setConsoleStderr(bool enabled);
+
     /**
      * @brief Set the file log level
      * @param level Minimum level to log to file
@@ -101,6 +190,38 @@ public:
      */
     LogLevel getFileLevel() const;
 
+    /**
+     * @brief Set what happens when a thread logs faster than messages are written
+     * @param policy Drop or block on a full queue
+     */
+    void setOverflowPolicy(LogOverflow policy);
+
+    /**
+     * @brief Set how long messages below ERROR may wait before being written
+     * @param interval Maximum delay
+     */
+    void setFlushInterval(std::chrono::milliseconds interval);
+
+    /**
+     * @brief Wait until every message logged so far has been written
+     */
+    void flush();
+
+    /**
+     * @brief Get the number of messages dropped because a queue was full
+     * @return Dropped message count
+     */
+    std::uint64_t getDroppedMessages() const;
+
+    /**
+     * @brief Check whether a message of this level would reach the console or the file
+     * @param level Log level
+     * @return true if the level is enabled
+     */
+    static bool isEnabled(LogLevel level) noexcept {
+        return level >= enabledLevel.load(std::memory_order_relaxed);
+    }
+
     /**
      * @brief Log a message
      * @param level Log level
@@ -114,18 +235,16 @@ public:
 
     /**
      * @brief Log a message with formatting
+     *
+     * The message is only formatted if the level is enabled.
+     *
      * @tparam Args Argument types
      * @param level Log level
-     * @param fmt Format string
+     * @param fmt Format string with {} placeholders (source location auto-filled)
      * @param args Format arguments
-     * @param location Source location (auto-filled)
      */
     template<typename... Args>
-    void logf(
-        LogLevel level,
-        std::string_view fmt,
-        Args&&... args,
-        const std::source_location& location = std::source_location::current());
+    void logf(LogLevel level, LogFormat fmt, const Args&... args);
 
     /**
      * @brief Log a trace message
@@ -195,8 +314,28 @@ private:
 
     class Impl;
     std::unique_ptr<Impl> pImpl;
+
+    // Lower of the console and file levels, checked before any formatting
+    static inline std::atomic<LogLevel> enabledLevel{LogLevel::DEBUG};
 };
 
+template<typename... Args>
+void Logger::logf(LogLevel level, LogFormat fmt, const Args&... args) {
+    if (!isEnabled(level)) {
+        return;
+    }
+
+    std::string message;
+    try {
+        message = detail::formatLogMessage(fmt.text, args...);
+    }
+    catch (const std::exception&) {
+        // A bad format string should not lose the message
+        message = fmt.text;
+    }
+    log(level, message, fmt.location);
+}
+
 /**
  * @brief Get the global logger
  * @return Reference to the global logger
@@ -207,10 +346,19 @@ inline Logger& getLogger() {
 
 } // namespace utm
 
-// Convenience macros
-#define UTM_TRACE(message, ...) utm::getLogger().trace(message)
-#define UTM_DEBUG(message, ...) utm::getLogger().debug(message)
-#define UTM_INFO(message, ...) utm::getLogger().info(message)
-#define UTM_WARNING(message, ...) utm::getLogger().warning(message)
-#define UTM_ERROR(message, ...) utm::getLogger().error(message)
-#define UTM_CRITICAL(message, ...) utm::getLogger().critical(message) 
\ No newline at end of file
+// Convenience macros; the arguments are only evaluated when the level is enabled
+#define UTM_LOG(level, ...)                                             \
+    do {                                                                \
+        if constexpr (static_cast<int>(level) >= UTM_MIN_LOG_LEVEL) {   \
+            if (utm::Logger::isEnabled(level)) {                        \
+                utm::getLogger().logf(level, __VA_ARGS__);              \
+            }                                                           \
+        }                                                               \
+    } while (false)
+
+#define UTM_TRACE(...) UTM_LOG(utm::LogLevel::TRACE, __VA_ARGS__)
+#define UTM_DEBUG(...) UTM_LOG(utm::LogLevel::DEBUG, __VA_ARGS__)
+#define UTM_INFO(...) UTM_LOG(utm::LogLevel::INFO, __VA_ARGS__)
+#define UTM_WARNING(...) UTM_LOG(utm::LogLevel::WARNING, __VA_ARGS__)
+#define UTM_ERROR(...) UTM_LOG(utm::LogLevel::ERROR, __VA_ARGS__)
+#define UTM_CRITICAL(...) UTM_LOG(utm::LogLevel::CRITICAL, __VA_ARGS__)
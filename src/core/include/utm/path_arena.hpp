@@ -0,0 +1,207 @@
+/**
+ * @file path_arena.hpp
+ * @brief Allocation-free path handling for the backup engine hot path
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <cstdint>
+#include <cstddef>
+
+namespace utm {
+namespace fs {
+
+/**
+ * @brief Monotonic arena for short-lived path strings
+ *
+ * Strings stored in the arena live until the next call to release(). The
+ * initial buffer is retained across releases, so walking a directory whose
+ * names fit in it performs no heap allocation at all.
+ */
+class PathArena {
+public:
+    /**
+     * @brief Constructor
+     * @param initialCapacity Size of the retained initial buffer in bytes
+     */
+    explicit PathArena(std::size_t initialCapacity = 64 * 1024);
+
+    PathArena(const PathArena&) = delete;
+    PathArena& operator=(const PathArena&) = delete;
+
+    /**
+     * @brief Copy a string into the arena
+     * @param text String to copy
+     * @return View of the NUL-terminated copy owned by the arena
+     */
+    std::string_view store(std::string_view text);
+
+    /**
+     * @brief Memory resource backing the arena, for pmr containers
+     * @return Pointer to the memory resource
+     */
+    std::pmr::memory_resource* resource() noexcept;
+
+    /**
+     * @brief Release everything stored since the last release
+     */
+    void release() noexcept;
+
+private:
+    std::unique_ptr<std::byte[]> initialBuffer;
+    std::size_t initialCapacity;
+    std::pmr::monotonic_buffer_resource memory;
+};
+
+/**
+ * @brief Interns directory components as (parent, name) pairs
+ *
+ * Every directory visited during a backup is given a small integer id. Files
+ * only carry the id of their parent plus their own name, and a full path is
+ * materialized only when it is actually needed (e.g. for an error message).
+ */
+class PathInterner {
+public:
+    using Id = std::uint32_t;
+
+    /// Id of the (unnamed) root component
+    static constexpr Id ROOT = 0;
+
+    /**
+     * @brief Constructor
+     */
+    PathInterner();
+
+    PathInterner(const PathInterner&) = delete;
+    PathInterner& operator=(const PathInterner&) = delete;
+
+    /**
+     * @brief Intern a component below a parent
+     * @param parent Id of the parent component
+     * @param name Component name
+     * @return Id of the new component
+     */
+    Id intern(Id parent, std::string_view name);
+
+    /**
+     * @brief Get the parent of a component
+     * @param id Component id
+     * @return Id of the parent (ROOT for top-level components and ROOT itself)
+     */
+    Id parent(Id id) const;
+
+    /**
+     * @brief Get the name of a component
+     * @param id Component id
+     * @return Component name (empty for ROOT)
+     */
+    std::string_view name(Id id) const;
+
+    /**
+     * @brief Append the relative path of a component to a string
+     * @param id Component id
+     * @param out String to append to
+     */
+    void appendPath(Id id, std::string& out) const;
+
+    /**
+     * @brief Build the relative path of a component
+     * @param id Component id
+     * @return Relative path using '/' separators
+     */
+    std::string path(Id id) const;
+
+    /**
+     * @brief Number of interned components, including ROOT
+     * @return Component count
+     */
+    std::size_t size() const noexcept;
+
+    /**
+     * @brief Forget every component except ROOT
+     */
+    void clear();
+
+private:
+    struct Component {
+        Id parent;
+        std::string_view name;
+    };
+
+    std::pmr::monotonic_buffer_resource names;
+    std::vector<Component> components;
+};
+
+/**
+ * @brief Reusable path buffer with push/pop of components
+ *
+ * Replaces `root / std::filesystem::relative(path, base)` in recursive walks:
+ * the buffer is reserved once and components are appended and truncated in
+ * place, so building the absolute path of each visited entry does not
+ * allocate.
+ */
+class PathBuilder {
+public:
+    /**
+     * @brief Constructor
+     * @param root Root path that every built path starts with
+     */
+    explicit PathBuilder(std::string_view root = {});
+
+    /**
+     * @brief Reset the builder to a new root
+     * @param root Root path
+     */
+    void reset(std::string_view root);
+
+    /**
+     * @brief Append a component
+     * @param component Component name (no separators)
+     * @return Mark to pass to truncate() to remove the component again
+     */
+    std::size_t push(std::string_view component);
+
+    /**
+     * @brief Remove every component pushed after a mark
+     * @param mark Value returned by push()
+     */
+    void truncate(std::size_t mark) noexcept;
+
+    /**
+     * @brief Full path
+     * @return View of the full path
+     */
+    std::string_view view() const noexcept { return buffer; }
+
+    /**
+     * @brief Full path as a C string
+     * @return NUL-terminated full path
+     */
+    const char* c_str() const noexcept { return buffer.c_str(); }
+
+    /**
+     * @brief Path relative to the root
+     * @return View of the part after the root (empty at the root)
+     */
+    std::string_view relative() const noexcept;
+
+    /**
+     * @brief Whether the builder holds a root
+     * @return true if no root was given
+     */
+    bool empty() const noexcept { return buffer.empty(); }
+
+private:
+    std::string buffer;
+    std::size_t rootLength = 0;
+};
+
+} // namespace fs
+} // namespace utm
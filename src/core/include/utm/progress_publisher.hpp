@@ -0,0 +1,61 @@
+/**
+ * @file progress_publisher.hpp
+ * @brief Rate-limited delivery of backup and restore progress
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include "utm/backup_engine.hpp"
+#include <memory>
+
+namespace utm {
+
+/**
+ * @brief Coalesces progress updates and hands them to a slow consumer on its own thread
+ *
+ * The engines report progress once per file, on the threads that copy the
+ * files. update() only stores the latest stats; a publisher thread passes
+ * them to the sink at most maxEventsPerSecond times a second, so printing,
+ * formatting or sending progress never runs on the copy path and costs it
+ * nothing while the sink is busy. Status changes are not coalesced: every
+ * change is delivered, in order and without waiting for the next tick, with
+ * the stats it was reported with.
+ */
+class ProgressPublisher {
+public:
+    /**
+     * @brief Constructor; starts the publisher thread
+     * @param sink Receives the progress, always on the publisher thread
+     * @param maxEventsPerSecond Most updates delivered per second between status changes
+     */
+    explicit ProgressPublisher(ProgressCallback sink, double maxEventsPerSecond = 10.0);
+
+    /**
+     * @brief Destructor; delivers what is pending and stops the publisher thread
+     */
+    ~ProgressPublisher();
+
+    ProgressPublisher(const ProgressPublisher&) = delete;
+    ProgressPublisher& operator=(const ProgressPublisher&) = delete;
+
+    /**
+     * @brief Report progress; never waits for the sink
+     * @param status Current status
+     * @param stats Current stats
+     */
+    void update(BackupStatus status, const BackupStats& stats);
+
+    /**
+     * @brief Callback for an engine that forwards to update()
+     * @return Callback that must not outlive the publisher
+     */
+    ProgressCallback callback();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
@@ -0,0 +1,144 @@
+/**
+ * @file resource_governor.hpp
+ * @brief CPU limit for the backup and restore workers
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief Options of the resource governor
+ */
+struct GovernorOptions {
+    bool limitCpuUsage = false;                          ///< Whether to enforce maxCpuPercentage
+    int maxCpuPercentage = 50;                           ///< Share of all CPUs the process may use (1-100)
+    bool yieldToDesktop = true;                          ///< Lower worker priority while a desktop session is in use
+    bool adaptToPressure = true;                         ///< Slow down while other tasks stall on CPU, I/O or memory
+    double pressureTarget = 10.0;                        ///< Stall percentage of other tasks to stay under
+    std::chrono::milliseconds period{100};               ///< Accounting period
+};
+
+/**
+ * @brief Statistics of the resource governor
+ */
+struct GovernorStats {
+    double cpuPercentage = 0.0;                          ///< Smoothed CPU use of the process (share of all CPUs)
+    double workerFraction = 1.0;                         ///< Share of each pool's workers allowed to run
+    bool desktopActive = false;                          ///< Whether workers currently yield to the desktop
+    double cpuPressure = 0.0;                            ///< Stall percentage of other tasks waiting for a CPU
+    double ioPressure = 0.0;                             ///< Stall percentage of other tasks waiting for I/O
+    double memoryPressure = 0.0;                         ///< Stall percentage of other tasks waiting for memory
+    double workerScale = 1.0;                            ///< Share of full speed the CPU and workers get under pressure
+    double ioScale = 1.0;                                ///< Share of full speed I/O gets under pressure
+    std::chrono::milliseconds throttledTime{0};          ///< Time workers spent waiting for CPU budget
+};
+
+/**
+ * @brief Keeps the process under its CPU limit and out of the way of other tasks
+ *
+ * A control thread samples the CPU time of the process every period and
+ * keeps a token bucket of CPU time, filled at maxCpuPercentage of all CPUs.
+ * Governed threads call throttle() between units of work and wait while the
+ * bucket is empty, which turns a sustained overrun into a duty cycle. Thread
+ * pools additionally ask activeWorkers() before taking a task; the allowed
+ * share shrinks while the process is over its limit and grows back when it
+ * is not, so parallel work slows down by running fewer workers rather than
+ * by sleeping all of them.
+ *
+ * While a graphical or terminal session is in use, throttle() moves the
+ * calling thread to SCHED_IDLE (or the lowest nice level if that is not
+ * allowed) so backups only get CPU time the desktop does not want. Coming
+ * back needs RLIMIT_NICE headroom or CAP_SYS_NICE; without them only
+ * threads that end with their job (see markJobThread()) are moved, so a
+ * long-lived thread never stays in the background for good.
+ *
+ * Every second the control thread also measures how long other workloads
+ * stalled: the largest "some" stall time of the cgroups outside the
+ * process's own (see system::getOtherCgroupsPressure()), or, for a process
+ * in the root cgroup, the system's "full" stall time, during which every
+ * task waited. It feeds this to two controllers: CPU and memory pressure
+ * scale the CPU budget and the pool share, I/O and memory pressure scale
+ * the rate of every IoLimiter (see ioScale()). A scale drops multiplicatively while pressure
+ * is over the target and climbs back, quickly when the machine is idle,
+ * once it is well under. Without /proc/pressure the load average stands in
+ * for CPU pressure.
+ */
+class ResourceGovernor {
+public:
+    /**
+     * @brief Get the singleton instance
+     * @return Reference to the governor
+     */
+    static ResourceGovernor& getInstance();
+
+    /**
+     * @brief Destructor; stops the control thread
+     */
+    ~ResourceGovernor();
+
+    ResourceGovernor(const ResourceGovernor&) = delete;
+    ResourceGovernor& operator=(const ResourceGovernor&) = delete;
+
+    /**
+     * @brief Apply new options; starts or stops the control thread as needed
+     * @param options Governor options
+     */
+    void configure(const GovernorOptions& options);
+
+    /**
+     * @brief Wait for CPU budget and apply the current scheduling class to the calling thread
+     *
+     * Cheap when the process is within its limit; call it between files or tasks.
+     */
+    void throttle();
+
+    /**
+     * @brief Declare that the calling thread ends with the job it works for
+     *
+     * throttle() may then move it to the background even if it could not
+     * move it back.
+     */
+    void markJobThread();
+
+    /**
+     * @brief Number of workers of a pool that may run tasks at the moment
+     * @param poolSize Number of workers in the pool
+     * @return Between 1 and poolSize
+     */
+    std::size_t activeWorkers(std::size_t poolSize) const;
+
+    /**
+     * @brief Share of its full speed that I/O may use at the moment
+     * @return Between a small minimum and 1 (no pressure)
+     */
+    double ioScale() const noexcept;
+
+    /**
+     * @brief Get the statistics
+     * @return Current statistics
+     */
+    GovernorStats getStats() const;
+
+private:
+    ResourceGovernor();
+
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+/**
+ * @brief Get the global resource governor
+ * @return Reference to the global resource governor
+ */
+inline ResourceGovernor& getResourceGovernor() {
+    return ResourceGovernor::getInstance();
+}
+
+} // namespace utm
@@ -0,0 +1,109 @@
+/**
+ * @file scheduler.hpp
+ * @brief Runs the backups of profiles on their schedules
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include "utm/config.hpp"
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace utm {
+
+/**
+ * @brief Starts the backup of a profile whose time has come
+ * @return false if the backup could not start (another one is running); it is retried later
+ */
+using ScheduledBackup = std::function<bool(const BackupProfile& profile)>;
+
+/**
+ * @brief Fires the scheduled backups of any number of profiles
+ *
+ * Profiles are kept in a min-heap keyed on their next run, and a single
+ * thread sleeps until the earliest one on a wall-clock timer (timerfd),
+ * so the daemon does no periodic polling however many profiles there are.
+ * The timer also wakes up when the clock is set, and a run whose time
+ * passed while the machine was off or suspended is started once, right
+ * away, rather than once per missed interval. Each profile's runs are
+ * offset by a small jitter derived from its name, so profiles sharing a
+ * schedule do not all start at the same moment.
+ */
+class Scheduler {
+public:
+    /**
+     * @brief Delay before a backup that could not start is tried again
+     */
+    static constexpr std::chrono::seconds RETRY_DELAY{60};
+
+    /**
+     * @brief Constructor
+     * @param callback Called on the scheduler thread to start a backup
+     */
+    explicit Scheduler(ScheduledBackup callback);
+
+    /**
+     * @brief Destructor; stops the scheduler
+     */
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * @brief Start the scheduler thread
+     *
+     * Changes in the profiles directory reload the profiles from the
+     * configuration and reschedule those whose schedule changed.
+     *
+     * @param profilesDir Directory of the profile files to watch (empty = don't watch)
+     * @return true if the scheduler is running
+     */
+    bool start(const std::filesystem::path& profilesDir = {});
+
+    /**
+     * @brief Stop the scheduler thread
+     */
+    void stop();
+
+    /**
+     * @brief Replace the scheduled profiles
+     *
+     * Profiles whose schedule is unchanged keep their next run. New or
+     * changed ones are scheduled after the latest snapshot at their
+     * destination; if that run is already due, it starts shortly.
+     *
+     * @param profiles All profiles; disabled schedules are ignored
+     */
+    void setProfiles(const std::vector<BackupProfile>& profiles);
+
+    /**
+     * @brief Get the next run of a profile
+     * @param profileName Profile name
+     * @return Time of the next run, or nullopt if the profile is not scheduled
+     */
+    std::optional<std::chrono::system_clock::time_point> nextRun(const std::string& profileName) const;
+
+    /**
+     * @brief First time a schedule fires after a given time, without jitter
+     * @param schedule Schedule
+     * @param after Time to start from
+     * @return The next run, in local time for calendar schedules
+     */
+    static std::chrono::system_clock::time_point nextOccurrence(
+        const ScheduleConfig& schedule,
+        std::chrono::system_clock::time_point after);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
@@ -0,0 +1,117 @@
+/**
+ * @file snapshot_catalog.hpp
+ * @brief Per-destination catalog of snapshots and their summaries
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <cstdint>
+
+namespace utm {
+
+/**
+ * @brief State of a snapshot in the catalog
+ */
+enum class SnapshotState : std::uint32_t {
+    COMPLETE = 1,   ///< Backup finished
+    VERIFIED = 2,   ///< Backup finished and was verified
+    FAILED = 3      ///< Backup failed or was cancelled; the directory is incomplete
+};
+
+/**
+ * @brief Summary of one snapshot, as recorded when it was committed
+ */
+struct SnapshotSummary {
+    std::chrono::system_clock::time_point timestamp;    ///< Snapshot time (names the snapshot directory)
+    std::chrono::system_clock::time_point endTime;      ///< When the backup finished
+    SnapshotState state = SnapshotState::COMPLETE;      ///< State of the snapshot
+    std::uint64_t totalFiles = 0;                       ///< Files in the snapshot
+    std::uint64_t totalDirectories = 0;                 ///< Directories in the snapshot
+    std::uint64_t totalSize = 0;                        ///< Size of the snapshot's files in bytes
+    std::uint64_t newFiles = 0;                         ///< Files not in the previous snapshot
+    std::uint64_t modifiedFiles = 0;                    ///< Files changed since the previous snapshot
+    std::uint64_t unchangedFiles = 0;                   ///< Files hard-linked from the previous snapshot
+    std::uint64_t skippedFiles = 0;                     ///< Excluded files
+    std::uint64_t processedSize = 0;                    ///< Bytes processed by the backup
+
+    /**
+     * @brief Whether the snapshot can be restored from and linked against
+     * @return true for complete and verified snapshots
+     */
+    bool usable() const noexcept {
+        return state == SnapshotState::COMPLETE || state == SnapshotState::VERIFIED;
+    }
+};
+
+/**
+ * @brief Catalog of the snapshots stored at a backup destination
+ *
+ * Stored as `backups/.utm-catalog` at the destination: a fixed-size record
+ * per snapshot, newest first. Every change rewrites the file under a
+ * temporary name and renames it into place while holding an exclusive lock,
+ * so readers never see a partial catalog and never need a lock. Loaded
+ * catalogs are cached per destination and revalidated with a single stat,
+ * so listing snapshots does not touch the destination's directory tree.
+ */
+class SnapshotCatalog {
+public:
+    /**
+     * @brief Name of the catalog file in the backups directory
+     */
+    static constexpr const char* FILE_NAME = ".utm-catalog";
+
+    /**
+     * @brief Load the catalog of a destination
+     *
+     * A destination without a catalog (backups made by older versions) is
+     * catalogued once from its snapshot directories and their
+     * backup-info.json files.
+     *
+     * @param destination Backup destination path
+     * @return The catalog; empty if the destination has no snapshots
+     */
+    static std::shared_ptr<const SnapshotCatalog> load(const std::filesystem::path& destination);
+
+    /**
+     * @brief Add a snapshot to the catalog, replacing any entry with the same timestamp
+     * @param destination Backup destination path
+     * @param summary Summary of the snapshot
+     * @return true if the catalog was updated
+     */
+    static bool commit(const std::filesystem::path& destination, const SnapshotSummary& summary);
+
+    /**
+     * @brief Remove snapshots from the catalog
+     * @param destination Backup destination path
+     * @param timestamps Timestamps of the snapshots to remove
+     * @return true if the catalog was updated
+     */
+    static bool remove(
+        const std::filesystem::path& destination,
+        const std::vector<std::chrono::system_clock::time_point>& timestamps);
+
+    /**
+     * @brief All snapshots, newest first
+     * @return Snapshot summaries
+     */
+    const std::vector<SnapshotSummary>& snapshots() const noexcept { return entries; }
+
+    /**
+     * @brief Find a snapshot by timestamp
+     * @param timestamp Snapshot time
+     * @return The summary, or nullopt if the catalog has no such snapshot
+     */
+    std::optional<SnapshotSummary> find(const std::chrono::system_clock::time_point& timestamp) const;
+
+private:
+    std::vector<SnapshotSummary> entries;
+};
+
+} // namespace utm
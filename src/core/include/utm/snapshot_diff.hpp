@@ -0,0 +1,85 @@
+/**
+ * @file snapshot_diff.hpp
+ * @brief Differences between two snapshots, computed from their indexes
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include "utm/snapshot_index.hpp"
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief Kind of change between two snapshots
+ */
+enum class DiffChange {
+    ADDED,      ///< Only in the newer snapshot
+    REMOVED,    ///< Only in the older snapshot
+    MODIFIED,   ///< In both, with different size or modification time
+    RENAMED     ///< Removed file reappearing under another path with the same size and modification time
+};
+
+/**
+ * @brief One changed entry
+ */
+struct DiffEntry {
+    DiffChange change = DiffChange::ADDED;               ///< Kind of change
+    std::string path;                                    ///< Path in the newer snapshot (older one for REMOVED)
+    std::string previousPath;                            ///< Path in the older snapshot (RENAMED only)
+    std::filesystem::file_type type = std::filesystem::file_type::none; ///< Entry type
+    std::uintmax_t oldSize = 0;                          ///< Size in the older snapshot (0 if added)
+    std::uintmax_t newSize = 0;                          ///< Size in the newer snapshot (0 if removed)
+};
+
+/**
+ * @brief Totals of a snapshot diff
+ */
+struct DiffSummary {
+    size_t addedEntries = 0;                             ///< Entries added
+    size_t removedEntries = 0;                           ///< Entries removed
+    size_t modifiedEntries = 0;                          ///< Entries modified
+    size_t renamedEntries = 0;                           ///< Entries renamed
+    std::uintmax_t addedBytes = 0;                       ///< Size of added entries
+    std::uintmax_t removedBytes = 0;                     ///< Size of removed entries
+    std::uintmax_t modifiedBytes = 0;                    ///< Size of modified entries in the newer snapshot
+    std::uintmax_t renamedBytes = 0;                     ///< Size of renamed entries
+    std::intmax_t growthBytes = 0;                       ///< Net change of the total size
+};
+
+/**
+ * @brief Callback receiving each changed entry
+ */
+using DiffCallback = std::function<void(const DiffEntry& entry)>;
+
+/**
+ * @brief Compare two snapshots by merging their indexes
+ *
+ * Both indexes are sorted by directory path and by name within each
+ * directory, so the diff is a single merge over the two entry tables and
+ * never touches the snapshot trees. An entry present in both snapshots is
+ * unchanged when it is the same inode (hard-linked by the backup) or has
+ * the same type, size and modification time.
+ *
+ * Modified entries and entries that cannot be renames are reported as the
+ * merge reaches them. Non-empty regular files that were added or removed
+ * are held back until the merge ends, paired into renames, and reported
+ * after it.
+ *
+ * @param from Index of the older snapshot
+ * @param to Index of the newer snapshot
+ * @param callback Called for every changed entry; may be empty for totals only
+ * @return Totals of the diff
+ */
+DiffSummary diffSnapshots(
+    const SnapshotIndex& from,
+    const SnapshotIndex& to,
+    const DiffCallback& callback);
+
+} // namespace utm
@@ -0,0 +1,132 @@
+/**
+ * @file snapshot_index.hpp
+ * @brief On-disk directory index of a snapshot, for browsing without walking it
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace utm {
+
+class IoLimiter;
+
+/**
+ * @brief Read-only, memory-mapped index of every directory in a snapshot
+ *
+ * The index is stored as `.utm-index` in the snapshot root. It holds one
+ * record per directory, sorted by path, and the entries of each directory
+ * stored contiguously and sorted by name. Finding a directory and seeking
+ * to a name within it are binary searches, so listing any page of any
+ * directory costs O(log n) regardless of the snapshot size.
+ */
+class SnapshotIndex {
+public:
+    /**
+     * @brief Name of the index file in the snapshot root
+     */
+    static constexpr const char* FILE_NAME = ".utm-index";
+
+    /**
+     * @brief One directory entry
+     *
+     * The name points into the mapped index and stays valid as long as the
+     * index is alive.
+     */
+    struct Entry {
+        std::string_view name;                 ///< Entry name
+        mode_t mode = 0;                       ///< File type and permissions
+        std::uintmax_t size = 0;               ///< Size in bytes (0 for directories)
+        std::int64_t modifiedNs = 0;           ///< Modification time in nanoseconds since the epoch
+        std::uint64_t inode = 0;               ///< Inode number in the backup filesystem
+    };
+
+    /**
+     * @brief Build the index of a snapshot and store it atomically
+     * @param snapshotDir Snapshot root directory
+     * @param limiter Optional limiter the directory reads and index writes are accounted to
+     * @return true if the index was written
+     */
+    static bool build(const std::filesystem::path& snapshotDir, IoLimiter* limiter = nullptr);
+
+    /**
+     * @brief Open the index of a snapshot
+     * @param snapshotDir Snapshot root directory
+     * @param buildIfMissing Whether to build the index of a snapshot that has none
+     * @return The index, or nullptr on failure
+     */
+    static std::shared_ptr<const SnapshotIndex> open(
+        const std::filesystem::path& snapshotDir,
+        bool buildIfMissing = true);
+
+    ~SnapshotIndex();
+
+    SnapshotIndex(const SnapshotIndex&) = delete;
+    SnapshotIndex& operator=(const SnapshotIndex&) = delete;
+
+    /**
+     * @brief Number of directories, including the root
+     * @return Directory count
+     */
+    std::size_t directoryCount() const noexcept;
+
+    /**
+     * @brief Number of entries in all directories
+     * @return Entry count
+     */
+    std::size_t totalEntries() const noexcept;
+
+    /**
+     * @brief Find a directory by path
+     * @param relativeDir Path relative to the snapshot root, '/' separated; empty for the root
+     * @return Directory number, or nullopt if the snapshot has no such directory
+     */
+    std::optional<std::size_t> findDirectory(std::string_view relativeDir) const;
+
+    /**
+     * @brief Path of a directory
+     * @param directory Directory number
+     * @return Path relative to the snapshot root
+     */
+    std::string_view directoryPath(std::size_t directory) const;
+
+    /**
+     * @brief Number of entries in a directory
+     * @param directory Directory number
+     * @return Entry count
+     */
+    std::size_t entryCount(std::size_t directory) const;
+
+    /**
+     * @brief Position of the first entry whose name sorts after a given name
+     * @param directory Directory number
+     * @param name Name to seek past; empty for the first entry
+     * @return Position in [0, entryCount(directory)]
+     */
+    std::size_t seekAfter(std::size_t directory, std::string_view name) const;
+
+    /**
+     * @brief Get an entry of a directory
+     * @param directory Directory number
+     * @param position Position in the directory, sorted by name
+     * @return The entry
+     */
+    Entry entry(std::size_t directory, std::size_t position) const;
+
+private:
+    SnapshotIndex();
+
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
@@ -0,0 +1,45 @@
+/**
+ * @file space_accounting.hpp
+ * @brief Space freed by deleting hard-linked snapshots
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+namespace utm {
+
+/**
+ * @brief Space freed by deleting one snapshot
+ */
+struct ReclaimEstimate {
+    std::uintmax_t reclaimableBytes = 0;   ///< Freed when deleted after the snapshots before it
+    std::uintmax_t exclusiveBytes = 0;     ///< File data no other snapshot links to
+};
+
+/**
+ * @brief Compute the space freed by deleting snapshots in order
+ *
+ * Unchanged files are hard links shared between snapshots, so deleting a
+ * snapshot frees only the inodes whose last link it holds. The links of
+ * every inode are counted across the snapshot indexes of the destination:
+ * an inode is freed by the snapshot, in deletion order, that removes its
+ * last link, and never if a snapshot that is kept links to it. The
+ * reclaimable bytes of any prefix of the order therefore add up to exactly
+ * what deleting that prefix frees. Sizes are apparent file sizes.
+ *
+ * @param destination Backup destination path
+ * @param deletionOrder Snapshots in the order they would be deleted
+ * @return One estimate per snapshot of the order, or nullopt if a snapshot index cannot be read
+ */
+std::optional<std::vector<ReclaimEstimate>> estimateReclaimableSpace(
+    const std::filesystem::path& destination,
+    const std::vector<std::chrono::system_clock::time_point>& deletionOrder);
+
+} // namespace utm
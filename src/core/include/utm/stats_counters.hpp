@@ -0,0 +1,127 @@
+/**
+ * @file stats_counters.hpp
+ * @brief Progress counters updated by many threads and read without stopping them
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <initializer_list>
+#include <utility>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace utm {
+
+struct BackupStats;
+
+/**
+ * @brief Counters of a backup or restore
+ */
+enum class StatCounter : std::size_t {
+    TOTAL_FILES,
+    TOTAL_DIRECTORIES,
+    TOTAL_SIZE,
+    PROCESSED_FILES,
+    PROCESSED_SIZE,
+    NEW_FILES,
+    MODIFIED_FILES,
+    UNCHANGED_FILES,
+    SKIPPED_FILES,
+    DEDUP_SAVINGS,
+    COUNT
+};
+
+/**
+ * @brief Amount to add to a counter
+ */
+using StatDelta = std::pair<StatCounter, std::uint64_t>;
+
+/**
+ * @brief Counters of a running backup or restore
+ *
+ * Every thread adds to its own slot, a cache line of counters that no other
+ * thread normally writes, so workers do not contend. Each slot is guarded
+ * by a sequence number: a writer makes it odd while it updates the slot and
+ * even again when done, and a reader copies the slot until it sees the same
+ * even number before and after. Readers never block writers, and an update
+ * of several counters (a file and its bytes, say) is seen whole or not at
+ * all. Threads share a slot only when there are more threads than slots;
+ * they then take turns on its sequence number.
+ *
+ * fill() also derives rates from the counters, smoothed over about a
+ * second, and an estimate of the remaining time.
+ */
+class StatsCounters {
+public:
+    /**
+     * @brief Values of all counters
+     */
+    using Values = std::array<std::uint64_t, static_cast<std::size_t>(StatCounter::COUNT)>;
+
+    /**
+     * @brief Constructor
+     * @param slots Number of slots (0 = one per hardware thread)
+     */
+    explicit StatsCounters(std::size_t slots = 0);
+
+    /**
+     * @brief Destructor
+     */
+    ~StatsCounters();
+
+    StatsCounters(const StatsCounters&) = delete;
+    StatsCounters& operator=(const StatsCounters&) = delete;
+
+    /**
+     * @brief Zero the counters and start the clock; only while no thread updates them
+     */
+    void reset();
+
+    /**
+     * @brief Stop the clock; fill() reports the end time and rates stop changing
+     */
+    void finish();
+
+    /**
+     * @brief Add to a counter
+     * @param counter Counter
+     * @param amount Amount to add
+     */
+    void add(StatCounter counter, std::uint64_t amount = 1);
+
+    /**
+     * @brief Add to several counters in one update
+     * @param deltas Counters and amounts
+     */
+    void add(std::initializer_list<StatDelta> deltas);
+
+    /**
+     * @brief Consistent copy of all counters
+     * @return Sum of every slot
+     */
+    Values snapshot() const;
+
+    /**
+     * @brief Value of a single counter
+     * @param counter Counter
+     * @return Its value
+     */
+    std::uint64_t value(StatCounter counter) const;
+
+    /**
+     * @brief Store the counters, times, rates and remaining time in stats
+     * @param stats Stats to fill; other fields are left alone
+     */
+    void fill(BackupStats& stats) const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
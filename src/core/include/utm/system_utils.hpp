@@ -12,6 +12,7 @@
 #include <filesystem>
 #include <optional>
 #include <functional>
+#include <map>
 
 namespace utm {
 namespace system {
@@ -69,12 +70,19 @@ struct MountpointInfo {
     bool isNetworkMount;                       ///< Whether it's a network mount
     std::optional<std::string> label;          ///< Filesystem label if available
     std::optional<std::string> uuid;           ///< Filesystem UUID if available
+    std::string physicalDevice;                ///< Disk or array serving the filesystem (e.g. "sda", "md0"), empty if unknown
+    bool isRotational = false;                 ///< Whether that disk is rotational
 };
 
 /**
- * @brief Get information about a mountpoint
- * @param path Mountpoint path
- * @return Mountpoint information or nullopt if path is not a mountpoint
+ * @brief Get information about the mountpoint holding a path
+ *
+ * Partitions, and device-mapper volumes on a single device, are resolved
+ * to the disk that serves them, so paths on the same spindle or SSD share
+ * a physicalDevice.
+ *
+ * @param path Any existing path
+ * @return Information on the mount containing the path, or nullopt if it cannot be determined
  */
 std::optional<MountpointInfo> getMountpointInfo(const std::filesystem::path& path);
 
@@ -148,12 +156,57 @@ std::filesystem::path getTempDirectory();
  */
 std::tuple<double, double, double> getSystemLoad();
 
+/**
+ * @brief Pressure stall information of one resource
+ */
+struct PressureStall {
+    double someAvg10 = 0.0;                    ///< Percent of time some tasks stalled, over the last 10 seconds
+    double fullAvg10 = 0.0;                    ///< Percent of time all non-idle tasks stalled, over the last 10 seconds
+    uint64_t someTotal = 0;                    ///< Total time some tasks stalled, in microseconds
+    uint64_t fullTotal = 0;                    ///< Total time all non-idle tasks stalled, in microseconds
+};
+
+/**
+ * @brief Pressure stall information of the system
+ */
+struct SystemPressure {
+    PressureStall cpu;                         ///< Tasks waiting for a CPU
+    PressureStall io;                          ///< Tasks waiting for I/O
+    PressureStall memory;                      ///< Tasks waiting for memory (reclaim, refaults, swap)
+};
+
+/**
+ * @brief Read the pressure stall information from /proc/pressure
+ * @return Pressure of CPU, I/O and memory, or nullopt if the kernel does not provide it
+ */
+std::optional<SystemPressure> getSystemPressure();
+
+/**
+ * @brief Read the pressure stall information of the cgroups the process does not run in
+ *
+ * These are the siblings of the process's cgroup and of each of its
+ * ancestors, which between them hold every other task outside the root
+ * cgroup. Only available on the unified (v2) hierarchy, for processes
+ * outside the root cgroup, such as a systemd service or a login session.
+ * @return Pressure by cgroup path, or nullopt if unavailable
+ */
+std::optional<std::map<std::string, SystemPressure>> getOtherCgroupsPressure();
+
 /**
  * @brief Get the current CPU usage percentage
  * @return CPU usage percentage (0-100)
  */
 double getCpuUsage();
 
+/**
+ * @brief Check whether someone is working at the machine
+ *
+ * Looks for a local, active logind session that is not idle: a graphical
+ * session without the idle hint, or a text console typed on recently.
+ * @return true if a local session is in use, false otherwise
+ */
+bool isDesktopInUse();
+
 /**
  * @brief Check if the system supports systemd
  * @return true if systemd is supported, false otherwise
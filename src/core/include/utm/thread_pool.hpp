@@ -0,0 +1,77 @@
+/**
+ * @file thread_pool.hpp
+ * @brief Worker pool used by the engines for parallel transfers
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief Fixed-size pool of worker threads with a FIFO task queue
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Task type
+     */
+    using Task = std::function<void()>;
+
+    /**
+     * @brief Constructor
+     * @param threadCount Number of workers (0 = hardware concurrency)
+     * @param jobScoped Whether the pool is destroyed when its job ends (see ResourceGovernor::markJobThread())
+     */
+    explicit ThreadPool(std::size_t threadCount = 0, bool jobScoped = false);
+
+    /**
+     * @brief Destructor; waits for queued tasks and joins the workers
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queue a task
+     * @param task Task to run on a worker
+     */
+    void submit(Task task);
+
+    /**
+     * @brief Block until the queue is empty and every worker is idle
+     */
+    void wait();
+
+    /**
+     * @brief Block until the pool is idle or a timeout expires
+     * @param timeout Maximum time to wait
+     * @return true if the pool is idle
+     */
+    bool waitFor(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Drop every task that has not started yet
+     * @return Number of discarded tasks
+     */
+    std::size_t discardPending();
+
+    /**
+     * @brief Number of worker threads
+     * @return Worker count
+     */
+    std::size_t size() const noexcept;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
@@ -0,0 +1,108 @@
+/**
+ * @file trash_collector.hpp
+ * @brief Background deletion of pruned snapshots
+ * @author Ubuntu Time Machine Team
+ * @copyright Copyright (c) 2024, GPLv3
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <cstddef>
+
+namespace utm {
+
+/**
+ * @brief Options for deleting trashed snapshots
+ */
+struct TrashOptions {
+    int threadCount = 4;                                 ///< Directories deleted in parallel
+    std::size_t maxUnlinksPerSecond = 0;                 ///< Throttle for the whole collector (0 = unlimited)
+};
+
+/**
+ * @brief Statistics of a trash collector
+ */
+struct TrashStats {
+    std::size_t removedEntries = 0;                      ///< Files and directories removed
+    std::size_t removedSnapshots = 0;                    ///< Trashed snapshots removed completely
+    std::size_t failedEntries = 0;                       ///< Entries that could not be removed
+};
+
+/**
+ * @brief Deletes pruned snapshots in the background
+ *
+ * Pruning renames a snapshot into `backups/.utm-trash` at its destination,
+ * which removes it from the backups directory in a single operation. The
+ * collector then deletes the trash with a pool of workers, one directory
+ * per task, using unlinkat() relative to each directory's descriptor. The
+ * trash is the only state, so deletion that is interrupted (stop(), exit or
+ * a crash) simply continues the next time the destination is collected.
+ */
+class TrashCollector {
+public:
+    /**
+     * @brief Name of the trash directory in the backups directory
+     */
+    static constexpr const char* TRASH_DIR = ".utm-trash";
+
+    /**
+     * @brief Constructor
+     * @param options Deletion options
+     */
+    explicit TrashCollector(const TrashOptions& options = TrashOptions());
+
+    /**
+     * @brief Destructor; stops collecting and leaves the rest of the trash for later
+     */
+    ~TrashCollector();
+
+    TrashCollector(const TrashCollector&) = delete;
+    TrashCollector& operator=(const TrashCollector&) = delete;
+
+    /**
+     * @brief Move a snapshot directory into the trash of its destination
+     * @param snapshotDir Snapshot directory (`<destination>/backups/<name>`)
+     * @return true if the snapshot is no longer in the backups directory
+     */
+    static bool moveToTrash(const std::filesystem::path& snapshotDir);
+
+    /**
+     * @brief Queue the trash of a destination for background deletion
+     * @param destination Backup destination path
+     */
+    void schedule(const std::filesystem::path& destination);
+
+    /**
+     * @brief Delete the trash of a destination and wait for it
+     * @param destination Backup destination path
+     * @return true if the trash is empty afterwards
+     */
+    bool collect(const std::filesystem::path& destination);
+
+    /**
+     * @brief Block until every scheduled destination has been collected
+     */
+    void wait();
+
+    /**
+     * @brief Stop collecting as soon as possible
+     *
+     * Work already scheduled is dropped; it is resumed by the next
+     * schedule() or collect() of the destination.
+     */
+    void stop();
+
+    /**
+     * @brief Get the statistics
+     * @return Totals since construction
+     */
+    TrashStats getStats() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+} // namespace utm
@@ -2,8 +2,21 @@
 #include "utm/logging.hpp"
 #include "utm/filesystem_utils.hpp"
 #include "utm/system_utils.hpp"
+#include "utm/path_arena.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/snapshot_index.hpp"
+#include "utm/database.hpp"
+#include "utm/snapshot_catalog.hpp"
+#include "utm/trash_collector.hpp"
+#include "utm/space_accounting.hpp"
+#include "utm/resource_governor.hpp"
+#include "utm/io_limiter.hpp"
+#include "utm/backup_journal.hpp"
+#include "utm/stats_counters.hpp"
+#include "utm/event_log.hpp"
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <chrono>
 #include <thread>
 #include <mutex>
@@ -13,13 +26,39 @@
 #include <algorithm>
 #include <iomanip>
 #include <cstring>
+#include <memory_resource>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace utm {
 
+using fs::PathArena;
+using fs::PathBuilder;
+using fs::PathInterner;
+using fs::DirStack;
+using fs::FileHandle;
+using fs::FileStat;
+using fs::statAt;
+using fs::statFd;
+using fs::openAt;
+using fs::linkAt;
+using fs::copyContents;
+
 // Implementation class for BackupEngine
 class BackupEngine::Impl {
 public:
-    Impl() : status(BackupStatus::IDLE) {}
+    Impl() = default;
+
+    ~Impl() {
+        // The backup thread uses the members; a running backup is cancelled
+        cancelRequested = true;
+        if (backupThread.joinable()) {
+            backupThread.join();
+        }
+    }
     
     // Initialize the backup engine
     bool initialize(const std::filesystem::path& metadataPath) {
@@ -32,6 +71,11 @@ public:
             if (!std::filesystem::exists(metadataPath)) {
                 std::filesystem::create_directories(metadataPath);
             }
+
+            // The file catalog is optional: backups still work without history queries
+            if (!catalog.open(metadataPath / "catalog.db")) {
+                getLogger().warning("File catalog unavailable, file history will not be recorded");
+            }
             
             getLogger().info("Backup engine initialized with metadata path: " + metadataPath.string());
             return true;
@@ -56,13 +100,20 @@ public:
                 return false;
             }
             
+            // The previous backup has finished, but its thread may not have exited yet
+            if (backupThread.joinable()) {
+                backupThread.join();
+            }
+            cancelRequested = false;
+
             // Reset stats
-            stats = BackupStats();
-            stats.startTime = std::chrono::system_clock::now();
+            counters.reset();
             
             // Store configuration
             this->config = config;
             this->progressCallback = progressCallback;
+            ioLimiter.setLimits(config.ioLimits);
+            ioThrottledBase = ioLimiter.throttledTime();
             
             // Start backup thread
             status = BackupStatus::SCANNING;
@@ -110,7 +161,20 @@ public:
     
     // Get current backup statistics
     BackupStats getStats() const {
-        return stats;
+        BackupStats current;
+        counters.fill(current);
+        current.ioThrottledTime = ioThrottledTime();
+        return current;
+    }
+
+    // Time this backup waited for the I/O limits
+    std::chrono::milliseconds ioThrottledTime() const {
+        return ioLimiter.throttledTime() - ioThrottledBase;
+    }
+
+    // Change the I/O limits of the running backup
+    void setIoLimits(const IoLimits& limits) {
+        ioLimiter.setLimits(limits);
     }
     
     // List available backups for a destination
@@ -132,37 +196,13 @@ public:
                 return result;
             }
             
-            // Look for backup directories
-            std::filesystem::path backupsDir = destination / "backups";
-            if (!std::filesystem::exists(backupsDir)) {
-                return result; // No backups yet
-            }
-            
-            // Iterate over backup directories
-            for (const auto& entry : std::filesystem::directory_iterator(backupsDir)) {
-                if (entry.is_directory()) {
-                    std::string dirName = entry.path().filename().string();
-                    
-                    // Try to parse timestamp from directory name
-                    try {
-                        std::tm tm = {};
-                        std::istringstream ss(dirName);
-                        ss >> std::get_time(&tm, "%Y%m%d-%H%M%S");
-                        
-                        if (!ss.fail()) {
-                            auto timePoint = std::chrono::system_clock::from_time_t(std::mktime(&tm));
-                            result.push_back(timePoint);
-                        }
-                    }
-                    catch (const std::exception& e) {
-                        getLogger().warning("Failed to parse backup timestamp from directory: " + dirName);
-                    }
+            // Finished snapshots from the destination's catalog, newest first
+            for (const auto& snapshot : SnapshotCatalog::load(destination)->snapshots()) {
+                if (snapshot.usable()) {
+                    result.push_back(snapshot.timestamp);
                 }
             }
             
-            // Sort backups by timestamp (newest first)
-            std::sort(result.begin(), result.end(), std::greater<>());
-            
             return result;
         }
         catch (const std::exception& e) {
@@ -171,122 +211,150 @@ public:
         }
     }
     
+    // List snapshots with their summaries
+    std::vector<SnapshotSummary> listSnapshots(const std::filesystem::path& destination) const {
+        try {
+            return SnapshotCatalog::load(destination)->snapshots();
+        }
+        catch (const std::exception& e) {
+            getLogger().error("Failed to list snapshots: " + std::string(e.what()));
+            return {};
+        }
+    }
+    
     // Prune old backups
     bool pruneBackups(
         const std::filesystem::path& destination,
-        int keepDaily,
-        int keepWeekly,
-        int keepMonthly) {
+        const RetentionPolicy& policy,
+        bool dryRun) {
         
         try {
-            // Get list of backups
+            PrunePlan plan;
+            lastPrunePlan = plan;
+
+            // Finished backups and all snapshots, newest first
             auto backups = listBackups(destination);
+            const auto snapshots = SnapshotCatalog::load(destination)->snapshots();
             
-            if (backups.empty()) {
+            if (snapshots.empty()) {
                 getLogger().info("No backups to prune");
+                if (!dryRun) {
+                    trash.schedule(destination);
+                }
                 return true;
             }
             
-            // Group backups by day, week, and month
-            std::map<std::string, std::vector<std::chrono::system_clock::time_point>> dailyBackups;
-            std::map<std::string, std::vector<std::chrono::system_clock::time_point>> weeklyBackups;
-            std::map<std::string, std::vector<std::chrono::system_clock::time_point>> monthlyBackups;
-            
-            for (const auto& backup : backups) {
-                std::time_t time = std::chrono::system_clock::to_time_t(backup);
-                std::tm* tm = std::localtime(&time);
-                
-                // Format for day: YYYY-MM-DD
-                char dayStr[11];
-                std::strftime(dayStr, sizeof(dayStr), "%Y-%m-%d", tm);
-                dailyBackups[dayStr].push_back(backup);
-                
-                // Format for week: YYYY-WW (ISO week)
-                char weekStr[9];
-                std::strftime(weekStr, sizeof(weekStr), "%G-%V", tm);
-                weeklyBackups[weekStr].push_back(backup);
-                
-                // Format for month: YYYY-MM
-                char monthStr[8];
-                std::strftime(monthStr, sizeof(monthStr), "%Y-%m", tm);
-                monthlyBackups[monthStr].push_back(backup);
-            }
-            
-            // Determine which backups to keep
+            // Keep the newest backup of each of the newest days, weeks, months and years
             std::set<std::chrono::system_clock::time_point> backupsToKeep;
+            keepNewestPerPeriod(backups, policy.keepDaily, "%Y-%m-%d", backupsToKeep);
+            keepNewestPerPeriod(backups, policy.keepWeekly, "%G-%V", backupsToKeep);
+            keepNewestPerPeriod(backups, policy.keepMonthly, "%Y-%m", backupsToKeep);
+            keepNewestPerPeriod(backups, policy.keepYearly, "%Y", backupsToKeep);
             
-            // Keep daily backups
-            int dailyCount = 0;
-            for (auto& [day, dayBackups] : dailyBackups) {
-                if (dailyCount >= keepDaily) {
-                    break;
-                }
-                
-                // Sort by time (newest first)
-                std::sort(dayBackups.begin(), dayBackups.end(), std::greater<>());
-                
-                // Keep the newest backup of each day
-                if (!dayBackups.empty()) {
-                    backupsToKeep.insert(dayBackups.front());
-                    dailyCount++;
+            // Snapshots of failed backups go first, then expired backups, oldest first
+            std::vector<std::chrono::system_clock::time_point> order;
+            std::vector<PruneReason> reasons;
+            for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it) {
+                if (it->state == SnapshotState::FAILED) {
+                    order.push_back(it->timestamp);
+                    reasons.push_back(PruneReason::FAILED);
                 }
             }
-            
-            // Keep weekly backups
-            int weeklyCount = 0;
-            for (auto& [week, weekBackups] : weeklyBackups) {
-                if (weeklyCount >= keepWeekly) {
-                    break;
+            for (auto it = backups.rbegin(); it != backups.rend(); ++it) {
+                if (backupsToKeep.find(*it) == backupsToKeep.end()) {
+                    order.push_back(*it);
+                    reasons.push_back(PruneReason::RETENTION);
                 }
-                
-                // Sort by time (newest first)
-                std::sort(weekBackups.begin(), weekBackups.end(), std::greater<>());
-                
-                // Keep the newest backup of each week
-                if (!weekBackups.empty()) {
-                    backupsToKeep.insert(weekBackups.front());
-                    weeklyCount++;
+            }
+            const size_t expired = order.size();
+
+            // Then whatever the free space target may need, except the latest backup
+            const std::uintmax_t targetFreeBytes = static_cast<std::uintmax_t>(std::max(policy.targetFreeGB, 0)) << 30;
+            if (targetFreeBytes > 0) {
+                for (auto it = backups.rbegin(); it != backups.rend() && std::next(it) != backups.rend(); ++it) {
+                    if (backupsToKeep.find(*it) != backupsToKeep.end()) {
+                        order.push_back(*it);
+                        reasons.push_back(PruneReason::FREE_SPACE);
+                    }
                 }
             }
-            
-            // Keep monthly backups
-            int monthlyCount = 0;
-            for (auto& [month, monthBackups] : monthlyBackups) {
-                if (monthlyCount >= keepMonthly) {
+
+            std::error_code ec;
+            plan.freeBytesBefore = std::filesystem::space(destination, ec).available;
+            std::optional<std::vector<ReclaimEstimate>> estimates = std::vector<ReclaimEstimate>();
+            if (!order.empty()) {
+                estimates = estimateReclaimableSpace(destination, order);
+            }
+            if (!estimates) {
+                getLogger().warning("Space freed by pruning " + destination.string() + " is unknown");
+                plan.accounted = false;
+            }
+
+            for (size_t i = 0; i < order.size(); i++) {
+                if (i >= expired && (!estimates || plan.freeBytesBefore + plan.reclaimableBytes >= targetFreeBytes)) {
                     break;
                 }
-                
-                // Sort by time (newest first)
-                std::sort(monthBackups.begin(), monthBackups.end(), std::greater<>());
-                
-                // Keep the newest backup of each month
-                if (!monthBackups.empty()) {
-                    backupsToKeep.insert(monthBackups.front());
-                    monthlyCount++;
+
+                PruneCandidate candidate;
+                candidate.timestamp = order[i];
+                candidate.reason = reasons[i];
+                if (estimates) {
+                    candidate.reclaimableBytes = (*estimates)[i].reclaimableBytes;
+                    candidate.exclusiveBytes = (*estimates)[i].exclusiveBytes;
                 }
+                plan.reclaimableBytes += candidate.reclaimableBytes;
+                plan.snapshots.push_back(candidate);
+            }
+            plan.keptSnapshots = snapshots.size() - plan.snapshots.size();
+            lastPrunePlan = plan;
+
+            if (targetFreeBytes > 0 && plan.accounted && plan.freeBytesBefore + plan.reclaimableBytes < targetFreeBytes) {
+                getLogger().warning("Pruning cannot free enough space on " + destination.string() + " for the free space target");
             }
             
-            // Delete backups that aren't in the keep set
+            if (dryRun) {
+                getLogger().info("Pruning would remove " + std::to_string(plan.snapshots.size()) + " backups and free " +
+                                std::to_string(plan.reclaimableBytes) + " bytes, keeping " + std::to_string(plan.keptSnapshots));
+                return true;
+            }
+
+            // Catalog sessions of this destination, by snapshot time
+            std::map<std::time_t, std::int64_t> sessions;
+            for (const auto& session : catalog.getAllBackupSessions()) {
+                if (session.destinationPath == destination) {
+                    sessions[std::chrono::system_clock::to_time_t(session.startTime)] = session.id;
+                }
+            }
+
+            // Drop them from the catalog first so nothing can pick a half-deleted snapshot
+            std::vector<std::chrono::system_clock::time_point> doomed;
+            for (const auto& candidate : plan.snapshots) {
+                doomed.push_back(candidate.timestamp);
+            }
+            if (!doomed.empty() && !SnapshotCatalog::remove(destination, doomed)) {
+                return false;
+            }
+
+            // Trashing is one rename per snapshot; the contents are deleted in the background
             int deletedCount = 0;
-            for (const auto& backup : backups) {
-                if (backupsToKeep.find(backup) == backupsToKeep.end()) {
-                    // Delete this backup
-                    std::time_t time = std::chrono::system_clock::to_time_t(backup);
-                    std::tm* tm = std::localtime(&time);
-                    
-                    char backupDirName[20];
-                    std::strftime(backupDirName, sizeof(backupDirName), "%Y%m%d-%H%M%S", tm);
-                    
-                    std::filesystem::path backupDir = destination / "backups" / backupDirName;
-                    if (std::filesystem::exists(backupDir)) {
-                        std::filesystem::remove_all(backupDir);
-                        deletedCount++;
-                    }
+            for (const auto& backup : doomed) {
+                std::filesystem::path backupDir = fs::getBackupPath(destination, backup);
+                if (std::filesystem::exists(backupDir) && TrashCollector::moveToTrash(backupDir)) {
+                    deletedCount++;
+                }
+
+                auto session = sessions.find(std::chrono::system_clock::to_time_t(backup));
+                if (session != sessions.end()) {
+                    catalog.deleteBackupSession(session->second);
                 }
             }
             
-            getLogger().info("Pruned " + std::to_string(deletedCount) + " backups, keeping " + 
-                            std::to_string(backupsToKeep.size()));
+            getLogger().info("Pruned " + std::to_string(deletedCount) + " backups, freeing " +
+                            std::to_string(plan.reclaimableBytes) + " bytes, keeping " + 
+                            std::to_string(plan.keptSnapshots));
+
+            // Also resumes deleting whatever an earlier prune left in the trash
+            trash.schedule(destination);
             return true;
         }
         catch (const std::exception& e) {
@@ -294,6 +362,40 @@ public:
             return false;
         }
     }
+
+    PrunePlan getLastPrunePlan() const {
+        return lastPrunePlan;
+    }
+
+    bool collectTrash(const std::filesystem::path& destination) {
+        return trash.collect(destination);
+    }
+
+    // Keep the newest backup of each of the newest `count` periods (strftime format)
+    static void keepNewestPerPeriod(
+        const std::vector<std::chrono::system_clock::time_point>& backups,
+        int count,
+        const char* format,
+        std::set<std::chrono::system_clock::time_point>& keep) {
+
+        std::set<std::string> periods;
+        for (const auto& backup : backups) {
+            std::time_t time = std::chrono::system_clock::to_time_t(backup);
+            std::tm tm{};
+            localtime_r(&time, &tm);
+            char period[16];
+            std::strftime(period, sizeof(period), format, &tm);
+
+            if (periods.count(period)) {
+                continue;
+            }
+            if (periods.size() >= static_cast<size_t>(std::max(count, 0))) {
+                break;
+            }
+            periods.insert(period);
+            keep.insert(backup);
+        }
+    }
     
 private:
     // Mutex for thread safety
@@ -304,15 +406,81 @@ private:
     BackupConfig config;
     ProgressCallback progressCallback;
     
-    // State
-    BackupStatus status;
-    BackupStats stats;
+    // State; read by other threads through getStatus()
+    std::atomic<BackupStatus> status{BackupStatus::IDLE};
+    StatsCounters counters;
     std::thread backupThread;
     std::atomic<bool> cancelRequested{false};
+
+    // Deletes pruned snapshots; it shares the disk with backups, so it is throttled
+    TrashCollector trash{TrashOptions{4, 20000}};
+    IoLimiter ioLimiter;
+    std::chrono::milliseconds ioThrottledBase{0};       // limiter total when this backup started
+    PrunePlan lastPrunePlan;
+
+    // Time of the snapshot being written, once its directory exists
+    std::optional<std::chrono::system_clock::time_point> snapshotTime;
+
+    // The snapshot is written to stagingDir and renamed to backupDir once complete;
+    // the journal holds the subtrees done so far, so an interrupted backup can resume
+    std::filesystem::path stagingDir;
+    std::filesystem::path backupDir;
+    FileHandle stagingHandle;
+    BackupJournal journal;
+    bool journaled = false;                             // whether this backup can be resumed
+    bool resuming = false;                              // whether it continues an interrupted one
+    std::size_t sourceIndex = 0;
+
+    // File catalog and the session of the running backup (0 when not recorded)
+    Database catalog;
+    std::int64_t sessionId = 0;
+
+    // Catalog records of the files backed up since the last flush, with their strings in the arena;
+    // they are written in one transaction at the end of each directory, at checkpoints, and when
+    // this many are pending
+    std::vector<FileRecordEntry> catalogRecords;
+    PathArena catalogArena;
+    static constexpr std::size_t CATALOG_BATCH_RECORDS = 4096;
+
+    // Directory entry read ahead of processing
+    struct DirEntry {
+        std::string_view name;
+        unsigned char type;
+    };
+
+    // Arena and entry list reused by every directory at one depth
+    struct PerDirectory {
+        PathArena arena;
+        std::optional<std::pmr::vector<DirEntry>> entries;
+    };
+
+    // Path state for the walk; reused across files so the hot path does not allocate.
+    // The source path is only kept for exclude matching and messages, all file
+    // operations go through the open directory stacks.
+    PathBuilder sourcePathBuilder;
+    PathInterner interner;
+    DirStack sourceDirs;
+    DirStack destDirs;
+    DirStack prevDirs;
+    std::vector<std::unique_ptr<PerDirectory>> arenas;
+    std::vector<char> copyBuffer = std::vector<char>(128 * 1024);
+    fs::ChecksumBuilder copyChecksum{"sha256"};
+    std::string copyDigest;
+    std::vector<char> compareBuffer = std::vector<char>(128 * 1024);
+
+    // Per-file events for diagnosing slow backups, if configured
+    EventLog events;
     
     // The main backup thread function
     void backupThreadFunction() {
+        // This thread ends with the backup, so it may go to the background for good
+        getResourceGovernor().markJobThread();
+
         try {
+            if (!config.eventLogPath.empty()) {
+                events.open(config.eventLogPath, config.eventLogRecords);
+            }
+
             // Phase 1: Scanning files
             status = BackupStatus::SCANNING;
             if (!scanFiles()) {
@@ -329,7 +497,7 @@ private:
             // Phase 2: Backing up files
             status = BackupStatus::BACKING_UP;
             if (!backupFiles()) {
-                completeBackup(false);
+                completeBackup(false, cancelRequested);
                 return;
             }
             
@@ -359,10 +527,11 @@ private:
         }
         catch (const std::exception& e) {
             getLogger().error("Exception in backup thread: " + std::string(e.what()));
+            events.close();
             status = BackupStatus::FAILED;
             
             if (progressCallback) {
-                progressCallback(status, stats);
+                progressCallback(status, getStats());
             }
         }
     }
@@ -380,7 +549,12 @@ private:
                 }
                 
                 // Scan directory recursively
-                scanDirectory(sourcePath);
+                sourcePathBuilder.reset(sourcePath.native());
+                if (!sourceDirs.openRoot(sourcePath)) {
+                    getLogger().error("Failed to open source path " + sourcePath.string() + ": " + std::strerror(errno));
+                    return false;
+                }
+                scanDirectory();
                 
                 // Check for cancellation
                 if (cancelRequested) {
@@ -389,6 +563,7 @@ private:
                 }
             }
             
+            const BackupStats stats = getStats();
             getLogger().info("Scan completed: " + std::to_string(stats.totalFiles) + 
                             " files, " + std::to_string(stats.totalSize) + " bytes");
                             
@@ -405,33 +580,99 @@ private:
         }
     }
     
-    // Scan a directory recursively
-    void scanDirectory(const std::filesystem::path& path) {
+    // Read the entries of the current source directory into the arena for its depth
+    bool readDirectory(std::pmr::vector<DirEntry>*& entries) {
+        std::size_t depth = sourceDirs.depth();
+        if (arenas.size() <= depth) {
+            arenas.push_back(std::make_unique<PerDirectory>());
+        }
+
+        PerDirectory& level = *arenas[depth];
+        level.entries.reset();
+        level.arena.release();
+        level.entries.emplace(level.arena.resource());
+        entries = &*level.entries;
+
+        // fdopendir takes ownership, so hand it a duplicate of the stack's descriptor
+        int fd = ::fcntl(sourceDirs.fd(), F_DUPFD_CLOEXEC, 0);
+        DIR* dir = fd >= 0 ? ::fdopendir(fd) : nullptr;
+        if (!dir) {
+            getLogger().error("Failed to read directory " + std::string(sourcePathBuilder.view()) + ": " + std::strerror(errno));
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        ioLimiter.operations();
+
+        while (struct dirent* ent = ::readdir(dir)) {
+            std::string_view name(ent->d_name);
+            if (name == "." || name == "..") {
+                continue;
+            }
+            entries->push_back({level.arena.store(name), ent->d_type});
+        }
+
+        ::closedir(dir);
+        return true;
+    }
+
+    // Resolve the type of a directory entry, following symlinks like std::filesystem does
+    bool statEntry(const DirEntry& entry, FileStat& st) {
+        if (entry.type == DT_DIR) {
+            // Directories need no size, so skip the syscall
+            st.mode = S_IFDIR;
+            return true;
+        }
+
+        // Dangling symlinks and entries that vanished since readdir are ignored
+        return statAt(sourceDirs.fd(), entry.name.data(), st);
+    }
+
+    // Check if the current source path matches an exclude pattern
+    bool isExcluded(std::string_view path) const {
+        for (const auto& pattern : config.excludePatterns) {
+            // Simple pattern matching for this example
+            if (path.find(pattern) != std::string_view::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Scan the current source directory recursively
+    void scanDirectory() {
         try {
-            for (const auto& entry : std::filesystem::directory_iterator(path)) {
+            std::pmr::vector<DirEntry>* entries = nullptr;
+            if (!readDirectory(entries)) {
+                return;
+            }
+
+            for (const auto& entry : *entries) {
+                std::size_t mark = sourcePathBuilder.push(entry.name);
+
                 // Check if this path should be excluded
-                bool exclude = false;
-                for (const auto& pattern : config.excludePatterns) {
-                    // Simple pattern matching for this example
-                    if (entry.path().string().find(pattern) != std::string::npos) {
-                        exclude = true;
-                        break;
-                    }
-                }
-                
-                if (exclude) {
+                if (isExcluded(sourcePathBuilder.view())) {
+                    sourcePathBuilder.truncate(mark);
                     continue;
                 }
-                
-                if (entry.is_directory()) {
-                    stats.totalDirectories++;
-                    scanDirectory(entry.path());
-                }
-                else if (entry.is_regular_file()) {
-                    stats.totalFiles++;
-                    stats.totalSize += entry.file_size();
+
+                FileStat st;
+                if (statEntry(entry, st)) {
+                    if (S_ISDIR(st.mode)) {
+                        counters.add(StatCounter::TOTAL_DIRECTORIES);
+                        if (sourceDirs.enter(entry.name.data())) {
+                            scanDirectory();
+                        }
+                        sourceDirs.leave();
+                    }
+                    else if (S_ISREG(st.mode)) {
+                        counters.add({{StatCounter::TOTAL_FILES, 1}, {StatCounter::TOTAL_SIZE, st.size}});
+                    }
                 }
-                
+
+                sourcePathBuilder.truncate(mark);
+
                 // Check for cancellation
                 if (cancelRequested) {
                     return;
@@ -439,15 +680,16 @@ private:
             }
         }
         catch (const std::exception& e) {
-            getLogger().error("Exception scanning directory " + path.string() + ": " + std::string(e.what()));
+            getLogger().error("Exception scanning directory " + std::string(sourcePathBuilder.view()) + ": " + std::string(e.what()));
         }
     }
     
     // Backup files
     bool backupFiles() {
         try {
-            getLogger().info("Starting backup of " + std::to_string(stats.totalFiles) + 
-                            " files (" + std::to_string(stats.totalSize) + " bytes)");
+            const BackupStats scanned = getStats();
+            getLogger().info("Starting backup of " + std::to_string(scanned.totalFiles) + 
+                            " files (" + std::to_string(scanned.totalSize) + " bytes)");
             
             // Create backup destination directory structure
             std::filesystem::path backupRoot = config.destinationPath;
@@ -462,16 +704,17 @@ private:
                 std::filesystem::create_directories(backupsDir);
             }
             
-            // Create a timestamp-based directory for this backup
+            // The snapshot gets a timestamp-based directory once it is complete
             auto now = std::chrono::system_clock::now();
-            std::time_t time = std::chrono::system_clock::to_time_t(now);
-            std::tm* tm = std::localtime(&time);
-            
-            char backupDirName[20];
-            std::strftime(backupDirName, sizeof(backupDirName), "%Y%m%d-%H%M%S", tm);
-            
-            std::filesystem::path backupDir = backupsDir / backupDirName;
-            std::filesystem::create_directories(backupDir);
+            backupDir = fs::getBackupPath(backupRoot, now);
+
+            // Until then it is built in a staging directory of these sources, which may
+            // hold what an interrupted backup finished
+            stagingDir = BackupJournal::stagingDirectory(backupsDir, config.sourcePaths);
+            std::filesystem::create_directories(stagingDir);
+            if (!journal.open(stagingDir)) {
+                return false;
+            }
             
             // Find the previous backup for hard linking if enabled
             std::filesystem::path previousBackupDir;
@@ -479,19 +722,41 @@ private:
                 auto backups = listBackups(config.destinationPath);
                 if (!backups.empty()) {
                     // Use the most recent backup
-                    std::time_t prevTime = std::chrono::system_clock::to_time_t(backups[0]);
-                    std::tm* prevTm = std::localtime(&prevTime);
-                    
-                    char prevBackupDirName[20];
-                    std::strftime(prevBackupDirName, sizeof(prevBackupDirName), "%Y%m%d-%H%M%S", prevTm);
-                    
-                    previousBackupDir = backupsDir / prevBackupDirName;
+                    previousBackupDir = fs::getBackupPath(backupRoot, backups[0]);
                 }
             }
             
+            snapshotTime = now;
+
+            // Record the snapshot in the catalog, continuing the session of an interrupted backup
+            if (!resumeSession(now) && !startSession(now)) {
+                return false;
+            }
+            
             // Back up each source path
-            for (const auto& sourcePath : config.sourcePaths) {
-                if (!backupDirectory(sourcePath, backupDir, sourcePath, previousBackupDir)) {
+            for (sourceIndex = 0; sourceIndex < config.sourcePaths.size(); sourceIndex++) {
+                const auto& sourcePath = config.sourcePaths[sourceIndex];
+                sourcePathBuilder.reset(sourcePath.native());
+                interner.clear();
+
+                if (auto totals = journal.completed(sourceIndex, "")) {
+                    addTotals(*totals);
+                    continue;
+                }
+
+                // Hold the three roots open; everything below is resolved relative to them
+                if (!sourceDirs.openRoot(sourcePath)) {
+                    getLogger().error("Failed to open source path " + sourcePath.string() + ": " + std::strerror(errno));
+                    return false;
+                }
+                if (!destDirs.openRoot(stagingDir, true)) {
+                    getLogger().error("Failed to open backup directory " + stagingDir.string() + ": " + std::strerror(errno));
+                    return false;
+                }
+                prevDirs.openRoot(previousBackupDir);
+
+                SubtreeTotals before = currentTotals();
+                if (!backupDirectory(PathInterner::ROOT)) {
                     return false;
                 }
                 
@@ -500,11 +765,25 @@ private:
                     getLogger().info("Backup cancelled during backup phase");
                     return false;
                 }
+                completeSubtree("", before);
             }
             
+            sourceDirs.clear();
+            destDirs.clear();
+            prevDirs.clear();
+            
             // Save backup metadata
-            saveBackupMetadata(backupDir);
+            saveBackupMetadata(stagingDir);
+
+            // Index the finished snapshot so it can be browsed without walking it
+            SnapshotIndex::build(stagingDir, &ioLimiter);
+
+            if (sessionId > 0 && !flushCatalog()) {
+                getLogger().warning("Failed to store the file catalog of this backup");
+                abortSession();
+            }
             
+            const BackupStats stats = getStats();
             getLogger().info("Backup completed successfully: " + std::to_string(stats.processedFiles) + 
                             " files, " + std::to_string(stats.processedSize) + " bytes");
             return true;
@@ -515,165 +794,589 @@ private:
         }
     }
     
-    // Backup a directory recursively
-    bool backupDirectory(
-        const std::filesystem::path& sourcePath,
-        const std::filesystem::path& backupDir,
-        const std::filesystem::path& basePath,
-        const std::filesystem::path& previousBackupDir) {
-        
+    // Backup the current source directory recursively into the current destination directory
+    bool backupDirectory(PathInterner::Id dirId) {
         try {
-            // Create destination directory
-            std::filesystem::path relativePath = std::filesystem::relative(sourcePath, basePath);
-            std::filesystem::path destPath = backupDir / relativePath;
-            
-            if (!std::filesystem::exists(destPath)) {
-                std::filesystem::create_directories(destPath);
+            // Interner ids restart with each source, so events number directories themselves
+            const std::uint32_t eventDirectory = events.addPath(sourcePathBuilder.view());
+            const auto listStarted = events.start();
+
+            std::pmr::vector<DirEntry>* entries = nullptr;
+            if (!readDirectory(entries)) {
+                events.record(EventPhase::READ_DIRECTORY, eventDirectory, 0, listStarted, true);
+                return false;
             }
-            
+            events.record(EventPhase::READ_DIRECTORY, eventDirectory, entries->size(), listStarted);
+
+            // The sources share the staging root, so only directories below it are theirs alone
+            if (resuming && dirId != PathInterner::ROOT) {
+                removeStaleEntries(*entries);
+            }
+
             // Iterate over directory entries
-            for (const auto& entry : std::filesystem::directory_iterator(sourcePath)) {
+            for (const auto& entry : *entries) {
+                std::size_t mark = sourcePathBuilder.push(entry.name);
+
                 // Check if this path should be excluded
-                bool exclude = false;
-                for (const auto& pattern : config.excludePatterns) {
-                    // Simple pattern matching for this example
-                    if (entry.path().string().find(pattern) != std::string::npos) {
-                        exclude = true;
-                        break;
-                    }
-                }
-                
-                if (exclude) {
-                    stats.skippedFiles++;
+                if (isExcluded(sourcePathBuilder.view())) {
+                    counters.add(StatCounter::SKIPPED_FILES);
+                    sourcePathBuilder.truncate(mark);
                     continue;
                 }
-                
-                if (entry.is_directory()) {
-                    // Recursively backup this directory
-                    if (!backupDirectory(entry.path(), backupDir, basePath, previousBackupDir)) {
-                        return false;
-                    }
-                }
-                else if (entry.is_regular_file()) {
-                    // Backup this file
-                    if (!backupFile(entry.path(), backupDir, basePath, previousBackupDir)) {
-                        return false;
+
+                bool ok = true;
+                FileStat st;
+                if (statEntry(entry, st)) {
+                    if (S_ISDIR(st.mode)) {
+                        // Subtrees an interrupted backup finished are already in the staging directory
+                        if (resuming) {
+                            if (auto totals = journal.completed(sourceIndex, sourcePathBuilder.relative())) {
+                                addTotals(*totals);
+                                sourcePathBuilder.truncate(mark);
+                                continue;
+                            }
+                        }
+
+                        // Every stack takes a level, valid or not, so they stay in lockstep; each
+                        // destination directory is created exactly once, on entry, and only for a
+                        // source directory that could be opened
+                        const char* name = entry.name.data();
+                        const bool sourceOpen = sourceDirs.enter(name);
+                        int error = errno;
+                        if (!destDirs.enter(name, sourceOpen) && sourceOpen) {
+                            error = errno;
+                        }
+                        prevDirs.enter(name);
+
+                        if (sourceDirs.valid() && destDirs.valid()) {
+                            // Recursively backup this directory
+                            SubtreeTotals before = currentTotals();
+                            ok = backupDirectory(interner.intern(dirId, entry.name));
+                            if (ok && !cancelRequested) {
+                                completeSubtree(sourcePathBuilder.relative(), before);
+                            }
+                        }
+                        else {
+                            getLogger().error("Failed to open directory " + std::string(sourcePathBuilder.view()) +
+                                              ": " + std::strerror(error));
+                            ok = false;
+                        }
+
+                        prevDirs.leave();
+                        destDirs.leave();
+                        sourceDirs.leave();
                     }
-                    
-                    // Update progress
-                    stats.processedFiles++;
-                    stats.processedSize += entry.file_size();
-                    
-                    if (progressCallback) {
-                        progressCallback(status, stats);
+                    else if (S_ISREG(st.mode)) {
+                        // Backup this file, once the CPU limit allows
+                        getResourceGovernor().throttle();
+                        StatCounter outcome = StatCounter::NEW_FILES;
+                        const auto fileStarted = events.start();
+                        ok = backupFile(entry.name.data(), st.size, outcome);
+                        events.record(outcome == StatCounter::UNCHANGED_FILES ? EventPhase::LINK : EventPhase::COPY,
+                                      eventDirectory, st.size, fileStarted, !ok, sourcePathBuilder.view());
+
+                        if (ok) {
+                            // Update progress; the file and its bytes are counted in one update
+                            counters.add({{StatCounter::PROCESSED_FILES, 1},
+                                          {StatCounter::PROCESSED_SIZE, st.size},
+                                          {outcome, 1}});
+
+                            if (progressCallback) {
+                                progressCallback(status, getStats());
+                            }
+                        }
                     }
                 }
-                
+
+                sourcePathBuilder.truncate(mark);
+
+                if (!ok) {
+                    return false;
+                }
+
                 // Check for cancellation
                 if (cancelRequested) {
                     return false;
                 }
             }
-            
+
+            if (!flushCatalog()) {
+                getLogger().warning("Failed to store part of the file catalog of this backup");
+            }
             return true;
         }
         catch (const std::exception& e) {
-            getLogger().error("Exception backing up directory " + sourcePath.string() + ": " + std::string(e.what()));
+            getLogger().error("Exception backing up directory " + interner.path(dirId) + ": " + std::string(e.what()));
             return false;
         }
     }
     
-    // Backup a single file
-    bool backupFile(
-        const std::filesystem::path& sourceFile,
-        const std::filesystem::path& backupDir,
-        const std::filesystem::path& basePath,
-        const std::filesystem::path& previousBackupDir) {
-        
+    // Backup a single file from the current source directory; outcome tells whether it was new, modified or unchanged
+    bool backupFile(const char* name, std::uintmax_t size, StatCounter& outcome) {
         try {
-            // Get relative path
-            std::filesystem::path relativePath = std::filesystem::relative(sourceFile, basePath);
-            std::filesystem::path destFile = backupDir / relativePath;
-            
-            // Create parent directories if needed
-            std::filesystem::create_directories(destFile.parent_path());
-            
+            // An interrupted backup may have left a link into the previous snapshot, which must not be written to
+            if (resuming && ::unlinkat(destDirs.fd(), name, 0) == 0) {
+                ioLimiter.operations();
+            }
+
             // Check if the file exists in the previous backup
-            bool fileChanged = true;
-            if (!previousBackupDir.empty()) {
-                std::filesystem::path prevFile = previousBackupDir / relativePath;
-                
-                if (std::filesystem::exists(prevFile) && 
-                    std::filesystem::file_size(prevFile) == std::filesystem::file_size(sourceFile)) {
-                    
-                    // Check if file contents are the same
-                    fileChanged = !areFilesEqual(sourceFile, prevFile);
-                    
-                    if (!fileChanged) {
-                        // File unchanged, create hard link
-                        std::filesystem::create_hard_link(prevFile, destFile);
-                        stats.unchangedFiles++;
+            bool existedBefore = false;
+            FileStat prevSt;
+            if (prevDirs.valid() && statAt(prevDirs.fd(), name, prevSt) && S_ISREG(prevSt.mode)) {
+                existedBefore = true;
+
+                // Check if file contents are the same
+                if (prevSt.size == size && areFilesEqual(name)) {
+                    // File unchanged, create hard link
+                    if (linkAt(prevDirs.fd(), name, destDirs.fd(), name)) {
+                        ioLimiter.operations();
+                        outcome = StatCounter::UNCHANGED_FILES;
+                        recordFile(name, true);
+                        UTM_TRACE("Linked unchanged {}", sourcePathBuilder.view());
                         return true;
                     }
+
+                    // Link count exhausted or similar: fall back to a copy
+                    getLogger().warning("Failed to hard link " + std::string(sourcePathBuilder.view()) +
+                                        " from previous backup: " + std::strerror(errno) + ", copying instead");
                 }
             }
-            
-            // File changed or no previous backup, copy the file
-            std::filesystem::copy_file(sourceFile, destFile, std::filesystem::copy_options::overwrite_existing);
-            
-            if (fileChanged) {
-                stats.modifiedFiles++;
-            } else {
-                stats.newFiles++;
+
+            // File changed or no previous backup, copy the file, hashing it on the way for the catalog
+            if (!copyFile(name, sessionId > 0 ? &copyDigest : nullptr)) {
+                return false;
             }
-            
+
+            outcome = existedBefore ? StatCounter::MODIFIED_FILES : StatCounter::NEW_FILES;
+
+            recordFile(name, false, copyDigest);
+            UTM_TRACE("Copied {} ({} bytes)", sourcePathBuilder.view(), size);
             return true;
         }
         catch (const std::exception& e) {
-            getLogger().error("Exception backing up file " + sourceFile.string() + ": " + std::string(e.what()));
+            getLogger().error("Exception backing up file " + std::string(sourcePathBuilder.view()) + ": " + std::string(e.what()));
             return false;
         }
     }
-    
-    // Compare two files to see if they are equal
-    bool areFilesEqual(const std::filesystem::path& file1, const std::filesystem::path& file2) {
-        try {
-            // Check file sizes first
-            if (std::filesystem::file_size(file1) != std::filesystem::file_size(file2)) {
+
+    // Copy a file from the current source directory, overwriting the destination and preserving permissions;
+    // with checksum set, the data is hashed as it is copied
+    bool copyFile(const char* name, std::string* checksum = nullptr) {
+        FileHandle in = openAt(sourceDirs.fd(), name, O_RDONLY);
+        FileStat st;
+        if (!in.valid() || !statFd(in.get(), st)) {
+            getLogger().error("Failed to open " + std::string(sourcePathBuilder.view()) + ": " + std::strerror(errno));
+            return false;
+        }
+
+        FileHandle out = openAt(destDirs.fd(), name, O_WRONLY | O_CREAT | O_TRUNC, st.mode & 07777);
+        if (!out.valid()) {
+            getLogger().error("Failed to create backup copy of " + std::string(sourcePathBuilder.view()) +
+                              ": " + std::strerror(errno));
+            return false;
+        }
+        ioLimiter.operations();
+
+        // The source is read once, front to back
+        ::posix_fadvise(in.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        // Keep the source modification time so restores can tell unchanged files by metadata
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1] = st.modified;
+
+        bool copied;
+        if (checksum) {
+            copied = copyContents(in.get(), out.get(), copyBuffer, &ioLimiter,
+                                  [this](const char* data, std::size_t size) { copyChecksum.update(data, size); });
+            // Finishing also resets the builder after a failed copy
+            copyChecksum.finish(*checksum);
+        }
+        else {
+            copied = copyContents(in.get(), out.get(), copyBuffer, &ioLimiter);
+        }
+
+        if (!copied || ::futimens(out.get(), times) != 0 || !out.close()) {
+            getLogger().error("Failed to copy " + std::string(sourcePathBuilder.view()) + ": " + std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    // Counters that make up the totals of a subtree
+    SubtreeTotals currentTotals() const {
+        const StatsCounters::Values values = counters.snapshot();
+        auto value = [&values](StatCounter counter) { return values[static_cast<std::size_t>(counter)]; };
+        return {value(StatCounter::PROCESSED_FILES), value(StatCounter::PROCESSED_SIZE), value(StatCounter::NEW_FILES),
+                value(StatCounter::MODIFIED_FILES), value(StatCounter::UNCHANGED_FILES), value(StatCounter::SKIPPED_FILES)};
+    }
+
+    // Count a subtree an interrupted backup finished
+    void addTotals(const SubtreeTotals& totals) {
+        counters.add({{StatCounter::PROCESSED_FILES, totals.files},
+                      {StatCounter::PROCESSED_SIZE, totals.size},
+                      {StatCounter::NEW_FILES, totals.newFiles},
+                      {StatCounter::MODIFIED_FILES, totals.modifiedFiles},
+                      {StatCounter::UNCHANGED_FILES, totals.unchangedFiles},
+                      {StatCounter::SKIPPED_FILES, totals.skippedFiles}});
+
+        if (progressCallback) {
+            progressCallback(status, getStats());
+        }
+    }
+
+    // Journal a finished subtree, and checkpoint the journal when it is time to
+    void completeSubtree(std::string_view relative, const SubtreeTotals& before) {
+        if (!journaled) {
+            return;
+        }
+
+        SubtreeTotals now = currentTotals();
+        journal.complete(sourceIndex, relative, {now.files - before.files, now.size - before.size,
+                                                 now.newFiles - before.newFiles, now.modifiedFiles - before.modifiedFiles,
+                                                 now.unchangedFiles - before.unchangedFiles, now.skippedFiles - before.skippedFiles});
+        if (journal.checkpointDue()) {
+            checkpoint();
+        }
+    }
+
+    // Store the catalog records of the finished subtrees, then journal them
+    void checkpoint() {
+        if (!flushCatalog()) {
+            getLogger().warning("Failed to store part of the file catalog of this backup");
+            return;
+        }
+        journal.checkpoint(stagingHandle.get());
+    }
+
+    // Continue the session of an interrupted backup of the same sources, as the snapshot taken at snapshotTime
+    bool resumeSession(const std::chrono::system_clock::time_point& snapshotTime) {
+        const auto& previous = journal.previous();
+        if (!previous) {
+            return false;
+        }
+        if (previous->excludePatterns != config.excludePatterns) {
+            getLogger().info("Exclude patterns changed since the interrupted backup, starting over");
+            return false;
+        }
+
+        // Its catalog records only fit if no other backup of the destination was recorded since
+        std::optional<BackupSession> session;
+        if (previous->catalogSession > 0) {
+            session = catalog.getBackupSession(previous->catalogSession);
+            bool superseded = !session || session->isComplete;
+            for (const auto& other : superseded ? std::vector<BackupSession>() : catalog.getAllBackupSessions()) {
+                superseded = superseded || (other.id > session->id && other.destinationPath == session->destinationPath);
+            }
+            if (superseded) {
+                getLogger().info("The catalog changed since the interrupted backup, starting over");
                 return false;
             }
-            
-            // Compare file contents
-            std::ifstream f1(file1, std::ifstream::binary);
-            std::ifstream f2(file2, std::ifstream::binary);
-            
-            if (!f1 || !f2) {
+        }
+
+        stagingHandle = fs::openDirectoryAt(AT_FDCWD, stagingDir.c_str());
+        if (!stagingHandle.valid()) {
+            getLogger().error("Failed to open " + stagingDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        std::time_t started = std::chrono::system_clock::to_time_t(previous->started);
+        std::tm startedTm{};
+        localtime_r(&started, &startedTm);
+        char startedText[32];
+        std::strftime(startedText, sizeof(startedText), "%Y-%m-%d %H:%M:%S", &startedTm);
+        getLogger().info("Resuming the backup started at " + std::string(startedText));
+
+        // The snapshot is published under the time of this run; pruning finds the session by it
+        if (session) {
+            session->startTime = snapshotTime;
+            if (!catalog.updateBackupSession(*session)) {
+                getLogger().warning("Failed to update the catalog session of the resumed backup");
+            }
+        }
+
+        sessionId = previous->catalogSession;
+        journaled = true;
+        resuming = true;
+        return true;
+    }
+
+    // Start a new session in an empty staging directory
+    bool startSession(const std::chrono::system_clock::time_point& snapshotTime) {
+        resuming = false;
+        journaled = false;
+
+        // Whatever an earlier session left cannot be used
+        if (const auto& previous = journal.previous(); previous && previous->catalogSession > 0) {
+            auto session = catalog.getBackupSession(previous->catalogSession);
+            if (session && !session->isComplete) {
+                catalog.deleteBackupSession(session->id);
+            }
+        }
+        if (!std::filesystem::is_empty(stagingDir)) {
+            stagingHandle = FileHandle();
+            if (!TrashCollector::moveToTrash(stagingDir)) {
                 return false;
             }
-            
-            constexpr size_t BUFFER_SIZE = 4096;
-            char buffer1[BUFFER_SIZE];
-            char buffer2[BUFFER_SIZE];
-            
-            while (f1 && f2) {
-                f1.read(buffer1, BUFFER_SIZE);
-                f2.read(buffer2, BUFFER_SIZE);
-                
-                if (f1.gcount() != f2.gcount()) {
-                    return false;
+            std::filesystem::create_directories(stagingDir);
+        }
+
+        stagingHandle = fs::openDirectoryAt(AT_FDCWD, stagingDir.c_str());
+        if (!stagingHandle.valid()) {
+            getLogger().error("Failed to open " + stagingDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        beginSession(snapshotTime);
+
+        JournalHeader header;
+        header.started = snapshotTime;
+        header.catalogSession = sessionId;
+        header.excludePatterns = config.excludePatterns;
+        journaled = journal.start(header);
+        if (!journaled) {
+            getLogger().warning("This backup cannot be resumed if it is interrupted");
+        }
+        return true;
+    }
+
+    // Keep what an unfinished backup did for the next backup of the same sources
+    void suspendSession() {
+        if (!journaled) {
+            abortSession();
+            journal.close();
+            return;
+        }
+
+        checkpoint();
+        discardCatalog();
+        journal.close();
+        journaled = false;
+        resuming = false;
+        stagingHandle = FileHandle();
+
+        // The catalog session stays open for the resumed backup
+        sessionId = 0;
+        getLogger().info("The next backup of these sources resumes from the last checkpoint");
+    }
+
+    // Give the complete snapshot in the staging directory its timestamped name
+    bool publishSnapshot() {
+        // Everything in the snapshot is on disk before it appears under its name
+        if (::syncfs(stagingHandle.get()) != 0) {
+            getLogger().error("Failed to flush " + stagingDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+        if (::renameat2(AT_FDCWD, stagingDir.c_str(), AT_FDCWD, backupDir.c_str(), RENAME_NOREPLACE) != 0) {
+            getLogger().error("Failed to publish " + backupDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+        FileHandle backups = fs::openDirectoryAt(AT_FDCWD, backupDir.parent_path().c_str());
+        if (backups.valid()) {
+            ::fsync(backups.get());
+        }
+
+        journal.remove();
+        journaled = false;
+        resuming = false;
+        stagingHandle = FileHandle();
+        return true;
+    }
+
+    // Remove entries of the current staging directory that are gone from the source or changed type
+    void removeStaleEntries(const std::pmr::vector<DirEntry>& sourceEntries) {
+        std::unordered_map<std::string_view, unsigned char> sourceTypes;
+        for (const auto& entry : sourceEntries) {
+            sourceTypes.emplace(entry.name, entry.type);
+        }
+
+        int fd = ::fcntl(destDirs.fd(), F_DUPFD_CLOEXEC, 0);
+        DIR* dir = fd >= 0 ? ::fdopendir(fd) : nullptr;
+        if (!dir) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return;
+        }
+
+        std::vector<std::string> stale;
+        while (struct dirent* ent = ::readdir(dir)) {
+            std::string_view name(ent->d_name);
+            if (name == "." || name == "..") {
+                continue;
+            }
+            auto it = sourceTypes.find(name);
+            bool known = it != sourceTypes.end() && it->second != DT_UNKNOWN && it->second != DT_LNK && ent->d_type != DT_UNKNOWN;
+            if (it == sourceTypes.end() || (known && (it->second == DT_DIR) != (ent->d_type == DT_DIR))) {
+                stale.emplace_back(name);
+            }
+        }
+        ::closedir(dir);
+
+        for (const auto& name : stale) {
+            if (::unlinkat(destDirs.fd(), name.c_str(), 0) != 0) {
+                std::error_code ec;
+                std::filesystem::remove_all(stagingDir / sourcePathBuilder.relative() / name, ec);
+            }
+            ioLimiter.operations();
+        }
+    }
+
+    // Open a catalog session for the snapshot taken at snapshotTime
+    void beginSession(const std::chrono::system_clock::time_point& snapshotTime) {
+        sessionId = 0;
+
+        BackupSession session;
+        session.startTime = snapshotTime;
+        session.destinationPath = config.destinationPath;
+        if (!config.sourcePaths.empty()) {
+            session.sourcePath = config.sourcePaths.front();
+        }
+
+        sessionId = catalog.createBackupSession(session);
+        if (sessionId <= 0) {
+            sessionId = 0;
+        }
+    }
+
+    // Drop the catalog session of a backup that did not finish, with the batches already stored
+    void abortSession() {
+        discardCatalog();
+        if (sessionId > 0) {
+            catalog.deleteBackupSession(sessionId);
+            sessionId = 0;
+        }
+    }
+
+    // Queue the catalog record of the file just backed up from the current source directory; checksum
+    // is the hash taken while copying it, if it was copied
+    void recordFile(const char* name, bool unchanged, std::string_view checksum = {}) {
+        if (sessionId <= 0) {
+            return;
+        }
+
+        FileRecordEntry entry;
+        entry.path = catalogArena.store(sourcePathBuilder.relative());
+        entry.unchanged = unchanged;
+
+        // Unchanged files only extend the interval of their current version
+        if (!unchanged) {
+            FileStat st;
+            if (!statAt(destDirs.fd(), name, st)) {
+                return;
+            }
+            entry.checksum = catalogArena.store(checksum);
+            setRecordStat(entry, st);
+        }
+
+        catalogRecords.push_back(entry);
+        if (catalogRecords.size() >= CATALOG_BATCH_RECORDS && !flushCatalog()) {
+            getLogger().warning("Failed to store part of the file catalog of this backup");
+        }
+    }
+
+    static void setRecordStat(FileRecordEntry& entry, const FileStat& st) {
+        entry.size = st.size;
+        entry.modificationTime = std::chrono::file_clock::from_sys(
+            std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(st.modified.tv_sec) + std::chrono::nanoseconds(st.modified.tv_nsec))));
+    }
+
+    // Write the queued catalog records in one short transaction, so concurrent backups can interleave
+    bool flushCatalog() {
+        if (catalogRecords.empty()) {
+            return true;
+        }
+
+        bool ok = catalog.beginTransaction();
+        if (ok) {
+            // An interrupted backup may have recorded the files already
+            std::vector<std::size_t> missing;
+            ok = catalog.recordFiles(catalogRecords, sessionId, resuming, missing);
+
+            // Linked files without a catalog version were never read: hash their backup copies
+            std::vector<FileRecordEntry> hashed;
+            for (std::size_t i = 0; ok && i < missing.size(); i++) {
+                FileRecordEntry entry = catalogRecords[missing[i]];
+                FileHandle copy = openAt(AT_FDCWD, (stagingDir / entry.path).c_str(), O_RDONLY);
+                FileStat st;
+                if (!copy.valid() || !statFd(copy.get(), st)) {
+                    continue;
                 }
-                
-                if (std::memcmp(buffer1, buffer2, f1.gcount()) != 0) {
-                    return false;
+                entry.unchanged = false;
+                entry.checksum = catalogArena.store(fs::calculateChecksum(copy.get(), "sha256", &ioLimiter));
+                setRecordStat(entry, st);
+                hashed.push_back(entry);
+            }
+            ok = ok && (hashed.empty() || catalog.recordFiles(hashed, sessionId, false, missing));
+
+            if (ok) {
+                ok = catalog.commitTransaction();
+            }
+            else {
+                catalog.rollbackTransaction();
+            }
+        }
+
+        discardCatalog();
+        return ok;
+    }
+
+    void discardCatalog() {
+        catalogRecords.clear();
+        catalogArena.release();
+    }
+
+    // Read until the buffer is full or end of file
+    static ssize_t readFully(int fd, char* buffer, std::size_t size) {
+        std::size_t total = 0;
+        while (total < size) {
+            ssize_t n = ::read(fd, buffer + total, size - total);
+            if (n == 0) {
+                break;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
                 }
+                return -1;
             }
-            
-            return true;
+            total += n;
         }
-        catch (const std::exception& e) {
-            getLogger().error("Exception comparing files: " + std::string(e.what()));
+        return static_cast<ssize_t>(total);
+    }
+    
+    // Compare a file in the current source directory with its copy in the previous backup
+    bool areFilesEqual(const char* name) {
+        FileHandle file1 = openAt(sourceDirs.fd(), name, O_RDONLY);
+        FileHandle file2 = openAt(prevDirs.fd(), name, O_RDONLY);
+        if (!file1.valid() || !file2.valid()) {
             return false;
         }
+
+        // Both files are read front to back exactly once
+        ::posix_fadvise(file1.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+        ::posix_fadvise(file2.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        const std::size_t half = compareBuffer.size() / 2;
+        char* buffer1 = compareBuffer.data();
+        char* buffer2 = compareBuffer.data() + half;
+
+        while (true) {
+            ssize_t n1 = readFully(file1.get(), buffer1, half);
+            ssize_t n2 = readFully(file2.get(), buffer2, half);
+
+            if (n1 > 0 || n2 > 0) {
+                ioLimiter.read(static_cast<std::uint64_t>(std::max<ssize_t>(n1, 0) + std::max<ssize_t>(n2, 0)), 2);
+            }
+            if (n1 < 0 || n2 < 0 || n1 != n2 || std::memcmp(buffer1, buffer2, n1) != 0) {
+                return false;
+            }
+            if (n1 == 0) {
+                return true;
+            }
+        }
     }
     
     // Save backup metadata
@@ -689,6 +1392,7 @@ private:
             }
             
             // Write metadata
+            const BackupStats stats = getStats();
             file << "{\n";
             file << "  \"timestamp\": \"" << std::chrono::system_clock::to_time_t(stats.startTime) << "\",\n";
             file << "  \"endTime\": \"" << std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) << "\",\n";
@@ -735,6 +1439,14 @@ private:
     
     // Complete the backup
     void completeBackup(bool success, bool cancelled = false) {
+        // Only a complete snapshot leaves the staging directory; anything else waits to be resumed
+        if (success && !cancelled && stagingHandle.valid() && !publishSnapshot()) {
+            success = false;
+        }
+        if (!success || cancelled) {
+            suspendSession();
+        }
+
         if (cancelled) {
             status = BackupStatus::CANCELLED;
             getLogger().info("Backup cancelled");
@@ -749,7 +1461,48 @@ private:
         }
         
         // Set end time
-        stats.endTime = std::chrono::system_clock::now();
+        counters.finish();
+        events.close();
+        const BackupStats stats = getStats();
+
+        // Record the published snapshot in the destination's snapshot catalog
+        if (snapshotTime && success && !cancelled) {
+            SnapshotSummary summary;
+            summary.timestamp = *snapshotTime;
+            summary.endTime = *stats.endTime;
+            // verifyBackup() does not check the copies yet, so nothing is recorded as verified
+            summary.state = SnapshotState::COMPLETE;
+            summary.totalFiles = stats.totalFiles;
+            summary.totalDirectories = stats.totalDirectories;
+            summary.totalSize = stats.totalSize;
+            summary.newFiles = stats.newFiles;
+            summary.modifiedFiles = stats.modifiedFiles;
+            summary.unchangedFiles = stats.unchangedFiles;
+            summary.skippedFiles = stats.skippedFiles;
+            summary.processedSize = stats.processedSize;
+            if (!SnapshotCatalog::commit(config.destinationPath, summary)) {
+                getLogger().error("Failed to record the snapshot in the catalog of " + config.destinationPath.string());
+            }
+        }
+        snapshotTime.reset();
+
+        // Only finished snapshots keep their catalog session
+        if (sessionId > 0) {
+            if (success && !cancelled) {
+                if (auto session = catalog.getBackupSession(sessionId)) {
+                    session->endTime = stats.endTime;
+                    session->isComplete = true;
+                    session->isVerified = false;
+                    session->totalFiles = static_cast<int>(stats.processedFiles);
+                    session->totalSize = stats.processedSize;
+                    catalog.updateBackupSession(*session);
+                }
+            }
+            else {
+                catalog.deleteBackupSession(sessionId);
+            }
+            sessionId = 0;
+        }
         
         // Call progress callback one last time
         if (progressCallback) {
@@ -785,17 +1538,46 @@ BackupStats BackupEngine::getStats() const {
     return pImpl->getStats();
 }
 
+void BackupEngine::setIoLimits(const IoLimits& limits) {
+    pImpl->setIoLimits(limits);
+}
+
 std::vector<std::chrono::system_clock::time_point> BackupEngine::listBackups(
     const std::filesystem::path& destination) const {
     return pImpl->listBackups(destination);
 }
 
+std::vector<SnapshotSummary> BackupEngine::listSnapshots(
+    const std::filesystem::path& destination) const {
+    return pImpl->listSnapshots(destination);
+}
+
 bool BackupEngine::pruneBackups(
     const std::filesystem::path& destination,
     int keepDaily,
     int keepWeekly,
     int keepMonthly) {
-    return pImpl->pruneBackups(destination, keepDaily, keepWeekly, keepMonthly);
+    RetentionPolicy policy;
+    policy.keepDaily = keepDaily;
+    policy.keepWeekly = keepWeekly;
+    policy.keepMonthly = keepMonthly;
+    policy.keepYearly = 0;
+    return pImpl->pruneBackups(destination, policy, false);
+}
+
+bool BackupEngine::pruneBackups(
+    const std::filesystem::path& destination,
+    const RetentionPolicy& policy,
+    bool dryRun) {
+    return pImpl->pruneBackups(destination, policy, dryRun);
+}
+
+PrunePlan BackupEngine::getLastPrunePlan() const {
+    return pImpl->getLastPrunePlan();
+}
+
+bool BackupEngine::collectTrash(const std::filesystem::path& destination) {
+    return pImpl->collectTrash(destination);
 }
 
 } // namespace utm 
\ No newline at end of file
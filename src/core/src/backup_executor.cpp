@@ -0,0 +1,429 @@
+#include "utm/backup_executor.hpp"
+#include "utm/system_utils.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utm {
+
+namespace {
+
+// A device a job needs a slot on; capacity is the number of jobs it serves at once
+struct DeviceSlot {
+    std::string key;
+    int capacity;
+};
+
+struct Job {
+    std::string name;
+    BackupConfig config;
+    ProgressCallback progressCallback;
+    std::vector<DeviceSlot> devices;
+    std::atomic<bool> cancelled{false};
+    BackupEngine* engine = nullptr;                     // while the backup runs
+};
+
+bool isActive(BackupStatus status) {
+    return status == BackupStatus::SCANNING || status == BackupStatus::BACKING_UP || status == BackupStatus::VERIFYING;
+}
+
+// Lock file of a device; the hash keeps keys that sanitize alike apart
+std::string lockFileName(const std::string& key) {
+    std::string name = "utm-";
+    for (char c : key) {
+        name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    std::ostringstream hash;
+    hash << std::hex << std::hash<std::string>()(key);
+    return name.substr(0, 64) + "-" + hash.str() + ".lock";
+}
+
+} // namespace
+
+// Implementation class for BackupExecutor
+class BackupExecutor::Impl {
+public:
+    Impl(const std::filesystem::path& metadataPath, const ExecutorOptions& options)
+        : metadataPath(metadataPath), options(options) {
+        if (this->options.lockDirectory.empty()) {
+            // Only this user's processes share the locks, so they live in a directory nobody else can write
+            this->options.lockDirectory = metadataPath / "device-locks";
+        }
+        for (int i = 0; i < std::max(1, options.maxConcurrentJobs); i++) {
+            workers.emplace_back(&Impl::workerFunction, this);
+        }
+    }
+
+    ~Impl() {
+        cancelAll();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    bool submit(const std::string& name, const BackupConfig& config, ProgressCallback progressCallback) {
+        auto job = std::make_shared<Job>();
+        job->name = name;
+        job->config = config;
+        job->progressCallback = std::move(progressCallback);
+        job->devices = devicesOf(config);
+
+        std::string devices;
+        for (const auto& device : job->devices) {
+            devices += (devices.empty() ? "" : ", ") + device.key;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (findLocked(name)) {
+                getLogger().warning("Backup " + name + " is already queued or running");
+                return false;
+            }
+            queue.push_back(job);
+        }
+        getLogger().info("Queued backup " + name + " on " + devices);
+        changed.notify_all();
+        return true;
+    }
+
+    bool cancel(const std::string& name) {
+        std::shared_ptr<Job> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& job : running) {
+                if (job->name == name) {
+                    cancelLocked(*job);
+                    return true;
+                }
+            }
+            auto it = std::find_if(queue.begin(), queue.end(), [&name](const std::shared_ptr<Job>& job) { return job->name == name; });
+            if (it == queue.end()) {
+                return false;
+            }
+            dropped = *it;
+            queue.erase(it);
+        }
+        changed.notify_all();
+        report(*dropped, BackupStatus::CANCELLED);
+        return true;
+    }
+
+    void cancelAll() {
+        std::deque<std::shared_ptr<Job>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            dropped.swap(queue);
+            for (const auto& job : running) {
+                cancelLocked(*job);
+            }
+        }
+        changed.notify_all();
+        for (const auto& job : dropped) {
+            report(*job, BackupStatus::CANCELLED);
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return queue.empty() && running.empty(); });
+    }
+
+    bool isIdle() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.empty() && running.empty();
+    }
+
+    size_t runningJobs() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running.size();
+    }
+
+    size_t queuedJobs() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size();
+    }
+
+private:
+    std::filesystem::path metadataPath;
+    ExecutorOptions options;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::shared_ptr<Job>> queue;
+    std::vector<std::shared_ptr<Job>> running;
+    std::map<std::string, int> inUse;                   // running jobs per device
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    void workerFunction() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            std::shared_ptr<Job> job;
+            changed.wait(lock, [&] { return stopping || (job = takeStartableLocked()) != nullptr; });
+            if (!job) {
+                return;
+            }
+
+            running.push_back(job);
+            for (const auto& device : job->devices) {
+                inUse[device.key]++;
+            }
+            lock.unlock();
+
+            run(*job);
+
+            lock.lock();
+            for (const auto& device : job->devices) {
+                if (--inUse[device.key] == 0) {
+                    inUse.erase(device.key);
+                }
+            }
+            running.erase(std::find(running.begin(), running.end(), job));
+            changed.notify_all();
+        }
+    }
+
+    // First queued job whose devices all have room; a waiting job holds its place on its devices
+    std::shared_ptr<Job> takeStartableLocked() {
+        std::set<std::string> waitedFor;
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+            bool fits = true;
+            for (const auto& device : (*it)->devices) {
+                auto used = inUse.find(device.key);
+                if ((used != inUse.end() && used->second >= device.capacity) || waitedFor.count(device.key)) {
+                    fits = false;
+                    break;
+                }
+            }
+
+            if (fits) {
+                std::shared_ptr<Job> job = *it;
+                queue.erase(it);
+                return job;
+            }
+            for (const auto& device : (*it)->devices) {
+                waitedFor.insert(device.key);
+            }
+        }
+        return nullptr;
+    }
+
+    void run(Job& job) {
+        std::vector<int> locks;
+        auto unlock = [&locks] {
+            for (int fd : locks) {
+                ::close(fd);
+            }
+        };
+
+        if (!lockDevices(job, locks)) {
+            unlock();
+            report(job, job.cancelled ? BackupStatus::CANCELLED : BackupStatus::FAILED);
+            return;
+        }
+
+        BackupEngine engine;
+        if (!engine.initialize(metadataPath)) {
+            unlock();
+            report(job, BackupStatus::FAILED);
+            return;
+        }
+
+        std::mutex doneMutex;
+        std::condition_variable doneChanged;
+        bool done = false;
+        auto callback = [&](BackupStatus status, const BackupStats& stats) {
+            if (job.progressCallback) {
+                job.progressCallback(status, stats);
+            }
+            if (status == BackupStatus::COMPLETED || status == BackupStatus::FAILED || status == BackupStatus::CANCELLED) {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                done = true;
+                doneChanged.notify_all();
+            }
+        };
+
+        // Started under the lock, so a cancellation either sees the engine or stops the start
+        bool started = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job.cancelled) {
+                getLogger().info("Starting backup " + job.name);
+                started = engine.startBackup(job.config, callback);
+                job.engine = started ? &engine : nullptr;
+            }
+        }
+
+        if (started) {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneChanged.wait(lock, [&] { return done; });
+        } else {
+            report(job, job.cancelled ? BackupStatus::CANCELLED : BackupStatus::FAILED);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job.engine = nullptr;
+        }
+        unlock();
+    }
+
+    // Take the cross-process locks of the job's serialized devices, in key order
+    bool lockDevices(Job& job, std::vector<int>& locks) {
+        std::error_code ec;
+        if (!std::filesystem::exists(options.lockDirectory, ec)) {
+            std::filesystem::create_directories(options.lockDirectory, ec);
+            std::filesystem::permissions(options.lockDirectory, std::filesystem::perms::owner_all, ec);
+        }
+
+        for (const auto& device : job.devices) {
+            if (device.capacity != 1) {
+                continue;
+            }
+
+            std::filesystem::path lockPath = options.lockDirectory / lockFileName(device.key);
+            int fd = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                getLogger().warning("Failed to open device lock " + lockPath.string() + ": " + std::strerror(errno));
+                continue;
+            }
+
+            // A lock file someone else created is not one of ours
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != ::geteuid()) {
+                getLogger().warning("Ignoring device lock " + lockPath.string() + " not owned by this user");
+                ::close(fd);
+                continue;
+            }
+            locks.push_back(fd);
+
+            // Another process holds the device; wait for it, but stay cancellable
+            bool logged = false;
+            while (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+                if (errno != EWOULDBLOCK && errno != EINTR) {
+                    getLogger().warning("Failed to lock " + device.key + ": " + std::strerror(errno));
+                    break;
+                }
+                if (job.cancelled) {
+                    return false;
+                }
+                if (!logged) {
+                    getLogger().info("Backup " + job.name + " is waiting for another process using " + device.key);
+                    logged = true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+        }
+        return true;
+    }
+
+    void report(Job& job, BackupStatus status) {
+        if (job.progressCallback) {
+            job.progressCallback(status, BackupStats());
+        }
+    }
+
+    void cancelLocked(Job& job) {
+        job.cancelled = true;
+        if (job.engine && isActive(job.engine->getStatus())) {
+            job.engine->cancelBackup();
+        }
+    }
+
+    bool findLocked(const std::string& name) const {
+        auto named = [&name](const std::shared_ptr<Job>& job) { return job->name == name; };
+        return std::any_of(queue.begin(), queue.end(), named) || std::any_of(running.begin(), running.end(), named);
+    }
+
+    // The devices a backup reads and writes, and its destination, which takes one backup at a time
+    std::vector<DeviceSlot> devicesOf(const BackupConfig& config) const {
+        const int shared = std::max(1, options.jobsPerSolidStateDevice);
+        std::vector<DeviceSlot> devices;
+        auto add = [&devices](std::string key, int capacity) {
+            auto it = std::find_if(devices.begin(), devices.end(), [&key](const DeviceSlot& d) { return d.key == key; });
+            if (it == devices.end()) {
+                devices.push_back(DeviceSlot{std::move(key), capacity});
+            }
+        };
+
+        std::vector<std::filesystem::path> paths = config.sourcePaths;
+        paths.push_back(config.destinationPath);
+        for (const auto& path : paths) {
+            auto info = system::getMountpointInfo(path);
+            if (!info) {
+                add("path:" + path.string(), 1);
+            } else if (info->isNetworkMount) {
+                add("net:" + info->device, shared);
+            } else if (!info->physicalDevice.empty()) {
+                add("disk:" + info->physicalDevice, info->isRotational ? 1 : shared);
+            } else {
+                add("mount:" + info->path.string(), shared);
+            }
+        }
+
+        std::error_code ec;
+        add("destination:" + std::filesystem::weakly_canonical(config.destinationPath, ec).string(), 1);
+
+        std::sort(devices.begin(), devices.end(), [](const DeviceSlot& a, const DeviceSlot& b) { return a.key < b.key; });
+        return devices;
+    }
+};
+
+// BackupExecutor implementation
+
+BackupExecutor::BackupExecutor(const std::filesystem::path& metadataPath, const ExecutorOptions& options)
+    : pImpl(std::make_unique<Impl>(metadataPath, options)) {
+}
+
+BackupExecutor::~BackupExecutor() = default;
+
+bool BackupExecutor::submit(const std::string& name, const BackupConfig& config, ProgressCallback progressCallback) {
+    return pImpl->submit(name, config, std::move(progressCallback));
+}
+
+bool BackupExecutor::cancel(const std::string& name) {
+    return pImpl->cancel(name);
+}
+
+void BackupExecutor::cancelAll() {
+    pImpl->cancelAll();
+}
+
+void BackupExecutor::wait() {
+    pImpl->wait();
+}
+
+bool BackupExecutor::isIdle() const {
+    return pImpl->isIdle();
+}
+
+size_t BackupExecutor::runningJobs() const {
+    return pImpl->runningJobs();
+}
+
+size_t BackupExecutor::queuedJobs() const {
+    return pImpl->queuedJobs();
+}
+
+} // namespace utm
@@ -0,0 +1,355 @@
+#include "utm/backup_journal.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/logging.hpp"
+#include <unordered_map>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::FileHandle;
+
+namespace {
+
+constexpr const char* JOURNAL_MAGIC = "utm-journal 1";
+constexpr const char* JOURNAL_SUFFIX = ".journal";
+
+// Completed subtrees are written at most this often; a crash loses at most this much work
+constexpr std::chrono::seconds checkpointInterval{30};
+
+// Paths go last on their line; only the line break and the escape character need escaping
+std::string escape(std::string_view text) {
+    std::string result;
+    result.reserve(text.size());
+    for (char c : text) {
+        if (c == '\\') {
+            result += "\\\\";
+        } else if (c == '\n') {
+            result += "\\n";
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+std::string unescape(std::string_view text) {
+    std::string result;
+    result.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\\' && i + 1 < text.size()) {
+            result += text[++i] == 'n' ? '\n' : text[i];
+        } else {
+            result += text[i];
+        }
+    }
+    return result;
+}
+
+std::string subtreeKey(std::size_t source, std::string_view relative) {
+    std::string key = std::to_string(source);
+    key += '\0';
+    key += relative;
+    return key;
+}
+
+// Whether child lies below parent ("" is the root of the source)
+bool isBelow(std::string_view child, std::string_view parent) {
+    return parent.empty() ||
+           (child.size() > parent.size() && child.compare(0, parent.size(), parent) == 0 && child[parent.size()] == '/');
+}
+
+bool writeAll(int fd, const std::string& data) {
+    std::size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+} // namespace
+
+// Implementation class for BackupJournal
+class BackupJournal::Impl {
+public:
+    bool open(const std::filesystem::path& stagingDir) {
+        close();
+        path = stagingDir.string() + JOURNAL_SUFFIX;
+
+        file = fs::openAt(AT_FDCWD, path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (!file.valid()) {
+            getLogger().error("Failed to open backup journal " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        if (::flock(file.get(), LOCK_EX | LOCK_NB) != 0) {
+            getLogger().error(errno == EWOULDBLOCK
+                ? "Another backup of the same sources is writing to " + stagingDir.string()
+                : "Failed to lock backup journal " + path + ": " + std::strerror(errno));
+            file = FileHandle();
+            return false;
+        }
+
+        try {
+            read();
+        }
+        catch (const std::exception& e) {
+            getLogger().warning("Backup journal " + path + " is unreadable, starting over: " + e.what());
+            header.reset();
+            subtrees.clear();
+        }
+        lastCheckpoint = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    const std::optional<JournalHeader>& previous() const noexcept {
+        return header;
+    }
+
+    bool start(const JournalHeader& newHeader) {
+        header.reset();
+        subtrees.clear();
+        pending.clear();
+
+        std::ostringstream out;
+        out << JOURNAL_MAGIC << '\n';
+        out << "started " << std::chrono::system_clock::to_time_t(newHeader.started) << '\n';
+        out << "session " << newHeader.catalogSession << '\n';
+        for (const auto& pattern : newHeader.excludePatterns) {
+            out << "exclude " << escape(pattern) << '\n';
+        }
+        out << "begin\n";
+
+        if (::ftruncate(file.get(), 0) != 0 || !writeAll(file.get(), out.str()) || ::fdatasync(file.get()) != 0) {
+            getLogger().error("Failed to write backup journal " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        lastCheckpoint = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool resuming() const noexcept {
+        return header.has_value();
+    }
+
+    std::optional<SubtreeTotals> completed(std::size_t source, std::string_view relative) const {
+        if (subtrees.empty()) {
+            return std::nullopt;
+        }
+        auto it = subtrees.find(subtreeKey(source, relative));
+        if (it == subtrees.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void complete(std::size_t source, std::string_view relative, const SubtreeTotals& totals) {
+        // Subtrees complete depth first, so the ones this subtree covers are the last ones recorded
+        while (!pending.empty() && pending.back().source == source && isBelow(pending.back().relative, relative)) {
+            pending.pop_back();
+        }
+        pending.push_back({source, std::string(relative), totals});
+    }
+
+    bool checkpointDue() const {
+        return !pending.empty() && std::chrono::steady_clock::now() - lastCheckpoint >= checkpointInterval;
+    }
+
+    bool checkpoint(int stagingFd) {
+        lastCheckpoint = std::chrono::steady_clock::now();
+        if (pending.empty()) {
+            return true;
+        }
+
+        // The subtrees have to be on disk before the journal says so
+        if (::syncfs(stagingFd) != 0) {
+            getLogger().error("Failed to flush backup staging directory: " + std::string(std::strerror(errno)));
+            return false;
+        }
+
+        std::ostringstream out;
+        for (const auto& subtree : pending) {
+            const SubtreeTotals& t = subtree.totals;
+            out << "done " << subtree.source << ' ' << t.files << ' ' << t.size << ' ' << t.newFiles << ' '
+                << t.modifiedFiles << ' ' << t.unchangedFiles << ' ' << t.skippedFiles << ' '
+                << escape(subtree.relative) << '\n';
+        }
+        if (!writeAll(file.get(), out.str()) || ::fdatasync(file.get()) != 0) {
+            getLogger().error("Failed to write backup journal " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        pending.clear();
+        return true;
+    }
+
+    void remove() {
+        if (file.valid() && ::unlink(path.c_str()) != 0 && errno != ENOENT) {
+            getLogger().warning("Failed to remove backup journal " + path + ": " + std::strerror(errno));
+        }
+        close();
+    }
+
+    void close() {
+        file = FileHandle();
+        header.reset();
+        subtrees.clear();
+        pending.clear();
+    }
+
+private:
+    struct Pending {
+        std::size_t source;
+        std::string relative;
+        SubtreeTotals totals;
+    };
+
+    std::string path;
+    FileHandle file;
+    std::optional<JournalHeader> header;
+    std::unordered_map<std::string, SubtreeTotals> subtrees;
+    std::vector<Pending> pending;
+    std::chrono::steady_clock::time_point lastCheckpoint;
+
+    // Read the journal an earlier session left; a torn last line is ignored
+    void read() {
+        header.reset();
+        subtrees.clear();
+
+        std::string contents;
+        char buffer[64 * 1024];
+        ssize_t n;
+        while ((n = ::pread(file.get(), buffer, sizeof(buffer), static_cast<off_t>(contents.size()))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                getLogger().warning("Failed to read backup journal " + path + ": " + std::strerror(errno));
+                return;
+            }
+            contents.append(buffer, n);
+        }
+
+        JournalHeader parsed;
+        bool inHeader = true;
+        std::size_t lineNumber = 0;
+        for (std::size_t start = 0, end; (end = contents.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string_view line(contents.data() + start, end - start);
+            if (lineNumber++ == 0) {
+                if (line != JOURNAL_MAGIC) {
+                    return;
+                }
+                continue;
+            }
+
+            std::size_t space = line.find(' ');
+            std::string_view tag = line.substr(0, space);
+            std::string_view value = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+
+            if (inHeader) {
+                if (tag == "started") {
+                    parsed.started = std::chrono::system_clock::from_time_t(std::stoll(std::string(value)));
+                } else if (tag == "session") {
+                    parsed.catalogSession = std::stoll(std::string(value));
+                } else if (tag == "exclude") {
+                    parsed.excludePatterns.push_back(unescape(value));
+                } else if (tag == "begin") {
+                    inHeader = false;
+                    header = parsed;
+                }
+                continue;
+            }
+
+            if (tag == "done") {
+                std::istringstream fields{std::string(value)};
+                std::size_t source = 0;
+                SubtreeTotals t;
+                fields >> source >> t.files >> t.size >> t.newFiles >> t.modifiedFiles >> t.unchangedFiles >> t.skippedFiles;
+                if (!fields || fields.get() != ' ') {
+                    continue;
+                }
+                std::string relative(std::istreambuf_iterator<char>(fields), {});
+                subtrees[subtreeKey(source, unescape(relative))] = t;
+            }
+        }
+    }
+};
+
+// BackupJournal implementation
+
+std::filesystem::path BackupJournal::stagingDirectory(
+    const std::filesystem::path& backupsDir,
+    const std::vector<std::filesystem::path>& sourcePaths) {
+
+    // FNV-1a over the source paths: stable across runs and builds
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const auto& sourcePath : sourcePaths) {
+        for (unsigned char c : sourcePath.native()) {
+            hash = (hash ^ c) * 0x100000001b3ULL;
+        }
+        hash = (hash ^ 0) * 0x100000001b3ULL;
+    }
+
+    std::ostringstream name;
+    name << STAGING_PREFIX << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return backupsDir / name.str();
+}
+
+BackupJournal::BackupJournal() : pImpl(std::make_unique<Impl>()) {
+}
+
+BackupJournal::~BackupJournal() = default;
+
+bool BackupJournal::open(const std::filesystem::path& stagingDir) {
+    return pImpl->open(stagingDir);
+}
+
+const std::optional<JournalHeader>& BackupJournal::previous() const noexcept {
+    return pImpl->previous();
+}
+
+bool BackupJournal::start(const JournalHeader& header) {
+    return pImpl->start(header);
+}
+
+bool BackupJournal::resuming() const noexcept {
+    return pImpl->resuming();
+}
+
+std::optional<SubtreeTotals> BackupJournal::completed(std::size_t source, std::string_view relative) const {
+    return pImpl->completed(source, relative);
+}
+
+void BackupJournal::complete(std::size_t source, std::string_view relative, const SubtreeTotals& totals) {
+    pImpl->complete(source, relative, totals);
+}
+
+bool BackupJournal::checkpointDue() const {
+    return pImpl->checkpointDue();
+}
+
+bool BackupJournal::checkpoint(int stagingFd) {
+    return pImpl->checkpoint(stagingFd);
+}
+
+void BackupJournal::remove() {
+    pImpl->remove();
+}
+
+void BackupJournal::close() {
+    pImpl->close();
+}
+
+} // namespace utm
@@ -4,6 +4,8 @@
 
 #include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <ctime>
 #include <vector>
 #include <algorithm>
 #include <mutex>
@@ -95,10 +97,16 @@ public:
             appConfig.autoStart = false;
             appConfig.limitCpuUsage = true;
             appConfig.maxCpuPercentage = 50;
+            appConfig.adaptToPressure = true;
+            appConfig.pressureTargetPercentage = 10;
             appConfig.pauseOnBattery = true;
             appConfig.pauseOnMeteredConnection = true;
             appConfig.maxLogSize = 10 * 1024 * 1024;
             appConfig.maxLogFiles = 5;
+            appConfig.blockOnLogOverflow = false;
+            appConfig.logFlushIntervalMs = 200;
+            appConfig.eventLog = false;
+            appConfig.eventLogRecords = 1024 * 1024;
 
             // Save the default config
             return saveConfig();
@@ -126,10 +134,16 @@ public:
                 appConfig.autoStart = appNode->get<bool>("autoStart", false);
                 appConfig.limitCpuUsage = appNode->get<bool>("limitCpuUsage", true);
                 appConfig.maxCpuPercentage = appNode->get<int>("maxCpuPercentage", 50);
+                appConfig.adaptToPressure = appNode->get<bool>("adaptToPressure", true);
+                appConfig.pressureTargetPercentage = appNode->get<int>("pressureTargetPercentage", 10);
                 appConfig.pauseOnBattery = appNode->get<bool>("pauseOnBattery", true);
                 appConfig.pauseOnMeteredConnection = appNode->get<bool>("pauseOnMeteredConnection", true);
                 appConfig.maxLogSize = appNode->get<size_t>("maxLogSize", 10 * 1024 * 1024);
                 appConfig.maxLogFiles = appNode->get<int>("maxLogFiles", 5);
+                appConfig.blockOnLogOverflow = appNode->get<bool>("blockOnLogOverflow", false);
+                appConfig.logFlushIntervalMs = appNode->get<int>("logFlushIntervalMs", 200);
+                appConfig.eventLog = appNode->get<bool>("eventLog", false);
+                appConfig.eventLogRecords = appNode->get<size_t>("eventLogRecords", 1024 * 1024);
             } else {
                 UTM_WARNING("No application configuration found, using defaults");
                 appConfig = {};
@@ -163,10 +177,16 @@ public:
             appNode.put("autoStart", appConfig.autoStart);
             appNode.put("limitCpuUsage", appConfig.limitCpuUsage);
             appNode.put("maxCpuPercentage", appConfig.maxCpuPercentage);
+            appNode.put("adaptToPressure", appConfig.adaptToPressure);
+            appNode.put("pressureTargetPercentage", appConfig.pressureTargetPercentage);
             appNode.put("pauseOnBattery", appConfig.pauseOnBattery);
             appNode.put("pauseOnMeteredConnection", appConfig.pauseOnMeteredConnection);
             appNode.put("maxLogSize", appConfig.maxLogSize);
             appNode.put("maxLogFiles", appConfig.maxLogFiles);
+            appNode.put("blockOnLogOverflow", appConfig.blockOnLogOverflow);
+            appNode.put("logFlushIntervalMs", appConfig.logFlushIntervalMs);
+            appNode.put("eventLog", appConfig.eventLog);
+            appNode.put("eventLogRecords", appConfig.eventLogRecords);
 
             root.put_child("application", appNode);
 
@@ -253,6 +273,14 @@ public:
             profile.verifyBackup = root.get<bool>("verifyBackup", true);
             profile.useHardLinks = root.get<bool>("useHardLinks", true);
             profile.threadCount = root.get<int>("threadCount", 0);
+
+            // I/O limits
+            if (auto ioNode = root.get_child_optional("ioLimits")) {
+                profile.ioLimits.readBytesPerSecond = ioNode->get<std::uint64_t>("readBytesPerSecond", 0);
+                profile.ioLimits.writeBytesPerSecond = ioNode->get<std::uint64_t>("writeBytesPerSecond", 0);
+                profile.ioLimits.operationsPerSecond = ioNode->get<std::uint32_t>("operationsPerSecond", 0);
+                profile.ioLimits.priority = stringToIoPriority(ioNode->get<std::string>("priority", "NORMAL"));
+            }
             
             // Schedule
             if (auto scheduleNode = root.get_child_optional("schedule")) {
@@ -272,9 +300,17 @@ public:
                 // Start time is stored as a string in ISO format
                 std::string startTimeStr = scheduleNode->get<std::string>("startTime", "");
                 if (!startTimeStr.empty()) {
-                    // Convert startTimeStr to time_point - this is simplified
-                    // A real implementation would parse the ISO string properly
-                    profile.schedule.startTime = std::chrono::system_clock::now();
+                    // UTC with a trailing Z, local time otherwise
+                    std::tm tm{};
+                    std::istringstream stream(startTimeStr);
+                    stream >> std::get_time(&tm, "%Y-%m-%dT%H:%M:%S");
+                    if (!stream.fail()) {
+                        tm.tm_isdst = -1;
+                        std::time_t time = startTimeStr.back() == 'Z' ? timegm(&tm) : std::mktime(&tm);
+                        profile.schedule.startTime = std::chrono::system_clock::from_time_t(time);
+                    } else {
+                        UTM_WARNING("Invalid schedule start time in profile {}: {}", profileId, startTimeStr);
+                    }
                 }
             }
             
@@ -284,6 +320,7 @@ public:
                 profile.retention.keepWeekly = retentionNode->get<int>("keepWeekly", 4);
                 profile.retention.keepMonthly = retentionNode->get<int>("keepMonthly", 12);
                 profile.retention.keepYearly = retentionNode->get<int>("keepYearly", 5);
+                profile.retention.targetFreeGB = retentionNode->get<int>("targetFreeGB", 0);
                 profile.retention.autoDelete = retentionNode->get<bool>("autoDelete", true);
             }
             
@@ -335,6 +372,14 @@ public:
             root.put("verifyBackup", profile.verifyBackup);
             root.put("useHardLinks", profile.useHardLinks);
             root.put("threadCount", profile.threadCount);
+
+            // I/O limits
+            boost::property_tree::ptree ioNode;
+            ioNode.put("readBytesPerSecond", profile.ioLimits.readBytesPerSecond);
+            ioNode.put("writeBytesPerSecond", profile.ioLimits.writeBytesPerSecond);
+            ioNode.put("operationsPerSecond", profile.ioLimits.operationsPerSecond);
+            ioNode.put("priority", ioPriorityToString(profile.ioLimits.priority));
+            root.put_child("ioLimits", ioNode);
             
             // Schedule
             boost::property_tree::ptree scheduleNode;
@@ -356,8 +401,12 @@ public:
             scheduleNode.put("dayOfMonth", profile.schedule.dayOfMonth);
             scheduleNode.put("enabled", profile.schedule.enabled);
             
-            // This is simplified - a real implementation would format the time properly
-            scheduleNode.put("startTime", "2023-01-01T00:00:00Z");
+            std::time_t startTime = std::chrono::system_clock::to_time_t(profile.schedule.startTime);
+            std::tm startTm{};
+            gmtime_r(&startTime, &startTm);
+            char startTimeStr[32];
+            std::strftime(startTimeStr, sizeof(startTimeStr), "%Y-%m-%dT%H:%M:%SZ", &startTm);
+            scheduleNode.put("startTime", startTimeStr);
             
             root.put_child("schedule", scheduleNode);
             
@@ -367,6 +416,7 @@ public:
             retentionNode.put("keepWeekly", profile.retention.keepWeekly);
             retentionNode.put("keepMonthly", profile.retention.keepMonthly);
             retentionNode.put("keepYearly", profile.retention.keepYearly);
+            retentionNode.put("targetFreeGB", profile.retention.targetFreeGB);
             retentionNode.put("autoDelete", profile.retention.autoDelete);
             
             root.put_child("retention", retentionNode);
@@ -378,6 +428,7 @@ public:
             boost::property_tree::write_json(profilePath.string(), root);
             
             // Update the profiles vector
+            std::lock_guard<std::mutex> lock(configMutex);
             auto it = std::find_if(profiles.begin(), profiles.end(),
                 [&profileId](const BackupProfile& p) { return p.name == profileId; });
                 
@@ -407,6 +458,7 @@ public:
             std::filesystem::remove(profilePath);
             
             // Update the profiles vector
+            std::lock_guard<std::mutex> lock(configMutex);
             profiles.erase(std::remove_if(profiles.begin(), profiles.end(),
                 [&profileId](const BackupProfile& p) { return p.name == profileId; }),
                 profiles.end());
@@ -419,11 +471,18 @@ public:
         }
     }
 
+    void reloadProfiles() {
+        std::lock_guard<std::mutex> lock(configMutex);
+        loadProfiles();
+    }
+
     std::vector<BackupProfile> getAllBackupProfiles() const {
+        std::lock_guard<std::mutex> lock(configMutex);
         return profiles;
     }
 
     std::optional<BackupProfile> getBackupProfile(const std::string& profileId) const {
+        std::lock_guard<std::mutex> lock(configMutex);
         auto it = std::find_if(profiles.begin(), profiles.end(),
             [&profileId](const BackupProfile& profile) {
                 return profile.name == profileId;
@@ -452,19 +511,9 @@ private:
     std::filesystem::path profilesDir;
     std::vector<BackupProfile> profiles;
     ApplicationConfig appConfig;
-    std::mutex configMutex;
+    mutable std::mutex configMutex;
 };
 
-// Static singleton instance
-namespace {
-    std::unique_ptr<Config> configInstance;
-    std::once_flag initFlag;
-
-    void createConfigInstance() {
-        configInstance = Config::create();
-    }
-}
-
 // Config implementation
 Config::Config() : pImpl(std::make_unique<Impl>()) {
 }
@@ -476,8 +525,9 @@ std::unique_ptr<Config> Config::create() {
 }
 
 Config& Config::getInstance() {
-    std::call_once(initFlag, createConfigInstance);
-    return *configInstance;
+    // Created on first use, after the logger, so it is destroyed (and saved) while the logger still exists
+    static std::unique_ptr<Config> instance = Config::create();
+    return *instance;
 }
 
 bool Config::initialize(const std::filesystem::path& configDir) {
@@ -512,4 +562,8 @@ bool Config::deleteBackupProfile(const std::string& name) {
     return pImpl->deleteProfile(name);
 }
 
+void Config::reloadProfiles() {
+    pImpl->reloadProfiles();
+}
+
 } // namespace utm
\ No newline at end of file
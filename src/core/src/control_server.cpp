@@ -0,0 +1,549 @@
+#include "utm/control_server.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/system_utils.hpp"
+#include "utm/logging.hpp"
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::FileHandle;
+
+namespace {
+
+// Frames start with their payload length, 32 bits little-endian
+constexpr std::size_t FRAME_HEADER_SIZE = 4;
+
+void appendFrame(std::string& output, std::string_view payload) {
+    auto length = static_cast<std::uint32_t>(payload.size());
+    for (int i = 0; i < 4; i++) {
+        output += static_cast<char>((length >> (8 * i)) & 0xff);
+    }
+    output += payload;
+}
+
+std::uint32_t frameLength(const char* header) {
+    std::uint32_t length = 0;
+    for (int i = 0; i < 4; i++) {
+        length |= static_cast<std::uint32_t>(static_cast<unsigned char>(header[i])) << (8 * i);
+    }
+    return length;
+}
+
+bool socketAddress(const std::filesystem::path& path, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.native().size());
+    return true;
+}
+
+// Request ids are echoed back: numbers as numbers, anything else as a string
+std::string requestId(const boost::property_tree::ptree& request) {
+    auto id = request.get_child_optional("id");
+    if (!id) {
+        return "null";
+    }
+    const std::string& text = id->data();
+    bool numeric = !text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+    return numeric ? text : jsonString(text);
+}
+
+} // namespace
+
+std::string jsonString(std::string_view text) {
+    std::string result = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                    result += escaped;
+                } else {
+                    result += c;
+                }
+        }
+    }
+    result += '"';
+    return result;
+}
+
+// Implementation class for ControlServer
+class ControlServer::Impl {
+public:
+    explicit Impl(const ControlServerOptions& options) : options(options) {
+        if (this->options.socketPath.empty()) {
+            this->options.socketPath = defaultSocketPath();
+        }
+    }
+
+    ~Impl() {
+        stop();
+    }
+
+    void registerMethod(const std::string& method, RpcHandler handler) {
+        methods[method] = std::move(handler);
+    }
+
+    bool start() {
+        if (running) {
+            return true;
+        }
+
+        const std::filesystem::path& path = options.socketPath;
+        sockaddr_un address;
+        if (!socketAddress(path, address)) {
+            getLogger().error("Control socket path is too long: " + path.string());
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+
+        // A socket that still accepts connections belongs to a running daemon; anything else is stale
+        FileHandle probe(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (probe.valid() && ::connect(probe.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            getLogger().error("Another daemon is already listening on " + path.string());
+            return false;
+        }
+        ::unlink(path.c_str());
+
+        listenSocket = FileHandle(::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        if (!listenSocket.valid()) {
+            getLogger().error("Failed to create control socket: " + std::string(std::strerror(errno)));
+            return false;
+        }
+
+        // Only the owner may connect; bind() creates the socket file with the mode of the socket
+        // (less the umask), so it is right from the moment the file exists
+        if (::fchmod(listenSocket.get(), 0600) != 0) {
+            getLogger().error("Failed to set the mode of the control socket: " + std::string(std::strerror(errno)));
+            listenSocket = FileHandle();
+            return false;
+        }
+        if (::bind(listenSocket.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listenSocket.get(), 16) != 0) {
+            getLogger().error("Failed to listen on " + path.string() + ": " + std::strerror(errno));
+            listenSocket = FileHandle();
+            return false;
+        }
+
+        wakeEvent = FileHandle(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        if (!wakeEvent.valid()) {
+            getLogger().error("Failed to create control server event: " + std::string(std::strerror(errno)));
+            listenSocket = FileHandle();
+            ::unlink(path.c_str());
+            return false;
+        }
+
+        running = true;
+        serverThread = std::thread(&Impl::serve, this);
+        getLogger().info("Control socket listening on " + path.string());
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        wake();
+        if (serverThread.joinable()) {
+            serverThread.join();
+        }
+
+        clients.clear();
+        connected = 0;
+        listenSocket = FileHandle();
+        wakeEvent = FileHandle();
+        ::unlink(options.socketPath.c_str());
+    }
+
+    void publish(const std::string& topic, const std::string& key, const std::string& data) {
+        {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            latest[{topic, key}] = data;
+            changed.insert({topic, key});
+        }
+
+        // One wake-up per batch; the server thread clears the flag before it looks for changes
+        if (!wakePending.exchange(true)) {
+            wake();
+        }
+    }
+
+    std::size_t clientCount() const {
+        return connected;
+    }
+
+private:
+    using EventKey = std::pair<std::string, std::string>;
+
+    struct Client {
+        FileHandle socket;
+        std::string input;
+        std::string output;
+        std::size_t outputOffset = 0;
+        std::set<std::string> topics;
+        bool closing = false;
+
+        std::size_t pendingOutput() const noexcept {
+            return output.size() - outputOffset;
+        }
+    };
+
+    ControlServerOptions options;
+    std::map<std::string, RpcHandler> methods;
+
+    FileHandle listenSocket;
+    FileHandle wakeEvent;
+    std::thread serverThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> wakePending{false};
+    std::atomic<std::size_t> connected{0};
+
+    // Owned by the server thread
+    std::vector<std::unique_ptr<Client>> clients;
+    std::chrono::steady_clock::time_point lastFlush;
+
+    // Latest event per topic and key, and the ones not sent yet
+    std::mutex eventMutex;
+    std::map<EventKey, std::string> latest;
+    std::set<EventKey> changed;
+
+    void wake() {
+        std::uint64_t one = 1;
+        if (wakeEvent.valid() && ::write(wakeEvent.get(), &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            UTM_DEBUG("Failed to wake the control server: {}", std::strerror(errno));
+        }
+    }
+
+    void serve() {
+        // Signals are for the daemon's main thread
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        std::vector<pollfd> fds;
+        while (running) {
+            // Changed events wait for the end of the current interval
+            int timeout = -1;
+            {
+                std::lock_guard<std::mutex> lock(eventMutex);
+                if (!changed.empty()) {
+                    auto due = lastFlush + options.eventInterval;
+                    auto now = std::chrono::steady_clock::now();
+                    timeout = due <= now ? 0 : static_cast<int>(
+                        std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count() + 1);
+                }
+            }
+
+            fds.clear();
+            fds.push_back({wakeEvent.get(), POLLIN, 0});
+            fds.push_back({listenSocket.get(), static_cast<short>(clients.size() < options.maxClients ? POLLIN : 0), 0});
+            for (const auto& client : clients) {
+                fds.push_back({client->socket.get(), static_cast<short>(POLLIN | (client->pendingOutput() ? POLLOUT : 0)), 0});
+            }
+
+            if (::poll(fds.data(), fds.size(), timeout) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                getLogger().error("Control server failed: " + std::string(std::strerror(errno)));
+                break;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                std::uint64_t count;
+                while (::read(wakeEvent.get(), &count, sizeof(count)) > 0) {
+                }
+                wakePending = false;
+            }
+            if (fds[1].revents & POLLIN) {
+                acceptClients();
+            }
+
+            // New clients are past the end of fds and get served from the next round on
+            for (std::size_t i = 2; i < fds.size(); i++) {
+                Client& client = *clients[i - 2];
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    receive(client);
+                }
+                if (!client.closing && client.pendingOutput()) {
+                    send(client);
+                }
+            }
+
+            flushEvents();
+            dropClosedClients();
+        }
+    }
+
+    void acceptClients() {
+        while (clients.size() < options.maxClients) {
+            FileHandle socket(::accept4(listenSocket.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+            if (!socket.valid()) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    getLogger().warning("Failed to accept control connection: " + std::string(std::strerror(errno)));
+                }
+                return;
+            }
+
+            // The socket mode already keeps other users out; check the peer anyway
+            struct ucred credentials;
+            socklen_t length = sizeof(credentials);
+            if (::getsockopt(socket.get(), SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 ||
+                (credentials.uid != ::getuid() && credentials.uid != 0)) {
+                getLogger().warning("Rejected control connection from another user");
+                continue;
+            }
+
+            auto client = std::make_unique<Client>();
+            client->socket = std::move(socket);
+            clients.push_back(std::move(client));
+            connected = clients.size();
+            UTM_DEBUG("Control client connected (pid {})", credentials.pid);
+        }
+    }
+
+    void receive(Client& client) {
+        char buffer[64 * 1024];
+        while (true) {
+            ssize_t n = ::recv(client.socket.get(), buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n > 0) {
+                client.input.append(buffer, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                client.closing = true;
+            }
+            break;
+        }
+
+        std::size_t offset = 0;
+        while (!client.closing && client.input.size() - offset >= FRAME_HEADER_SIZE) {
+            std::uint32_t length = frameLength(client.input.data() + offset);
+            if (length > options.maxFrameSize) {
+                getLogger().warning("Dropping control client: request of " + std::to_string(length) + " bytes");
+                client.closing = true;
+                break;
+            }
+            if (client.input.size() - offset - FRAME_HEADER_SIZE < length) {
+                break;
+            }
+            handleRequest(client, std::string_view(client.input).substr(offset + FRAME_HEADER_SIZE, length));
+            offset += FRAME_HEADER_SIZE + length;
+        }
+        client.input.erase(0, offset);
+    }
+
+    void handleRequest(Client& client, std::string_view payload) {
+        boost::property_tree::ptree request;
+        try {
+            std::istringstream in{std::string(payload)};
+            boost::property_tree::read_json(in, request);
+        }
+        catch (const std::exception& e) {
+            respond(client, "null", false, "Malformed request");
+            return;
+        }
+
+        const std::string id = requestId(request);
+        const std::string method = request.get<std::string>("method", "");
+        RpcParams params;
+        if (auto node = request.get_child_optional("params")) {
+            for (const auto& [name, value] : *node) {
+                params[name] = value.data();
+            }
+        }
+
+        if (method == "subscribe" || method == "unsubscribe") {
+            auto topic = params.find("topic");
+            if (topic == params.end() || topic->second.empty()) {
+                respond(client, id, false, "Missing parameter: topic");
+                return;
+            }
+            if (method == "unsubscribe") {
+                client.topics.erase(topic->second);
+                respond(client, id, true, "true");
+                return;
+            }
+
+            client.topics.insert(topic->second);
+            respond(client, id, true, "true");
+
+            // Catch the new subscriber up with the current state
+            std::lock_guard<std::mutex> lock(eventMutex);
+            for (auto it = latest.lower_bound({topic->second, ""}); it != latest.end() && it->first.first == topic->second; ++it) {
+                appendEvent(client, it->first, it->second);
+            }
+            return;
+        }
+
+        auto handler = methods.find(method);
+        if (handler == methods.end()) {
+            respond(client, id, false, "Unknown method: " + method);
+            return;
+        }
+
+        std::string result;
+        bool ok = false;
+        try {
+            ok = handler->second(params, result);
+        }
+        catch (const std::exception& e) {
+            result = e.what();
+        }
+        respond(client, id, ok, result);
+    }
+
+    void respond(Client& client, const std::string& id, bool ok, const std::string& result) {
+        std::string message = "{\"id\":" + id + (ok ? ",\"result\":" + result : ",\"error\":" + jsonString(result)) + "}";
+        appendFrame(client.output, message);
+        checkBacklog(client);
+    }
+
+    void appendEvent(Client& client, const EventKey& key, const std::string& data) {
+        appendFrame(client.output, "{\"event\":" + jsonString(key.first) + ",\"key\":" + jsonString(key.second) +
+                                   ",\"data\":" + data + "}");
+        checkBacklog(client);
+    }
+
+    void checkBacklog(Client& client) {
+        if (!client.closing && client.pendingOutput() > options.maxPendingOutput) {
+            getLogger().warning("Dropping control client: it does not read its messages");
+            client.closing = true;
+        }
+    }
+
+    void send(Client& client) {
+        while (client.pendingOutput()) {
+            ssize_t n = ::send(client.socket.get(), client.output.data() + client.outputOffset,
+                               client.pendingOutput(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    client.closing = true;
+                }
+                break;
+            }
+            client.outputOffset += n;
+        }
+
+        // Keep the buffer from growing while a client reads slowly
+        if (!client.pendingOutput()) {
+            client.output.clear();
+            client.outputOffset = 0;
+        } else if (client.outputOffset > 64 * 1024) {
+            client.output.erase(0, client.outputOffset);
+            client.outputOffset = 0;
+        }
+    }
+
+    // Send the events that changed since the last flush, once the interval is over
+    void flushEvents() {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::pair<EventKey, std::string>> events;
+        {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            if (changed.empty() || now < lastFlush + options.eventInterval) {
+                return;
+            }
+            for (const auto& key : changed) {
+                events.emplace_back(key, latest[key]);
+            }
+            changed.clear();
+        }
+        lastFlush = now;
+
+        for (auto& client : clients) {
+            bool subscribed = false;
+            for (const auto& [key, data] : events) {
+                if (!client->closing && client->topics.count(key.first)) {
+                    appendEvent(*client, key, data);
+                    subscribed = true;
+                }
+            }
+            if (subscribed && !client->closing) {
+                send(*client);
+            }
+        }
+    }
+
+    void dropClosedClients() {
+        auto closed = std::remove_if(clients.begin(), clients.end(), [](const auto& client) { return client->closing; });
+        if (closed != clients.end()) {
+            clients.erase(closed, clients.end());
+            connected = clients.size();
+            UTM_DEBUG("Control client disconnected");
+        }
+    }
+};
+
+// ControlServer implementation
+
+std::filesystem::path ControlServer::defaultSocketPath() {
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) {
+        return std::filesystem::path(runtimeDir) / "ubuntu-time-machine.sock";
+    }
+    return system::getAppDataDirectory() / "core.sock";
+}
+
+ControlServer::ControlServer(const ControlServerOptions& options) : pImpl(std::make_unique<Impl>(options)) {
+}
+
+ControlServer::~ControlServer() = default;
+
+void ControlServer::registerMethod(const std::string& method, RpcHandler handler) {
+    pImpl->registerMethod(method, std::move(handler));
+}
+
+bool ControlServer::start() {
+    return pImpl->start();
+}
+
+void ControlServer::stop() {
+    pImpl->stop();
+}
+
+void ControlServer::publish(const std::string& topic, const std::string& key, const std::string& data) {
+    pImpl->publish(topic, key, data);
+}
+
+std::size_t ControlServer::clientCount() const {
+    return pImpl->clientCount();
+}
+
+} // namespace utm
@@ -0,0 +1,961 @@
+#include "utm/database.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <sqlite3.h>
+
+namespace utm {
+
+namespace {
+
+// Schema of the catalog. A version row covers the sessions first_session..last_session
+// of one destination in which the path had that content.
+const char* const SCHEMA = R"SQL(
+CREATE TABLE IF NOT EXISTS sessions (
+    id INTEGER PRIMARY KEY,
+    start_time INTEGER NOT NULL,
+    end_time INTEGER,
+    source_path TEXT NOT NULL,
+    destination_path TEXT NOT NULL,
+    is_complete INTEGER NOT NULL DEFAULT 0,
+    is_verified INTEGER NOT NULL DEFAULT 0,
+    total_files INTEGER NOT NULL DEFAULT 0,
+    total_size INTEGER NOT NULL DEFAULT 0
+);
+CREATE INDEX IF NOT EXISTS sessions_by_destination ON sessions(destination_path, id);
+CREATE INDEX IF NOT EXISTS sessions_by_time ON sessions(start_time);
+
+CREATE TABLE IF NOT EXISTS paths (
+    id INTEGER PRIMARY KEY,
+    path TEXT NOT NULL UNIQUE
+);
+
+CREATE TABLE IF NOT EXISTS versions (
+    id INTEGER PRIMARY KEY,
+    path_id INTEGER NOT NULL REFERENCES paths(id),
+    checksum TEXT NOT NULL,
+    size INTEGER NOT NULL,
+    modification_time INTEGER NOT NULL,
+    first_session INTEGER NOT NULL REFERENCES sessions(id),
+    last_session INTEGER NOT NULL REFERENCES sessions(id),
+    hardlink_target TEXT,
+    is_symlink INTEGER NOT NULL DEFAULT 0,
+    symlink_target TEXT,
+    is_compressed INTEGER NOT NULL DEFAULT 0,
+    is_encrypted INTEGER NOT NULL DEFAULT 0
+);
+CREATE INDEX IF NOT EXISTS versions_by_path ON versions(path_id, last_session);
+CREATE INDEX IF NOT EXISTS versions_by_first_session ON versions(first_session);
+CREATE INDEX IF NOT EXISTS versions_by_last_session ON versions(last_session);
+CREATE INDEX IF NOT EXISTS versions_by_checksum ON versions(checksum);
+)SQL";
+
+// Trigram index over file names, one row per path with rowid = paths.id.
+// Substring (LIKE) and GLOB queries with three or more literal characters
+// are answered from the trigram posting lists instead of scanning names.
+const char* const NAME_INDEX_SCHEMA = R"SQL(
+CREATE VIRTUAL TABLE IF NOT EXISTS path_names USING fts5(name, tokenize = 'trigram', detail = 'none');
+)SQL";
+
+// Scratch table for the paths a session deletion leaves without versions
+const char* const TEMP_SCHEMA = R"SQL(
+CREATE TEMP TABLE IF NOT EXISTS orphan_paths (id INTEGER PRIMARY KEY);
+)SQL";
+
+// Columns read by readVersion()
+const char* const VERSION_COLUMNS = R"SQL(
+    SELECT v.id, p.path, v.checksum, v.size, v.modification_time, v.hardlink_target,
+           v.is_symlink, v.symlink_target, v.is_compressed, v.is_encrypted,
+           v.first_session, v.last_session, f.start_time, l.start_time, v.path_id
+    FROM versions v
+    JOIN paths p ON p.id = v.path_id
+    JOIN sessions f ON f.id = v.first_session
+    JOIN sessions l ON l.id = v.last_session
+)SQL";
+
+const char* const SESSION_COLUMNS = R"SQL(
+    SELECT id, start_time, end_time, source_path, destination_path,
+           is_complete, is_verified, total_files, total_size
+    FROM sessions
+)SQL";
+
+std::int64_t toSeconds(const std::chrono::system_clock::time_point& time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+std::chrono::system_clock::time_point fromSeconds(std::int64_t seconds) {
+    return std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+}
+
+std::string normalizePath(const std::filesystem::path& path) {
+    std::string result = path.relative_path().lexically_normal().generic_string();
+    while (!result.empty() && result.back() == '/') {
+        result.pop_back();
+    }
+    return result;
+}
+
+std::string_view fileName(std::string_view path) {
+    std::size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+bool isGlobPattern(std::string_view pattern) {
+    return pattern.find_first_of("*?[") != std::string_view::npos;
+}
+
+// ASCII case-insensitive substring test, matching what SQLite LIKE does
+bool containsIgnoreCase(std::string_view text, std::string_view needle) {
+    auto it = std::search(text.begin(), text.end(), needle.begin(), needle.end(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+    return it != text.end();
+}
+
+std::string_view columnView(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? std::string_view(reinterpret_cast<const char*>(text), sqlite3_column_bytes(stmt, column))
+                : std::string_view();
+}
+
+std::string columnText(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? std::string(reinterpret_cast<const char*>(text), sqlite3_column_bytes(stmt, column)) : std::string();
+}
+
+// Resets a cached statement when it goes out of scope
+class StatementScope {
+public:
+    explicit StatementScope(sqlite3_stmt* stmt) : stmt(stmt) {}
+    ~StatementScope() {
+        if (stmt) {
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+    }
+
+    StatementScope(const StatementScope&) = delete;
+    StatementScope& operator=(const StatementScope&) = delete;
+
+    sqlite3_stmt* get() const noexcept { return stmt; }
+    explicit operator bool() const noexcept { return stmt != nullptr; }
+
+private:
+    sqlite3_stmt* stmt;
+};
+
+} // namespace
+
+// Implementation class for Database
+class Database::Impl {
+public:
+    ~Impl() {
+        close();
+    }
+
+    bool open(const std::filesystem::path& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        closeLocked();
+
+        try {
+            if (path.has_parent_path()) {
+                std::filesystem::create_directories(path.parent_path());
+            }
+        }
+        catch (const std::exception& e) {
+            getLogger().error("Failed to create database directory: " + std::string(e.what()));
+            return false;
+        }
+
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+                            nullptr) != SQLITE_OK) {
+            getLogger().error("Failed to open database " + path.string() + ": " + errorMessage());
+            closeLocked();
+            return false;
+        }
+
+        sqlite3_busy_timeout(db, 5000);
+        sqlite3_create_function_v2(db, "name_of", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                   &nameOfFunction, nullptr, nullptr, nullptr);
+        if (!execLocked("PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL; PRAGMA foreign_keys=ON;") ||
+            !execLocked(SCHEMA) || !execLocked(TEMP_SCHEMA)) {
+            closeLocked();
+            return false;
+        }
+
+        // Without FTS5 file name searches still work, by scanning every name
+        nameIndex = execLocked(NAME_INDEX_SCHEMA, false) && indexExistingNames();
+        if (!nameIndex) {
+            getLogger().warning("File name index unavailable, searches will scan the catalog");
+        }
+
+        getLogger().info("Database opened: " + path.string());
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closeLocked();
+    }
+
+    bool exec(const char* sql) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return db && execLocked(sql);
+    }
+
+    std::int64_t createBackupSession(const BackupSession& session) {
+        std::lock_guard<std::mutex> lock(mutex);
+        StatementScope stmt(prepare(
+            "INSERT INTO sessions (start_time, end_time, source_path, destination_path, "
+            "is_complete, is_verified, total_files, total_size) VALUES (?, ?, ?, ?, ?, ?, ?, ?)"));
+        if (!stmt) {
+            return -1;
+        }
+
+        bindSession(stmt.get(), session);
+        if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            getLogger().error("Failed to create backup session: " + errorMessage());
+            return -1;
+        }
+        return sqlite3_last_insert_rowid(db);
+    }
+
+    bool updateBackupSession(const BackupSession& session) {
+        std::lock_guard<std::mutex> lock(mutex);
+        StatementScope stmt(prepare(
+            "UPDATE sessions SET start_time = ?, end_time = ?, source_path = ?, destination_path = ?, "
+            "is_complete = ?, is_verified = ?, total_files = ?, total_size = ? WHERE id = ?"));
+        if (!stmt) {
+            return false;
+        }
+
+        bindSession(stmt.get(), session);
+        sqlite3_bind_int64(stmt.get(), 9, session.id);
+        if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            getLogger().error("Failed to update backup session: " + errorMessage());
+            return false;
+        }
+        return sqlite3_changes(db) > 0;
+    }
+
+    std::optional<BackupSession> getBackupSession(std::int64_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        StatementScope stmt(prepare(std::string(SESSION_COLUMNS) + " WHERE id = ?"));
+        if (!stmt) {
+            return std::nullopt;
+        }
+
+        sqlite3_bind_int64(stmt.get(), 1, id);
+        if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+            return std::nullopt;
+        }
+        return readSession(stmt.get());
+    }
+
+    std::vector<BackupSession> getAllBackupSessions() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<BackupSession> result;
+        StatementScope stmt(prepare(std::string(SESSION_COLUMNS) + " ORDER BY id"));
+        while (stmt && sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            result.push_back(readSession(stmt.get()));
+        }
+        return result;
+    }
+
+    std::int64_t addFileRecord(const FileRecord& record, std::int64_t sessionId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!db) {
+            return -1;
+        }
+
+        const std::string path = normalizePath(record.path);
+        FileRecordEntry entry{path, record.checksum, record.size, record.modificationTime};
+        return addVersion(entry, &record, sessionId, previousSession(sessionId));
+    }
+
+    bool carryForwardFile(const std::filesystem::path& path, std::int64_t sessionId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!db) {
+            return false;
+        }
+
+        std::int64_t previous = previousSession(sessionId);
+        return previous > 0 && carryForward(normalizePath(path), sessionId, previous) > 0;
+    }
+
+    bool forgetFileRecord(const std::filesystem::path& path, std::int64_t sessionId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!db) {
+            return false;
+        }
+        return forget(normalizePath(path), sessionId, previousSession(sessionId));
+    }
+
+    bool recordFiles(const std::vector<FileRecordEntry>& entries, std::int64_t sessionId, bool replace,
+                     std::vector<std::size_t>& missing) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!db) {
+            return false;
+        }
+
+        const std::int64_t previous = previousSession(sessionId);
+        for (std::size_t i = 0; i < entries.size(); i++) {
+            const FileRecordEntry& entry = entries[i];
+            if (replace && !forget(entry.path, sessionId, previous)) {
+                return false;
+            }
+
+            if (entry.unchanged) {
+                const int carried = previous > 0 ? carryForward(entry.path, sessionId, previous) : 0;
+                if (carried < 0) {
+                    return false;
+                }
+                if (carried == 0) {
+                    missing.push_back(i);
+                }
+            }
+            else if (addVersion(entry, nullptr, sessionId, previous) < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::optional<FileRecord> getFileRecord(const std::filesystem::path& path, std::int64_t sessionId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        StatementScope stmt(prepare(std::string(VERSION_COLUMNS) +
+            " WHERE v.path_id = (SELECT id FROM paths WHERE path = ?1)"
+            " AND v.first_session <= ?2 AND v.last_session >= ?2"
+            " AND f.destination_path = (SELECT destination_path FROM sessions WHERE id = ?2)"
+            " LIMIT 1"));
+        if (!stmt) {
+            return std::nullopt;
+        }
+
+        std::string normalized = normalizePath(path);
+        sqlite3_bind_text(stmt.get(), 1, normalized.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt.get(), 2, sessionId);
+        if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+            return std::nullopt;
+        }
+        return readVersion(stmt.get()).record;
+    }
+
+    std::vector<FileRecord> findFilesByChecksum(const std::string& checksum) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<FileRecord> result;
+        StatementScope stmt(prepare(std::string(VERSION_COLUMNS) + " WHERE v.checksum = ? ORDER BY v.first_session"));
+        if (stmt) {
+            sqlite3_bind_text(stmt.get(), 1, checksum.c_str(), -1, SQLITE_TRANSIENT);
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                result.push_back(readVersion(stmt.get()).record);
+            }
+        }
+        return result;
+    }
+
+    std::vector<FileRecord> getSessionFiles(std::int64_t sessionId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<FileRecord> result;
+        StatementScope stmt(prepare(std::string(VERSION_COLUMNS) +
+            " WHERE v.first_session <= ?1 AND v.last_session >= ?1"
+            " AND f.destination_path = (SELECT destination_path FROM sessions WHERE id = ?1)"
+            " ORDER BY p.path"));
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, sessionId);
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                result.push_back(readVersion(stmt.get()).record);
+            }
+        }
+        return result;
+    }
+
+    std::vector<FileVersion> getFileVersions(const std::filesystem::path& path, const std::filesystem::path& destinationPath) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<FileVersion> result;
+        StatementScope stmt(prepare(std::string(VERSION_COLUMNS) +
+            " WHERE v.path_id = (SELECT id FROM paths WHERE path = ?1)"
+            " AND (?2 = '' OR f.destination_path = ?2)"
+            " ORDER BY v.first_session"));
+        if (stmt) {
+            std::string normalized = normalizePath(path);
+            sqlite3_bind_text(stmt.get(), 1, normalized.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt.get(), 2, destinationPath.c_str(), -1, SQLITE_TRANSIENT);
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                result.push_back(readVersion(stmt.get()));
+            }
+        }
+        return result;
+    }
+
+    std::vector<FileVersion> getVersionsChangedBetween(
+        const std::chrono::system_clock::time_point& from,
+        const std::chrono::system_clock::time_point& to,
+        const std::filesystem::path& destinationPath) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<FileVersion> result;
+        StatementScope stmt(prepare(std::string(VERSION_COLUMNS) +
+            " WHERE v.first_session IN (SELECT id FROM sessions WHERE start_time > ?1 AND start_time <= ?2"
+            " AND (?3 = '' OR destination_path = ?3))"
+            " ORDER BY v.first_session, p.path"));
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, toSeconds(from));
+            sqlite3_bind_int64(stmt.get(), 2, toSeconds(to));
+            sqlite3_bind_text(stmt.get(), 3, destinationPath.c_str(), -1, SQLITE_TRANSIENT);
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                result.push_back(readVersion(stmt.get()));
+            }
+        }
+        return result;
+    }
+
+    std::vector<FileVersion> findFiles(
+        const std::string& pattern,
+        const std::filesystem::path& destinationPath,
+        std::size_t limit) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<FileVersion> result;
+        if (pattern.empty()) {
+            return result;
+        }
+
+        // A glob matches whole names case-sensitively; anything else is a
+        // case-insensitive substring. '%' and '_' in a substring are LIKE
+        // wildcards, so every candidate is checked again below.
+        const bool glob = isGlobPattern(pattern);
+        const std::string names = nameIndex ? "SELECT rowid FROM path_names WHERE name " : "SELECT id FROM paths WHERE name_of(path) ";
+        StatementScope stmt(prepare(std::string(VERSION_COLUMNS) +
+            " WHERE v.path_id IN (" + names + (glob ? "GLOB ?1" : "LIKE ?1") + ")"
+            " AND (?2 = '' OR f.destination_path = ?2)"
+            " ORDER BY p.path, v.first_session"));
+        if (!stmt) {
+            return result;
+        }
+
+        std::string bound = glob ? pattern : "%" + pattern + "%";
+        sqlite3_bind_text(stmt.get(), 1, bound.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt.get(), 2, destinationPath.c_str(), -1, SQLITE_TRANSIENT);
+
+        std::size_t matchedPaths = 0;
+        std::int64_t lastPathId = 0;
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            FileVersion version = readVersion(stmt.get());
+            if (!glob && !containsIgnoreCase(fileName(version.record.path.native()), pattern)) {
+                continue;
+            }
+
+            // The limit counts paths, so every version of the last path is returned
+            std::int64_t pathId = sqlite3_column_int64(stmt.get(), 14);
+            if (pathId != lastPathId) {
+                if (matchedPaths == limit) {
+                    break;
+                }
+                matchedPaths++;
+                lastPathId = pathId;
+            }
+            result.push_back(std::move(version));
+        }
+        return result;
+    }
+
+    bool deleteBackupSession(std::int64_t sessionId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!db) {
+            return false;
+        }
+
+        std::int64_t previous = previousSession(sessionId);
+        std::int64_t next = nextSession(sessionId);
+
+        // Versions only live in this session disappear; the others shrink to the
+        // neighbouring sessions, which stay consecutive once this one is gone
+        bool ok = execLocked("SAVEPOINT delete_session");
+
+        // Paths whose only versions belong to this session leave the catalog and the name index
+        ok = ok && execLocked("DELETE FROM orphan_paths");
+        ok = ok && runUpdate(
+            "INSERT INTO orphan_paths (id) SELECT DISTINCT v.path_id FROM versions v "
+            "WHERE v.first_session = ?1 AND v.last_session = ?1 AND NOT EXISTS ("
+            "SELECT 1 FROM versions o WHERE o.path_id = v.path_id AND (o.first_session <> ?1 OR o.last_session <> ?1))",
+            sessionId, 0);
+
+        ok = ok && runUpdate("DELETE FROM versions WHERE first_session = ?1 AND last_session = ?1", sessionId, 0);
+        if (next > 0) {
+            ok = ok && runUpdate("UPDATE versions SET first_session = ?2 WHERE first_session = ?1", sessionId, next);
+        }
+        if (previous > 0) {
+            ok = ok && runUpdate("UPDATE versions SET last_session = ?2 WHERE last_session = ?1", sessionId, previous);
+        }
+        ok = ok && runUpdate("DELETE FROM sessions WHERE id = ?1", sessionId, 0);
+        if (nameIndex) {
+            ok = ok && execLocked("DELETE FROM path_names WHERE rowid IN (SELECT id FROM orphan_paths)");
+        }
+        ok = ok && execLocked("DELETE FROM paths WHERE id IN (SELECT id FROM orphan_paths)");
+
+        if (!ok) {
+            getLogger().error("Failed to delete backup session " + std::to_string(sessionId) + ": " + errorMessage());
+            execLocked("ROLLBACK TO delete_session; RELEASE delete_session");
+            return false;
+        }
+        return execLocked("RELEASE delete_session");
+    }
+
+private:
+    void closeLocked() {
+        for (auto& [sql, stmt] : statements) {
+            sqlite3_finalize(stmt);
+        }
+        statements.clear();
+
+        if (db) {
+            sqlite3_close(db);
+            db = nullptr;
+        }
+    }
+
+    std::string errorMessage() const {
+        return db ? sqlite3_errmsg(db) : "database is not open";
+    }
+
+    bool execLocked(const char* sql, bool logErrors = true) {
+        char* error = nullptr;
+        if (sqlite3_exec(db, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+            if (logErrors) {
+                getLogger().error("Database error: " + std::string(error ? error : "unknown"));
+            }
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+    // Prepared statements are compiled once and reused; looking one up does not allocate
+    sqlite3_stmt* prepare(std::string_view sql) {
+        if (!db) {
+            return nullptr;
+        }
+
+        auto it = statements.find(sql);
+        if (it != statements.end()) {
+            return it->second;
+        }
+
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v3(db, sql.data(), static_cast<int>(sql.size()), SQLITE_PREPARE_PERSISTENT, &stmt,
+                               nullptr) != SQLITE_OK) {
+            getLogger().error("Failed to prepare statement: " + errorMessage());
+            return nullptr;
+        }
+        statements.emplace(std::string(sql), stmt);
+        return stmt;
+    }
+
+    // Add a version of a file, or extend its version of the previous session if the content is the same;
+    // record supplies the optional columns, which are NULL or 0 without it
+    std::int64_t addVersion(const FileRecordEntry& entry, const FileRecord* record, std::int64_t sessionId,
+                            std::int64_t previous) {
+        std::int64_t pathId = internPath(entry.path);
+        if (pathId < 0) {
+            return -1;
+        }
+
+        // Same content as in the previous session: extend that version instead of adding one
+        if (previous > 0 && !entry.checksum.empty()) {
+            StatementScope find(prepare("SELECT id, checksum FROM versions WHERE path_id = ? AND last_session = ?"));
+            if (!find) {
+                return -1;
+            }
+            sqlite3_bind_int64(find.get(), 1, pathId);
+            sqlite3_bind_int64(find.get(), 2, previous);
+            if (sqlite3_step(find.get()) == SQLITE_ROW && columnView(find.get(), 1) == entry.checksum) {
+                std::int64_t versionId = sqlite3_column_int64(find.get(), 0);
+                return extendVersion(versionId, sessionId) ? versionId : -1;
+            }
+        }
+
+        StatementScope insert(prepare(
+            "INSERT INTO versions (path_id, checksum, size, modification_time, first_session, last_session, "
+            "hardlink_target, is_symlink, symlink_target, is_compressed, is_encrypted) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"));
+        if (!insert) {
+            return -1;
+        }
+
+        sqlite3_bind_int64(insert.get(), 1, pathId);
+        bindText(insert.get(), 2, entry.checksum);
+        sqlite3_bind_int64(insert.get(), 3, static_cast<sqlite3_int64>(entry.size));
+        sqlite3_bind_int64(insert.get(), 4, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            entry.modificationTime.time_since_epoch()).count());
+        sqlite3_bind_int64(insert.get(), 5, sessionId);
+        sqlite3_bind_int64(insert.get(), 6, sessionId);
+        if (record) {
+            bindOptionalPath(insert.get(), 7, record->hardlinkTarget);
+            sqlite3_bind_int(insert.get(), 8, record->isSymlink ? 1 : 0);
+            bindOptionalPath(insert.get(), 9, record->symlinkTarget);
+            sqlite3_bind_int(insert.get(), 10, record->isCompressed ? 1 : 0);
+            sqlite3_bind_int(insert.get(), 11, record->isEncrypted ? 1 : 0);
+        }
+        else {
+            sqlite3_bind_int(insert.get(), 8, 0);
+            sqlite3_bind_int(insert.get(), 10, 0);
+            sqlite3_bind_int(insert.get(), 11, 0);
+        }
+
+        if (sqlite3_step(insert.get()) != SQLITE_DONE) {
+            getLogger().error("Failed to add file record for " + std::string(entry.path) + ": " + errorMessage());
+            return -1;
+        }
+        return sqlite3_last_insert_rowid(db);
+    }
+
+    // Extend a file's version of the previous session to this one; returns the number of
+    // versions extended (0 if the file had none), or -1 on error
+    int carryForward(std::string_view path, std::int64_t sessionId, std::int64_t previous) {
+        StatementScope stmt(prepare(
+            "UPDATE versions SET last_session = ?1 "
+            "WHERE path_id = (SELECT id FROM paths WHERE path = ?2) AND last_session = ?3"));
+        if (!stmt) {
+            return -1;
+        }
+
+        sqlite3_bind_int64(stmt.get(), 1, sessionId);
+        bindText(stmt.get(), 2, path);
+        sqlite3_bind_int64(stmt.get(), 3, previous);
+        return sqlite3_step(stmt.get()) == SQLITE_DONE ? sqlite3_changes(db) : -1;
+    }
+
+    // Undo what a session recorded for a file
+    bool forget(std::string_view path, std::int64_t sessionId, std::int64_t previous) {
+        StatementScope find(prepare("SELECT id FROM paths WHERE path = ?"));
+        if (!find) {
+            return false;
+        }
+        bindText(find.get(), 1, path);
+        if (sqlite3_step(find.get()) != SQLITE_ROW) {
+            return true;
+        }
+        std::int64_t pathId = sqlite3_column_int64(find.get(), 0);
+
+        if (!runUpdate("DELETE FROM versions WHERE path_id = ?1 AND first_session = ?2 AND last_session = ?2", pathId, sessionId)) {
+            return false;
+        }
+
+        if (previous <= 0) {
+            return true;
+        }
+        StatementScope shrink(prepare("UPDATE versions SET last_session = ?3 WHERE path_id = ?1 AND last_session = ?2"));
+        if (!shrink) {
+            return false;
+        }
+        sqlite3_bind_int64(shrink.get(), 1, pathId);
+        sqlite3_bind_int64(shrink.get(), 2, sessionId);
+        sqlite3_bind_int64(shrink.get(), 3, previous);
+        return sqlite3_step(shrink.get()) == SQLITE_DONE;
+    }
+
+    bool runUpdate(const char* sql, std::int64_t first, std::int64_t second) {
+        StatementScope stmt(prepare(sql));
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, first);
+        if (sqlite3_bind_parameter_count(stmt.get()) > 1) {
+            sqlite3_bind_int64(stmt.get(), 2, second);
+        }
+        return sqlite3_step(stmt.get()) == SQLITE_DONE;
+    }
+
+    bool extendVersion(std::int64_t versionId, std::int64_t sessionId) {
+        return runUpdate("UPDATE versions SET last_session = ?2 WHERE id = ?1", versionId, sessionId);
+    }
+
+    std::int64_t internPath(std::string_view path) {
+        StatementScope insert(prepare("INSERT OR IGNORE INTO paths (path) VALUES (?)"));
+        StatementScope select(prepare("SELECT id FROM paths WHERE path = ?"));
+        if (!insert || !select) {
+            return -1;
+        }
+
+        bindText(insert.get(), 1, path);
+        if (sqlite3_step(insert.get()) != SQLITE_DONE) {
+            getLogger().error("Failed to add path " + std::string(path) + ": " + errorMessage());
+            return -1;
+        }
+        if (sqlite3_changes(db) > 0) {
+            std::int64_t pathId = sqlite3_last_insert_rowid(db);
+            return !nameIndex || indexName(pathId, path) ? pathId : -1;
+        }
+
+        bindText(select.get(), 1, path);
+        return sqlite3_step(select.get()) == SQLITE_ROW ? sqlite3_column_int64(select.get(), 0) : -1;
+    }
+
+    bool indexName(std::int64_t pathId, std::string_view path) {
+        StatementScope stmt(prepare("INSERT INTO path_names (rowid, name) VALUES (?, ?)"));
+        if (!stmt) {
+            return false;
+        }
+
+        std::string_view name = fileName(path);
+        sqlite3_bind_int64(stmt.get(), 1, pathId);
+        bindText(stmt.get(), 2, name);
+        if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            getLogger().error("Failed to index file name " + std::string(name) + ": " + errorMessage());
+            return false;
+        }
+        return true;
+    }
+
+    // Index the names of paths recorded before the name index existed
+    bool indexExistingNames() {
+        std::vector<std::pair<std::int64_t, std::string>> missing;
+        {
+            StatementScope stmt(prepare(
+                "SELECT id, path FROM paths WHERE id > (SELECT coalesce(max(rowid), 0) FROM path_names) ORDER BY id"));
+            if (!stmt) {
+                return false;
+            }
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                missing.emplace_back(sqlite3_column_int64(stmt.get(), 0), columnText(stmt.get(), 1));
+            }
+        }
+        if (missing.empty()) {
+            return true;
+        }
+
+        getLogger().info("Indexing " + std::to_string(missing.size()) + " file names");
+        bool ok = execLocked("SAVEPOINT index_names");
+        for (const auto& [pathId, path] : missing) {
+            ok = ok && indexName(pathId, path);
+        }
+        if (!ok) {
+            execLocked("ROLLBACK TO index_names; RELEASE index_names");
+            return false;
+        }
+        return execLocked("RELEASE index_names");
+    }
+
+    // The session of the same destination directly before or after a session
+    std::int64_t previousSession(std::int64_t sessionId) {
+        return neighbourSession(
+            "SELECT id FROM sessions WHERE destination_path = (SELECT destination_path FROM sessions WHERE id = ?1) "
+            "AND id < ?1 ORDER BY id DESC LIMIT 1", sessionId);
+    }
+
+    std::int64_t nextSession(std::int64_t sessionId) {
+        return neighbourSession(
+            "SELECT id FROM sessions WHERE destination_path = (SELECT destination_path FROM sessions WHERE id = ?1) "
+            "AND id > ?1 ORDER BY id LIMIT 1", sessionId);
+    }
+
+    std::int64_t neighbourSession(const char* sql, std::int64_t sessionId) {
+        StatementScope stmt(prepare(sql));
+        if (!stmt) {
+            return -1;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, sessionId);
+        return sqlite3_step(stmt.get()) == SQLITE_ROW ? sqlite3_column_int64(stmt.get(), 0) : -1;
+    }
+
+    // SQL function name_of(path): the file name part of a catalog path
+    static void nameOfFunction(sqlite3_context* context, int, sqlite3_value** args) {
+        const unsigned char* text = sqlite3_value_text(args[0]);
+        if (!text) {
+            sqlite3_result_null(context);
+            return;
+        }
+        std::string_view name = fileName(std::string_view(reinterpret_cast<const char*>(text), sqlite3_value_bytes(args[0])));
+        sqlite3_result_text(context, name.data(), static_cast<int>(name.size()), SQLITE_TRANSIENT);
+    }
+
+    static void bindSession(sqlite3_stmt* stmt, const BackupSession& session) {
+        sqlite3_bind_int64(stmt, 1, toSeconds(session.startTime));
+        if (session.endTime) {
+            sqlite3_bind_int64(stmt, 2, toSeconds(*session.endTime));
+        } else {
+            sqlite3_bind_null(stmt, 2);
+        }
+        sqlite3_bind_text(stmt, 3, session.sourcePath.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 4, session.destinationPath.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 5, session.isComplete ? 1 : 0);
+        sqlite3_bind_int(stmt, 6, session.isVerified ? 1 : 0);
+        sqlite3_bind_int(stmt, 7, session.totalFiles);
+        sqlite3_bind_int64(stmt, 8, static_cast<sqlite3_int64>(session.totalSize));
+    }
+
+    // Bind text that outlives the statement's execution, without copying it
+    static void bindText(sqlite3_stmt* stmt, int index, std::string_view text) {
+        sqlite3_bind_text(stmt, index, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+    }
+
+    static void bindOptionalPath(sqlite3_stmt* stmt, int index, const std::optional<std::filesystem::path>& path) {
+        if (path) {
+            sqlite3_bind_text(stmt, index, path->c_str(), -1, SQLITE_TRANSIENT);
+        } else {
+            sqlite3_bind_null(stmt, index);
+        }
+    }
+
+    static BackupSession readSession(sqlite3_stmt* stmt) {
+        BackupSession session;
+        session.id = sqlite3_column_int64(stmt, 0);
+        session.startTime = fromSeconds(sqlite3_column_int64(stmt, 1));
+        if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
+            session.endTime = fromSeconds(sqlite3_column_int64(stmt, 2));
+        }
+        session.sourcePath = columnText(stmt, 3);
+        session.destinationPath = columnText(stmt, 4);
+        session.isComplete = sqlite3_column_int(stmt, 5) != 0;
+        session.isVerified = sqlite3_column_int(stmt, 6) != 0;
+        session.totalFiles = sqlite3_column_int(stmt, 7);
+        session.totalSize = static_cast<std::uintmax_t>(sqlite3_column_int64(stmt, 8));
+        return session;
+    }
+
+    static FileVersion readVersion(sqlite3_stmt* stmt) {
+        FileVersion version;
+        FileRecord& record = version.record;
+        record.id = sqlite3_column_int64(stmt, 0);
+        record.path = columnText(stmt, 1);
+        record.checksum = columnText(stmt, 2);
+        record.size = static_cast<std::uintmax_t>(sqlite3_column_int64(stmt, 3));
+        record.modificationTime = std::filesystem::file_time_type(
+            std::chrono::duration_cast<std::filesystem::file_time_type::duration>(
+                std::chrono::nanoseconds(sqlite3_column_int64(stmt, 4))));
+        if (sqlite3_column_type(stmt, 5) != SQLITE_NULL) {
+            record.hardlinkTarget = columnText(stmt, 5);
+        }
+        record.isSymlink = sqlite3_column_int(stmt, 6) != 0;
+        if (sqlite3_column_type(stmt, 7) != SQLITE_NULL) {
+            record.symlinkTarget = columnText(stmt, 7);
+        }
+        record.isCompressed = sqlite3_column_int(stmt, 8) != 0;
+        record.isEncrypted = sqlite3_column_int(stmt, 9) != 0;
+
+        version.firstSessionId = sqlite3_column_int64(stmt, 10);
+        version.lastSessionId = sqlite3_column_int64(stmt, 11);
+        version.firstSeen = fromSeconds(sqlite3_column_int64(stmt, 12));
+        version.lastSeen = fromSeconds(sqlite3_column_int64(stmt, 13));
+        record.backupTime = version.firstSeen;
+        return version;
+    }
+
+    std::mutex mutex;
+    sqlite3* db = nullptr;
+    std::map<std::string, sqlite3_stmt*, std::less<>> statements;
+    bool nameIndex = false;
+};
+
+// Database implementation
+
+Database::Database() : pImpl(std::make_unique<Impl>()) {
+}
+
+Database::~Database() = default;
+
+bool Database::open(const std::filesystem::path& path) {
+    return pImpl->open(path);
+}
+
+void Database::close() {
+    pImpl->close();
+}
+
+bool Database::beginTransaction() {
+    return pImpl->exec("BEGIN IMMEDIATE");
+}
+
+bool Database::commitTransaction() {
+    return pImpl->exec("COMMIT");
+}
+
+bool Database::rollbackTransaction() {
+    return pImpl->exec("ROLLBACK");
+}
+
+std::int64_t Database::createBackupSession(const BackupSession& session) {
+    return pImpl->createBackupSession(session);
+}
+
+bool Database::updateBackupSession(const BackupSession& session) {
+    return pImpl->updateBackupSession(session);
+}
+
+std::optional<BackupSession> Database::getBackupSession(std::int64_t id) {
+    return pImpl->getBackupSession(id);
+}
+
+std::vector<BackupSession> Database::getAllBackupSessions() {
+    return pImpl->getAllBackupSessions();
+}
+
+std::int64_t Database::addFileRecord(const FileRecord& record, std::int64_t sessionId) {
+    return pImpl->addFileRecord(record, sessionId);
+}
+
+bool Database::carryForwardFile(const std::filesystem::path& path, std::int64_t sessionId) {
+    return pImpl->carryForwardFile(path, sessionId);
+}
+
+bool Database::forgetFileRecord(const std::filesystem::path& path, std::int64_t sessionId) {
+    return pImpl->forgetFileRecord(path, sessionId);
+}
+
+bool Database::recordFiles(
+    const std::vector<FileRecordEntry>& entries,
+    std::int64_t sessionId,
+    bool replace,
+    std::vector<std::size_t>& missing) {
+    return pImpl->recordFiles(entries, sessionId, replace, missing);
+}
+
+std::optional<FileRecord> Database::getFileRecord(
+    const std::filesystem::path& path,
+    std::int64_t sessionId) {
+    return pImpl->getFileRecord(path, sessionId);
+}
+
+std::vector<FileRecord> Database::findFilesByChecksum(const std::string& checksum) {
+    return pImpl->findFilesByChecksum(checksum);
+}
+
+std::vector<FileRecord> Database::getSessionFiles(std::int64_t sessionId) {
+    return pImpl->getSessionFiles(sessionId);
+}
+
+std::vector<FileRecord> Database::getFileHistory(const std::filesystem::path& path) {
+    std::vector<FileRecord> result;
+    for (auto& version : pImpl->getFileVersions(path, {})) {
+        result.push_back(std::move(version.record));
+    }
+    return result;
+}
+
+std::vector<FileVersion> Database::getFileVersions(
+    const std::filesystem::path& path,
+    const std::filesystem::path& destinationPath) {
+    return pImpl->getFileVersions(path, destinationPath);
+}
+
+std::vector<FileVersion> Database::getVersionsChangedBetween(
+    const std::chrono::system_clock::time_point& from,
+    const std::chrono::system_clock::time_point& to,
+    const std::filesystem::path& destinationPath) {
+    return pImpl->getVersionsChangedBetween(from, to, destinationPath);
+}
+
+std::vector<FileVersion> Database::findFiles(
+    const std::string& pattern,
+    const std::filesystem::path& destinationPath,
+    std::size_t limit) {
+    return pImpl->findFiles(pattern, destinationPath, limit);
+}
+
+bool Database::deleteBackupSession(std::int64_t sessionId) {
+    return pImpl->deleteBackupSession(sessionId);
+}
+
+} // namespace utm
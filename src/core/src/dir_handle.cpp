@@ -0,0 +1,441 @@
+#include "utm/dir_handle.hpp"
+#include "utm/io_limiter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+namespace utm::fs {
+
+// FileHandle implementation
+
+FileHandle::~FileHandle() {
+    close();
+}
+
+FileHandle::FileHandle(FileHandle&& other) noexcept : fd(other.release()) {
+}
+
+FileHandle& FileHandle::operator=(FileHandle&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = other.release();
+    }
+    return *this;
+}
+
+int FileHandle::release() noexcept {
+    int result = fd;
+    fd = -1;
+    return result;
+}
+
+bool FileHandle::close() noexcept {
+    if (fd < 0) {
+        return true;
+    }
+    int result = ::close(fd);
+    fd = -1;
+    return result == 0;
+}
+
+// Free functions
+
+namespace {
+    constexpr unsigned int STATX_FIELDS =
+        STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_MTIME;
+
+    void fromStatx(const struct statx& stx, FileStat& out) {
+        out.mode = stx.stx_mode;
+        out.size = stx.stx_size;
+        out.inode = stx.stx_ino;
+        out.device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        out.linkCount = stx.stx_nlink;
+        out.modified.tv_sec = stx.stx_mtime.tv_sec;
+        out.modified.tv_nsec = stx.stx_mtime.tv_nsec;
+    }
+}
+
+bool statAt(int dirFd, const char* name, FileStat& out, bool followSymlinks) {
+    struct statx stx;
+    int flags = AT_STATX_SYNC_AS_STAT | (followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW);
+    if (::statx(dirFd, name, flags, STATX_FIELDS, &stx) != 0) {
+        return false;
+    }
+    fromStatx(stx, out);
+    return true;
+}
+
+bool statFd(int fd, FileStat& out) {
+    struct statx stx;
+    if (::statx(fd, "", AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, STATX_FIELDS, &stx) != 0) {
+        return false;
+    }
+    fromStatx(stx, out);
+    return true;
+}
+
+FileHandle openDirectoryAt(int dirFd, const char* name) {
+    return FileHandle(::openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+}
+
+FileHandle openAt(int dirFd, const char* name, int flags, mode_t mode) {
+    return FileHandle(::openat(dirFd, name, flags | O_CLOEXEC, mode));
+}
+
+bool mkdirAt(int dirFd, const char* name, mode_t mode) {
+    return ::mkdirat(dirFd, name, mode) == 0 || errno == EEXIST;
+}
+
+bool linkAt(int fromDirFd, const char* fromName, int toDirFd, const char* toName) {
+    return ::linkat(fromDirFd, fromName, toDirFd, toName, 0) == 0;
+}
+
+bool renameAt(int fromDirFd, const char* fromName, int toDirFd, const char* toName) {
+    return ::renameat(fromDirFd, fromName, toDirFd, toName) == 0;
+}
+
+bool copyContents(int in, int out, std::vector<char>& buffer, IoLimiter* limiter) {
+    return copyContents(in, out, buffer, limiter, nullptr);
+}
+
+bool copyContents(int in, int out, std::vector<char>& buffer, IoLimiter* limiter,
+                  const std::function<void(const char* data, std::size_t size)>& consume) {
+    // Let the kernel copy (and possibly share extents) when it can; limited copies go in small steps
+    const std::size_t chunk = limiter ? limiter->chunkSize(1 << 30) : 1 << 30;
+    while (!consume) {
+        ssize_t copied = ::copy_file_range(in, nullptr, out, nullptr, chunk, 0);
+        if (copied > 0) {
+            if (limiter) {
+                limiter->read(static_cast<std::uint64_t>(copied));
+                limiter->write(static_cast<std::uint64_t>(copied));
+            }
+            continue;
+        }
+        if (copied == 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+            break;
+        }
+        return false;
+    }
+
+    // Fall back to a plain read/write loop
+    if (buffer.empty()) {
+        buffer.resize(128 * 1024);
+    }
+
+    while (true) {
+        ssize_t n = ::read(in, buffer.data(), buffer.size());
+        if (n == 0) {
+            return true;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (limiter) {
+            limiter->read(static_cast<std::uint64_t>(n));
+        }
+        if (consume) {
+            consume(buffer.data(), static_cast<std::size_t>(n));
+        }
+
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = ::write(out, buffer.data() + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += w;
+        }
+        if (limiter) {
+            limiter->write(static_cast<std::uint64_t>(n));
+        }
+    }
+}
+
+bool copyRange(int in, int out, off_t offset, std::uintmax_t length, std::vector<char>& buffer, IoLimiter* limiter) {
+    loff_t inOffset = offset;
+    loff_t outOffset = offset;
+    std::uintmax_t remaining = length;
+    const std::size_t maxChunk = limiter ? limiter->chunkSize(1 << 30) : 1 << 30;
+
+    while (remaining > 0) {
+        std::size_t chunk = static_cast<std::size_t>(std::min<std::uintmax_t>(remaining, maxChunk));
+        ssize_t copied = ::copy_file_range(in, &inOffset, out, &outOffset, chunk, 0);
+        if (copied > 0) {
+            remaining -= copied;
+            if (limiter) {
+                limiter->read(static_cast<std::uint64_t>(copied));
+                limiter->write(static_cast<std::uint64_t>(copied));
+            }
+            continue;
+        }
+        if (copied == 0) {
+            // Source shrank underneath us
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+            break;
+        }
+        return false;
+    }
+
+    // Fall back to positional reads and writes
+    if (buffer.empty()) {
+        buffer.resize(128 * 1024);
+    }
+
+    while (remaining > 0) {
+        std::size_t want = static_cast<std::size_t>(std::min<std::uintmax_t>(remaining, buffer.size()));
+        ssize_t n = ::pread(in, buffer.data(), want, inOffset);
+        if (n == 0) {
+            return true;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (limiter) {
+            limiter->read(static_cast<std::uint64_t>(n));
+        }
+
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = ::pwrite(out, buffer.data() + written, n - written, outOffset + written);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += w;
+        }
+        if (limiter) {
+            limiter->write(static_cast<std::uint64_t>(n));
+        }
+
+        inOffset += n;
+        outOffset += n;
+        remaining -= n;
+    }
+
+    return true;
+}
+
+bool cloneFile(int in, int out) {
+    return ::ioctl(out, FICLONE, in) == 0;
+}
+
+bool physicalOffset(int fd, std::uint64_t& offset) {
+    // Room for the header and a single extent; only the first one is needed
+    alignas(struct fiemap) char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    auto* map = reinterpret_cast<struct fiemap*>(buffer);
+    map->fm_start = 0;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_flags = 0;
+    map->fm_extent_count = 1;
+
+    if (::ioctl(fd, FS_IOC_FIEMAP, map) != 0) {
+        return false;
+    }
+
+    // Files without data (or with data inline in the inode) have no extent to seek to
+    offset = map->fm_mapped_extents > 0 && !(map->fm_extents[0].fe_flags & FIEMAP_EXTENT_DATA_INLINE)
+        ? map->fm_extents[0].fe_physical : 0;
+    return true;
+}
+
+std::filesystem::file_type fileType(mode_t mode) {
+    switch (mode & S_IFMT) {
+        case S_IFREG: return std::filesystem::file_type::regular;
+        case S_IFDIR: return std::filesystem::file_type::directory;
+        case S_IFLNK: return std::filesystem::file_type::symlink;
+        case S_IFBLK: return std::filesystem::file_type::block;
+        case S_IFCHR: return std::filesystem::file_type::character;
+        case S_IFIFO: return std::filesystem::file_type::fifo;
+        case S_IFSOCK: return std::filesystem::file_type::socket;
+        default: return std::filesystem::file_type::unknown;
+    }
+}
+
+std::string joinRelative(std::string_view directory, std::string_view name) {
+    std::string result;
+    result.reserve(directory.size() + name.size() + 1);
+    result.append(directory);
+    if (!result.empty() && !name.empty()) {
+        result.push_back('/');
+    }
+    result.append(name);
+    return result;
+}
+
+bool isSnapshotMetadata(std::string_view name) {
+    return name == "backup-info.json" || name.starts_with(".utm-");
+}
+
+// DirectoryCache implementation
+
+class DirectoryCache::Impl {
+public:
+    Impl(const std::filesystem::path& root, std::size_t maxOpen, bool create)
+        : maxOpen(std::max<std::size_t>(maxOpen, 1)), create(create) {
+        if (create) {
+            std::error_code ec;
+            std::filesystem::create_directories(root, ec);
+        }
+        rootHandle = std::make_shared<FileHandle>(openDirectoryAt(AT_FDCWD, root.c_str()));
+    }
+
+    std::shared_ptr<FileHandle> get(std::string_view relativeDir) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lookup(relativeDir);
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<FileHandle> handle;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    std::shared_ptr<FileHandle> lookup(std::string_view relativeDir) {
+        while (!relativeDir.empty() && relativeDir.back() == '/') {
+            relativeDir.remove_suffix(1);
+        }
+        if (relativeDir.empty()) {
+            return rootHandle;
+        }
+
+        std::string key(relativeDir);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lruPosition);
+            return it->second.handle;
+        }
+
+        // Resolve the parent first (it is cached in turn), then create this level
+        std::string_view parentDir;
+        std::string_view name = relativeDir;
+        if (auto slash = relativeDir.rfind('/'); slash != std::string_view::npos) {
+            parentDir = relativeDir.substr(0, slash);
+            name = relativeDir.substr(slash + 1);
+        }
+
+        std::shared_ptr<FileHandle> parent = lookup(parentDir);
+        if (!parent || !parent->valid()) {
+            return std::make_shared<FileHandle>();
+        }
+
+        std::string nameString(name);
+        if (create && !mkdirAt(parent->get(), nameString.c_str())) {
+            return std::make_shared<FileHandle>();
+        }
+
+        auto handle = std::make_shared<FileHandle>(openDirectoryAt(parent->get(), nameString.c_str()));
+        if (!handle->valid()) {
+            return handle;
+        }
+
+        lru.push_front(key);
+        entries.emplace(std::move(key), Entry{handle, lru.begin()});
+
+        // Evict the least recently used descriptors; users keep theirs alive
+        while (entries.size() > maxOpen) {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+
+        return handle;
+    }
+
+    std::mutex mutex;
+    std::size_t maxOpen;
+    bool create;
+    std::shared_ptr<FileHandle> rootHandle;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;
+};
+
+DirectoryCache::DirectoryCache(const std::filesystem::path& root, std::size_t maxOpen, bool create)
+    : pImpl(std::make_unique<Impl>(root, maxOpen, create)) {
+}
+
+DirectoryCache::~DirectoryCache() = default;
+
+std::shared_ptr<FileHandle> DirectoryCache::get(std::string_view relativeDir) {
+    return pImpl->get(relativeDir);
+}
+
+// DirStack implementation
+
+bool DirStack::openRoot(const std::filesystem::path& root, bool create) {
+    clear();
+
+    if (root.empty()) {
+        levels.emplace_back();
+        return false;
+    }
+
+    if (create) {
+        std::error_code ec;
+        std::filesystem::create_directories(root, ec);
+    }
+
+    levels.push_back(openDirectoryAt(AT_FDCWD, root.c_str()));
+    return levels.back().valid();
+}
+
+bool DirStack::enter(const char* name, bool create) {
+    int parent = fd();
+    if (parent < 0) {
+        levels.emplace_back();
+        return false;
+    }
+
+    if (create && !mkdirAt(parent, name)) {
+        levels.emplace_back();
+        return false;
+    }
+
+    levels.push_back(openDirectoryAt(parent, name));
+    return levels.back().valid();
+}
+
+void DirStack::leave() noexcept {
+    if (levels.size() > 1) {
+        levels.pop_back();
+    }
+}
+
+void DirStack::clear() noexcept {
+    levels.clear();
+}
+
+int DirStack::fd() const noexcept {
+    return levels.empty() ? -1 : levels.back().get();
+}
+
+} // namespace utm::fs
@@ -0,0 +1,401 @@
+#include "utm/event_log.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::FileHandle;
+using fs::FileStat;
+
+namespace {
+
+constexpr char EVENT_MAGIC[8] = {'U', 'T', 'M', 'E', 'V', 'L', 'O', 'G'};
+constexpr std::uint32_t EVENT_VERSION = 1;
+
+// Records start on their own page, after the header
+constexpr std::uint64_t RECORDS_OFFSET = 4096;
+
+// Paths are written out in chunks of about this size
+constexpr std::size_t PATHS_BUFFER_SIZE = 64 * 1024;
+
+struct EventLogHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+    std::uint64_t capacity;         // records in the ring
+    std::uint64_t next;             // events recorded so far, only updated atomically
+    std::int64_t openedNs;          // wall clock time the log was opened, since the epoch
+};
+
+static_assert(sizeof(EventLogHeader) <= RECORDS_OFFSET, "header must fit before the records");
+
+std::filesystem::path pathsFileOf(const std::filesystem::path& file) {
+    std::filesystem::path paths = file;
+    paths.replace_extension(".paths");
+    return paths;
+}
+
+// One path per line: id, tab, path with backslash, newline and tab escaped
+void appendPathLine(std::string& out, std::uint32_t id, std::string_view path) {
+    out += std::to_string(id);
+    out += '\t';
+    for (char c : path) {
+        switch (c) {
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:   out += c; break;
+        }
+    }
+    out += '\n';
+}
+
+std::string unescapePath(std::string_view escaped) {
+    std::string path;
+    path.reserve(escaped.size());
+    for (std::size_t i = 0; i < escaped.size(); i++) {
+        if (escaped[i] == '\\' && i + 1 < escaped.size()) {
+            const char c = escaped[++i];
+            path += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+        } else {
+            path += escaped[i];
+        }
+    }
+    return path;
+}
+
+} // namespace
+
+const char* eventPhaseToString(EventPhase phase) {
+    switch (phase) {
+        case EventPhase::READ_DIRECTORY: return "readdir";
+        case EventPhase::COPY:           return "copy";
+        case EventPhase::LINK:           return "link";
+        default:                         return "unknown";
+    }
+}
+
+// Implementation class for EventLog
+class EventLog::Impl {
+public:
+    ~Impl() {
+        close();
+    }
+
+    bool open(const std::filesystem::path& file, std::size_t capacity) {
+        close();
+        capacity = std::max<std::size_t>(capacity, 1);
+
+        const std::uint64_t fileLength = RECORDS_OFFSET + capacity * sizeof(EventRecord);
+        FileHandle out = fs::openAt(AT_FDCWD, file.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW, 0644);
+        if (!out.valid()) {
+            getLogger().error("Failed to create event log " + file.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        // Another backup of the profile may be recording into the file; truncating it under that
+        // backup's mapping would crash it, so this backup goes without events. The lock is held until close().
+        if (::flock(out.get(), LOCK_EX | LOCK_NB) != 0) {
+            getLogger().warning("Event log " + file.string() + " is in use by another backup, not recording events");
+            return false;
+        }
+        if (::ftruncate(out.get(), 0) != 0 || ::ftruncate(out.get(), fileLength) != 0) {
+            getLogger().error("Failed to create event log " + file.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        const std::filesystem::path pathsFile = pathsFileOf(file);
+        FileHandle pathsOut = fs::openAt(AT_FDCWD, pathsFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (!pathsOut.valid()) {
+            getLogger().error("Failed to create event log " + pathsFile.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        void* mapping = ::mmap(nullptr, fileLength, PROT_READ | PROT_WRITE, MAP_SHARED, out.get(), 0);
+        if (mapping == MAP_FAILED) {
+            getLogger().error("Failed to map event log " + file.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        data = static_cast<char*>(mapping);
+        length = fileLength;
+        header = reinterpret_cast<EventLogHeader*>(data);
+        std::memcpy(header->magic, EVENT_MAGIC, sizeof(EVENT_MAGIC));
+        header->version = EVENT_VERSION;
+        header->recordSize = sizeof(EventRecord);
+        header->capacity = capacity;
+        header->next = 0;
+        header->openedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        records = reinterpret_cast<EventRecord*>(data + RECORDS_OFFSET);
+        this->capacity = capacity;
+        opened = std::chrono::steady_clock::now();
+
+        fd = std::move(out);
+        pathsFd = std::move(pathsOut);
+        nextPath = 1;
+        getLogger().info("Recording backup events in " + file.string());
+        return true;
+    }
+
+    void close() {
+        if (!data) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pathsMutex);
+            flushPaths();
+        }
+
+        const std::uint64_t written = std::min<std::uint64_t>(header->next, capacity);
+        ::munmap(data, length);
+        data = nullptr;
+        header = nullptr;
+        records = nullptr;
+
+        // A ring that never wrapped keeps only the records written
+        if (::ftruncate(fd.get(), RECORDS_OFFSET + written * sizeof(EventRecord)) != 0) {
+            getLogger().warning("Failed to trim event log: " + std::string(std::strerror(errno)));
+        }
+        fd.close();
+        pathsFd.close();
+    }
+
+    bool isOpen() const noexcept {
+        return data != nullptr;
+    }
+
+    std::chrono::steady_clock::time_point start() const noexcept {
+        return data ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    }
+
+    std::uint32_t addPath(std::string_view path) {
+        if (!data) {
+            return NO_PATH;
+        }
+
+        std::lock_guard<std::mutex> lock(pathsMutex);
+        const std::uint32_t id = nextPath++;
+        appendPathLine(pathsBuffer, id, path);
+        if (pathsBuffer.size() >= PATHS_BUFFER_SIZE) {
+            flushPaths();
+        }
+        return id;
+    }
+
+    void record(EventPhase phase, std::uint32_t directory, std::uint64_t bytes,
+                std::chrono::steady_clock::time_point started, bool failed, std::string_view file) {
+        if (!data) {
+            return;
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - started;
+        EventRecord event;
+        event.time = started > opened ? std::chrono::duration_cast<std::chrono::nanoseconds>(started - opened).count() : 0;
+        event.bytes = bytes;
+        event.latency = static_cast<std::uint32_t>(std::min<std::chrono::microseconds::rep>(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(),
+            std::numeric_limits<std::uint32_t>::max()));
+        event.directory = directory;
+        event.file = elapsed >= SLOW_EVENT && !file.empty() ? addPath(file) : NO_PATH;
+        event.phase = phase;
+        event.failed = failed ? 1 : 0;
+
+        const std::uint64_t slot = std::atomic_ref<std::uint64_t>(header->next).fetch_add(1, std::memory_order_relaxed);
+        records[slot % capacity] = event;
+    }
+
+private:
+    FileHandle fd;
+    char* data = nullptr;
+    std::size_t length = 0;
+    EventLogHeader* header = nullptr;
+    EventRecord* records = nullptr;
+    std::uint64_t capacity = 0;
+    std::chrono::steady_clock::time_point opened;
+
+    // Path table, written in chunks
+    std::mutex pathsMutex;
+    FileHandle pathsFd;
+    std::string pathsBuffer;
+    std::uint32_t nextPath = 1;
+
+    void flushPaths() {
+        const char* buffer = pathsBuffer.data();
+        std::size_t remaining = pathsBuffer.size();
+        while (remaining > 0) {
+            ssize_t n = ::write(pathsFd.get(), buffer, remaining);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                getLogger().warning("Failed to write event log paths: " + std::string(std::strerror(errno)));
+                break;
+            }
+            buffer += n;
+            remaining -= n;
+        }
+        pathsBuffer.clear();
+    }
+};
+
+// EventLog implementation
+EventLog::EventLog() : pImpl(std::make_unique<Impl>()) {
+}
+
+EventLog::~EventLog() = default;
+
+bool EventLog::open(const std::filesystem::path& file, std::size_t capacity) {
+    return pImpl->open(file, capacity);
+}
+
+void EventLog::close() {
+    pImpl->close();
+}
+
+bool EventLog::isOpen() const noexcept {
+    return pImpl->isOpen();
+}
+
+std::chrono::steady_clock::time_point EventLog::start() const noexcept {
+    return pImpl->start();
+}
+
+std::uint32_t EventLog::addPath(std::string_view path) {
+    return pImpl->addPath(path);
+}
+
+void EventLog::record(EventPhase phase, std::uint32_t directory, std::uint64_t bytes,
+                      std::chrono::steady_clock::time_point started, bool failed, std::string_view file) {
+    pImpl->record(phase, directory, bytes, started, failed, file);
+}
+
+const std::string& EventLogContents::path(std::uint32_t id) const {
+    static const std::string none;
+    return id < paths.size() ? paths[id] : none;
+}
+
+std::optional<EventLogContents> readEventLog(const std::filesystem::path& file) {
+    FileHandle fd = fs::openAt(AT_FDCWD, file.c_str(), O_RDONLY);
+    FileStat st;
+    if (!fd.valid() || !fs::statFd(fd.get(), st) || st.size < RECORDS_OFFSET) {
+        getLogger().error("Failed to open event log: " + file.string());
+        return std::nullopt;
+    }
+
+    // Read rather than mapped: a backup that starts recording may truncate the file at any time
+    std::vector<char> data(st.size);
+    std::size_t size = 0;
+    while (size < data.size()) {
+        ssize_t n = ::pread(fd.get(), data.data() + size, data.size() - size, static_cast<off_t>(size));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        size += static_cast<std::size_t>(n);
+    }
+
+    EventLogHeader header;
+    if (size < RECORDS_OFFSET) {
+        getLogger().error("Failed to read event log " + file.string());
+        return std::nullopt;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, EVENT_MAGIC, sizeof(EVENT_MAGIC)) != 0 || header.version != EVENT_VERSION ||
+        header.recordSize != sizeof(EventRecord) || header.capacity == 0) {
+        getLogger().error("Unsupported or corrupt event log: " + file.string());
+        return std::nullopt;
+    }
+
+    EventLogContents contents;
+    contents.opened = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(header.openedNs)));
+    contents.totalEvents = header.next;
+
+    // Oldest first; a ring that wrapped starts at the slot written next
+    const std::uint64_t available = (size - RECORDS_OFFSET) / sizeof(EventRecord);
+    const std::uint64_t count = std::min({header.next, header.capacity, available});
+    const std::uint64_t oldest = header.next > header.capacity ? header.next % header.capacity : 0;
+    contents.records.reserve(count);
+    for (std::uint64_t i = 0; i < count; i++) {
+        const std::uint64_t slot = (oldest + i) % header.capacity;
+        if (slot < available) {
+            EventRecord record;
+            std::memcpy(&record, data.data() + RECORDS_OFFSET + slot * sizeof(EventRecord), sizeof(record));
+            contents.records.push_back(record);
+        }
+    }
+
+    // Concurrent writers may claim slots slightly out of time order
+    std::stable_sort(contents.records.begin(), contents.records.end(),
+                     [](const EventRecord& a, const EventRecord& b) { return a.time < b.time; });
+
+    std::ifstream paths(pathsFileOf(file));
+    std::string line;
+    while (std::getline(paths, line)) {
+        const std::size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            continue;
+        }
+        const std::uint32_t id = static_cast<std::uint32_t>(std::strtoul(line.c_str(), nullptr, 10));
+        if (id == EventLog::NO_PATH) {
+            continue;
+        }
+        if (id >= contents.paths.size()) {
+            contents.paths.resize(id + 1);
+        }
+        contents.paths[id] = unescapePath(std::string_view(line).substr(tab + 1));
+    }
+
+    return contents;
+}
+
+std::vector<EventDirectorySummary> summarizeEventLog(const EventLogContents& contents, std::size_t top) {
+    std::unordered_map<std::uint32_t, EventDirectorySummary> byDirectory;
+    for (const auto& record : contents.records) {
+        EventDirectorySummary& summary = byDirectory[record.directory];
+        summary.directory = record.directory;
+        summary.events++;
+        summary.failed += record.failed ? 1 : 0;
+        if (record.phase != EventPhase::READ_DIRECTORY) {
+            summary.bytes += record.bytes;
+        }
+        summary.totalLatency += record.latency;
+        if (record.latency >= summary.maxLatency) {
+            summary.maxLatency = record.latency;
+            summary.slowestFile = record.file;
+        }
+    }
+
+    std::vector<EventDirectorySummary> summaries;
+    summaries.reserve(byDirectory.size());
+    for (const auto& [directory, summary] : byDirectory) {
+        summaries.push_back(summary);
+    }
+
+    top = std::min(top, summaries.size());
+    std::partial_sort(summaries.begin(), summaries.begin() + top, summaries.end(),
+                      [](const EventDirectorySummary& a, const EventDirectorySummary& b) {
+                          return a.totalLatency > b.totalLatency;
+                      });
+    summaries.resize(top);
+    return summaries;
+}
+
+} // namespace utm
@@ -0,0 +1,158 @@
+#include "utm/filesystem_utils.hpp"
+#include "utm/logging.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/io_limiter.hpp"
+#include <ctime>
+#include <memory>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+namespace utm::fs {
+
+// Get the snapshot directory for a backup timestamp
+std::filesystem::path getBackupPath(
+    const std::filesystem::path& backupRoot,
+    const std::chrono::system_clock::time_point& timestamp) {
+
+    // Snapshot directories are named after the local start time of the backup
+    std::time_t time = std::chrono::system_clock::to_time_t(timestamp);
+    std::tm tm = {};
+    localtime_r(&time, &tm);
+
+    char backupDirName[20];
+    std::strftime(backupDirName, sizeof(backupDirName), "%Y%m%d-%H%M%S", &tm);
+
+    return backupRoot / "backups" / backupDirName;
+}
+
+// Calculate the checksum of a file
+std::string calculateChecksum(
+    const std::filesystem::path& path,
+    const std::string& algorithm,
+    IoLimiter* limiter) {
+
+    FileHandle file = openAt(AT_FDCWD, path.c_str(), O_RDONLY);
+    if (!file.valid()) {
+        getLogger().error("Failed to open " + path.string() + " for checksum: " + std::strerror(errno));
+        return {};
+    }
+
+    std::string result = calculateChecksum(file.get(), algorithm, limiter);
+    if (result.empty()) {
+        getLogger().error("Failed to calculate checksum of " + path.string());
+    }
+    return result;
+}
+
+std::string calculateChecksum(int fd, const std::string& algorithm, IoLimiter* limiter) {
+    ChecksumBuilder checksum(algorithm);
+
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    thread_local std::vector<char> buffer(128 * 1024);
+    while (true) {
+        ssize_t n = ::read(fd, buffer.data(), buffer.size());
+        if (limiter && n > 0) {
+            limiter->read(static_cast<std::uint64_t>(n));
+        }
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            getLogger().error("Failed to read file for checksum: " + std::string(std::strerror(errno)));
+            return {};
+        }
+        checksum.update(buffer.data(), static_cast<std::size_t>(n));
+    }
+    return checksum.finish();
+}
+
+// Implementation class for ChecksumBuilder
+class ChecksumBuilder::Impl {
+public:
+    explicit Impl(const std::string& algorithm)
+        : algorithm(algorithm), context(EVP_MD_CTX_new(), EVP_MD_CTX_free) {
+        const EVP_MD* digest = EVP_get_digestbyname(algorithm.c_str());
+        if (!digest) {
+            getLogger().error("Unknown checksum algorithm: " + algorithm);
+        }
+        else if (!context || EVP_DigestInit_ex(context.get(), digest, nullptr) != 1) {
+            getLogger().error("Failed to initialize " + algorithm + " digest");
+        }
+        else {
+            ready = true;
+        }
+    }
+
+    void update(const char* data, std::size_t size) {
+        if (ready && !failed && EVP_DigestUpdate(context.get(), data, size) != 1) {
+            failed = true;
+        }
+    }
+
+    bool finish(std::string& result) {
+        result.clear();
+        if (!ready) {
+            return false;
+        }
+
+        unsigned char value[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        const bool finished = !failed && EVP_DigestFinal_ex(context.get(), value, &length) == 1;
+
+        // Start the next checksum with the same digest
+        failed = false;
+        if (EVP_DigestInit_ex(context.get(), nullptr, nullptr) != 1) {
+            getLogger().error("Failed to initialize " + algorithm + " digest");
+            ready = false;
+        }
+
+        if (!finished) {
+            getLogger().error("Failed to finalize " + algorithm + " digest");
+            return false;
+        }
+
+        static const char hexDigits[] = "0123456789abcdef";
+        result.reserve(length * 2);
+        for (unsigned int i = 0; i < length; i++) {
+            result.push_back(hexDigits[value[i] >> 4]);
+            result.push_back(hexDigits[value[i] & 0x0f]);
+        }
+        return true;
+    }
+
+private:
+    std::string algorithm;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context;
+    bool ready = false;     // the context holds an initialized digest
+    bool failed = false;    // an update of the current checksum failed
+};
+
+ChecksumBuilder::ChecksumBuilder(const std::string& algorithm) : pImpl(std::make_unique<Impl>(algorithm)) {
+}
+
+ChecksumBuilder::~ChecksumBuilder() = default;
+
+void ChecksumBuilder::update(const char* data, std::size_t size) {
+    pImpl->update(data, size);
+}
+
+std::string ChecksumBuilder::finish() {
+    std::string checksum;
+    pImpl->finish(checksum);
+    return checksum;
+}
+
+bool ChecksumBuilder::finish(std::string& checksum) {
+    return pImpl->finish(checksum);
+}
+
+} // namespace utm::fs
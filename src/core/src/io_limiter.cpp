@@ -0,0 +1,224 @@
+#include "utm/io_limiter.hpp"
+#include "utm/logging.hpp"
+#include "utm/resource_governor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace utm {
+
+namespace {
+
+// ioprio_set() has no glibc wrapper
+constexpr int IOPRIO_WHO_PROCESS = 1;
+constexpr int IOPRIO_CLASS_SHIFT = 13;
+constexpr int IOPRIO_CLASS_BE = 2;
+constexpr int IOPRIO_CLASS_IDLE = 3;
+
+int ioprioValue(IoPriority priority) {
+    switch (priority) {
+        case IoPriority::LOW:  return (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;
+        case IoPriority::IDLE: return IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+        default:               return 0;    // no class: follows the CPU nice level
+    }
+}
+
+// Unused rate a bucket may save up, so short files are not stalled one by one
+constexpr std::chrono::milliseconds burst{100};
+
+// Window over which the unthrottled rate of a bucket is measured
+constexpr std::chrono::seconds rateWindow{1};
+
+// A rate with its schedule: next is when the work accounted so far is paid for
+struct Bucket {
+    std::uint64_t rate = 0;
+    std::chrono::steady_clock::time_point next;
+
+    // Rate reached without pressure, recently; what pressure scales when no rate is configured
+    double natural = 0.0;
+    std::uint64_t windowAmount = 0;
+    std::chrono::steady_clock::time_point windowStart;
+
+    // Add work and return when it is paid for; scale is the governor's share of full speed
+    std::chrono::steady_clock::time_point add(std::uint64_t amount, std::chrono::steady_clock::time_point now, double scale) {
+        if (scale >= 1.0) {
+            windowAmount += amount;
+            if (now - windowStart >= rateWindow) {
+                double measured = windowAmount / std::chrono::duration<double>(now - windowStart).count();
+                natural = std::max(natural * 0.8, measured);
+                windowAmount = 0;
+                windowStart = now;
+            }
+        } else {
+            windowAmount = 0;
+            windowStart = now;
+        }
+
+        double effective = rate > 0 ? rate * scale : (scale < 1.0 ? natural * scale : 0.0);
+        if (effective <= 0.0) {
+            return now;
+        }
+        next = std::max(next, now - burst);
+        next += std::chrono::nanoseconds(static_cast<std::int64_t>(amount * 1e9 / effective));
+        return next;
+    }
+};
+
+// Every setLimits() of every limiter gets a new generation; threads remember the one they applied
+std::atomic<unsigned> nextGeneration{1};
+thread_local unsigned priorityGeneration = 0;
+
+} // namespace
+
+const char* ioPriorityToString(IoPriority priority) {
+    switch (priority) {
+        case IoPriority::LOW:  return "LOW";
+        case IoPriority::IDLE: return "IDLE";
+        default:               return "NORMAL";
+    }
+}
+
+IoPriority stringToIoPriority(const std::string& name) {
+    if (name == "LOW") return IoPriority::LOW;
+    if (name == "IDLE") return IoPriority::IDLE;
+    return IoPriority::NORMAL;
+}
+
+// Implementation class for IoLimiter
+class IoLimiter::Impl {
+public:
+    explicit Impl(const IoLimits& limits) {
+        setLimits(limits);
+    }
+
+    void setLimits(const IoLimits& newLimits) {
+        std::lock_guard<std::mutex> lock(mutex);
+        limits = newLimits;
+
+        // Debt under the old limits does not carry over
+        auto now = std::chrono::steady_clock::now();
+        for (auto [bucket, rate] : {std::pair{&readBucket, limits.readBytesPerSecond},
+                                    std::pair{&writeBucket, limits.writeBytesPerSecond},
+                                    std::pair{&operationBucket, std::uint64_t{limits.operationsPerSecond}}}) {
+            bucket->rate = rate;
+            bucket->next = now;
+        }
+
+        limited = limits.readBytesPerSecond > 0 || limits.writeBytesPerSecond > 0 || limits.operationsPerSecond > 0;
+        generation = nextGeneration++;
+    }
+
+    IoLimits getLimits() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return limits;
+    }
+
+    bool isLimited() const noexcept {
+        return limited.load(std::memory_order_relaxed) || getResourceGovernor().ioScale() < 1.0;
+    }
+
+    std::size_t chunkSize(std::size_t unlimited) const noexcept {
+        return isLimited() ? std::min(unlimited, LIMITED_CHUNK_SIZE) : unlimited;
+    }
+
+    void account(std::uint64_t readBytes, std::uint64_t writtenBytes, std::uint32_t operations) {
+        applyPriority();
+
+        // Unlimited work is still counted, to learn the rates pressure will scale down
+        double scale = getResourceGovernor().ioScale();
+        std::chrono::steady_clock::time_point until;
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            until = std::max({readBucket.add(readBytes, now, scale),
+                              writeBucket.add(writtenBytes, now, scale),
+                              operationBucket.add(operations, now, scale)});
+        }
+
+        if (until > now) {
+            std::this_thread::sleep_until(until);
+            throttledNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(until - now).count();
+        }
+    }
+
+    std::chrono::milliseconds throttledTime() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(throttledNanos.load()));
+    }
+
+private:
+    mutable std::mutex mutex;
+    IoLimits limits;
+    Bucket readBucket;
+    Bucket writeBucket;
+    Bucket operationBucket;
+    std::atomic<bool> limited{false};
+    std::atomic<unsigned> generation{0};
+    std::atomic<std::int64_t> throttledNanos{0};
+
+    // Set the calling thread's I/O class when it starts working for this limiter or the limits changed
+    void applyPriority() {
+        unsigned current = generation.load(std::memory_order_relaxed);
+        if (priorityGeneration == current) {
+            return;
+        }
+        priorityGeneration = current;
+
+        IoPriority priority;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            priority = limits.priority;
+        }
+
+        // With who 0 the class applies to the calling thread only
+        if (::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprioValue(priority)) != 0) {
+            UTM_DEBUG("Failed to set I/O priority {}: {}", ioPriorityToString(priority), std::strerror(errno));
+        }
+    }
+};
+
+// IoLimiter implementation
+
+IoLimiter::IoLimiter(const IoLimits& limits) : pImpl(std::make_unique<Impl>(limits)) {
+}
+
+IoLimiter::~IoLimiter() = default;
+
+void IoLimiter::setLimits(const IoLimits& limits) {
+    pImpl->setLimits(limits);
+}
+
+IoLimits IoLimiter::getLimits() const {
+    return pImpl->getLimits();
+}
+
+bool IoLimiter::isLimited() const noexcept {
+    return pImpl->isLimited();
+}
+
+std::size_t IoLimiter::chunkSize(std::size_t unlimited) const noexcept {
+    return pImpl->chunkSize(unlimited);
+}
+
+void IoLimiter::read(std::uint64_t bytes, std::uint32_t operations) {
+    pImpl->account(bytes, 0, operations);
+}
+
+void IoLimiter::write(std::uint64_t bytes, std::uint32_t operations) {
+    pImpl->account(0, bytes, operations);
+}
+
+void IoLimiter::operations(std::uint32_t operations) {
+    pImpl->account(0, 0, operations);
+}
+
+std::chrono::milliseconds IoLimiter::throttledTime() const {
+    return pImpl->throttledTime();
+}
+
+} // namespace utm
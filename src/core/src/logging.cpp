@@ -1,32 +1,195 @@
 #include "utm/logging.hpp"
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <iomanip>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <deque>
 #include <chrono>
 #include <ctime>
-#include <regex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
 #include <string_view>
-#include <format>
+#include <algorithm>
 #include <filesystem>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
 namespace utm {
 
+namespace {
+
+// Messages a thread can queue before the overflow policy applies
+constexpr std::size_t RING_CAPACITY = 1024;
+
+// A ring this full wakes the writer thread before its interval is up
+constexpr std::size_t RING_WAKE_THRESHOLD = RING_CAPACITY / 2;
+
+// Signals after which the queued messages are written before the process dies
+constexpr int CRASH_SIGNALS[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+// Rotated logs wait under this name, followed by a sequence number, until they are compressed
+constexpr std::string_view PENDING_PREFIX = "utm.log.pending.";
+
+// A rotated log being compressed, followed by the id of the compressing process
+constexpr std::string_view COMPRESS_PREFIX = "utm.log.gz.tmp.";
+
+// A queued message; formatting is left to the writer thread
+struct LogRecord {
+    LogLevel level = LogLevel::INFO;
+    bool toConsole = false;
+    bool toFile = false;
+    std::chrono::system_clock::time_point time;
+    const char* file = "";
+    std::uint_least32_t line = 0;
+    std::string message;
+};
+
+// Queue of one thread's messages: that thread pushes, the writer thread drains
+class LogRing {
+public:
+    LogRing() : records(RING_CAPACITY) {}
+
+    bool tryPush(LogRecord&& record) {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == RING_CAPACITY) {
+            return false;
+        }
+        records[t % RING_CAPACITY] = std::move(record);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    template<typename Consume>
+    void drain(Consume&& consume) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        const std::size_t t = tail.load(std::memory_order_acquire);
+        for (; h != t; h++) {
+            consume(records[h % RING_CAPACITY]);
+        }
+        head.store(h, std::memory_order_release);
+    }
+
+    std::atomic<bool> orphaned{false};    // its thread has exited
+
+private:
+    std::vector<LogRecord> records;
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
+
+// Block the signals the main thread handles, leaving crash signals deliverable
+void blockTerminationSignals() {
+    sigset_t signals;
+    sigfillset(&signals);
+    for (int signal : CRASH_SIGNALS) {
+        sigdelset(&signals, signal);
+    }
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+// Exclusive flock for as long as it lives; processes sharing a log directory take it on the directory
+class FileLock {
+public:
+    explicit FileLock(int fd) : fd(fd) {
+        while (fd >= 0 && ::flock(fd, LOCK_EX) != 0 && errno == EINTR) {
+        }
+    }
+
+    ~FileLock() {
+        if (fd >= 0) {
+            ::flock(fd, LOCK_UN);
+        }
+    }
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+    int fd;
+};
+
+void writeFully(int fd, const char* data, std::size_t size) {
+    while (size > 0 && fd >= 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::TRACE:    return "TRACE";
+        case LogLevel::DEBUG:    return "DEBUG";
+        case LogLevel::INFO:     return "INFO";
+        case LogLevel::WARNING:  return "WARNING";
+        case LogLevel::ERROR:    return "ERROR";
+        case LogLevel::CRITICAL: return "CRITICAL";
+        case LogLevel::OFF:      return "OFF";
+        default:                 return "UNKNOWN";
+    }
+}
+
+} // namespace
+
 // Implementation class for Logger
 class Logger::Impl {
 public:
-    Impl() : consoleLevel(LogLevel::INFO), fileLevel(LogLevel::DEBUG), initialized(false) {}
-    
+    Impl() {
+        writer = std::thread([this] { run(); });
+    }
+
     ~Impl() {
-        if (logFile.is_open()) {
-            logFile.close();
+        // Stop compressing first so its warnings are still written; unfinished files wait for the next start
+        {
+            std::lock_guard<std::mutex> lock(compressMutex);
+            compressStopping = true;
+        }
+        compressWake.notify_one();
+        if (compressor.joinable()) {
+            compressor.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        stoppingFlag.store(true, std::memory_order_relaxed);
+        wake.notify_one();
+        if (writer.joinable()) {
+            writer.join();
+        }
+        if (crashInstance.load() == this) {
+            crashInstance.store(nullptr);
+        }
+        if (logFd >= 0) {
+            ::close(logFd);
+        }
+        if (logDirFd >= 0) {
+            ::close(logDirFd);
         }
     }
-    
+
     bool initialize(const std::filesystem::path& logDir, std::size_t maxLogSize, int maxLogFiles) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        
         try {
             // Create log directory if it doesn't exist
             if (!std::filesystem::exists(logDir)) {
@@ -35,30 +198,73 @@ public:
                     return false;
                 }
             }
-            
+
+            // Other processes may log to the same directory; its lock keeps them from rotating underneath
+            int dirFd = ::open(logDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd < 0) {
+                std::cerr << "Failed to open log directory: " << logDir.string() << std::endl;
+                return false;
+            }
+            FileLock directoryLock(dirFd);
+
             // Open log file
-            this->logDir = logDir;
             std::filesystem::path logFilePath = logDir / "utm.log";
-            
-            logFile.open(logFilePath, std::ios::out | std::ios::app);
-            if (!logFile) {
+            int fd = ::open(logFilePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) {
                 std::cerr << "Failed to open log file: " << logFilePath.string() << std::endl;
+                ::close(dirFd);
                 return false;
             }
-            
-            // Store settings
-            this->maxLogSize = maxLogSize;
-            this->maxLogFiles = maxLogFiles;
-            
+
             // Log initialization
             auto now = std::chrono::system_clock::now();
             std::time_t timeT = std::chrono::system_clock::to_time_t(now);
-            std::string timeStr = std::ctime(&timeT);
+            char timeBuffer[32];
+            std::string timeStr = ::ctime_r(&timeT, timeBuffer);
             timeStr.resize(timeStr.size() - 1); // Remove trailing newline
-            
-            logFile << "===== Ubuntu Time Machine Log Started at " << timeStr << " =====" << std::endl;
-            
-            initialized = true;
+
+            const std::string banner = "===== Ubuntu Time Machine Log Started at " + timeStr + " =====\n";
+            writeFully(fd, banner.data(), banner.size());
+
+            // Rotated logs an earlier run did not get to compress; a live process may still be
+            // compressing some of them, which the compressor finds out from their lock
+            std::vector<std::pair<unsigned long, std::filesystem::path>> leftovers;
+            for (const auto& entry : std::filesystem::directory_iterator(logDir)) {
+                const std::string name = entry.path().filename().string();
+                if (name.starts_with(PENDING_PREFIX)) {
+                    leftovers.emplace_back(std::strtoul(name.c_str() + PENDING_PREFIX.size(), nullptr, 10), entry.path());
+                }
+                else if (name.starts_with(COMPRESS_PREFIX)) {
+                    const pid_t owner = static_cast<pid_t>(std::strtol(name.c_str() + COMPRESS_PREFIX.size(), nullptr, 10));
+                    if (owner > 0 && ::kill(owner, 0) != 0 && errno == ESRCH) {
+                        ::unlink(entry.path().c_str());
+                    }
+                }
+            }
+            std::sort(leftovers.begin(), leftovers.end());
+
+            // Store settings; the writer thread picks up the file with its next batch
+            {
+                std::lock_guard<std::mutex> lock(fileMutex);
+                if (logFd >= 0) {
+                    ::close(logFd);
+                }
+                if (logDirFd >= 0) {
+                    ::close(logDirFd);
+                }
+                this->logDir = logDir;
+                this->maxLogSize = maxLogSize;
+                this->maxLogFiles.store(maxLogFiles, std::memory_order_relaxed);
+                logFd = fd;
+                logDirFd = dirFd;
+                rotateAt = maxLogSize;
+                pendingSequence = leftovers.empty() ? 1 : leftovers.back().first + 1;
+                crashLogFd.store(fd, std::memory_order_release);
+            }
+            for (auto& leftover : leftovers) {
+                queueCompression(std::move(leftover.second));
+            }
+            installCrashHandler();
             return true;
         }
         catch (const std::exception& e) {
@@ -66,93 +272,543 @@ public:
             return false;
         }
     }
-    
+
     void setConsoleLevel(LogLevel level) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        consoleLevel = level;
+        consoleLevel.store(level, std::memory_order_relaxed);
+        updateEnabledLevel();
     }
-    
+
+    void setConsoleStderr(bool enabled) {
+        consoleStderr.store(enabled, std::memory_order_relaxed);
+    }
+
     void setFileLevel(LogLevel level) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        fileLevel = level;
+        fileLevel.store(level, std::memory_order_relaxed);
+        updateEnabledLevel();
     }
-    
+
     LogLevel getConsoleLevel() const {
-        return consoleLevel;
+        return consoleLevel.load(std::memory_order_relaxed);
     }
-    
+
     LogLevel getFileLevel() const {
-        return fileLevel;
+        return fileLevel.load(std::memory_order_relaxed);
     }
-    
+
+    void setOverflowPolicy(LogOverflow policy) {
+        overflow.store(policy, std::memory_order_relaxed);
+    }
+
+    void setFlushInterval(std::chrono::milliseconds interval) {
+        flushInterval.store(std::max<std::chrono::milliseconds::rep>(interval.count(), 1), std::memory_order_relaxed);
+        requestWake();
+    }
+
+    std::uint64_t getDroppedMessages() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
     bool shouldLog(LogLevel level, LogLevel threshold) const {
         return level >= threshold && threshold != LogLevel::OFF;
     }
-    
-    std::string formatMessage(LogLevel level, const std::string& message, const std::source_location& location) const {
-        // Format timestamp
-        auto now = std::chrono::system_clock::now();
-        std::time_t timeT = std::chrono::system_clock::to_time_t(now);
-        std::tm* tm = std::localtime(&timeT);
-        
-        std::stringstream ss;
-        ss << std::put_time(tm, "%Y-%m-%d %H:%M:%S");
-        
-        // Add milliseconds
-        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-        ss << '.' << std::setfill('0') << std::setw(3) << ms.count();
-        
-        // Format the message
-        ss << " [" << logLevelToString(level) << "] ";
-        
-        // Add file and line information for levels >= WARNING
-        if (level >= LogLevel::WARNING) {
-            std::filesystem::path filePath(location.file_name());
-            ss << "[" << filePath.filename().string() << ":" << location.line() << "] ";
-        }
-        
-        ss << message;
-        
-        return ss.str();
-    }
-    
+
     void log(LogLevel level, const std::string& message, const std::source_location& location) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        
-        std::string formattedMessage = formatMessage(level, message, location);
-        
-        // Log to console if level is high enough
-        if (shouldLog(level, consoleLevel)) {
-            if (level >= LogLevel::ERROR) {
-                std::cerr << formattedMessage << std::endl;
-            } else {
-                std::cout << formattedMessage << std::endl;
+        LogRecord record;
+        record.toConsole = shouldLog(level, consoleLevel.load(std::memory_order_relaxed));
+        record.toFile = shouldLog(level, fileLevel.load(std::memory_order_relaxed));
+        if (!record.toConsole && !record.toFile) {
+            return;
+        }
+        record.level = level;
+        record.time = std::chrono::system_clock::now();
+        record.file = location.file_name();
+        record.line = location.line();
+        record.message = message;
+
+        LogRing& ring = localRing();
+        if (!ring.tryPush(std::move(record))) {
+            if (overflow.load(std::memory_order_relaxed) == LogOverflow::DROP ||
+                stoppingFlag.load(std::memory_order_relaxed)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
             }
+            // Wait for the writer thread to make room
+            do {
+                requestWake();
+                std::this_thread::yield();
+            } while (!ring.tryPush(std::move(record)));
         }
-        
-        // Log to file if initialized and level is high enough
-        if (initialized && shouldLog(level, fileLevel) && logFile.is_open()) {
-            logFile << formattedMessage << std::endl;
-            logFile.flush();
-            
-            // TODO: Implement log rotation
+
+        // Errors go out at once; other messages wait for the interval or a filling ring
+        if (level >= LogLevel::ERROR || ring.size() >= RING_WAKE_THRESHOLD) {
+            requestWake();
         }
     }
-    
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        if (writerDone) {
+            return;
+        }
+        const std::uint64_t target = ++flushRequested;
+        wake.notify_one();
+        flushed.wait(lock, [this, target] { return flushCompleted >= target || writerDone; });
+    }
+
 private:
-    // Log levels
-    LogLevel consoleLevel;
-    LogLevel fileLevel;
-    
+    // Levels and policies
+    std::atomic<LogLevel> consoleLevel{LogLevel::INFO};
+    std::atomic<LogLevel> fileLevel{LogLevel::DEBUG};
+    std::atomic<bool> consoleStderr{false};
+    std::atomic<LogOverflow> overflow{LogOverflow::DROP};
+    std::atomic<std::chrono::milliseconds::rep> flushInterval{200};
+    std::atomic<std::uint64_t> dropped{0};
+    std::uint64_t droppedReported = 0;
+
     // File handling
-    bool initialized;
+    std::mutex fileMutex;
     std::filesystem::path logDir;
-    std::ofstream logFile;
-    std::size_t maxLogSize;
-    int maxLogFiles;
-    
-    // Thread safety
-    std::mutex logMutex;
+    int logFd = -1;
+    int logDirFd = -1;                  // locked while finding, rotating and writing utm.log
+    std::size_t maxLogSize = 10 * 1024 * 1024;
+    std::size_t rotateAt = maxLogSize;  // maxLogSize, or further after a failed rotation
+    std::atomic<int> maxLogFiles{5};
+    unsigned long pendingSequence = 1;
+
+    // Compression of rotated logs
+    std::thread compressor;
+    std::mutex compressMutex;
+    std::condition_variable compressWake;
+    std::deque<std::filesystem::path> compressQueue;
+    bool compressStopping = false;
+
+    // Rings of the threads that log
+    std::mutex ringsMutex;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::atomic<bool> draining{false};
+
+    // Writer thread
+    std::thread writer;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::condition_variable flushed;
+    std::atomic<bool> wakeRequested{false};
+    std::atomic<bool> stoppingFlag{false};
+    bool stopping = false;
+    bool writerDone = false;
+    std::uint64_t flushRequested = 0;
+    std::uint64_t flushCompleted = 0;
+
+    // Batch buffers, only used by the writer thread
+    std::vector<LogRecord> batch;
+    std::string consoleOut;
+    std::string errorOut;
+    std::string fileOut;
+    std::time_t cachedSecond = -1;
+    char cachedTime[32] = {};
+
+    // Crash flush
+    std::atomic<int> crashLogFd{-1};
+    static inline std::atomic<Impl*> crashInstance{nullptr};
+
+    void updateEnabledLevel() {
+        Logger::enabledLevel.store(std::min(consoleLevel.load(std::memory_order_relaxed),
+                                            fileLevel.load(std::memory_order_relaxed)),
+                                   std::memory_order_relaxed);
+    }
+
+    void requestWake() {
+        if (!wakeRequested.exchange(true, std::memory_order_acq_rel)) {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+    }
+
+    // The calling thread's ring, registered on first use
+    LogRing& localRing() {
+        struct Local {
+            std::shared_ptr<LogRing> ring;
+            ~Local() {
+                if (ring) {
+                    ring->orphaned.store(true, std::memory_order_release);
+                }
+            }
+        };
+        thread_local Local local;
+        if (!local.ring) {
+            local.ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            rings.push_back(local.ring);
+        }
+        return *local.ring;
+    }
+
+    void run() {
+        blockTerminationSignals();
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        for (;;) {
+            const std::chrono::milliseconds interval(flushInterval.load(std::memory_order_relaxed));
+            wake.wait_for(lock, interval, [this] {
+                return stopping || flushRequested > flushCompleted || wakeRequested.load(std::memory_order_acquire);
+            });
+            wakeRequested.store(false, std::memory_order_release);
+            const bool stop = stopping;
+            const std::uint64_t flushTarget = flushRequested;
+
+            lock.unlock();
+            writeBatch();
+            lock.lock();
+
+            flushCompleted = flushTarget;
+            flushed.notify_all();
+            if (stop) {
+                writerDone = true;
+                flushed.notify_all();
+                return;
+            }
+        }
+    }
+
+    // Collect every queued message, order them by time and write each destination once
+    void writeBatch() {
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            draining.store(true, std::memory_order_relaxed);
+            for (auto it = rings.begin(); it != rings.end();) {
+                LogRing& ring = **it;
+                const bool orphaned = ring.orphaned.load(std::memory_order_acquire);
+                ring.drain([this](LogRecord& record) { batch.push_back(std::move(record)); });
+                it = orphaned ? rings.erase(it) : it + 1;
+            }
+            draining.store(false, std::memory_order_release);
+        }
+
+        const std::uint64_t droppedNow = dropped.load(std::memory_order_relaxed);
+        if (droppedNow != droppedReported) {
+            LogRecord record;
+            record.level = LogLevel::WARNING;
+            record.toConsole = shouldLog(record.level, consoleLevel.load(std::memory_order_relaxed));
+            record.toFile = shouldLog(record.level, fileLevel.load(std::memory_order_relaxed));
+            record.time = std::chrono::system_clock::now();
+            record.file = __FILE__;
+            record.line = __LINE__;
+            record.message = std::to_string(droppedNow - droppedReported) + " log messages were dropped because their queue was full";
+            batch.push_back(std::move(record));
+            droppedReported = droppedNow;
+        }
+        if (batch.empty()) {
+            return;
+        }
+
+        // Each thread's messages are already in order
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const LogRecord& a, const LogRecord& b) { return a.time < b.time; });
+
+        const bool allToStderr = consoleStderr.load(std::memory_order_relaxed);
+        for (const LogRecord& record : batch) {
+            const std::size_t start = fileOut.size();
+            format(record, fileOut);
+            const std::string_view line(fileOut.data() + start, fileOut.size() - start);
+            if (record.toConsole) {
+                (record.level >= LogLevel::ERROR || allToStderr ? errorOut : consoleOut).append(line);
+            }
+            if (!record.toFile) {
+                fileOut.resize(start);
+            }
+        }
+        batch.clear();
+
+        writeFully(STDOUT_FILENO, consoleOut.data(), consoleOut.size());
+        writeFully(STDERR_FILENO, errorOut.data(), errorOut.size());
+        if (!fileOut.empty()) {
+            std::lock_guard<std::mutex> lock(fileMutex);
+            FileLock directoryLock(logDirFd);
+            const std::size_t size = followLogFile();
+            if (maxLogSize > 0 && size > 0 && size + fileOut.size() > rotateAt) {
+                rotate(size);
+            }
+            writeFully(logFd, fileOut.data(), fileOut.size());
+        }
+        consoleOut.clear();
+        errorOut.clear();
+        fileOut.clear();
+    }
+
+    // Reopen utm.log if another process rotated it and return its size, which counts everyone's
+    // writes; fileMutex and the directory lock are held
+    std::size_t followLogFile() {
+        struct stat current;
+        if (logFd < 0 || ::fstat(logFd, &current) != 0) {
+            return 0;
+        }
+
+        const std::filesystem::path logFilePath = logDir / "utm.log";
+        struct stat named;
+        if (::stat(logFilePath.c_str(), &named) != 0 || named.st_ino != current.st_ino || named.st_dev != current.st_dev) {
+            int fd = ::open(logFilePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd >= 0 && ::fstat(fd, &current) == 0) {
+                replaceLogFd(fd);
+                rotateAt = maxLogSize;
+            }
+            else if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        return static_cast<std::size_t>(current.st_size);
+    }
+
+    void replaceLogFd(int fd) {
+        crashLogFd.store(fd, std::memory_order_release);
+        ::close(logFd);
+        logFd = fd;
+    }
+
+    // Swap in an empty utm.log and hand the full one to the compressor thread; fileMutex and the
+    // directory lock are held
+    void rotate(std::size_t size) {
+        const std::filesystem::path logFilePath = logDir / "utm.log";
+        const std::filesystem::path nextPath = logDir / "utm.log.next";
+
+        int fd = ::open(nextPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            rotateAt = size + maxLogSize;   // retry after another maxLogSize rather than on every batch
+            return;
+        }
+
+        // The full log gets a second name, one that no file has yet since other processes rotate the
+        // same log, then the new file replaces utm.log in one rename
+        std::filesystem::path pendingPath;
+        bool linked = false;
+        bool moved = false;
+        for (int attempt = 0; attempt < 1000 && !linked && !moved; attempt++) {
+            pendingPath = logDir / (std::string(PENDING_PREFIX) + std::to_string(pendingSequence++));
+            linked = ::link(logFilePath.c_str(), pendingPath.c_str()) == 0;
+            if (!linked && errno != EEXIST) {
+                // Without hard links the log moves away and utm.log is briefly missing
+                moved = ::renameat2(AT_FDCWD, logFilePath.c_str(), AT_FDCWD, pendingPath.c_str(), RENAME_NOREPLACE) == 0;
+                if (!moved && errno != EEXIST) {
+                    break;
+                }
+            }
+        }
+        if ((!linked && !moved) || ::rename(nextPath.c_str(), logFilePath.c_str()) != 0) {
+            if (linked) {
+                ::unlink(pendingPath.c_str());
+            }
+            else if (moved) {
+                ::renameat2(AT_FDCWD, pendingPath.c_str(), AT_FDCWD, logFilePath.c_str(), RENAME_NOREPLACE);
+            }
+            ::close(fd);
+            ::unlink(nextPath.c_str());
+            rotateAt = size + maxLogSize;
+            return;
+        }
+
+        replaceLogFd(fd);
+        rotateAt = maxLogSize;
+        queueCompression(pendingPath);
+    }
+
+    void queueCompression(std::filesystem::path path) {
+        {
+            std::lock_guard<std::mutex> lock(compressMutex);
+            compressQueue.push_back(std::move(path));
+            if (!compressor.joinable()) {
+                compressor = std::thread([this] { compressRotated(); });
+            }
+        }
+        compressWake.notify_one();
+    }
+
+    void compressRotated() {
+        blockTerminationSignals();
+
+        // Compressing old logs only gets CPU time nothing else wants
+        struct sched_param param{};
+        ::sched_setscheduler(0, SCHED_IDLE, &param);
+
+        std::unique_lock<std::mutex> lock(compressMutex);
+        for (;;) {
+            compressWake.wait(lock, [this] { return compressStopping || !compressQueue.empty(); });
+            if (compressStopping) {
+                return;
+            }
+            std::filesystem::path pendingPath = std::move(compressQueue.front());
+            compressQueue.pop_front();
+
+            lock.unlock();
+            compressLog(pendingPath);
+            lock.lock();
+        }
+    }
+
+    // Compress a rotated log to utm.log.1.gz, moving older ones up and dropping those beyond maxLogFiles
+    void compressLog(const std::filesystem::path& pendingPath) {
+        const std::filesystem::path dir = pendingPath.parent_path();
+
+        // Processes that started together may both have queued it; whoever holds its lock compresses it
+        int in = ::open(pendingPath.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (in < 0) {
+            return;
+        }
+        struct stat st;
+        if (::flock(in, LOCK_EX | LOCK_NB) != 0 || ::fstat(in, &st) != 0 || st.st_nlink == 0) {
+            ::close(in);
+            return;
+        }
+
+        const int keep = maxLogFiles.load(std::memory_order_relaxed);
+        if (keep <= 0) {
+            ::unlink(pendingPath.c_str());
+            ::close(in);
+            return;
+        }
+
+        const std::filesystem::path tempPath = dir / (std::string(COMPRESS_PREFIX) + std::to_string(::getpid()));
+        int out = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+        gzFile gz = out >= 0 ? ::gzdopen(out, "wb6") : nullptr;
+        bool ok = gz != nullptr;
+        if (!gz && out >= 0) {
+            ::close(out);
+        }
+
+        std::vector<char> buffer(64 * 1024);
+        while (ok) {
+            ssize_t n = ::read(in, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            ok = ::gzwrite(gz, buffer.data(), static_cast<unsigned>(n)) == n;
+        }
+        if (gz && ::gzclose(gz) != Z_OK) {
+            ok = false;
+        }
+
+        if (!ok) {
+            // The uncompressed file stays and is tried again on the next start
+            ::unlink(tempPath.c_str());
+            ::close(in);
+            log(LogLevel::WARNING, "Failed to compress rotated log " + pendingPath.string(), std::source_location::current());
+            return;
+        }
+
+        // Other processes move the same files up
+        int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        {
+            FileLock directoryLock(dirFd);
+            auto rotatedPath = [&dir](int index) { return dir / ("utm.log." + std::to_string(index) + ".gz"); };
+            ::unlink(rotatedPath(keep).c_str());
+            for (int index = keep - 1; index >= 1; index--) {
+                ::rename(rotatedPath(index).c_str(), rotatedPath(index + 1).c_str());
+            }
+            ::rename(tempPath.c_str(), rotatedPath(1).c_str());
+            ::unlink(pendingPath.c_str());
+        }
+        if (dirFd >= 0) {
+            ::close(dirFd);
+        }
+        ::close(in);
+    }
+
+    void format(const LogRecord& record, std::string& out) {
+        // Format timestamp; the local time is only worked out once per second
+        const auto sinceEpoch = record.time.time_since_epoch();
+        const std::time_t second = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+        if (second != cachedSecond) {
+            std::tm tm;
+            localtime_r(&second, &tm);
+            std::strftime(cachedTime, sizeof(cachedTime), "%Y-%m-%d %H:%M:%S", &tm);
+            cachedSecond = second;
+        }
+        char millis[8];
+        std::snprintf(millis, sizeof(millis), ".%03d",
+                      static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(sinceEpoch).count() % 1000));
+
+        out += cachedTime;
+        out += millis;
+        out += " [";
+        out += levelName(record.level);
+        out += "] ";
+
+        // Add file and line information for levels >= WARNING
+        if (record.level >= LogLevel::WARNING) {
+            std::string_view file(record.file);
+            const std::size_t slash = file.rfind('/');
+            if (slash != std::string_view::npos) {
+                file.remove_prefix(slash + 1);
+            }
+            out += '[';
+            out += file;
+            out += ':';
+            out += std::to_string(record.line);
+            out += "] ";
+        }
+
+        out += record.message;
+        out += '\n';
+    }
+
+    void installCrashHandler() {
+        Impl* expected = nullptr;
+        if (!crashInstance.compare_exchange_strong(expected, this)) {
+            return;
+        }
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = &Impl::crashHandler;
+        action.sa_flags = SA_RESETHAND;
+        sigemptyset(&action.sa_mask);
+        for (int signal : CRASH_SIGNALS) {
+            // Leave handlers someone else installed alone
+            struct sigaction previous;
+            if (::sigaction(signal, nullptr, &previous) == 0 && previous.sa_handler == SIG_DFL) {
+                ::sigaction(signal, &action, nullptr);
+            }
+        }
+    }
+
+    // Write what is still queued, then let the signal take its default course
+    static void crashHandler(int signal) {
+        if (Impl* impl = crashInstance.load()) {
+            impl->crashFlush();
+        }
+        ::raise(signal);
+    }
+
+    // Best effort from a signal handler: no locks, no formatting beyond the level
+    void crashFlush() {
+        bool expected = false;
+        if (!draining.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return;    // the writer thread is draining; its batch cannot be finished from here
+        }
+        if (!ringsMutex.try_lock()) {
+            draining.store(false, std::memory_order_release);
+            return;
+        }
+        const int fd = crashLogFd.load(std::memory_order_acquire);
+        for (const auto& ring : rings) {
+            ring->drain([fd](LogRecord& record) {
+                const char* level = levelName(record.level);
+                for (int out : {STDERR_FILENO, fd}) {
+                    writeFully(out, "[", 1);
+                    writeFully(out, level, std::strlen(level));
+                    writeFully(out, "] ", 2);
+                    writeFully(out, record.message.data(), record.message.size());
+                    writeFully(out, "\n", 1);
+                }
+            });
+        }
+        if (fd >= 0) {
+            ::fdatasync(fd);
+        }
+        ringsMutex.unlock();
+        draining.store(false, std::memory_order_release);
+    }
 };
 
 // Static singleton instance
@@ -188,6 +844,10 @@ void Logger::setConsoleLevel(LogLevel level) {
     pImpl->setConsoleLevel(level);
 }
 
+void Logger::setConsoleStderr(bool enabled) {
+    pImpl->setConsoleStderr(enabled);
+}
+
 void Logger::setFileLevel(LogLevel level) {
     pImpl->setFileLevel(level);
 }
@@ -200,6 +860,22 @@ LogLevel Logger::getFileLevel() const {
     return pImpl->getFileLevel();
 }
 
+void Logger::setOverflowPolicy(LogOverflow policy) {
+    pImpl->setOverflowPolicy(policy);
+}
+
+void Logger::setFlushInterval(std::chrono::milliseconds interval) {
+    pImpl->setFlushInterval(interval);
+}
+
+void Logger::flush() {
+    pImpl->flush();
+}
+
+std::uint64_t Logger::getDroppedMessages() const {
+    return pImpl->getDroppedMessages();
+}
+
 void Logger::log(LogLevel level, const std::string& message, const std::source_location& location) {
     pImpl->log(level, message, location);
 }
@@ -228,6 +904,37 @@ void Logger::critical(const std::string& message, const std::source_location& lo
     log(LogLevel::CRITICAL, message, location);
 }
 
+namespace detail {
+
+std::string substituteLogArguments(std::string_view fmt, const std::string* args, std::size_t count) {
+    std::string result;
+    result.reserve(fmt.size());
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < fmt.size(); i++) {
+        const char c = fmt[i];
+        if ((c == '{' || c == '}') && i + 1 < fmt.size() && fmt[i + 1] == c) {
+            result += c;
+            i++;
+        } else if (c == '{') {
+            // Format specs are not supported here; the placeholder takes the next argument as is
+            const std::size_t close = fmt.find('}', i);
+            if (close == std::string_view::npos) {
+                result.append(fmt.substr(i));
+                break;
+            }
+            if (next < count) {
+                result += args[next++];
+            }
+            i = close;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+} // namespace detail
+
 // Utility functions
 std::string logLevelToString(LogLevel level) {
     switch (level) {
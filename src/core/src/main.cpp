@@ -6,6 +6,13 @@
  */
 
 #include "utm/backup_engine.hpp"
+#include "utm/scheduler.hpp"
+#include "utm/backup_executor.hpp"
+#include "utm/resource_governor.hpp"
+#include "utm/control_server.hpp"
+#include "utm/progress_publisher.hpp"
+#include "utm/event_log.hpp"
+#include "utm/snapshot_index.hpp"
 #include "utm/database.hpp"
 #include "utm/config.hpp"
 #include "utm/logging.hpp"
@@ -21,13 +28,480 @@
 #include <thread>
 #include <csignal>
 #include <atomic>
+#include <optional>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <string_view>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 namespace po = boost::program_options;
+using utm::jsonString;
 
 // Global variables
 std::atomic<bool> g_running = true;
 std::unique_ptr<utm::BackupEngine> g_backupEngine;
 
+// Where backups record their per-file events (empty = not recorded)
+std::filesystem::path g_eventLogDir;
+std::size_t g_eventLogRecords = 0;
+
+// Parse a backup time as printed by --list-backups (or a backup directory name)
+std::optional<std::chrono::system_clock::time_point> parseSnapshotTime(const std::string& text) {
+    for (const char* format : {"%Y-%m-%d %H:%M:%S", "%Y%m%d-%H%M%S"}) {
+        std::tm tm = {};
+        std::istringstream ss(text);
+        ss >> std::get_time(&tm, format);
+        if (!ss.fail()) {
+            tm.tm_isdst = -1;
+            return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+        }
+    }
+    return std::nullopt;
+}
+
+// Pick the backup named by requested, or the most recent one if it is empty
+std::optional<std::chrono::system_clock::time_point> findSnapshot(
+    const std::string& requested,
+    const utm::BackupProfile& profile,
+    std::string& error) {
+
+    if (!requested.empty()) {
+        auto timestamp = parseSnapshotTime(requested);
+        if (!timestamp) {
+            error = "Invalid snapshot time: " + requested;
+        }
+        return timestamp;
+    }
+
+    const auto backups = g_backupEngine->listBackups(profile.destinationPath);
+    if (backups.empty()) {
+        error = "No backups found for profile: " + profile.name;
+        return std::nullopt;
+    }
+    return backups.front();
+}
+
+// Pick the backup named by --snapshot, or the most recent one
+std::optional<std::chrono::system_clock::time_point> selectSnapshot(
+    const po::variables_map& vm,
+    const utm::BackupProfile& profile) {
+
+    std::string error;
+    auto timestamp = findSnapshot(vm.count("snapshot") ? vm["snapshot"].as<std::string>() : std::string(), profile, error);
+    if (!timestamp) {
+        std::cerr << error << std::endl;
+    }
+    return timestamp;
+}
+
+// Format a time as printed by --list-backups
+std::string formatTime(const std::chrono::system_clock::time_point& timePoint) {
+    std::time_t time = std::chrono::system_clock::to_time_t(timePoint);
+    std::tm tm{};
+    localtime_r(&time, &tm);
+    char timeStr[32];
+    std::strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &tm);
+    return timeStr;
+}
+
+// Snapshots of a profile as one JSON document, from the snapshot catalog
+void writeSnapshots(std::ostream& out, const std::string& profileName, const utm::BackupProfile& profile) {
+    out << "{\"backups\":[";
+    bool first = true;
+    for (const auto& snapshot : g_backupEngine->listSnapshots(profile.destinationPath)) {
+        // The id is the snapshot directory name, which is in local time
+        std::time_t time = std::chrono::system_clock::to_time_t(snapshot.timestamp);
+        std::tm local{};
+        std::tm utc{};
+        localtime_r(&time, &local);
+        gmtime_r(&time, &utc);
+        char id[20];
+        char timestamp[32];
+        std::strftime(id, sizeof(id), "%Y%m%d-%H%M%S", &local);
+        std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+        out << (first ? "" : ",") << "{\"id\":" << jsonString(id)
+            << ",\"profileId\":" << jsonString(profileName)
+            << ",\"timestamp\":" << jsonString(timestamp)
+            << ",\"size\":" << snapshot.totalSize
+            << ",\"fileCount\":" << snapshot.totalFiles
+            << ",\"status\":\"" << (snapshot.usable() ? "success" : "error") << "\""
+            << ",\"verified\":" << (snapshot.state == utm::SnapshotState::VERIFIED ? "true" : "false")
+            << ",\"newFiles\":" << snapshot.newFiles
+            << ",\"modifiedFiles\":" << snapshot.modifiedFiles
+            << ",\"unchangedFiles\":" << snapshot.unchangedFiles
+            << ",\"duration\":" << std::chrono::duration_cast<std::chrono::seconds>(
+                   snapshot.endTime - snapshot.timestamp).count()
+            << "}";
+        first = false;
+    }
+    out << "]}";
+}
+
+// A page of a backup directory as one JSON document
+void writeDirectoryPage(std::ostream& out, const std::string& path, const utm::DirectoryPage& page) {
+    out << "{\"path\":" << jsonString(path)
+        << ",\"total\":" << page.totalEntries
+        << ",\"next\":" << jsonString(page.nextCursor)
+        << ",\"entries\":[";
+    for (size_t i = 0; i < page.entries.size(); i++) {
+        const auto& entry = page.entries[i];
+        const char* type = entry.type == std::filesystem::file_type::directory ? "directory"
+                         : entry.type == std::filesystem::file_type::regular ? "file"
+                         : entry.type == std::filesystem::file_type::symlink ? "symlink" : "other";
+        out << (i ? "," : "") << "{\"name\":" << jsonString(entry.name)
+            << ",\"type\":\"" << type << "\""
+            << ",\"size\":" << entry.size
+            << ",\"modified\":" << std::chrono::system_clock::to_time_t(entry.modified) << "}";
+    }
+    out << "]}";
+}
+
+// Name of a backup status in progress events
+const char* backupStatusName(utm::BackupStatus status) {
+    switch (status) {
+        case utm::BackupStatus::SCANNING:   return "SCANNING";
+        case utm::BackupStatus::BACKING_UP: return "BACKING_UP";
+        case utm::BackupStatus::VERIFYING:  return "VERIFYING";
+        case utm::BackupStatus::RESTORING:  return "RESTORING";
+        case utm::BackupStatus::COMPLETED:  return "COMPLETED";
+        case utm::BackupStatus::FAILED:     return "FAILED";
+        case utm::BackupStatus::CANCELLED:  return "CANCELLED";
+        default:                            return "IDLE";
+    }
+}
+
+// Progress of a backup as a JSON object
+std::string progressJson(const std::string& profileName, utm::BackupStatus status, const utm::BackupStats& stats) {
+    std::ostringstream out;
+    out << "{\"profile\":" << jsonString(profileName)
+        << ",\"status\":\"" << backupStatusName(status) << "\""
+        << ",\"totalFiles\":" << stats.totalFiles
+        << ",\"processedFiles\":" << stats.processedFiles
+        << ",\"totalSize\":" << stats.totalSize
+        << ",\"processedSize\":" << stats.processedSize
+        << ",\"newFiles\":" << stats.newFiles
+        << ",\"modifiedFiles\":" << stats.modifiedFiles
+        << ",\"unchangedFiles\":" << stats.unchangedFiles
+        << ",\"skippedFiles\":" << stats.skippedFiles
+        << ",\"totalDirectories\":" << stats.totalDirectories
+        << ",\"elapsedMs\":" << std::chrono::duration_cast<std::chrono::milliseconds>(
+               stats.endTime.value_or(std::chrono::system_clock::now()) - stats.startTime).count()
+        << ",\"ioThrottledMs\":" << stats.ioThrottledTime.count()
+        << ",\"compressionRatio\":" << stats.compressionRatio
+        << ",\"dedupSavings\":" << stats.dedupSavings
+        << ",\"filesPerSecond\":" << stats.filesPerSecond
+        << ",\"bytesPerSecond\":" << stats.bytesPerSecond
+        << ",\"remainingSeconds\":";
+    if (stats.remainingTime) {
+        out << stats.remainingTime->count();
+    } else {
+        out << "null";
+    }
+    out
+        << ",\"percentComplete\":" << (stats.totalSize ? 100.0 * stats.processedSize / stats.totalSize : 0.0)
+        << "}";
+    return out.str();
+}
+
+// Rate and remaining time after a line of text progress
+void printRate(const utm::BackupStats& stats) {
+    std::cout << ", " << static_cast<std::uint64_t>(stats.filesPerSecond) << " files/s";
+    if (stats.remainingTime) {
+        std::cout << ", " << stats.remainingTime->count() << "s left";
+    }
+    std::cout << '\n';
+}
+
+// Text progress of a backup
+void printBackupProgress(utm::BackupStatus status, const utm::BackupStats& stats) {
+    switch (status) {
+        case utm::BackupStatus::SCANNING:
+            std::cout << "Scanning files...\n";
+            break;
+        case utm::BackupStatus::BACKING_UP:
+            std::cout << "Backing up files: " << stats.processedFiles << "/" << stats.totalFiles 
+                      << " (" << (stats.processedSize * 100 / (stats.totalSize ? stats.totalSize : 1)) << "%)";
+            printRate(stats);
+            break;
+        case utm::BackupStatus::VERIFYING:
+            std::cout << "Verifying backup...\n";
+            break;
+        case utm::BackupStatus::COMPLETED:
+            std::cout << "Backup completed successfully.\n";
+            std::cout << "Total files: " << stats.totalFiles << '\n';
+            std::cout << "Total size: " << stats.totalSize << " bytes\n";
+            std::cout << "New files: " << stats.newFiles << '\n';
+            std::cout << "Modified files: " << stats.modifiedFiles << '\n';
+            std::cout << "Unchanged files: " << stats.unchangedFiles << '\n';
+            std::cout << "Skipped files: " << stats.skippedFiles << '\n';
+            if (stats.compressionRatio != 1.0) {
+                std::cout << "Compression ratio: " << stats.compressionRatio << '\n';
+            }
+            if (stats.dedupSavings > 0) {
+                std::cout << "Storage saved by deduplication: " << stats.dedupSavings << " bytes\n";
+            }
+            break;
+        case utm::BackupStatus::FAILED:
+            std::cerr << "Backup failed.\n";
+            break;
+        case utm::BackupStatus::CANCELLED:
+            std::cout << "Backup cancelled.\n";
+            break;
+        default:
+            break;
+    }
+    std::cout << std::flush;
+}
+
+// Text progress of a restore
+void printRestoreProgress(utm::BackupStatus status, const utm::BackupStats& stats, bool dryRun) {
+    switch (status) {
+        case utm::BackupStatus::SCANNING:
+            std::cout << "Scanning backup...\n";
+            break;
+        case utm::BackupStatus::VERIFYING:
+            std::cout << "Comparing files with the target...\n";
+            break;
+        case utm::BackupStatus::RESTORING:
+            std::cout << "Restoring files: " << stats.processedFiles << "/" << stats.totalFiles
+                      << " (" << (stats.processedSize * 100 / (stats.totalSize ? stats.totalSize : 1)) << "%)";
+            printRate(stats);
+            break;
+        case utm::BackupStatus::COMPLETED:
+            if (dryRun) {
+                break;
+            }
+            std::cout << "Restore completed successfully.\n";
+            std::cout << "Restored files: " << stats.processedFiles << '\n';
+            std::cout << "Restored size: " << stats.processedSize << " bytes\n";
+            break;
+        case utm::BackupStatus::FAILED:
+            std::cerr << "Restore failed.\n";
+            break;
+        case utm::BackupStatus::CANCELLED:
+            std::cout << "Restore cancelled.\n";
+            break;
+        default:
+            break;
+    }
+    std::cout << std::flush;
+}
+
+// Print the events of an event log, one per line
+void printEvents(const utm::EventLogContents& contents, bool ndjson) {
+    for (const auto& record : contents.records) {
+        const std::string& directory = contents.path(record.directory);
+        if (ndjson) {
+            std::cout << "{\"timeNs\":" << record.time
+                      << ",\"phase\":\"" << utm::eventPhaseToString(record.phase) << "\""
+                      << ",\"latencyUs\":" << record.latency
+                      << ",\"bytes\":" << record.bytes
+                      << ",\"directory\":" << jsonString(directory)
+                      << ",\"file\":";
+            if (record.file != utm::EventLog::NO_PATH) {
+                std::cout << jsonString(contents.path(record.file));
+            } else {
+                std::cout << "null";
+            }
+            std::cout << ",\"failed\":" << (record.failed ? "true" : "false") << "}\n";
+        } else {
+            std::cout << '+' << std::fixed << std::setprecision(6) << record.time / 1e9 << "s "
+                      << std::left << std::setw(8) << utm::eventPhaseToString(record.phase) << std::right
+                      << std::setw(10) << record.latency << "us "
+                      << std::setw(12) << record.bytes << "B  "
+                      << (record.file != utm::EventLog::NO_PATH ? contents.path(record.file) : directory)
+                      << (record.failed ? "  FAILED" : "") << '\n';
+        }
+    }
+    std::cout << std::flush;
+}
+
+// Print the directories of an event log that took longest
+void printEventSummary(const utm::EventLogContents& contents, std::size_t top, bool ndjson) {
+    const auto summaries = utm::summarizeEventLog(contents, top);
+    if (!ndjson) {
+        std::cout << "Event log opened " << formatTime(contents.opened) << ": " << contents.totalEvents
+                  << " events recorded, " << contents.records.size() << " kept\n";
+        std::cout << "Slowest directories:\n";
+    }
+    for (const auto& summary : summaries) {
+        const std::string& directory = contents.path(summary.directory);
+        if (ndjson) {
+            std::cout << "{\"directory\":" << jsonString(directory)
+                      << ",\"events\":" << summary.events
+                      << ",\"failed\":" << summary.failed
+                      << ",\"bytes\":" << summary.bytes
+                      << ",\"totalUs\":" << summary.totalLatency
+                      << ",\"maxUs\":" << summary.maxLatency
+                      << ",\"slowestFile\":";
+            if (summary.slowestFile != utm::EventLog::NO_PATH) {
+                std::cout << jsonString(contents.path(summary.slowestFile));
+            } else {
+                std::cout << "null";
+            }
+            std::cout << "}\n";
+        } else {
+            std::cout << std::fixed << std::setprecision(1)
+                      << std::setw(10) << summary.totalLatency / 1000.0 << " ms "
+                      << std::setw(8) << summary.events << " events "
+                      << std::setw(10) << summary.maxLatency / 1000.0 << " ms max  "
+                      << directory;
+            if (summary.failed > 0) {
+                std::cout << "  (" << summary.failed << " failed)";
+            }
+            if (summary.slowestFile != utm::EventLog::NO_PATH) {
+                std::cout << "\n" << std::string(48, ' ') << "slowest: " << contents.path(summary.slowestFile);
+            }
+            std::cout << '\n';
+        }
+    }
+    std::cout << std::flush;
+}
+
+// Backup configuration of a profile
+utm::BackupConfig makeBackupConfig(const utm::BackupProfile& profile) {
+    utm::BackupConfig config;
+    config.sourcePaths = profile.sourcePaths;
+    config.destinationPath = profile.destinationPath;
+    config.excludePatterns = profile.excludePatterns;
+    config.useCompression = profile.useCompression;
+    config.compressionLevel = profile.compressionLevel;
+    config.useHardLinks = profile.useHardLinks;
+    config.verifyBackup = profile.verifyBackup;
+    config.threadCount = profile.threadCount;
+    config.ioLimits = profile.ioLimits;
+
+    // One event log per profile, so concurrent backups do not share a ring
+    if (!g_eventLogDir.empty()) {
+        config.eventLogPath = g_eventLogDir / (profile.name + ".events");
+        config.eventLogRecords = g_eventLogRecords;
+    }
+
+    if (profile.useEncryption && !profile.encryptionMethod.empty()) {
+        // In a real implementation, we would prompt for a password or use a secure key store
+        // For this example, we'll just use a placeholder
+        config.encryptionKey = "encryption-key-placeholder";
+    }
+    return config;
+}
+
+// Requests the daemon serves on its control socket
+void registerControlMethods(
+    utm::ControlServer& server,
+    utm::BackupExecutor& executor,
+    const std::function<bool(const utm::BackupProfile&)>& submitBackup) {
+
+    auto param = [](const utm::RpcParams& params, const char* name) {
+        auto it = params.find(name);
+        return it != params.end() ? it->second : std::string();
+    };
+
+    // Every request but ping and status names a profile
+    auto withProfile = [param](auto handler) {
+        return [param, handler](const utm::RpcParams& params, std::string& result) {
+            const std::string name = param(params, "profile");
+            auto profile = utm::getConfig().getBackupProfile(name);
+            if (!profile) {
+                result = "Profile not found: " + name;
+                return false;
+            }
+            return handler(*profile, params, result);
+        };
+    };
+
+    server.registerMethod("ping", [](const utm::RpcParams&, std::string& result) {
+        result = "{\"version\":\"2.0.0\"}";
+        return true;
+    });
+
+    server.registerMethod("status", [&executor, &server](const utm::RpcParams&, std::string& result) {
+        result = "{\"runningJobs\":" + std::to_string(executor.runningJobs()) +
+                 ",\"queuedJobs\":" + std::to_string(executor.queuedJobs()) +
+                 ",\"clients\":" + std::to_string(server.clientCount()) + "}";
+        return true;
+    });
+
+    server.registerMethod("listProfiles", [](const utm::RpcParams&, std::string& result) {
+        result = "[";
+        for (const auto& profile : utm::getConfig().getAllBackupProfiles()) {
+            if (result.size() > 1) {
+                result += ',';
+            }
+            result += jsonString(profile.name);
+        }
+        result += "]";
+        return true;
+    });
+
+    server.registerMethod("listSnapshots", withProfile(
+        [](const utm::BackupProfile& profile, const utm::RpcParams&, std::string& result) {
+            std::ostringstream out;
+            writeSnapshots(out, profile.name, profile);
+            result = out.str();
+            return true;
+        }));
+
+    server.registerMethod("listDir", withProfile(
+        [param](const utm::BackupProfile& profile, const utm::RpcParams& params, std::string& result) {
+            auto timestamp = findSnapshot(param(params, "snapshot"), profile, result);
+            if (!timestamp) {
+                return false;
+            }
+
+            // Requests are served one at a time; indexing an old snapshot here would hold up every client
+            const auto snapshotDir = utm::fs::getBackupPath(profile.destinationPath, *timestamp);
+            if (!std::filesystem::exists(snapshotDir / utm::SnapshotIndex::FILE_NAME)) {
+                result = "Backup has no index yet; list it once with utm-core --list-dir to build one";
+                return false;
+            }
+
+            utm::RestoreEngine restoreEngine;
+            if (!restoreEngine.initialize(profile.destinationPath)) {
+                result = "Failed to open backups for profile: " + profile.name;
+                return false;
+            }
+
+            const std::string path = param(params, "path");
+            const std::string limit = param(params, "limit");
+            auto page = restoreEngine.listDirectory(path, *timestamp, param(params, "cursor"),
+                                                    limit.empty() ? 1000 : std::stoul(limit));
+            if (!page) {
+                result = "Directory not found in backup: " + path;
+                return false;
+            }
+
+            std::ostringstream out;
+            writeDirectoryPage(out, path, *page);
+            result = out.str();
+            return true;
+        }));
+
+    server.registerMethod("startBackup", withProfile(
+        [submitBackup](const utm::BackupProfile& profile, const utm::RpcParams&, std::string& result) {
+            if (!submitBackup(profile)) {
+                result = "A backup of this profile is already queued or running";
+                return false;
+            }
+            result = "{\"backupId\":" + jsonString(profile.name) + "}";
+            return true;
+        }));
+
+    server.registerMethod("cancelBackup", withProfile(
+        [&executor](const utm::BackupProfile& profile, const utm::RpcParams&, std::string& result) {
+            if (!executor.cancel(profile.name)) {
+                result = "No backup of this profile is queued or running";
+                return false;
+            }
+            result = "true";
+            return true;
+        }));
+}
+
 // Signal handler
 void signalHandler(int signal) {
     if (signal == SIGINT || signal == SIGTERM) {
@@ -46,15 +520,50 @@ int main(int argc, char* argv[]) {
             ("config,c", po::value<std::string>(), "Configuration directory")
             ("log-level,l", po::value<std::string>()->default_value("info"), "Log level (trace, debug, info, warning, error, critical)")
             ("daemon,d", "Run as a daemon")
+            ("output", po::value<std::string>()->default_value("text"), "Progress output of --backup and --restore (text, ndjson)")
+            ("progress-rate", po::value<double>()->default_value(10.0), "Most progress updates per second")
+            ("socket", po::value<std::string>(), "Control socket of the daemon (default: $XDG_RUNTIME_DIR/ubuntu-time-machine.sock)")
             ("backup", po::value<std::string>(), "Perform a backup with the specified profile")
             ("restore", po::value<std::string>(), "Restore a backup with the specified profile")
+            ("snapshot", po::value<std::string>(), "Backup to restore from, as shown by --list-backups (default: latest)")
+            ("target", po::value<std::string>(), "Directory to restore into")
+            ("path", po::value<std::vector<std::string>>()->composing(), "Path within the backup to restore (repeatable, default: everything)")
+            ("incremental", "Only restore files that differ from the target")
+            ("delete", "With --incremental, remove target files that are not in the backup")
+            ("dry-run", "Show what a restore or prune would change without writing anything")
+            ("prune", po::value<std::string>(), "Remove the backups of a profile that its retention policy no longer keeps")
             ("list-profiles", "List all available backup profiles")
-            ("list-backups", po::value<std::string>(), "List all backups for a profile");
+            ("list-backups", po::value<std::string>(), "List all backups for a profile")
+            ("list-snapshots", po::value<std::string>(), "List all snapshots of a profile with their summaries as JSON")
+            ("list-dir", po::value<std::string>(), "List a directory of a backup as JSON (with --snapshot, --path, --cursor, --limit)")
+            ("history", po::value<std::string>(), "List every backed-up version of --path for a profile")
+            ("find", po::value<std::string>(), "Find backed-up files of a profile by --name")
+            ("name", po::value<std::string>(), "File name glob (budget_2023*.xlsx) or substring for --find")
+            ("diff", po::value<std::string>(), "Show changes between two backups of a profile (with --from, --to)")
+            ("from", po::value<std::string>(), "Older backup for --diff (default: the one before --to)")
+            ("to", po::value<std::string>(), "Newer backup for --diff (default: latest)")
+            ("cursor", po::value<std::string>(), "Cursor returned by the previous --list-dir page")
+            ("limit", po::value<size_t>()->default_value(1000), "Maximum entries per --list-dir page")
+            ("event-log", "Record per-file backup events in <profile>.events next to the log")
+            ("decode-events", po::value<std::string>(), "Print the events of an event log (with --output)")
+            ("summary", "With --decode-events, show the slowest directories instead of every event")
+            ("top", po::value<size_t>()->default_value(20), "Directories shown by --summary");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
         po::notify(vm);
 
+        // The daemon takes termination signals with sigwaitinfo; they must be blocked before the
+        // logger or any other thread starts, so every thread inherits the mask
+        sigset_t daemonSignals;
+        sigemptyset(&daemonSignals);
+        sigaddset(&daemonSignals, SIGINT);
+        sigaddset(&daemonSignals, SIGTERM);
+        sigaddset(&daemonSignals, SIGHUP);
+        if (vm.count("daemon")) {
+            pthread_sigmask(SIG_BLOCK, &daemonSignals, nullptr);
+        }
+
         // Display help if requested
         if (vm.count("help")) {
             std::cout << desc << std::endl;
@@ -67,6 +576,36 @@ int main(int argc, char* argv[]) {
             return 0;
         }
 
+        // With --output=ndjson stdout only carries progress events, one JSON object per line
+        const std::string output = vm["output"].as<std::string>();
+        if (output != "text" && output != "ndjson") {
+            std::cerr << "Invalid --output: " << output << " (expected text or ndjson)" << std::endl;
+            return 1;
+        }
+        const bool ndjson = output == "ndjson";
+
+        // Log messages are written by the logger's thread; they go to stderr whenever stdout carries
+        // output meant for other programs, so they cannot end up in the middle of it
+        if (ndjson || vm.count("list-snapshots") || vm.count("list-dir") || vm.count("diff") ||
+            vm.count("decode-events")) {
+            utm::getLogger().setConsoleStderr(true);
+        }
+        const double progressRate = vm["progress-rate"].as<double>();
+
+        // Decoding an event log needs no configuration
+        if (vm.count("decode-events")) {
+            auto contents = utm::readEventLog(vm["decode-events"].as<std::string>());
+            if (!contents) {
+                return 1;
+            }
+            if (vm.count("summary")) {
+                printEventSummary(*contents, vm["top"].as<size_t>(), ndjson);
+            } else {
+                printEvents(*contents, ndjson);
+            }
+            return 0;
+        }
+
         // Determine configuration directory
         std::filesystem::path configDir;
         if (vm.count("config")) {
@@ -92,8 +631,9 @@ int main(int argc, char* argv[]) {
             std::filesystem::create_directories(logDir);
         }
 
+        const utm::ApplicationConfig& appConfig = utm::getConfig().getApplicationConfig();
         utm::Logger& logger = utm::getLogger();
-        if (!logger.initialize(logDir)) {
+        if (!logger.initialize(logDir, appConfig.maxLogSize, appConfig.maxLogFiles)) {
             std::cerr << "Failed to initialize logger" << std::endl;
             return 1;
         }
@@ -103,8 +643,24 @@ int main(int argc, char* argv[]) {
         logger.setConsoleLevel(utm::stringToLogLevel(logLevel));
         logger.setFileLevel(utm::LogLevel::DEBUG); // File logging is always more verbose
 
+        logger.setOverflowPolicy(appConfig.blockOnLogOverflow ? utm::LogOverflow::BLOCK : utm::LogOverflow::DROP);
+        logger.setFlushInterval(std::chrono::milliseconds(appConfig.logFlushIntervalMs));
+
+        if (appConfig.eventLog || vm.count("event-log")) {
+            g_eventLogDir = logDir;
+            g_eventLogRecords = appConfig.eventLogRecords;
+        }
+
         utm::getLogger().info("Ubuntu Time Machine Core v2.0.0 starting up");
 
+        // Keep backups and restores within the configured CPU share and behind other tasks
+        utm::GovernorOptions governorOptions;
+        governorOptions.limitCpuUsage = appConfig.limitCpuUsage;
+        governorOptions.maxCpuPercentage = appConfig.maxCpuPercentage;
+        governorOptions.adaptToPressure = appConfig.adaptToPressure;
+        governorOptions.pressureTarget = appConfig.pressureTargetPercentage;
+        utm::getResourceGovernor().configure(governorOptions);
+
         // Install signal handlers
         std::signal(SIGINT, signalHandler);
         std::signal(SIGTERM, signalHandler);
@@ -142,111 +698,441 @@ int main(int argc, char* argv[]) {
 
             std::cout << "Available backups for profile " << profileName << ":" << std::endl;
             for (const auto& backup : backups) {
-                // Format the time as ISO 8601
-                std::time_t time = std::chrono::system_clock::to_time_t(backup);
-                char timeStr[100];
-                std::strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", std::localtime(&time));
-                std::cout << "  - " << timeStr << std::endl;
+                std::cout << "  - " << formatTime(backup) << std::endl;
             }
             return 0;
         }
 
-        if (vm.count("backup")) {
-            const std::string profileName = vm["backup"].as<std::string>();
+        if (vm.count("list-snapshots")) {
+            const std::string profileName = vm["list-snapshots"].as<std::string>();
             auto profile = utm::getConfig().getBackupProfile(profileName);
             if (!profile) {
                 std::cerr << "Profile not found: " << profileName << std::endl;
                 return 1;
             }
 
-            utm::BackupConfig config;
-            config.sourcePaths = profile->sourcePaths;
-            config.destinationPath = profile->destinationPath;
-            config.excludePatterns = profile->excludePatterns;
-            config.useCompression = profile->useCompression;
-            config.compressionLevel = profile->compressionLevel;
-            config.useHardLinks = profile->useHardLinks;
-            config.verifyBackup = profile->verifyBackup;
-            config.threadCount = profile->threadCount;
-            
-            if (profile->useEncryption && !profile->encryptionMethod.empty()) {
-                // In a real implementation, we would prompt for a password or use a secure key store
-                // For this example, we'll just use a placeholder
-                config.encryptionKey = "encryption-key-placeholder";
+            // One JSON document from the snapshot catalog, for the GUI
+            writeSnapshots(std::cout, profileName, *profile);
+            std::cout << std::endl;
+            return 0;
+        }
+
+        if (vm.count("list-dir")) {
+            const std::string profileName = vm["list-dir"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
             }
 
-            utm::getLogger().info("Starting backup for profile: " + profileName);
-            
-            g_backupEngine->startBackup(config, [](utm::BackupStatus status, const utm::BackupStats& stats) {
-                switch (status) {
-                    case utm::BackupStatus::SCANNING:
-                        std::cout << "Scanning files..." << std::endl;
-                        break;
-                    case utm::BackupStatus::BACKING_UP:
-                        std::cout << "Backing up files: " << stats.processedFiles << "/" << stats.totalFiles 
-                                  << " (" << (stats.processedSize * 100 / (stats.totalSize ? stats.totalSize : 1)) << "%)" << std::endl;
-                        break;
-                    case utm::BackupStatus::VERIFYING:
-                        std::cout << "Verifying backup..." << std::endl;
-                        break;
-                    case utm::BackupStatus::COMPLETED:
-                        std::cout << "Backup completed successfully." << std::endl;
-                        std::cout << "Total files: " << stats.totalFiles << std::endl;
-                        std::cout << "Total size: " << stats.totalSize << " bytes" << std::endl;
-                        std::cout << "New files: " << stats.newFiles << std::endl;
-                        std::cout << "Modified files: " << stats.modifiedFiles << std::endl;
-                        std::cout << "Unchanged files: " << stats.unchangedFiles << std::endl;
-                        std::cout << "Skipped files: " << stats.skippedFiles << std::endl;
-                        if (stats.compressionRatio != 1.0) {
-                            std::cout << "Compression ratio: " << stats.compressionRatio << std::endl;
-                        }
-                        if (stats.dedupSavings > 0) {
-                            std::cout << "Storage saved by deduplication: " << stats.dedupSavings << " bytes" << std::endl;
-                        }
-                        g_running = false;
+            auto timestamp = selectSnapshot(vm, *profile);
+            if (!timestamp) {
+                return 1;
+            }
+
+            utm::RestoreEngine restoreEngine;
+            if (!restoreEngine.initialize(profile->destinationPath)) {
+                std::cerr << "Failed to open backups for profile: " << profileName << std::endl;
+                return 1;
+            }
+
+            std::string path;
+            if (vm.count("path")) {
+                path = vm["path"].as<std::vector<std::string>>().front();
+            }
+            const std::string cursor = vm.count("cursor") ? vm["cursor"].as<std::string>() : std::string();
+
+            auto page = restoreEngine.listDirectory(path, *timestamp, cursor, vm["limit"].as<size_t>());
+            if (!page) {
+                std::cerr << "Directory not found in backup: " << path << std::endl;
+                return 1;
+            }
+
+            // One JSON document, for the GUI
+            writeDirectoryPage(std::cout, path, *page);
+            std::cout << std::endl;
+            return 0;
+        }
+
+        if (vm.count("history")) {
+            const std::string profileName = vm["history"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
+            }
+            if (!vm.count("path")) {
+                std::cerr << "--history requires --path" << std::endl;
+                return 1;
+            }
+
+            utm::Database catalog;
+            if (!catalog.open(configDir / "metadata" / "catalog.db")) {
+                std::cerr << "Failed to open the file catalog" << std::endl;
+                return 1;
+            }
+
+            const std::string path = vm["path"].as<std::vector<std::string>>().front();
+            auto versions = catalog.getFileVersions(path, profile->destinationPath);
+            std::cout << versions.size() << " version(s) of " << path << ":" << std::endl;
+            for (const auto& version : versions) {
+                std::cout << "  - " << formatTime(version.firstSeen) << " .. " << formatTime(version.lastSeen)
+                          << "  " << version.record.size << " bytes"
+                          << "  " << version.record.checksum.substr(0, 16) << std::endl;
+            }
+            return 0;
+        }
+
+        if (vm.count("diff")) {
+            const std::string profileName = vm["diff"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
+            }
+
+            // Newest first, as returned by listBackups
+            const auto backups = g_backupEngine->listBackups(profile->destinationPath);
+            auto pick = [&](const char* option, std::size_t defaultPosition)
+                -> std::optional<std::chrono::system_clock::time_point> {
+                if (vm.count(option)) {
+                    auto requested = parseSnapshotTime(vm[option].as<std::string>());
+                    if (!requested) {
+                        std::cerr << "Invalid snapshot time: " << vm[option].as<std::string>() << std::endl;
+                    }
+                    return requested;
+                }
+                if (defaultPosition >= backups.size()) {
+                    std::cerr << "Not enough backups to compare for profile: " << profileName << std::endl;
+                    return std::nullopt;
+                }
+                return backups[defaultPosition];
+            };
+
+            auto to = pick("to", 0);
+            if (!to) {
+                return 1;
+            }
+            auto toPosition = std::find(backups.begin(), backups.end(), *to) - backups.begin();
+            auto from = pick("from", static_cast<std::size_t>(toPosition) + 1);
+            if (!from) {
+                return 1;
+            }
+
+            utm::RestoreEngine restoreEngine;
+            if (!restoreEngine.initialize(profile->destinationPath)) {
+                std::cerr << "Failed to open backups for profile: " << profileName << std::endl;
+                return 1;
+            }
+
+            auto summary = restoreEngine.diffBackups(*from, *to, [](const utm::DiffEntry& entry) {
+                switch (entry.change) {
+                    case utm::DiffChange::ADDED:
+                        std::cout << "A\t" << entry.newSize << "\t" << entry.path << "\n";
                         break;
-                    case utm::BackupStatus::FAILED:
-                        std::cerr << "Backup failed." << std::endl;
-                        g_running = false;
+                    case utm::DiffChange::REMOVED:
+                        std::cout << "D\t" << entry.oldSize << "\t" << entry.path << "\n";
                         break;
-                    case utm::BackupStatus::CANCELLED:
-                        std::cout << "Backup cancelled." << std::endl;
-                        g_running = false;
+                    case utm::DiffChange::MODIFIED:
+                        std::cout << "M\t" << entry.oldSize << " -> " << entry.newSize << "\t" << entry.path << "\n";
                         break;
-                    default:
+                    case utm::DiffChange::RENAMED:
+                        std::cout << "R\t" << entry.newSize << "\t" << entry.previousPath << " -> " << entry.path << "\n";
                         break;
                 }
             });
+            if (!summary) {
+                std::cerr << "Failed to compare backups" << std::endl;
+                return 1;
+            }
+
+            std::cout << "Changes from " << formatTime(*from) << " to " << formatTime(*to) << ":" << std::endl;
+            std::cout << "  Added:    " << summary->addedEntries << " (" << summary->addedBytes << " bytes)" << std::endl;
+            std::cout << "  Removed:  " << summary->removedEntries << " (" << summary->removedBytes << " bytes)" << std::endl;
+            std::cout << "  Modified: " << summary->modifiedEntries << " (" << summary->modifiedBytes << " bytes)" << std::endl;
+            std::cout << "  Renamed:  " << summary->renamedEntries << " (" << summary->renamedBytes << " bytes)" << std::endl;
+            std::cout << "  Growth:   " << summary->growthBytes << " bytes" << std::endl;
+            return 0;
+        }
+
+        if (vm.count("find")) {
+            const std::string profileName = vm["find"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
+            }
+            if (!vm.count("name")) {
+                std::cerr << "--find requires --name" << std::endl;
+                return 1;
+            }
+
+            utm::Database catalog;
+            if (!catalog.open(configDir / "metadata" / "catalog.db")) {
+                std::cerr << "Failed to open the file catalog" << std::endl;
+                return 1;
+            }
+
+            auto versions = catalog.findFiles(vm["name"].as<std::string>(), profile->destinationPath);
+            std::filesystem::path currentPath;
+            for (const auto& version : versions) {
+                if (version.record.path != currentPath) {
+                    currentPath = version.record.path;
+                    std::cout << currentPath.string() << std::endl;
+                }
+                std::cout << "  - " << formatTime(version.firstSeen) << " .. " << formatTime(version.lastSeen)
+                          << "  " << version.record.size << " bytes" << std::endl;
+            }
+            return 0;
+        }
+
+        if (vm.count("prune")) {
+            const std::string profileName = vm["prune"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
+            }
+
+            const bool dryRun = vm.count("dry-run") > 0;
+            if (!g_backupEngine->pruneBackups(profile->destinationPath, profile->retention, dryRun)) {
+                std::cerr << "Failed to prune backups for profile: " << profileName << std::endl;
+                return 1;
+            }
+
+            const utm::PrunePlan plan = g_backupEngine->getLastPrunePlan();
+            for (const auto& candidate : plan.snapshots) {
+                const char* reason = "";
+                switch (candidate.reason) {
+                    case utm::PruneReason::RETENTION: reason = "expired   "; break;
+                    case utm::PruneReason::FAILED: reason = "failed    "; break;
+                    case utm::PruneReason::FREE_SPACE: reason = "free-space"; break;
+                }
+                std::cout << reason << " " << formatTime(candidate.timestamp);
+                if (plan.accounted) {
+                    std::cout << " (" << candidate.reclaimableBytes << " bytes freed, "
+                              << candidate.exclusiveBytes << " bytes exclusive)";
+                }
+                std::cout << std::endl;
+            }
 
-            // Wait for backup to complete
-            while (g_running && g_backupEngine->getStatus() != utm::BackupStatus::IDLE &&
-                   g_backupEngine->getStatus() != utm::BackupStatus::COMPLETED &&
-                   g_backupEngine->getStatus() != utm::BackupStatus::FAILED &&
-                   g_backupEngine->getStatus() != utm::BackupStatus::CANCELLED) {
+            std::cout << (dryRun ? "Dry run, nothing was changed." : "Prune completed.") << std::endl;
+            std::cout << "Backups to remove: " << plan.snapshots.size() << std::endl;
+            std::cout << "Backups kept: " << plan.keptSnapshots << std::endl;
+            if (plan.accounted) {
+                std::cout << "Bytes freed: " << plan.reclaimableBytes << std::endl;
+            }
+            std::cout << "Free space before: " << plan.freeBytesBefore << " bytes" << std::endl;
+
+            // Finish deleting the pruned snapshots before exiting
+            if (!dryRun && !g_backupEngine->collectTrash(profile->destinationPath)) {
+                std::cerr << "Some pruned backups could not be deleted yet" << std::endl;
+            }
+            return 0;
+        }
+
+        if (vm.count("backup")) {
+            const std::string profileName = vm["backup"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
+            }
+
+            utm::BackupConfig config = makeBackupConfig(*profile);
+
+            utm::getLogger().info("Starting backup for profile: " + profileName);
+            
+            // Printed on the publisher's thread, a few times a second, never once per file
+            utm::ProgressPublisher progress([ndjson, &profileName](utm::BackupStatus status, const utm::BackupStats& stats) {
+                if (ndjson) {
+                    std::cout << progressJson(profileName, status, stats) << '\n' << std::flush;
+                } else {
+                    printBackupProgress(status, stats);
+                }
+                if (status == utm::BackupStatus::COMPLETED || status == utm::BackupStatus::FAILED ||
+                    status == utm::BackupStatus::CANCELLED) {
+                    g_running = false;
+                }
+            }, progressRate);
+
+            // Queued like the daemon's backups, so it takes turns with them on shared disks
+            std::atomic<utm::BackupStatus> finalStatus{utm::BackupStatus::IDLE};
+            utm::BackupExecutor executor(configDir / "metadata");
+            if (!executor.submit(profileName, config,
+                    [&progress, &finalStatus](utm::BackupStatus status, const utm::BackupStats& stats) {
+                        if (status == utm::BackupStatus::COMPLETED || status == utm::BackupStatus::FAILED ||
+                            status == utm::BackupStatus::CANCELLED) {
+                            finalStatus = status;
+                        }
+                        progress.update(status, stats);
+                    })) {
+                return 1;
+            }
+
+            // Wait for backup to complete, or cancel it on a termination signal
+            while (g_running && !executor.isIdle()) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
             }
+            if (!executor.isIdle() && finalStatus == utm::BackupStatus::IDLE) {
+                executor.cancelAll();
+            }
 
-            return g_backupEngine->getStatus() == utm::BackupStatus::COMPLETED ? 0 : 1;
+            // The job reports to the publisher until its thread ends
+            executor.wait();
+            return finalStatus == utm::BackupStatus::COMPLETED ? 0 : 1;
         }
 
         if (vm.count("restore")) {
-            // Similar to backup but for restore operations
-            std::cerr << "Restore functionality not implemented in this example" << std::endl;
-            return 1;
+            const std::string profileName = vm["restore"].as<std::string>();
+            auto profile = utm::getConfig().getBackupProfile(profileName);
+            if (!profile) {
+                std::cerr << "Profile not found: " << profileName << std::endl;
+                return 1;
+            }
+
+            if (!vm.count("target")) {
+                std::cerr << "No restore target given, use --target" << std::endl;
+                return 1;
+            }
+
+            // Pick the requested backup, or the most recent one
+            auto snapshot = selectSnapshot(vm, *profile);
+            if (!snapshot) {
+                return 1;
+            }
+            const std::chrono::system_clock::time_point timestamp = *snapshot;
+
+            std::vector<std::filesystem::path> paths;
+            if (vm.count("path")) {
+                for (const auto& path : vm["path"].as<std::vector<std::string>>()) {
+                    paths.emplace_back(path);
+                }
+            }
+
+            utm::RestoreEngine restoreEngine;
+            if (!restoreEngine.initialize(profile->destinationPath)) {
+                std::cerr << "Failed to open backups for profile: " << profileName << std::endl;
+                return 1;
+            }
+
+            utm::RestoreOptions options;
+            options.threadCount = profile->threadCount;
+            options.ioLimits = profile->ioLimits;
+            options.incremental = vm.count("incremental") > 0;
+            options.deleteExtraneous = options.incremental && vm.count("delete") > 0;
+            options.dryRun = vm.count("dry-run") > 0;
+
+            utm::getLogger().info("Starting restore for profile: " + profileName);
+
+            bool restored;
+            {
+                // Printed on the publisher's thread, a few times a second, never once per file
+                utm::ProgressPublisher progress(
+                    [ndjson, &profileName, dryRun = options.dryRun](utm::BackupStatus status, const utm::BackupStats& stats) {
+                        if (ndjson) {
+                            std::cout << progressJson(profileName, status, stats) << '\n' << std::flush;
+                        } else {
+                            printRestoreProgress(status, stats, dryRun);
+                        }
+                    }, progressRate);
+                restored = restoreEngine.restore(paths, vm["target"].as<std::string>(), timestamp,
+                                                 progress.callback(), options);
+            }
+
+            if (restored && options.dryRun) {
+                const utm::RestorePlan plan = restoreEngine.getLastPlan();
+                for (const auto& entry : plan.entries) {
+                    const char* action = "";
+                    switch (entry.action) {
+                        case utm::RestoreAction::CREATE: action = "create  "; break;
+                        case utm::RestoreAction::REPLACE: action = "replace "; break;
+                        case utm::RestoreAction::UPDATE_METADATA: action = "metadata"; break;
+                        case utm::RestoreAction::REMOVE: action = "remove  "; break;
+                        default: break;
+                    }
+                    std::cout << action << " " << entry.path.string() << " (" << entry.size << " bytes)" << std::endl;
+                }
+
+                std::cout << "Dry run, nothing was changed." << std::endl;
+                std::cout << "Files to create: " << plan.createFiles << std::endl;
+                std::cout << "Files to replace: " << plan.replaceFiles << std::endl;
+                std::cout << "Files to update metadata: " << plan.metadataFiles << std::endl;
+                std::cout << "Files unchanged: " << plan.unchangedFiles << std::endl;
+                std::cout << "Entries to remove: " << plan.removeEntries << " (" << plan.removeBytes << " bytes)" << std::endl;
+                std::cout << "Bytes to transfer: " << plan.transferBytes << std::endl;
+                std::cout << "Bytes already in place: " << plan.unchangedBytes << std::endl;
+            }
+
+            return restored ? 0 : 1;
         }
 
         // If no specific command was given, run as a service if daemon mode is enabled
         if (vm.count("daemon")) {
             utm::getLogger().info("Running in daemon mode");
-            
-            // Main service loop
+
+            // Clients talk to the daemon over its control socket instead of starting utm-core per call
+            utm::ControlServerOptions serverOptions;
+            if (vm.count("socket")) {
+                serverOptions.socketPath = vm["socket"].as<std::string>();
+            }
+            utm::ControlServer server(serverOptions);
+
+            // Scheduled backups of different profiles run side by side, queued per device
+            utm::BackupExecutor executor(configDir / "metadata");
+            std::mutex submitMutex;
+            auto submitBackup = [&executor, &server, &submitMutex, progressRate](const utm::BackupProfile& profile) {
+                // Nothing new starts once shutdown has begun
+                std::lock_guard<std::mutex> lock(submitMutex);
+                if (!g_running) {
+                    return false;
+                }
+
+                // The job's callback only stores stats; the publisher formats and sends them off the copy path
+                auto progress = std::make_shared<utm::ProgressPublisher>(
+                    [&server, name = profile.name](utm::BackupStatus status, const utm::BackupStats& stats) {
+                        server.publish("progress", name, progressJson(name, status, stats));
+                    }, progressRate);
+                return executor.submit(profile.name, makeBackupConfig(profile),
+                    [progress](utm::BackupStatus status, const utm::BackupStats& stats) {
+                        progress->update(status, stats);
+                    });
+            };
+            utm::Scheduler scheduler([&submitBackup](const utm::BackupProfile& profile) {
+                return submitBackup(profile);
+            });
+
+            registerControlMethods(server, executor, submitBackup);
+            if (!server.start()) {
+                return 1;
+            }
+
+            scheduler.setProfiles(utm::getConfig().getAllBackupProfiles());
+            if (!scheduler.start(configDir / "profiles")) {
+                return 1;
+            }
+
+            // Backups run on the scheduler's timers and on request; wait for a termination signal,
+            // reloading the profiles on SIGHUP
             while (g_running) {
-                // Check if there are any scheduled backups to run
-                // In a real implementation, this would check the schedule and run backups as needed
-                
-                // Sleep for a while before checking again
-                std::this_thread::sleep_for(std::chrono::seconds(10));
+                siginfo_t info;
+                int signal = sigwaitinfo(&daemonSignals, &info);
+                if (signal == SIGHUP) {
+                    utm::getLogger().info("Received SIGHUP, reloading profiles");
+                    utm::getConfig().reloadProfiles();
+                    scheduler.setProfiles(utm::getConfig().getAllBackupProfiles());
+                } else if (signal == SIGINT || signal == SIGTERM) {
+                    utm::getLogger().info("Received termination signal, shutting down...");
+                    g_running = false;
+                }
             }
+            // Running jobs publish their last progress through the server, so it stops last; a request
+            // that got past the check in submitBackup has queued its job before the lock is free
+            scheduler.stop();
+            { std::lock_guard<std::mutex> lock(submitMutex); }
+            executor.cancelAll();
+            executor.wait();
+            server.stop();
         } else {
             std::cout << "No command specified. Use --help for available options." << std::endl;
             return 1;
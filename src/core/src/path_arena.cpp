@@ -0,0 +1,139 @@
+#include "utm/path_arena.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <climits>
+
+namespace utm::fs {
+
+// PathArena implementation
+
+PathArena::PathArena(std::size_t initialCapacity)
+    : initialBuffer(std::make_unique<std::byte[]>(initialCapacity)),
+      initialCapacity(initialCapacity),
+      memory(initialBuffer.get(), initialCapacity) {
+}
+
+std::string_view PathArena::store(std::string_view text) {
+    auto* data = static_cast<char*>(memory.allocate(text.size() + 1, alignof(char)));
+    std::memcpy(data, text.data(), text.size());
+    data[text.size()] = '\0';
+    return std::string_view(data, text.size());
+}
+
+std::pmr::memory_resource* PathArena::resource() noexcept {
+    return &memory;
+}
+
+void PathArena::release() noexcept {
+    // Returns to the retained initial buffer; only overflow chunks are freed
+    memory.release();
+}
+
+// PathInterner implementation
+
+PathInterner::PathInterner() {
+    components.reserve(1024);
+    components.push_back({ROOT, {}});
+}
+
+PathInterner::Id PathInterner::intern(Id parent, std::string_view name) {
+    if (parent >= components.size()) {
+        throw std::out_of_range("Invalid parent component id");
+    }
+
+    auto* data = static_cast<char*>(names.allocate(name.size() + 1, alignof(char)));
+    std::memcpy(data, name.data(), name.size());
+    data[name.size()] = '\0';
+
+    components.push_back({parent, std::string_view(data, name.size())});
+    return static_cast<Id>(components.size() - 1);
+}
+
+PathInterner::Id PathInterner::parent(Id id) const {
+    return components.at(id).parent;
+}
+
+std::string_view PathInterner::name(Id id) const {
+    return components.at(id).name;
+}
+
+void PathInterner::appendPath(Id id, std::string& out) const {
+    if (id == ROOT) {
+        return;
+    }
+
+    // Collect the chain of components up to the root, then emit it in order
+    Id chain[PATH_MAX / 2];
+    std::size_t depth = 0;
+    for (Id current = id; current != ROOT && depth < std::size(chain); current = parent(current)) {
+        chain[depth++] = current;
+    }
+
+    while (depth > 0) {
+        std::string_view component = components[chain[--depth]].name;
+        if (!out.empty() && out.back() != '/') {
+            out.push_back('/');
+        }
+        out.append(component);
+    }
+}
+
+std::string PathInterner::path(Id id) const {
+    std::string result;
+    appendPath(id, result);
+    return result;
+}
+
+std::size_t PathInterner::size() const noexcept {
+    return components.size();
+}
+
+void PathInterner::clear() {
+    components.resize(1);
+    names.release();
+}
+
+// PathBuilder implementation
+
+PathBuilder::PathBuilder(std::string_view root) {
+    buffer.reserve(PATH_MAX);
+    reset(root);
+}
+
+void PathBuilder::reset(std::string_view root) {
+    buffer.assign(root);
+    while (buffer.size() > 1 && buffer.back() == '/') {
+        buffer.pop_back();
+    }
+    rootLength = buffer.size();
+}
+
+std::size_t PathBuilder::push(std::string_view component) {
+    std::size_t mark = buffer.size();
+    if (!buffer.empty() && buffer.back() != '/') {
+        buffer.push_back('/');
+    }
+    buffer.append(component);
+    return mark;
+}
+
+void PathBuilder::truncate(std::size_t mark) noexcept {
+    if (mark < buffer.size()) {
+        buffer.resize(mark);
+    }
+}
+
+std::string_view PathBuilder::relative() const noexcept {
+    std::string_view full(buffer);
+    if (full.size() <= rootLength) {
+        return {};
+    }
+
+    std::string_view rest = full.substr(rootLength);
+    if (!rest.empty() && rest.front() == '/') {
+        rest.remove_prefix(1);
+    }
+    return rest;
+}
+
+} // namespace utm::fs
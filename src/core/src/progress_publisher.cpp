@@ -0,0 +1,145 @@
+#include "utm/progress_publisher.hpp"
+#include "utm/logging.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include <pthread.h>
+#include <signal.h>
+
+namespace utm {
+
+// Implementation class for ProgressPublisher
+class ProgressPublisher::Impl {
+public:
+    Impl(ProgressCallback sink, double maxEventsPerSecond)
+        : sink(std::move(sink)),
+          interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(1.0 / (maxEventsPerSecond > 0.0 ? maxEventsPerSecond : 10.0)))) {
+        thread = std::thread([this] { run(); });
+    }
+
+    ~Impl() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    void update(BackupStatus status, const BackupStats& stats) {
+        if (static_cast<int>(status) != lastStatus.load(std::memory_order_relaxed)) {
+            // Status changes are rare and must all arrive; only the copy of the stats waits
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                lastStatus.store(static_cast<int>(status), std::memory_order_relaxed);
+                transitions.push_back({status, stats, ++sequence});
+            }
+            wake.notify_one();
+            return;
+        }
+
+        // The publisher only holds the lock to copy; if it does, the next file brings newer stats anyway
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (lock.owns_lock()) {
+            latest = {status, stats, ++sequence};
+        }
+    }
+
+private:
+    struct Event {
+        BackupStatus status = BackupStatus::IDLE;
+        BackupStats stats;
+        std::uint64_t sequence = 0;
+    };
+
+    ProgressCallback sink;
+    std::chrono::steady_clock::duration interval;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<int> lastStatus{-1};
+    std::vector<Event> transitions;
+    Event latest;
+    std::uint64_t sequence = 0;
+    std::uint64_t delivered = 0;
+    bool stopping = false;
+
+    void run() {
+        // Signals go to the thread that waits for them
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        std::vector<Event> pending;
+        auto nextTick = std::chrono::steady_clock::now();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait_until(lock, nextTick, [this] { return stopping || !transitions.empty(); });
+
+            const auto now = std::chrono::steady_clock::now();
+            pending.swap(transitions);
+            const bool tick = stopping || now >= nextTick;
+            if (tick) {
+                if (latest.sequence > delivered && (pending.empty() || latest.sequence > pending.back().sequence)) {
+                    pending.push_back(latest);
+                }
+                nextTick = now + interval;
+            }
+            if (!pending.empty()) {
+                delivered = std::max(delivered, pending.back().sequence);
+            }
+            const bool done = stopping;
+
+            lock.unlock();
+            deliver(pending);
+            pending.clear();
+            lock.lock();
+
+            if (done && transitions.empty()) {
+                return;
+            }
+        }
+    }
+
+    void deliver(const std::vector<Event>& events) {
+        for (const auto& event : events) {
+            try {
+                sink(event.status, event.stats);
+            }
+            catch (const std::exception& e) {
+                getLogger().warning("Progress consumer failed: " + std::string(e.what()));
+            }
+        }
+    }
+};
+
+// ProgressPublisher implementation
+
+ProgressPublisher::ProgressPublisher(ProgressCallback sink, double maxEventsPerSecond)
+    : pImpl(std::make_unique<Impl>(std::move(sink), maxEventsPerSecond)) {
+}
+
+ProgressPublisher::~ProgressPublisher() = default;
+
+void ProgressPublisher::update(BackupStatus status, const BackupStats& stats) {
+    pImpl->update(status, stats);
+}
+
+ProgressCallback ProgressPublisher::callback() {
+    return [this](BackupStatus status, const BackupStats& stats) {
+        pImpl->update(status, stats);
+    };
+}
+
+} // namespace utm
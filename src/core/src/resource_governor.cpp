@@ -0,0 +1,443 @@
+#include "utm/resource_governor.hpp"
+#include "utm/system_utils.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace utm {
+
+namespace {
+
+// How often the control thread checks for a desktop in use
+constexpr std::chrono::seconds desktopCheckInterval{10};
+
+// The bucket holds at most this much unused budget, and this much debt
+constexpr double burstSeconds = 0.5;
+constexpr double debtSeconds = 1.0;
+
+// Smallest share of a pool that keeps running while over the limit
+constexpr double minWorkerFraction = 0.05;
+
+// Pressure is measured over this window; the kernel's own averages react too slowly
+constexpr std::chrono::seconds pressureInterval{1};
+
+// Smallest share of full speed under pressure
+constexpr double minPressureScale = 0.05;
+
+std::int64_t processCpuTime() {
+    struct timespec ts;
+    if (::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+enum class Priority { NORMAL, BACKGROUND };
+
+// Scheduling state of the calling thread; its own nice level is restored on leaving the background
+struct ThreadPriority {
+    bool known = false;
+    bool restorable = false;            // whether the thread could leave the background again
+    bool jobThread = false;             // whether the thread ends with its job
+    Priority applied = Priority::NORMAL;
+    int normalNice = 0;
+};
+
+thread_local ThreadPriority threadPriority;
+
+} // namespace
+
+// Implementation class for ResourceGovernor
+class ResourceGovernor::Impl {
+public:
+    ~Impl() {
+        stopControl();
+    }
+
+    void configure(const GovernorOptions& newOptions) {
+        stopControl();
+
+        options = newOptions;
+        options.maxCpuPercentage = std::clamp(options.maxCpuPercentage, 1, 100);
+        if (options.period <= std::chrono::milliseconds(0)) {
+            options.period = std::chrono::milliseconds(100);
+        }
+        options.pressureTarget = std::clamp(options.pressureTarget, 1.0, 100.0);
+        limited = options.limitCpuUsage && options.maxCpuPercentage < 100;
+        workerPermille = 1000;
+        workerScalePermille = 1000;
+        ioScalePermille = 1000;
+
+        if (limited || options.yieldToDesktop || options.adaptToPressure) {
+            stopping = false;
+            controlThread = std::thread(&Impl::controlFunction, this);
+        }
+
+        if (limited) {
+            getLogger().info("Limiting CPU usage to " + std::to_string(options.maxCpuPercentage) + "% of " +
+                             std::to_string(cpuCount()) + " CPUs");
+        }
+    }
+
+    void throttle() {
+        applyPriority(desktopActive ? Priority::BACKGROUND : Priority::NORMAL);
+
+        if (!overBudget.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            budgetAvailable.wait(lock, [this] { return !overBudget || stopping; });
+        }
+        throttledNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::size_t activeWorkers(std::size_t poolSize) const {
+        int permille = workerScalePermille.load(std::memory_order_relaxed);
+        if (limited) {
+            permille = std::min(permille, workerPermille.load(std::memory_order_relaxed));
+        }
+        if (permille >= 1000 || poolSize <= 1) {
+            return poolSize;
+        }
+        auto allowed = static_cast<std::size_t>(std::ceil(poolSize * permille / 1000.0));
+        return std::clamp<std::size_t>(allowed, 1, poolSize);
+    }
+
+    double ioScale() const noexcept {
+        return ioScalePermille.load(std::memory_order_relaxed) / 1000.0;
+    }
+
+    GovernorStats getStats() const {
+        GovernorStats stats;
+        stats.cpuPercentage = cpuPermille.load() / 10.0;
+        stats.workerFraction = workerPermille.load() / 1000.0;
+        stats.desktopActive = desktopActive.load();
+        stats.cpuPressure = cpuPressurePermille.load() / 10.0;
+        stats.ioPressure = ioPressurePermille.load() / 10.0;
+        stats.memoryPressure = memoryPressurePermille.load() / 10.0;
+        stats.workerScale = workerScalePermille.load() / 1000.0;
+        stats.ioScale = ioScalePermille.load() / 1000.0;
+        stats.throttledTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::nanoseconds(throttledNanos.load()));
+        return stats;
+    }
+
+private:
+    GovernorOptions options;
+    std::thread controlThread;
+
+    std::mutex mutex;
+    std::condition_variable budgetAvailable;            // also wakes the control thread to stop
+    bool stopping = false;
+
+    std::atomic<bool> limited{false};
+    std::atomic<bool> overBudget{false};
+    std::atomic<bool> desktopActive{false};
+    std::atomic<int> workerPermille{1000};
+    std::atomic<int> cpuPermille{0};
+    std::atomic<int> workerScalePermille{1000};
+    std::atomic<int> ioScalePermille{1000};
+    std::atomic<int> cpuPressurePermille{0};
+    std::atomic<int> ioPressurePermille{0};
+    std::atomic<int> memoryPressurePermille{0};
+
+    // Pressure totals at the start of the current window, of the system and of the cgroups the process is not in
+    std::optional<system::SystemPressure> lastSystemPressure;
+    std::optional<std::map<std::string, system::SystemPressure>> lastOtherPressure;
+    std::atomic<std::int64_t> throttledNanos{0};
+
+    static unsigned cpuCount() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    void stopControl() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            overBudget = false;
+        }
+        budgetAvailable.notify_all();
+        if (controlThread.joinable()) {
+            controlThread.join();
+        }
+        desktopActive = false;
+    }
+
+    // Sample the process CPU time every period and keep the bucket, the pool share and the priority up to date
+    void controlFunction() {
+        // Signals are for the threads that wait for them, not for this one
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        const double cpus = cpuCount();
+        const double limit = cpus * options.maxCpuPercentage / 100.0;   // CPUs the process may use
+        double natural = 0.0;                                            // CPUs used at full speed, recently
+        double tokens = 0.0;                                             // CPU seconds left
+        double smoothed = 0.0;
+
+        auto lastWall = std::chrono::steady_clock::now();
+        std::int64_t lastCpu = processCpuTime();
+        auto nextDesktopCheck = lastWall;
+        auto lastPressureCheck = lastWall;
+
+        if (options.adaptToPressure) {
+            lastSystemPressure = system::getSystemPressure();
+            lastOtherPressure = system::getOtherCgroupsPressure();
+            if (!lastSystemPressure) {
+                getLogger().info("No pressure stall information; adapting to the load average instead");
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!budgetAvailable.wait_for(lock, options.period, [this] { return stopping; })) {
+            lock.unlock();
+
+            auto now = std::chrono::steady_clock::now();
+            std::int64_t cpu = processCpuTime();
+            double wall = std::chrono::duration<double>(now - lastWall).count();
+            double used = (cpu - lastCpu) / 1e9;
+            lastWall = now;
+            lastCpu = cpu;
+
+            if (options.yieldToDesktop && now >= nextDesktopCheck) {
+                bool active = system::isDesktopInUse();
+                if (active != desktopActive.exchange(active)) {
+                    getLogger().info(active ? "Desktop in use, backup workers yield the CPU"
+                                            : "Desktop idle, backup workers run at normal priority");
+                }
+                nextDesktopCheck = now + desktopCheckInterval;
+            }
+
+            if (options.adaptToPressure && now - lastPressureCheck >= pressureInterval) {
+                updatePressure(std::chrono::duration<double>(now - lastPressureCheck).count());
+                lastPressureCheck = now;
+            }
+
+            // Pressure scales the CPU the process would otherwise use: its limit, or what it used at full speed
+            const double scale = workerScalePermille / 1000.0;
+            if (wall > 0.0 && scale >= 1.0) {
+                natural = std::max(natural * 0.98, used / wall);
+            }
+            const bool budgeted = limited || scale < 1.0;
+            if (budgeted && wall > 0.0) {
+                double capacity = (limited ? limit : std::max(natural, 0.01 * cpus)) * scale;
+                tokens = std::clamp(tokens + capacity * wall - used, -capacity * debtSeconds, capacity * burstSeconds);
+            } else {
+                tokens = 0.0;
+            }
+
+            if (limited && wall > 0.0) {
+                double usage = 100.0 * used / wall / cpuCount();
+                smoothed = smoothed * 0.7 + usage * 0.3;
+                cpuPermille = static_cast<int>(smoothed * 10);
+
+                // Fewer workers while over the limit, more again once well under it
+                double fraction = workerPermille / 1000.0;
+                if (smoothed > options.maxCpuPercentage) {
+                    fraction = std::max(minWorkerFraction, fraction * 0.8);
+                }
+                else if (smoothed < options.maxCpuPercentage * 0.8) {
+                    fraction = std::min(1.0, fraction + 0.1);
+                }
+                workerPermille = static_cast<int>(fraction * 1000);
+            }
+
+            lock.lock();
+            bool over = budgeted && tokens < 0.0;
+            if (overBudget != over) {
+                overBudget = over;
+                if (!over) {
+                    budgetAvailable.notify_all();
+                }
+            }
+        }
+    }
+
+    // Measure the stalls of other tasks over the last window and steer both scales by them
+    void updatePressure(double windowSeconds) {
+        double cpuPressure = 0.0;
+        double ioPressure = 0.0;
+        double memoryPressure = 0.0;
+
+        auto systemPressure = system::getSystemPressure();
+        auto otherPressure = system::getOtherCgroupsPressure();
+        auto share = [windowSeconds](std::uint64_t stalled) {
+            return std::clamp(100.0 * static_cast<double>(stalled) / (windowSeconds * 1e6), 0.0, 100.0);
+        };
+        if (otherPressure && lastOtherPressure) {
+            // The most stalled workload outside the process's cgroup; the process's own stalls are not in it
+            auto worst = [&](system::PressureStall system::SystemPressure::*resource) {
+                std::uint64_t stalled = 0;
+                for (const auto& [path, pressure] : *otherPressure) {
+                    auto last = lastOtherPressure->find(path);
+                    if (last != lastOtherPressure->end() && (pressure.*resource).someTotal >= (last->second.*resource).someTotal) {
+                        stalled = std::max(stalled, (pressure.*resource).someTotal - (last->second.*resource).someTotal);
+                    }
+                }
+                return share(stalled);
+            };
+            cpuPressure = worst(&system::SystemPressure::cpu);
+            ioPressure = worst(&system::SystemPressure::io);
+            memoryPressure = worst(&system::SystemPressure::memory);
+        }
+        else if (systemPressure && lastSystemPressure) {
+            // In the root cgroup the process cannot be told apart from other tasks. "full" only counts
+            // time in which every task waited, which the process does not cause alone while others
+            // run. The kernel reports no such time for CPU at the system level.
+            auto full = [&](system::PressureStall system::SystemPressure::*resource) {
+                const auto now = (*systemPressure.*resource).fullTotal;
+                const auto last = (*lastSystemPressure.*resource).fullTotal;
+                return share(now >= last ? now - last : 0);
+            };
+            cpuPressure = full(&system::SystemPressure::cpu);
+            ioPressure = full(&system::SystemPressure::io);
+            memoryPressure = full(&system::SystemPressure::memory);
+        }
+        else if (!systemPressure) {
+            // Runnable tasks beyond the CPU count wait for a CPU
+            auto [load1, load5, load15] = system::getSystemLoad();
+            cpuPressure = std::clamp((load1 / cpuCount() - 1.0) * 100.0, 0.0, 100.0);
+        }
+        lastSystemPressure = systemPressure;
+        lastOtherPressure = std::move(otherPressure);
+
+        cpuPressurePermille = static_cast<int>(cpuPressure * 10);
+        ioPressurePermille = static_cast<int>(ioPressure * 10);
+        memoryPressurePermille = static_cast<int>(memoryPressure * 10);
+
+        steer(workerScalePermille, std::max(cpuPressure, memoryPressure), "CPU");
+        steer(ioScalePermille, std::max(ioPressure, memoryPressure), "I/O");
+    }
+
+    // Back off multiplicatively over the target, recover additively under it, fast when idle
+    void steer(std::atomic<int>& permille, double pressure, const char* resource) {
+        const double target = options.pressureTarget;
+        double before = permille / 1000.0;
+        double scale = before;
+        if (pressure > target) {
+            scale = std::max(minPressureScale, scale * 0.7);
+        }
+        else if (pressure < target / 4) {
+            scale = std::min(1.0, scale + 0.25);
+        }
+        else if (pressure < target / 2) {
+            scale = std::min(1.0, scale + 0.05);
+        }
+        permille = static_cast<int>(scale * 1000);
+
+        if (before >= 1.0 && scale < 1.0) {
+            UTM_DEBUG("Backing off {} use, other tasks stall {}% of the time", resource, static_cast<int>(pressure));
+        } else if (before < 1.0 && scale >= 1.0) {
+            UTM_DEBUG("Back to full {} speed", resource);
+        }
+    }
+
+    // Move the calling thread in or out of the background scheduling class
+    static void applyPriority(Priority priority) {
+        ThreadPriority& current = threadPriority;
+        if (!current.known) {
+            errno = 0;
+            int nice = ::getpriority(PRIO_PROCESS, 0);
+            current.normalNice = errno == 0 ? nice : 0;
+            current.restorable = canRaisePriority(current.normalNice);
+            current.known = true;
+        }
+        if (current.applied == priority) {
+            return;
+        }
+        current.applied = priority;
+
+        // With pid 0 both calls act on the calling thread only
+        struct sched_param param {};
+        if (priority == Priority::BACKGROUND) {
+            // A thread that outlives its job would stay in the background
+            if (!current.restorable && !current.jobThread) {
+                return;
+            }
+            if (::sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+                ::setpriority(PRIO_PROCESS, 0, 19);
+            }
+        }
+        else {
+            // Leaving SCHED_IDLE needs RLIMIT_NICE headroom; without it the thread stays in the background
+            if (::sched_getscheduler(0) == SCHED_IDLE && ::sched_setscheduler(0, SCHED_OTHER, &param) != 0) {
+                UTM_DEBUG("Failed to leave background scheduling: {}", std::strerror(errno));
+            }
+            if (::getpriority(PRIO_PROCESS, 0) != current.normalNice) {
+                ::setpriority(PRIO_PROCESS, 0, current.normalNice);
+            }
+        }
+    }
+
+    // Whether a thread at this nice level may leave SCHED_IDLE or nice 19 again: RLIMIT_NICE allows
+    // nice levels down to 20 minus its value, and CAP_SYS_NICE (assumed only for root) allows any
+    static bool canRaisePriority(int nice) {
+        struct rlimit limit;
+        if (::getrlimit(RLIMIT_NICE, &limit) == 0 &&
+            (limit.rlim_cur == RLIM_INFINITY || 20 - static_cast<long>(limit.rlim_cur) <= nice)) {
+            return true;
+        }
+        return ::geteuid() == 0;
+    }
+};
+
+// ResourceGovernor implementation
+
+ResourceGovernor::ResourceGovernor() : pImpl(std::make_unique<Impl>()) {
+}
+
+ResourceGovernor::~ResourceGovernor() = default;
+
+ResourceGovernor& ResourceGovernor::getInstance() {
+    // Created after the logger, so the control thread is gone before the logger
+    getLogger();
+    static ResourceGovernor instance;
+    return instance;
+}
+
+void ResourceGovernor::configure(const GovernorOptions& options) {
+    pImpl->configure(options);
+}
+
+void ResourceGovernor::throttle() {
+    pImpl->throttle();
+}
+
+void ResourceGovernor::markJobThread() {
+    threadPriority.jobThread = true;
+}
+
+std::size_t ResourceGovernor::activeWorkers(std::size_t poolSize) const {
+    return pImpl->activeWorkers(poolSize);
+}
+
+double ResourceGovernor::ioScale() const noexcept {
+    return pImpl->ioScale();
+}
+
+GovernorStats ResourceGovernor::getStats() const {
+    return pImpl->getStats();
+}
+
+} // namespace utm
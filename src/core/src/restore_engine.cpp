@@ -0,0 +1,1122 @@
+#include "utm/backup_engine.hpp"
+#include "utm/logging.hpp"
+#include "utm/filesystem_utils.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/thread_pool.hpp"
+#include "utm/snapshot_index.hpp"
+#include "utm/io_limiter.hpp"
+#include "utm/stats_counters.hpp"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::DirectoryCache;
+using fs::FileHandle;
+using fs::FileStat;
+using fs::fileType;
+using fs::isSnapshotMetadata;
+using fs::joinRelative;
+
+// Implementation class for RestoreEngine
+class RestoreEngine::Impl {
+public:
+    // Initialize the restore engine
+    bool initialize(const std::filesystem::path& backupPath) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        try {
+            if (!std::filesystem::is_directory(backupPath / "backups")) {
+                getLogger().error("No backups found at: " + backupPath.string());
+                return false;
+            }
+
+            this->backupPath = backupPath;
+            getLogger().info("Restore engine initialized with backup path: " + backupPath.string());
+            return true;
+        }
+        catch (const std::exception& e) {
+            getLogger().error("Failed to initialize restore engine: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    // Restore files from a snapshot
+    bool restore(
+        const std::vector<std::filesystem::path>& sourcePaths,
+        const std::filesystem::path& destinationPath,
+        const std::chrono::system_clock::time_point& timestamp,
+        ProgressCallback progressCallback,
+        const RestoreOptions& options) {
+
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            getLogger().error("Cannot start restore: another restore is already running");
+            return false;
+        }
+
+        try {
+            if (backupPath.empty()) {
+                getLogger().error("Restore engine is not initialized");
+                return false;
+            }
+
+            std::filesystem::path snapshotDir = fs::getBackupPath(backupPath, timestamp);
+            if (!std::filesystem::is_directory(snapshotDir)) {
+                getLogger().error("Snapshot does not exist: " + snapshotDir.string());
+                return false;
+            }
+
+            cancelRequested = false;
+            running = true;
+            this->options = options;
+            this->progressCallback = progressCallback;
+            ioLimiter.setLimits(options.ioLimits);
+            ioThrottledBase = ioLimiter.throttledTime();
+            counters.reset();
+            reflinked = false;
+            reflinkFailed = false;
+
+            // Phase 1: plan the transfer from the snapshot, comparing against the target if requested
+            reportProgress(BackupStatus::SCANNING);
+            files.clear();
+            directories.clear();
+            removals.clear();
+            plan = RestorePlan();
+            targetRoot = destinationPath;
+            if (options.incremental) {
+                targetLookup.emplace(destinationPath, 256, false);
+            }
+
+            if (!planRestore(snapshotDir, sourcePaths)) {
+                return finish(cancelRequested ? BackupStatus::CANCELLED : BackupStatus::FAILED);
+            }
+
+            // Phase 2: settle files whose metadata was inconclusive by their content
+            if (!compareContents(snapshotDir)) {
+                return finish(cancelRequested ? BackupStatus::CANCELLED : BackupStatus::FAILED);
+            }
+            targetLookup.reset();
+            summarizePlan();
+
+            getLogger().info(std::string(options.dryRun ? "Would restore " : "Restoring ") +
+                             std::to_string(files.size()) + " files (" + std::to_string(plan.transferBytes) +
+                             " bytes) from " + snapshotDir.string() + " to " + destinationPath.string() + "; " +
+                             std::to_string(plan.unchangedFiles) + " files already up to date, " +
+                             std::to_string(plan.removeEntries) + " entries to remove");
+
+            if (options.dryRun) {
+                return finish(BackupStatus::COMPLETED);
+            }
+
+            // Phase 3: transfer with the worker pool
+            reportProgress(BackupStatus::RESTORING);
+            if (!transfer(snapshotDir, destinationPath)) {
+                return finish(cancelRequested ? BackupStatus::CANCELLED : BackupStatus::FAILED);
+            }
+
+            return finish(BackupStatus::COMPLETED);
+        }
+        catch (const std::exception& e) {
+            getLogger().error("Exception during restore: " + std::string(e.what()));
+            return finish(BackupStatus::FAILED);
+        }
+    }
+
+    // Change the I/O limits of the running restore
+    void setIoLimits(const IoLimits& limits) {
+        ioLimiter.setLimits(limits);
+    }
+
+    // Cancel a running restore
+    bool cancelRestore() {
+        if (!running) {
+            getLogger().error("Cannot cancel restore: no restore is running");
+            return false;
+        }
+
+        cancelRequested = true;
+        getLogger().info("Restore cancellation requested");
+        return true;
+    }
+
+    // Get the plan of the most recent restore
+    RestorePlan getLastPlan() const {
+        std::lock_guard<std::mutex> lock(planMutex);
+        return lastPlan;
+    }
+
+    // List the entries of a directory in a snapshot
+    std::vector<std::filesystem::path> listFiles(
+        const std::filesystem::path& path,
+        const std::chrono::system_clock::time_point& timestamp) {
+
+        std::vector<std::filesystem::path> result;
+
+        auto page = listDirectory(path, timestamp, std::string(), std::numeric_limits<std::size_t>::max());
+        if (page) {
+            std::filesystem::path relative = path.relative_path();
+            result.reserve(page->entries.size());
+            for (const auto& entry : page->entries) {
+                result.push_back(relative / entry.name);
+            }
+        }
+
+        return result;
+    }
+
+    // List one page of a directory in a snapshot, from its index
+    std::optional<DirectoryPage> listDirectory(
+        const std::filesystem::path& path,
+        const std::chrono::system_clock::time_point& timestamp,
+        const std::string& cursor,
+        std::size_t limit) {
+
+        try {
+            auto index = openIndex(timestamp);
+            if (!index) {
+                return std::nullopt;
+            }
+
+            std::string relative = path.relative_path().lexically_normal().generic_string();
+            while (!relative.empty() && (relative.back() == '/' || relative == ".")) {
+                relative.pop_back();
+            }
+
+            auto directory = index->findDirectory(relative);
+            if (!directory) {
+                getLogger().error("Directory not found in backup: " + path.string());
+                return std::nullopt;
+            }
+
+            DirectoryPage page;
+            page.totalEntries = index->entryCount(*directory);
+
+            // The cursor is the last name of the previous page; seeking past it is a binary search
+            std::size_t position = index->seekAfter(*directory, cursor);
+            std::size_t end = position + std::min(limit, page.totalEntries - position);
+            page.entries.reserve(end - position);
+
+            for (; position < end; position++) {
+                SnapshotIndex::Entry entry = index->entry(*directory, position);
+                page.entries.push_back({
+                    std::string(entry.name),
+                    fileType(entry.mode),
+                    entry.size,
+                    std::chrono::system_clock::time_point(
+                        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                            std::chrono::nanoseconds(entry.modifiedNs)))
+                });
+            }
+
+            if (end < page.totalEntries && !page.entries.empty()) {
+                page.nextCursor = page.entries.back().name;
+            }
+            return page;
+        }
+        catch (const std::exception& e) {
+            getLogger().error("Failed to list files in backup: " + std::string(e.what()));
+            return std::nullopt;
+        }
+    }
+
+    // Compare two snapshots through their indexes
+    std::optional<DiffSummary> diffBackups(
+        const std::chrono::system_clock::time_point& from,
+        const std::chrono::system_clock::time_point& to,
+        const DiffCallback& callback) {
+
+        try {
+            auto fromIndex = openIndex(from);
+            auto toIndex = openIndex(to);
+            if (!fromIndex || !toIndex) {
+                return std::nullopt;
+            }
+            return diffSnapshots(*fromIndex, *toIndex, callback);
+        }
+        catch (const std::exception& e) {
+            getLogger().error("Failed to compare backups: " + std::string(e.what()));
+            return std::nullopt;
+        }
+    }
+
+private:
+    // A file to restore, relative to the snapshot and the target
+    struct RestoreItem {
+        std::string directory;
+        std::string name;
+        std::uintmax_t size;
+        mode_t mode;
+        std::timespec modified;
+        ino_t inode;
+        std::uint64_t placement = 0;          // sort key for reading from the backup medium
+        RestoreAction action = RestoreAction::CREATE;
+        bool compare = false;                 // content must be checked before the action is final
+    };
+
+    // A target file being written; a replaced file is written under a temporary name in the
+    // same directory and renamed over the old one only once it is complete
+    struct TargetFile {
+        FileHandle out;
+        std::shared_ptr<FileHandle> directory;
+        std::string tempName;                 // empty when writing the final name directly
+
+        // A replacement that was not completed is dropped, leaving the old file as it was
+        ~TargetFile() {
+            if (!tempName.empty() && directory && directory->valid()) {
+                ::unlinkat(directory->get(), tempName.c_str(), 0);
+            }
+        }
+    };
+
+    // State shared by the range tasks of one large file
+    struct LargeTransfer {
+        FileHandle in;
+        TargetFile target;
+        std::atomic<std::size_t> remaining{0};
+        std::atomic<bool> failed{false};
+    };
+
+    std::mutex mutex;
+    mutable std::mutex planMutex;
+    std::filesystem::path backupPath;
+    std::filesystem::path targetRoot;
+    RestoreOptions options;
+    ProgressCallback progressCallback;
+    StatsCounters counters;                      // failed files count as skipped
+    RestorePlan plan;
+    RestorePlan lastPlan;
+    std::vector<RestoreItem> files;
+    std::vector<std::string> directories;
+    std::vector<RestorePlanEntry> removals;
+    std::optional<DirectoryCache> targetLookup;   // read-only view of the target, incremental restores only
+    std::mutex indexMutex;
+    std::map<std::filesystem::path, std::shared_ptr<const SnapshotIndex>> indexes;
+
+    // Indexes kept mapped for browsing
+    static constexpr std::size_t maxCachedIndexes = 8;
+    std::atomic<bool> running{false};
+    std::atomic<bool> cancelRequested{false};
+    std::atomic<bool> reflinked{false};
+    std::atomic<bool> reflinkFailed{false};
+    std::atomic<std::uint64_t> tempFiles{0};
+    IoLimiter ioLimiter;
+    std::chrono::milliseconds ioThrottledBase{0};       // limiter total when this restore started
+
+    // Upper bound on the files one batch keeps open
+    static constexpr std::size_t maxBatchFiles = 32;
+
+    // Open (building if needed) and cache the index of a snapshot
+    std::shared_ptr<const SnapshotIndex> openIndex(const std::chrono::system_clock::time_point& timestamp) {
+        std::filesystem::path snapshotDir = fs::getBackupPath(backupPath, timestamp);
+
+        std::lock_guard<std::mutex> lock(indexMutex);
+        auto it = indexes.find(snapshotDir);
+        if (it != indexes.end()) {
+            return it->second;
+        }
+
+        if (!std::filesystem::is_directory(snapshotDir)) {
+            getLogger().error("Snapshot does not exist: " + snapshotDir.string());
+            return nullptr;
+        }
+
+        auto index = SnapshotIndex::open(snapshotDir);
+        if (index) {
+            if (indexes.size() >= maxCachedIndexes) {
+                indexes.clear();
+            }
+            indexes.emplace(snapshotDir, index);
+        }
+        return index;
+    }
+
+    // Open a directory stream on a duplicate of a directory descriptor
+    DIR* openDirectoryStream(int dirFd) {
+        int fd = ::fcntl(dirFd, F_DUPFD_CLOEXEC, 0);
+        DIR* dir = fd >= 0 ? ::fdopendir(fd) : nullptr;
+        if (!dir && fd >= 0) {
+            int savedErrno = errno;
+            ::close(fd);
+            errno = savedErrno;
+        }
+        if (dir) {
+            ioLimiter.operations();
+        }
+        return dir;
+    }
+
+    // Collect the files and directories selected for restore
+    bool planRestore(const std::filesystem::path& snapshotDir, const std::vector<std::filesystem::path>& sourcePaths) {
+        std::vector<std::string> roots;
+        if (sourcePaths.empty()) {
+            roots.emplace_back();
+        }
+        for (const auto& sourcePath : sourcePaths) {
+            // Paths are relative to the snapshot root; accept them with a leading '/'
+            roots.push_back(sourcePath.relative_path().lexically_normal().generic_string());
+            if (roots.back() == ".") {
+                roots.back().clear();
+            }
+        }
+
+        FileHandle snapshotFd = fs::openDirectoryAt(AT_FDCWD, snapshotDir.c_str());
+        if (!snapshotFd.valid()) {
+            getLogger().error("Failed to open snapshot " + snapshotDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        for (const auto& root : roots) {
+            FileStat st;
+            const char* name = root.empty() ? "." : root.c_str();
+            if (!fs::statAt(snapshotFd.get(), name, st)) {
+                getLogger().error("Path not found in snapshot: " + root);
+                return false;
+            }
+
+            if (S_ISDIR(st.mode)) {
+                FileStat current;
+                if (targetLookup && !root.empty() &&
+                    fs::statAt(AT_FDCWD, (targetRoot / root).c_str(), current, false) && !S_ISDIR(current.mode)) {
+                    addRemoval(root, current);
+                }
+
+                FileHandle dirFd = fs::openDirectoryAt(snapshotFd.get(), name);
+                if (!dirFd.valid() || !planDirectory(dirFd.get(), root)) {
+                    return false;
+                }
+            }
+            else if (S_ISREG(st.mode)) {
+                std::filesystem::path rootPath(root);
+                addFile(rootPath.parent_path().generic_string(), rootPath.filename().string(), st);
+            }
+
+            if (cancelRequested) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Walk one snapshot directory
+    bool planDirectory(int dirFd, const std::string& relativeDir) {
+        directories.push_back(relativeDir);
+
+        DIR* dir = openDirectoryStream(dirFd);
+        if (!dir) {
+            getLogger().error("Failed to read snapshot directory " + relativeDir + ": " + std::strerror(errno));
+            return false;
+        }
+
+        std::vector<std::string> subdirectories;
+        std::vector<std::string> names;
+        while (struct dirent* ent = ::readdir(dir)) {
+            std::string_view name(ent->d_name);
+            if (name == "." || name == ".." || (relativeDir.empty() && isSnapshotMetadata(name))) {
+                continue;
+            }
+
+            if (targetLookup) {
+                names.emplace_back(name);
+            }
+
+            FileStat st;
+            if (!fs::statAt(dirFd, ent->d_name, st, false)) {
+                continue;
+            }
+
+            if (S_ISDIR(st.mode)) {
+                subdirectories.emplace_back(name);
+            }
+            else if (S_ISREG(st.mode)) {
+                addFile(relativeDir, std::string(name), st);
+            }
+        }
+        ::closedir(dir);
+
+        if (targetLookup) {
+            planTargetDirectory(relativeDir, names, subdirectories);
+        }
+
+        for (const auto& name : subdirectories) {
+            if (cancelRequested) {
+                return false;
+            }
+
+            FileHandle child = fs::openDirectoryAt(dirFd, name.c_str());
+            if (!child.valid() || !planDirectory(child.get(), joinRelative(relativeDir, name))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void addFile(std::string directory, std::string name, const FileStat& st) {
+        RestoreItem item{std::move(directory), std::move(name), st.size, st.mode, st.modified, st.inode};
+        if (targetLookup) {
+            classifyFile(item);
+        }
+
+        if (item.action == RestoreAction::UNCHANGED) {
+            plan.unchangedFiles++;
+            plan.unchangedBytes += item.size;
+            return;
+        }
+        files.push_back(std::move(item));
+    }
+
+    // Compare a snapshot file with the target by metadata
+    void classifyFile(RestoreItem& item) {
+        auto targetDir = targetLookup->get(item.directory);
+        FileStat current;
+        if (!targetDir->valid() || !fs::statAt(targetDir->get(), item.name.c_str(), current, false)) {
+            return;
+        }
+
+        if (!S_ISREG(current.mode)) {
+            // Something other than a file is in the way
+            addRemoval(joinRelative(item.directory, item.name), current);
+            return;
+        }
+
+        item.action = RestoreAction::REPLACE;
+        if (current.size != item.size) {
+            return;
+        }
+
+        if (current.modified.tv_sec == item.modified.tv_sec && current.modified.tv_nsec == item.modified.tv_nsec) {
+            item.action = (current.mode & 07777) == (item.mode & 07777)
+                ? RestoreAction::UNCHANGED : RestoreAction::UPDATE_METADATA;
+            return;
+        }
+
+        // Same size but different times; only the content can tell
+        item.compare = options.compareContents;
+    }
+
+    // Find target entries that conflict with or are missing from a snapshot directory
+    void planTargetDirectory(const std::string& relativeDir, std::vector<std::string>& names,
+                             const std::vector<std::string>& subdirectories) {
+        auto targetDir = targetLookup->get(relativeDir);
+        if (!targetDir->valid()) {
+            return;
+        }
+
+        for (const auto& name : subdirectories) {
+            FileStat current;
+            if (fs::statAt(targetDir->get(), name.c_str(), current, false) && !S_ISDIR(current.mode)) {
+                addRemoval(joinRelative(relativeDir, name), current);
+            }
+        }
+
+        if (!options.deleteExtraneous) {
+            return;
+        }
+
+        DIR* dir = openDirectoryStream(targetDir->get());
+        if (!dir) {
+            getLogger().warning("Failed to read target directory " + relativeDir + ": " + std::strerror(errno));
+            return;
+        }
+
+        std::sort(names.begin(), names.end());
+        while (struct dirent* ent = ::readdir(dir)) {
+            std::string_view name(ent->d_name);
+            if (name == "." || name == ".." ||
+                std::binary_search(names.begin(), names.end(), name, std::less<>())) {
+                continue;
+            }
+
+            FileStat current;
+            if (fs::statAt(targetDir->get(), ent->d_name, current, false)) {
+                addRemoval(joinRelative(relativeDir, name), current);
+            }
+        }
+        ::closedir(dir);
+    }
+
+    // Schedule a target entry for deletion
+    void addRemoval(std::string relativePath, const FileStat& st) {
+        std::uintmax_t size = S_ISREG(st.mode) ? st.size : 0;
+        if (S_ISDIR(st.mode)) {
+            std::error_code ec;
+            auto walkOptions = std::filesystem::directory_options::skip_permission_denied;
+            for (std::filesystem::recursive_directory_iterator it(targetRoot / relativePath, walkOptions, ec), end;
+                 !ec && it != end; it.increment(ec)) {
+                if (it->is_regular_file(ec) && !it->is_symlink(ec)) {
+                    size += it->file_size(ec);
+                }
+            }
+        }
+        removals.push_back({std::move(relativePath), RestoreAction::REMOVE, size});
+    }
+
+    // Hash the files whose metadata was inconclusive, in parallel
+    bool compareContents(const std::filesystem::path& snapshotDir) {
+        std::size_t candidates = std::count_if(files.begin(), files.end(),
+                                               [](const RestoreItem& item) { return item.compare; });
+        if (candidates == 0) {
+            return true;
+        }
+
+        getLogger().info("Comparing the content of " + std::to_string(candidates) + " files with the target");
+        reportProgress(BackupStatus::VERIFYING);
+
+        std::size_t threadCount = options.threadCount > 0 ? static_cast<std::size_t>(options.threadCount) : 0;
+        ThreadPool pool(threadCount, true);
+        for (auto& item : files) {
+            if (!item.compare) {
+                continue;
+            }
+
+            pool.submit([this, &item, &snapshotDir] {
+                if (cancelRequested) {
+                    return;
+                }
+
+                std::string relativePath = joinRelative(item.directory, item.name);
+                std::string expected = fs::calculateChecksum(snapshotDir / relativePath, "sha256", &ioLimiter);
+                if (!expected.empty() &&
+                    expected == fs::calculateChecksum(targetRoot / relativePath, "sha256", &ioLimiter)) {
+                    item.action = RestoreAction::UPDATE_METADATA;
+                }
+                item.compare = false;
+            });
+        }
+
+        while (!pool.waitFor(std::chrono::milliseconds(250))) {
+            if (cancelRequested) {
+                pool.discardPending();
+            }
+            reportProgress(BackupStatus::VERIFYING);
+        }
+
+        return !cancelRequested;
+    }
+
+    // Total up the plan and publish it
+    void summarizePlan() {
+        for (const auto& item : files) {
+            switch (item.action) {
+                case RestoreAction::CREATE:
+                    plan.createFiles++;
+                    plan.transferBytes += item.size;
+                    break;
+                case RestoreAction::REPLACE:
+                    plan.replaceFiles++;
+                    plan.transferBytes += item.size;
+                    break;
+                case RestoreAction::UPDATE_METADATA:
+                    plan.metadataFiles++;
+                    plan.unchangedBytes += item.size;
+                    break;
+                default:
+                    break;
+            }
+
+            if (options.dryRun) {
+                std::uintmax_t size = item.action == RestoreAction::UPDATE_METADATA ? 0 : item.size;
+                plan.entries.push_back({joinRelative(item.directory, item.name), item.action, size});
+            }
+        }
+
+        for (const auto& removal : removals) {
+            plan.removeEntries++;
+            plan.removeBytes += removal.size;
+            if (options.dryRun) {
+                plan.entries.push_back(removal);
+            }
+        }
+
+        counters.add({{StatCounter::TOTAL_FILES, files.size()},
+                      {StatCounter::TOTAL_DIRECTORIES, directories.size()},
+                      {StatCounter::TOTAL_SIZE, plan.transferBytes},
+                      {StatCounter::NEW_FILES, plan.createFiles},
+                      {StatCounter::MODIFIED_FILES, plan.replaceFiles},
+                      {StatCounter::UNCHANGED_FILES, plan.unchangedFiles + plan.metadataFiles}});
+
+        std::lock_guard<std::mutex> lock(planMutex);
+        lastPlan = plan;
+    }
+
+    // Run the planned transfer on the worker pool
+    bool transfer(const std::filesystem::path& snapshotDir, const std::filesystem::path& destinationPath) {
+        DirectoryCache sourceDirs(snapshotDir, 256, false);
+        DirectoryCache targetDirs(destinationPath);
+
+        // Clear conflicting and extraneous entries before anything is written
+        for (const auto& removal : removals) {
+            std::error_code ec;
+            std::filesystem::remove_all(destinationPath / removal.path, ec);
+            if (ec) {
+                getLogger().error("Failed to remove " + (destinationPath / removal.path).string() + ": " + ec.message());
+                return false;
+            }
+        }
+
+        // Create the directory skeleton up front so empty directories are restored too
+        for (const auto& directory : directories) {
+            auto handle = targetDirs.get(directory);
+            if (!handle->valid()) {
+                getLogger().error("Failed to create directory " + (destinationPath / directory).string() +
+                                  ": " + std::strerror(errno));
+                return false;
+            }
+        }
+
+        orderReads(sourceDirs);
+
+        std::size_t threadCount = options.threadCount > 0 ? static_cast<std::size_t>(options.threadCount) : 0;
+        ThreadPool pool(threadCount, true);
+        getLogger().info("Restoring with " + std::to_string(pool.size()) + " worker threads");
+
+        // Small files are grouped into batches of neighbours on the backup medium
+        std::vector<const RestoreItem*> batch;
+        std::uintmax_t batchSize = 0;
+        auto submitBatch = [&] {
+            if (!batch.empty()) {
+                pool.submit([this, batch = std::move(batch), &sourceDirs, &targetDirs] {
+                    restoreBatch(batch, sourceDirs, targetDirs);
+                });
+                batch.clear();
+                batchSize = 0;
+            }
+        };
+
+        for (const auto& item : files) {
+            if (item.action == RestoreAction::UPDATE_METADATA) {
+                pool.submit([this, &item, &targetDirs] {
+                    restoreMetadata(item, targetDirs);
+                });
+            } else if (item.size >= options.largeFileThreshold && options.rangeSize > 0) {
+                pool.submit([this, &item, &pool, &sourceDirs, &targetDirs] {
+                    startLargeFile(item, pool, sourceDirs, targetDirs);
+                });
+            } else if (options.readaheadBatch > 0) {
+                batch.push_back(&item);
+                batchSize += item.size;
+                if (batchSize >= options.readaheadBatch || batch.size() >= maxBatchFiles) {
+                    submitBatch();
+                }
+            } else {
+                pool.submit([this, &item, &sourceDirs, &targetDirs] {
+                    restoreFile(item, openSource(item, sourceDirs), targetDirs);
+                });
+            }
+        }
+        submitBatch();
+
+        // Report progress from this thread while the workers run
+        while (!pool.waitFor(std::chrono::milliseconds(250))) {
+            if (cancelRequested) {
+                pool.discardPending();
+            }
+            reportProgress(BackupStatus::RESTORING);
+        }
+
+        if (cancelRequested) {
+            getLogger().info("Restore cancelled");
+            return false;
+        }
+
+        if (const std::uint64_t failedFiles = counters.value(StatCounter::SKIPPED_FILES); failedFiles > 0) {
+            getLogger().error(std::to_string(failedFiles) + " files could not be restored");
+            return false;
+        }
+
+        return true;
+    }
+
+    // Sort the files by their placement on the backup medium, so reads sweep the disk once
+    void orderReads(DirectoryCache& sourceDirs) {
+        if (options.readOrder == RestoreReadOrder::DIRECTORY) {
+            return;
+        }
+
+        bool physical = options.readOrder == RestoreReadOrder::PHYSICAL;
+        if (physical) {
+            for (auto& item : files) {
+                if (item.action == RestoreAction::UPDATE_METADATA) {
+                    continue;
+                }
+
+                FileHandle in = openSource(item, sourceDirs);
+                if (in.valid() && !fs::physicalOffset(in.get(), item.placement)) {
+                    if (errno == EOPNOTSUPP || errno == ENOTTY) {
+                        getLogger().info("Backup filesystem cannot map extents; ordering reads by inode");
+                        physical = false;
+                        break;
+                    }
+                    item.placement = 0;
+                }
+            }
+        }
+
+        if (!physical) {
+            for (auto& item : files) {
+                item.placement = item.inode;
+            }
+        }
+
+        std::stable_sort(files.begin(), files.end(), [](const RestoreItem& a, const RestoreItem& b) {
+            return a.placement < b.placement;
+        });
+    }
+
+    // Open the snapshot copy of an item
+    static FileHandle openSource(const RestoreItem& item, DirectoryCache& sourceDirs) {
+        auto sourceDir = sourceDirs.get(item.directory);
+        if (!sourceDir->valid()) {
+            return FileHandle();
+        }
+        return fs::openAt(sourceDir->get(), item.name.c_str(), O_RDONLY);
+    }
+
+    // Open the source and target of an item
+    bool openItem(const RestoreItem& item, DirectoryCache& sourceDirs, DirectoryCache& targetDirs,
+                  FileHandle& in, TargetFile& target) {
+        in = openSource(item, sourceDirs);
+        return in.valid() && openTarget(item, targetDirs, target);
+    }
+
+    // Create the target file of an item
+    bool openTarget(const RestoreItem& item, DirectoryCache& targetDirs, TargetFile& target) {
+        target.directory = targetDirs.get(item.directory);
+        if (!target.directory->valid()) {
+            return false;
+        }
+
+        // Replace rather than overwrite, so read-only or busy files and other hard links are left
+        // alone, and the user's file stays in place until its replacement is complete
+        if (item.action == RestoreAction::REPLACE) {
+            target.tempName = ".utm-restore." + std::to_string(::getpid()) + "." + std::to_string(tempFiles++);
+            target.out = fs::openAt(target.directory->get(), target.tempName.c_str(), O_WRONLY | O_CREAT | O_EXCL,
+                                    item.mode & 07777);
+        }
+        else {
+            target.out = fs::openAt(target.directory->get(), item.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                    item.mode & 07777);
+        }
+        ioLimiter.operations();
+        return target.out.valid();
+    }
+
+    // Finish a fully written target file, putting a replacement in place of the old file
+    bool commitTarget(const RestoreItem& item, TargetFile& target) {
+        if (!applyMetadata(item, target.out.get())) {
+            return false;
+        }
+        if (target.tempName.empty()) {
+            return target.out.close();
+        }
+        if (::fsync(target.out.get()) != 0 || !target.out.close() ||
+            !fs::renameAt(target.directory->get(), target.tempName.c_str(), target.directory->get(), item.name.c_str())) {
+            return false;
+        }
+        target.tempName.clear();
+        return true;
+    }
+
+
+    // Apply the snapshot's permissions and modification time to a restored file
+    static bool applyMetadata(const RestoreItem& item, int fd) {
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1] = item.modified;
+        return ::fchmod(fd, item.mode & 07777) == 0 && ::futimens(fd, times) == 0;
+    }
+
+    // Restore permissions and modification time of a file whose content is already identical
+    void restoreMetadata(const RestoreItem& item, DirectoryCache& targetDirs) {
+        if (cancelRequested) {
+            return;
+        }
+
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1] = item.modified;
+
+        auto targetDir = targetDirs.get(item.directory);
+        if (!targetDir->valid() ||
+            ::fchmodat(targetDir->get(), item.name.c_str(), item.mode & 07777, 0) != 0 ||
+            ::utimensat(targetDir->get(), item.name.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+            fileFailed(item, "update");
+            return;
+        }
+        ioLimiter.operations();
+
+        fileDone(item, 0);
+    }
+
+    void fileFailed(const RestoreItem& item, const char* action) {
+        getLogger().error(std::string("Failed to ") + action + " " + joinRelative(item.directory, item.name) +
+                          ": " + std::strerror(errno));
+        counters.add(StatCounter::SKIPPED_FILES);
+    }
+
+    void fileDone(const RestoreItem& item, std::uintmax_t size) {
+        counters.add({{StatCounter::PROCESSED_FILES, 1}, {StatCounter::PROCESSED_SIZE, size}});
+        UTM_TRACE("Restored {} ({} bytes)", joinRelative(item.directory, item.name), size);
+    }
+
+    // Restore a run of small files that lie close together on the backup medium
+    void restoreBatch(const std::vector<const RestoreItem*>& batch, DirectoryCache& sourceDirs, DirectoryCache& targetDirs) {
+        if (cancelRequested) {
+            return;
+        }
+
+        // Queue every read up front, in placement order, so the disk streams the batch in one sweep;
+        // not needed once reflinks are known to work, as clones never read the data, and not
+        // done under I/O limits, as readahead would bypass them
+        bool prefetch = (!reflinked || reflinkFailed) && !ioLimiter.isLimited();
+        std::vector<FileHandle> inputs;
+        inputs.reserve(batch.size());
+        for (const RestoreItem* item : batch) {
+            inputs.push_back(openSource(*item, sourceDirs));
+            if (prefetch && inputs.back().valid()) {
+                ::posix_fadvise(inputs.back().get(), 0, 0, POSIX_FADV_WILLNEED);
+            }
+        }
+
+        // Then write directory by directory, served from the page cache
+        std::vector<std::size_t> order(batch.size());
+        for (std::size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&batch](std::size_t a, std::size_t b) {
+            return std::tie(batch[a]->directory, batch[a]->name) < std::tie(batch[b]->directory, batch[b]->name);
+        });
+
+        for (std::size_t i : order) {
+            restoreFile(*batch[i], std::move(inputs[i]), targetDirs);
+        }
+    }
+
+    // Try to share the source's extents instead of copying
+    bool tryClone(int in, int out) {
+        if (!options.useReflinks || reflinkFailed) {
+            return false;
+        }
+
+        if (fs::cloneFile(in, out)) {
+            reflinked = true;
+            return true;
+        }
+
+        // Backup and target are on different or non-reflink filesystems; stop trying
+        if (errno == EXDEV || errno == EOPNOTSUPP || errno == ENOTTY) {
+            reflinkFailed = true;
+        }
+        return false;
+    }
+
+    // Restore a file in one piece
+    void restoreFile(const RestoreItem& item, FileHandle in, DirectoryCache& targetDirs) {
+        if (cancelRequested) {
+            return;
+        }
+
+        thread_local std::vector<char> buffer;
+
+        TargetFile target;
+        if (!in.valid() || !openTarget(item, targetDirs, target)) {
+            fileFailed(item, "open");
+            return;
+        }
+
+        // A reflink is instant when backup and target share a filesystem;
+        // copy_file_range still avoids user-space copies otherwise
+        bool cloned = tryClone(in.get(), target.out.get());
+        if (!cloned && !fs::copyContents(in.get(), target.out.get(), buffer, &ioLimiter)) {
+            fileFailed(item, "copy");
+            return;
+        }
+
+        if (!commitTarget(item, target)) {
+            fileFailed(item, "finish");
+            return;
+        }
+
+        fileDone(item, item.size);
+    }
+
+    // Prepare a large file and fan its ranges out to the pool
+    void startLargeFile(const RestoreItem& item, ThreadPool& pool, DirectoryCache& sourceDirs, DirectoryCache& targetDirs) {
+        if (cancelRequested) {
+            return;
+        }
+
+        auto transfer = std::make_shared<LargeTransfer>();
+        if (!openItem(item, sourceDirs, targetDirs, transfer->in, transfer->target)) {
+            fileFailed(item, "open");
+            return;
+        }
+
+        if (tryClone(transfer->in.get(), transfer->target.out.get())) {
+            finishLargeFile(item, *transfer);
+            return;
+        }
+
+        // Size the target up front so ranges can be written independently
+        if (::ftruncate(transfer->target.out.get(), static_cast<off_t>(item.size)) != 0) {
+            fileFailed(item, "allocate");
+            return;
+        }
+
+        std::size_t ranges = static_cast<std::size_t>((item.size + options.rangeSize - 1) / options.rangeSize);
+        transfer->remaining = ranges;
+
+        for (std::size_t i = 0; i < ranges; i++) {
+            off_t offset = static_cast<off_t>(i * options.rangeSize);
+            std::uintmax_t length = std::min<std::uintmax_t>(options.rangeSize, item.size - offset);
+
+            pool.submit([this, &item, transfer, offset, length] {
+                thread_local std::vector<char> buffer;
+
+                if (cancelRequested ||
+                    !fs::copyRange(transfer->in.get(), transfer->target.out.get(), offset, length, buffer, &ioLimiter)) {
+                    if (!cancelRequested) {
+                        getLogger().error("Failed to copy range of " + joinRelative(item.directory, item.name) +
+                                          ": " + std::strerror(errno));
+                    }
+                    transfer->failed = true;
+                }
+                else {
+                    counters.add(StatCounter::PROCESSED_SIZE, length);
+                }
+
+                // The last range to finish completes the file
+                if (--transfer->remaining == 0) {
+                    if (transfer->failed) {
+                        if (!cancelRequested) {
+                            counters.add(StatCounter::SKIPPED_FILES);
+                        }
+                                } else {
+                        finishLargeFile(item, *transfer, false);
+                    }
+                }
+            });
+        }
+    }
+
+    void finishLargeFile(const RestoreItem& item, LargeTransfer& transfer, bool countBytes = true) {
+        if (!commitTarget(item, transfer.target)) {
+            fileFailed(item, "finish");
+            return;
+        }
+
+        fileDone(item, countBytes ? item.size : 0);
+    }
+
+    void reportProgress(BackupStatus status) {
+        BackupStats stats;
+        counters.fill(stats);
+        stats.ioThrottledTime = ioLimiter.throttledTime() - ioThrottledBase;
+        if (progressCallback) {
+            progressCallback(status, stats);
+        }
+    }
+
+    bool finish(BackupStatus status) {
+        counters.finish();
+        reportProgress(status);
+        files.clear();
+        directories.clear();
+        removals.clear();
+        targetLookup.reset();
+        running = false;
+
+        if (status == BackupStatus::COMPLETED && options.dryRun) {
+            getLogger().info("Restore dry run completed: " + std::to_string(plan.transferBytes) + " bytes to transfer");
+            return true;
+        }
+        if (status == BackupStatus::COMPLETED) {
+            const StatsCounters::Values values = counters.snapshot();
+            getLogger().info("Restore completed successfully: " +
+                             std::to_string(values[static_cast<std::size_t>(StatCounter::PROCESSED_FILES)]) + " files, " +
+                             std::to_string(values[static_cast<std::size_t>(StatCounter::PROCESSED_SIZE)]) + " bytes");
+            return true;
+        }
+        return false;
+    }
+};
+
+// RestoreEngine implementation
+
+RestoreEngine::RestoreEngine() : pImpl(std::make_unique<Impl>()) {
+}
+
+RestoreEngine::~RestoreEngine() = default;
+
+bool RestoreEngine::initialize(const std::filesystem::path& backupPath) {
+    return pImpl->initialize(backupPath);
+}
+
+bool RestoreEngine::restore(
+    const std::vector<std::filesystem::path>& sourcePaths,
+    const std::filesystem::path& destinationPath,
+    const std::chrono::system_clock::time_point& timestamp,
+    ProgressCallback progressCallback) {
+    return pImpl->restore(sourcePaths, destinationPath, timestamp, progressCallback, RestoreOptions());
+}
+
+bool RestoreEngine::restore(
+    const std::vector<std::filesystem::path>& sourcePaths,
+    const std::filesystem::path& destinationPath,
+    const std::chrono::system_clock::time_point& timestamp,
+    ProgressCallback progressCallback,
+    const RestoreOptions& options) {
+    return pImpl->restore(sourcePaths, destinationPath, timestamp, progressCallback, options);
+}
+
+bool RestoreEngine::cancelRestore() {
+    return pImpl->cancelRestore();
+}
+
+void RestoreEngine::setIoLimits(const IoLimits& limits) {
+    pImpl->setIoLimits(limits);
+}
+
+RestorePlan RestoreEngine::getLastPlan() const {
+    return pImpl->getLastPlan();
+}
+
+std::vector<std::filesystem::path> RestoreEngine::listFiles(
+    const std::filesystem::path& path,
+    const std::chrono::system_clock::time_point& timestamp) {
+    return pImpl->listFiles(path, timestamp);
+}
+
+std::optional<DirectoryPage> RestoreEngine::listDirectory(
+    const std::filesystem::path& path,
+    const std::chrono::system_clock::time_point& timestamp,
+    const std::string& cursor,
+    size_t limit) {
+    return pImpl->listDirectory(path, timestamp, cursor, limit);
+}
+
+std::optional<DiffSummary> RestoreEngine::diffBackups(
+    const std::chrono::system_clock::time_point& from,
+    const std::chrono::system_clock::time_point& to,
+    const DiffCallback& callback) {
+    return pImpl->diffBackups(from, to, callback);
+}
+
+} // namespace utm
@@ -0,0 +1,465 @@
+#include "utm/scheduler.hpp"
+#include "utm/snapshot_catalog.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace utm {
+
+namespace {
+
+using Clock = std::chrono::system_clock;
+
+// Runs missed while the machine was off start within this window
+constexpr std::chrono::seconds missedRunSpread{300};
+
+// Jitter is at most this, or a twelfth of the schedule's period
+constexpr std::chrono::seconds maxJitter{900};
+
+std::chrono::seconds schedulePeriod(const ScheduleConfig& schedule) {
+    switch (schedule.type) {
+        case ScheduleType::HOURLY: return std::chrono::hours(1);
+        case ScheduleType::DAILY: return std::chrono::hours(24);
+        case ScheduleType::WEEKLY: return std::chrono::hours(24 * 7);
+        case ScheduleType::MONTHLY: return std::chrono::hours(24 * 28);
+        case ScheduleType::CUSTOM: return std::max<std::chrono::seconds>(schedule.interval, std::chrono::hours(1));
+    }
+    return std::chrono::hours(24);
+}
+
+// Stable offset in [0, window) derived from a profile name
+std::chrono::seconds jitterFor(const std::string& name, std::chrono::seconds window) {
+    if (window.count() <= 0) {
+        return std::chrono::seconds(0);
+    }
+    return std::chrono::seconds(static_cast<std::int64_t>(std::hash<std::string>()(name) % static_cast<std::size_t>(window.count())));
+}
+
+bool sameSchedule(const ScheduleConfig& a, const ScheduleConfig& b) {
+    return a.type == b.type && a.startTime == b.startTime && a.interval == b.interval &&
+           a.dayOfWeek == b.dayOfWeek && a.dayOfMonth == b.dayOfMonth && a.enabled == b.enabled;
+}
+
+std::tm toLocal(Clock::time_point time) {
+    std::time_t t = Clock::to_time_t(time);
+    std::tm tm{};
+    localtime_r(&t, &tm);
+    return tm;
+}
+
+Clock::time_point fromLocal(std::tm tm) {
+    tm.tm_isdst = -1;
+    return Clock::from_time_t(std::mktime(&tm));
+}
+
+int daysInMonth(int year, int month) {
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 1 && leap ? 29 : days[month];
+}
+
+// One scheduled run; stale once the profile's generation moves on
+struct Timer {
+    Clock::time_point when;
+    std::uint64_t generation;
+    std::string name;
+
+    bool operator>(const Timer& other) const {
+        return when > other.when;
+    }
+};
+
+} // namespace
+
+// Implementation class for Scheduler
+class Scheduler::Impl {
+public:
+    explicit Impl(ScheduledBackup callback) : callback(std::move(callback)) {}
+
+    ~Impl() {
+        stop();
+    }
+
+    bool start(const std::filesystem::path& profilesDir) {
+        if (thread.joinable()) {
+            return true;
+        }
+
+        timerFd = ::timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+        wakeFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (timerFd < 0 || wakeFd < 0) {
+            getLogger().error("Failed to create scheduler timer: " + std::string(std::strerror(errno)));
+            closeDescriptors();
+            return false;
+        }
+
+        if (!profilesDir.empty()) {
+            inotifyFd = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+            if (inotifyFd < 0 || ::inotify_add_watch(inotifyFd, profilesDir.c_str(),
+                    IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+                getLogger().warning("Not watching " + profilesDir.string() + " for profile changes: " + std::strerror(errno));
+                if (inotifyFd >= 0) {
+                    ::close(inotifyFd);
+                    inotifyFd = -1;
+                }
+            }
+        }
+
+        running = true;
+        thread = std::thread(&Impl::threadFunction, this);
+        return true;
+    }
+
+    void stop() {
+        if (!thread.joinable()) {
+            return;
+        }
+        running = false;
+        wake();
+        thread.join();
+        closeDescriptors();
+    }
+
+    void setProfiles(const std::vector<BackupProfile>& profiles) {
+        // Profiles that are new or rescheduled; finding their first run reads their backup drive
+        std::vector<const BackupProfile*> changed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& profile : profiles) {
+                auto existing = entries.find(profile.name);
+                if (profile.schedule.enabled &&
+                    (existing == entries.end() || !sameSchedule(existing->second.profile.schedule, profile.schedule))) {
+                    changed.push_back(&profile);
+                }
+            }
+        }
+
+        // Without the lock, so a slow or sleeping drive holds up neither the timers nor nextRun()
+        const auto now = Clock::now();
+        std::unordered_map<std::string, Clock::time_point> firstRuns;
+        for (const BackupProfile* profile : changed) {
+            firstRuns.emplace(profile->name, firstRun(*profile, now));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::unordered_map<std::string, Entry> scheduled;
+            for (const auto& profile : profiles) {
+                if (!profile.schedule.enabled) {
+                    continue;
+                }
+
+                auto existing = entries.find(profile.name);
+                if (existing != entries.end() && sameSchedule(existing->second.profile.schedule, profile.schedule)) {
+                    existing->second.profile = profile;
+                    scheduled.emplace(profile.name, std::move(existing->second));
+                    continue;
+                }
+
+                Entry entry;
+                entry.profile = profile;
+                entry.generation = nextGeneration++;
+                // A profile rescheduled by a concurrent call meanwhile starts from now
+                auto first = firstRuns.find(profile.name);
+                entry.next = first != firstRuns.end() ? first->second : nextFire(profile, now);
+                timers.push(Timer{entry.next, entry.generation, profile.name});
+                UTM_DEBUG("Next backup of profile {} in {} s", profile.name,
+                          std::chrono::duration_cast<std::chrono::seconds>(entry.next - now).count());
+                scheduled.emplace(profile.name, std::move(entry));
+            }
+            entries = std::move(scheduled);
+
+            // Rescheduling leaves stale timers behind; don't let them pile up
+            if (timers.size() > 2 * entries.size() + 64) {
+                rebuildTimers();
+            }
+        }
+        wake();
+    }
+
+    std::optional<Clock::time_point> nextRun(const std::string& profileName) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(profileName);
+        if (it == entries.end()) {
+            return std::nullopt;
+        }
+        return it->second.next;
+    }
+
+private:
+    struct Entry {
+        BackupProfile profile;
+        std::uint64_t generation = 0;
+        Clock::time_point next;
+    };
+
+    ScheduledBackup callback;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers;
+    std::uint64_t nextGeneration = 1;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    int timerFd = -1;
+    int wakeFd = -1;
+    int inotifyFd = -1;
+
+    void threadFunction() {
+        while (running) {
+            armTimer();
+
+            struct pollfd fds[3] = {
+                {timerFd, POLLIN, 0},
+                {wakeFd, POLLIN, 0},
+                {inotifyFd, POLLIN, 0}
+            };
+            if (::poll(fds, inotifyFd >= 0 ? 3 : 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                getLogger().error("Scheduler wait failed: " + std::string(std::strerror(errno)));
+                return;
+            }
+
+            // Reading the timer fails with ECANCELED when the clock was set; the due times are rechecked either way
+            std::uint64_t count;
+            if (fds[0].revents & POLLIN) {
+                [[maybe_unused]] ssize_t n = ::read(timerFd, &count, sizeof(count));
+            }
+            if (fds[1].revents & POLLIN) {
+                [[maybe_unused]] ssize_t n = ::read(wakeFd, &count, sizeof(count));
+            }
+            if (inotifyFd >= 0 && (fds[2].revents & POLLIN)) {
+                drainNotifications();
+                getConfig().reloadProfiles();
+                setProfiles(getConfig().getAllBackupProfiles());
+            }
+
+            if (running) {
+                fireDueRuns();
+            }
+        }
+    }
+
+    void fireDueRuns() {
+        std::vector<Timer> due;
+        std::vector<BackupProfile> profiles;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto now = Clock::now();
+            while (!timers.empty() && timers.top().when <= now) {
+                Timer timer = timers.top();
+                timers.pop();
+                auto it = entries.find(timer.name);
+                if (it != entries.end() && it->second.generation == timer.generation) {
+                    profiles.push_back(it->second.profile);
+                    due.push_back(std::move(timer));
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < due.size(); i++) {
+            getLogger().info("Scheduled backup of profile " + due[i].name + " is due");
+            const bool started = callback(profiles[i]);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(due[i].name);
+            if (it == entries.end() || it->second.generation != due[i].generation) {
+                continue;
+            }
+
+            // Runs missed meanwhile are not made up for; the next one is after now
+            const auto now = Clock::now();
+            it->second.next = started ? nextFire(it->second.profile, std::max(now, due[i].when)) : now + RETRY_DELAY;
+            timers.push(Timer{it->second.next, it->second.generation, it->first});
+        }
+    }
+
+    // First run of a newly scheduled profile, given its latest snapshot
+    static Clock::time_point firstRun(const BackupProfile& profile, Clock::time_point now) {
+        std::optional<Clock::time_point> lastRun;
+        std::error_code ec;
+        if (std::filesystem::is_directory(profile.destinationPath / "backups", ec)) {
+            const auto snapshots = SnapshotCatalog::load(profile.destinationPath)->snapshots();
+            if (!snapshots.empty()) {
+                lastRun = snapshots.front().timestamp;
+            }
+        }
+
+        if (lastRun) {
+            Clock::time_point due = nextFire(profile, *lastRun);
+            if (due <= now) {
+                return now + jitterFor(profile.name, missedRunSpread);
+            }
+            return due;
+        }
+        return nextFire(profile, now);
+    }
+
+    // Next run after a time, including the profile's jitter
+    static Clock::time_point nextFire(const BackupProfile& profile, Clock::time_point after) {
+        const auto jitter = jitterFor(profile.name, std::min(maxJitter, schedulePeriod(profile.schedule) / 12));
+        return Scheduler::nextOccurrence(profile.schedule, after - jitter) + jitter;
+    }
+
+    void armTimer() {
+        struct itimerspec spec{};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!timers.empty()) {
+                const Timer& top = timers.top();
+                auto it = entries.find(top.name);
+                if (it != entries.end() && it->second.generation == top.generation) {
+                    break;
+                }
+                timers.pop();
+            }
+
+            // A zero value disarms the timer; a due time in the past fires at once
+            if (!timers.empty()) {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timers.top().when.time_since_epoch()).count();
+                ns = std::max<std::int64_t>(ns, 1);
+                spec.it_value.tv_sec = ns / 1000000000;
+                spec.it_value.tv_nsec = ns % 1000000000;
+            }
+        }
+
+        if (::timerfd_settime(timerFd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr) < 0) {
+            getLogger().error("Failed to arm scheduler timer: " + std::string(std::strerror(errno)));
+        }
+    }
+
+    void rebuildTimers() {
+        timers = {};
+        for (const auto& [name, entry] : entries) {
+            timers.push(Timer{entry.next, entry.generation, name});
+        }
+    }
+
+    void drainNotifications() {
+        alignas(struct inotify_event) char buffer[4096];
+        while (::read(inotifyFd, buffer, sizeof(buffer)) > 0) {
+        }
+    }
+
+    void wake() {
+        if (wakeFd >= 0) {
+            std::uint64_t one = 1;
+            [[maybe_unused]] ssize_t n = ::write(wakeFd, &one, sizeof(one));
+        }
+    }
+
+    void closeDescriptors() {
+        for (int* fd : {&timerFd, &wakeFd, &inotifyFd}) {
+            if (*fd >= 0) {
+                ::close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+};
+
+// Scheduler implementation
+
+Scheduler::Scheduler(ScheduledBackup callback) : pImpl(std::make_unique<Impl>(std::move(callback))) {
+}
+
+Scheduler::~Scheduler() = default;
+
+bool Scheduler::start(const std::filesystem::path& profilesDir) {
+    return pImpl->start(profilesDir);
+}
+
+void Scheduler::stop() {
+    pImpl->stop();
+}
+
+void Scheduler::setProfiles(const std::vector<BackupProfile>& profiles) {
+    pImpl->setProfiles(profiles);
+}
+
+std::optional<std::chrono::system_clock::time_point> Scheduler::nextRun(const std::string& profileName) const {
+    return pImpl->nextRun(profileName);
+}
+
+std::chrono::system_clock::time_point Scheduler::nextOccurrence(
+    const ScheduleConfig& schedule,
+    std::chrono::system_clock::time_point after) {
+
+    if (schedule.type == ScheduleType::CUSTOM) {
+        const auto interval = schedulePeriod(schedule);
+        if (after < schedule.startTime) {
+            return schedule.startTime;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(after - schedule.startTime);
+        return schedule.startTime + (elapsed / interval + 1) * interval;
+    }
+
+    // Calendar schedules run at the start time's time of day (minute for hourly), in local time
+    const std::tm start = toLocal(schedule.startTime);
+    std::tm tm = toLocal(after);
+    tm.tm_sec = start.tm_sec;
+    tm.tm_min = start.tm_min;
+
+    switch (schedule.type) {
+        case ScheduleType::HOURLY: {
+            Clock::time_point next = fromLocal(tm);
+            return next > after ? next : next + std::chrono::hours(1);
+        }
+
+        case ScheduleType::DAILY:
+        case ScheduleType::WEEKLY: {
+            tm.tm_hour = start.tm_hour;
+            if (schedule.type == ScheduleType::WEEKLY) {
+                tm.tm_mday += ((schedule.dayOfWeek % 7 + 7) % 7 - tm.tm_wday + 7) % 7;
+            }
+            Clock::time_point next = fromLocal(tm);
+            if (next <= after) {
+                tm.tm_mday += schedule.type == ScheduleType::WEEKLY ? 7 : 1;
+                next = fromLocal(tm);
+            }
+            return next;
+        }
+
+        case ScheduleType::MONTHLY:
+        default: {
+            tm.tm_hour = start.tm_hour;
+            for (int month = 0; month < 3; month++) {
+                // mktime() carries the month over into the year
+                std::tm candidate = tm;
+                candidate.tm_mon += month;
+                candidate.tm_mday = 1;
+                candidate.tm_isdst = -1;
+                std::mktime(&candidate);
+
+                candidate.tm_mday = std::clamp(schedule.dayOfMonth, 1, daysInMonth(candidate.tm_year + 1900, candidate.tm_mon));
+                candidate.tm_hour = start.tm_hour;
+                candidate.tm_min = start.tm_min;
+                candidate.tm_sec = start.tm_sec;
+                Clock::time_point next = fromLocal(candidate);
+                if (next > after) {
+                    return next;
+                }
+            }
+            return after + std::chrono::hours(24 * 28);
+        }
+    }
+}
+
+} // namespace utm
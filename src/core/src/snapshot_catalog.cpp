@@ -0,0 +1,372 @@
+#include "utm/snapshot_catalog.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/logging.hpp"
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::FileHandle;
+using fs::FileStat;
+
+namespace {
+
+constexpr char CATALOG_MAGIC[8] = {'U', 'T', 'M', 'C', 'A', 'T', '\0', '\0'};
+constexpr std::uint32_t CATALOG_VERSION = 1;
+constexpr const char* LOCK_NAME = ".utm-catalog.lock";
+
+// File layout: header, then one record per snapshot, newest first
+struct CatalogHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+    std::uint64_t count;
+    std::uint64_t reserved;
+};
+
+struct CatalogRecord {
+    std::int64_t timestamp;         // seconds since the epoch
+    std::int64_t endTime;
+    std::uint32_t state;
+    std::uint32_t reserved;
+    std::uint64_t totalFiles;
+    std::uint64_t totalDirectories;
+    std::uint64_t totalSize;
+    std::uint64_t newFiles;
+    std::uint64_t modifiedFiles;
+    std::uint64_t unchangedFiles;
+    std::uint64_t skippedFiles;
+    std::uint64_t processedSize;
+};
+
+static_assert(sizeof(CatalogHeader) % 8 == 0 && sizeof(CatalogRecord) % 8 == 0,
+              "catalog records must keep 8-byte alignment");
+
+// A loaded catalog and the identity of the file it was read from
+struct CachedCatalog {
+    dev_t device;
+    ino_t inode;
+    std::int64_t modifiedNs;
+    std::uintmax_t size;
+    std::shared_ptr<const SnapshotCatalog> catalog;
+};
+
+std::mutex cacheMutex;
+std::map<std::filesystem::path, CachedCatalog> cache;
+
+std::int64_t toSeconds(const std::chrono::system_clock::time_point& time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+std::chrono::system_clock::time_point fromSeconds(std::int64_t seconds) {
+    return std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+}
+
+std::int64_t modifiedNs(const FileStat& st) {
+    return static_cast<std::int64_t>(st.modified.tv_sec) * 1000000000 + st.modified.tv_nsec;
+}
+
+void sortNewestFirst(std::vector<SnapshotSummary>& entries) {
+    std::sort(entries.begin(), entries.end(), [](const SnapshotSummary& a, const SnapshotSummary& b) {
+        return a.timestamp > b.timestamp;
+    });
+}
+
+bool readFully(int fd, void* data, std::size_t size) {
+    char* bytes = static_cast<char*>(data);
+    std::size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::read(fd, bytes + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void* data, std::size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    std::size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::write(fd, bytes + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+// Read a catalog file; false if it is missing (errno ENOENT) or unreadable
+bool readCatalog(int fd, std::vector<SnapshotSummary>& entries) {
+    CatalogHeader header = {};
+    if (!readFully(fd, &header, sizeof(header)) ||
+        std::memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+        header.version != CATALOG_VERSION || header.recordSize != sizeof(CatalogRecord)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    std::vector<CatalogRecord> records(header.count);
+    if (!readFully(fd, records.data(), records.size() * sizeof(CatalogRecord))) {
+        errno = EINVAL;
+        return false;
+    }
+
+    entries.clear();
+    entries.reserve(records.size());
+    for (const auto& record : records) {
+        SnapshotSummary summary;
+        summary.timestamp = fromSeconds(record.timestamp);
+        summary.endTime = fromSeconds(record.endTime);
+        summary.state = static_cast<SnapshotState>(record.state);
+        summary.totalFiles = record.totalFiles;
+        summary.totalDirectories = record.totalDirectories;
+        summary.totalSize = record.totalSize;
+        summary.newFiles = record.newFiles;
+        summary.modifiedFiles = record.modifiedFiles;
+        summary.unchangedFiles = record.unchangedFiles;
+        summary.skippedFiles = record.skippedFiles;
+        summary.processedSize = record.processedSize;
+        entries.push_back(summary);
+    }
+    return true;
+}
+
+// Replace the catalog in a backups directory atomically
+bool writeCatalog(int dirFd, const std::vector<SnapshotSummary>& entries) {
+    CatalogHeader header = {};
+    std::memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.version = CATALOG_VERSION;
+    header.recordSize = sizeof(CatalogRecord);
+    header.count = entries.size();
+
+    std::vector<CatalogRecord> records;
+    records.reserve(entries.size());
+    for (const auto& summary : entries) {
+        CatalogRecord record = {};
+        record.timestamp = toSeconds(summary.timestamp);
+        record.endTime = toSeconds(summary.endTime);
+        record.state = static_cast<std::uint32_t>(summary.state);
+        record.totalFiles = summary.totalFiles;
+        record.totalDirectories = summary.totalDirectories;
+        record.totalSize = summary.totalSize;
+        record.newFiles = summary.newFiles;
+        record.modifiedFiles = summary.modifiedFiles;
+        record.unchangedFiles = summary.unchangedFiles;
+        record.skippedFiles = summary.skippedFiles;
+        record.processedSize = summary.processedSize;
+        records.push_back(record);
+    }
+
+    const std::string tempName = std::string(SnapshotCatalog::FILE_NAME) + ".tmp." + std::to_string(::getpid());
+    FileHandle out = fs::openAt(dirFd, tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = out.valid() &&
+              writeFully(out.get(), &header, sizeof(header)) &&
+              writeFully(out.get(), records.data(), records.size() * sizeof(CatalogRecord)) &&
+              ::fsync(out.get()) == 0 && out.close() &&
+              fs::renameAt(dirFd, tempName.c_str(), dirFd, SnapshotCatalog::FILE_NAME);
+    if (!ok) {
+        int savedErrno = errno;
+        ::unlinkat(dirFd, tempName.c_str(), 0);
+        errno = savedErrno;
+    }
+    return ok;
+}
+
+// Catalog the snapshot directories of a destination that has no catalog yet
+std::vector<SnapshotSummary> scanSnapshots(const std::filesystem::path& backupsDir) {
+    std::vector<SnapshotSummary> entries;
+
+    for (const auto& entry : std::filesystem::directory_iterator(backupsDir)) {
+        if (!entry.is_directory()) {
+            continue;
+        }
+
+        std::string dirName = entry.path().filename().string();
+        std::tm tm = {};
+        std::istringstream ss(dirName);
+        ss >> std::get_time(&tm, "%Y%m%d-%H%M%S");
+        if (ss.fail()) {
+            continue;
+        }
+        tm.tm_isdst = -1;
+
+        SnapshotSummary summary;
+        summary.timestamp = std::chrono::system_clock::from_time_t(std::mktime(&tm));
+        summary.endTime = summary.timestamp;
+
+        // Metadata is written last, so a snapshot without it never finished
+        std::filesystem::path infoFile = entry.path() / "backup-info.json";
+        if (!std::filesystem::exists(infoFile)) {
+            summary.state = SnapshotState::FAILED;
+            entries.push_back(summary);
+            continue;
+        }
+
+        try {
+            boost::property_tree::ptree info;
+            boost::property_tree::read_json(infoFile.string(), info);
+            summary.endTime = fromSeconds(info.get<std::int64_t>("endTime", toSeconds(summary.timestamp)));
+            summary.totalFiles = info.get<std::uint64_t>("totalFiles", 0);
+            summary.totalDirectories = info.get<std::uint64_t>("totalDirectories", 0);
+            summary.totalSize = info.get<std::uint64_t>("totalSize", 0);
+            summary.newFiles = info.get<std::uint64_t>("newFiles", 0);
+            summary.modifiedFiles = info.get<std::uint64_t>("modifiedFiles", 0);
+            summary.unchangedFiles = info.get<std::uint64_t>("unchangedFiles", 0);
+            summary.skippedFiles = info.get<std::uint64_t>("skippedFiles", 0);
+            summary.processedSize = summary.totalSize;
+        }
+        catch (const std::exception& e) {
+            getLogger().warning("Failed to read " + infoFile.string() + ": " + std::string(e.what()));
+        }
+        entries.push_back(summary);
+    }
+
+    sortNewestFirst(entries);
+    return entries;
+}
+
+// Read-modify-write the catalog of a destination under its lock
+bool updateCatalog(
+    const std::filesystem::path& destination,
+    const std::function<void(std::vector<SnapshotSummary>&)>& change) {
+
+    std::filesystem::path backupsDir = destination / "backups";
+
+    try {
+        std::filesystem::create_directories(backupsDir);
+
+        FileHandle dir = fs::openDirectoryAt(AT_FDCWD, backupsDir.c_str());
+        FileHandle lock = dir.valid() ? fs::openAt(dir.get(), LOCK_NAME, O_RDWR | O_CREAT, 0644) : FileHandle();
+        if (!lock.valid()) {
+            getLogger().error("Failed to open snapshot catalog in " + backupsDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+        while (::flock(lock.get(), LOCK_EX) != 0) {
+            if (errno != EINTR) {
+                getLogger().error("Failed to lock snapshot catalog in " + backupsDir.string() + ": " + std::strerror(errno));
+                return false;
+            }
+        }
+
+        std::vector<SnapshotSummary> entries;
+        FileHandle in = fs::openAt(dir.get(), SnapshotCatalog::FILE_NAME, O_RDONLY);
+        if (!in.valid() || !readCatalog(in.get(), entries)) {
+            if (in.valid() || errno != ENOENT) {
+                getLogger().warning("Snapshot catalog in " + backupsDir.string() + " is unreadable, rebuilding it");
+            }
+            entries = scanSnapshots(backupsDir);
+        }
+
+        change(entries);
+        sortNewestFirst(entries);
+
+        if (!writeCatalog(dir.get(), entries)) {
+            getLogger().error("Failed to write snapshot catalog in " + backupsDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+    catch (const std::exception& e) {
+        getLogger().error("Failed to update snapshot catalog in " + backupsDir.string() + ": " + std::string(e.what()));
+        return false;
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const SnapshotCatalog> SnapshotCatalog::load(const std::filesystem::path& destination) {
+    std::filesystem::path catalogPath = destination / "backups" / FILE_NAME;
+    auto catalog = std::make_shared<SnapshotCatalog>();
+
+    FileHandle in = fs::openAt(AT_FDCWD, catalogPath.c_str(), O_RDONLY);
+    if (!in.valid() && errno == ENOENT) {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(destination / "backups", ec)) {
+            return catalog;
+        }
+
+        // First use on this destination: catalog the existing snapshots
+        getLogger().info("Cataloguing snapshots in " + destination.string());
+        if (!updateCatalog(destination, [](std::vector<SnapshotSummary>&) {})) {
+            catalog->entries = scanSnapshots(destination / "backups");
+            return catalog;
+        }
+        in = fs::openAt(AT_FDCWD, catalogPath.c_str(), O_RDONLY);
+    }
+
+    FileStat st;
+    if (!in.valid() || !fs::statFd(in.get(), st)) {
+        getLogger().error("Failed to open snapshot catalog " + catalogPath.string() + ": " + std::strerror(errno));
+        return catalog;
+    }
+
+    // The catalog is only ever replaced, so an unchanged file identity means unchanged contents
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(catalogPath);
+    if (it != cache.end() && it->second.device == st.device && it->second.inode == st.inode &&
+        it->second.modifiedNs == modifiedNs(st) && it->second.size == st.size) {
+        return it->second.catalog;
+    }
+
+    if (!readCatalog(in.get(), catalog->entries)) {
+        getLogger().error("Snapshot catalog " + catalogPath.string() + " is corrupt");
+        return catalog;
+    }
+
+    cache[catalogPath] = {st.device, st.inode, modifiedNs(st), st.size, catalog};
+    return catalog;
+}
+
+bool SnapshotCatalog::commit(const std::filesystem::path& destination, const SnapshotSummary& summary) {
+    // Snapshots are named with second resolution, and so are catalog timestamps
+    SnapshotSummary committed = summary;
+    committed.timestamp = std::chrono::floor<std::chrono::seconds>(summary.timestamp);
+
+    return updateCatalog(destination, [&committed](std::vector<SnapshotSummary>& entries) {
+        std::erase_if(entries, [&committed](const SnapshotSummary& entry) { return entry.timestamp == committed.timestamp; });
+        entries.push_back(committed);
+    });
+}
+
+bool SnapshotCatalog::remove(
+    const std::filesystem::path& destination,
+    const std::vector<std::chrono::system_clock::time_point>& timestamps) {
+
+    return updateCatalog(destination, [&timestamps](std::vector<SnapshotSummary>& entries) {
+        std::erase_if(entries, [&timestamps](const SnapshotSummary& entry) {
+            return std::find(timestamps.begin(), timestamps.end(), entry.timestamp) != timestamps.end();
+        });
+    });
+}
+
+std::optional<SnapshotSummary> SnapshotCatalog::find(const std::chrono::system_clock::time_point& timestamp) const {
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [&timestamp](const SnapshotSummary& entry) { return entry.timestamp == timestamp; });
+    if (it == entries.end()) {
+        return std::nullopt;
+    }
+    return *it;
+}
+
+} // namespace utm
@@ -0,0 +1,218 @@
+#include "utm/snapshot_diff.hpp"
+#include "utm/dir_handle.hpp"
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace utm {
+
+using fs::fileType;
+using fs::joinRelative;
+
+namespace {
+
+// Size and modification time identify a file moved between snapshots
+struct RenameKey {
+    std::uintmax_t size;
+    std::int64_t modifiedNs;
+
+    bool operator==(const RenameKey&) const = default;
+};
+
+struct RenameKeyHash {
+    std::size_t operator()(const RenameKey& key) const noexcept {
+        return std::hash<std::uintmax_t>()(key.size) * 31 + std::hash<std::int64_t>()(key.modifiedNs);
+    }
+};
+
+class DiffMerger {
+public:
+    DiffMerger(const SnapshotIndex& from, const SnapshotIndex& to, const DiffCallback& callback)
+        : from(from), to(to), callback(callback) {}
+
+    DiffSummary run() {
+        // Directories are sorted by path in both indexes
+        std::size_t a = 0;
+        std::size_t b = 0;
+        const std::size_t aEnd = from.directoryCount();
+        const std::size_t bEnd = to.directoryCount();
+
+        while (a < aEnd || b < bEnd) {
+            int order = a == aEnd ? 1 : b == bEnd ? -1 : from.directoryPath(a).compare(to.directoryPath(b));
+            if (order < 0) {
+                removeDirectory(a++);
+            }
+            else if (order > 0) {
+                addDirectory(b++);
+            }
+            else {
+                mergeDirectory(a++, b++);
+            }
+        }
+
+        pairRenames();
+        return summary;
+    }
+
+private:
+    const SnapshotIndex& from;
+    const SnapshotIndex& to;
+    const DiffCallback& callback;
+    DiffSummary summary;
+
+    // Rename candidates, reported once the merge has seen both sides
+    std::unordered_multimap<RenameKey, std::string, RenameKeyHash> removedFiles;
+    std::vector<std::pair<RenameKey, std::string>> addedFiles;
+
+    static bool isRenameCandidate(const SnapshotIndex::Entry& entry) {
+        return S_ISREG(entry.mode) && entry.size > 0;
+    }
+
+    void mergeDirectory(std::size_t a, std::size_t b) {
+        std::string_view directory = to.directoryPath(b);
+        std::size_t i = 0;
+        std::size_t j = 0;
+        const std::size_t iEnd = from.entryCount(a);
+        const std::size_t jEnd = to.entryCount(b);
+
+        while (i < iEnd || j < jEnd) {
+            if (i == iEnd) {
+                added(directory, to.entry(b, j++));
+                continue;
+            }
+            if (j == jEnd) {
+                removed(directory, from.entry(a, i++));
+                continue;
+            }
+
+            SnapshotIndex::Entry oldEntry = from.entry(a, i);
+            SnapshotIndex::Entry newEntry = to.entry(b, j);
+            int order = oldEntry.name.compare(newEntry.name);
+            if (order < 0) {
+                removed(directory, oldEntry);
+                i++;
+            }
+            else if (order > 0) {
+                added(directory, newEntry);
+                j++;
+            }
+            else {
+                compare(directory, oldEntry, newEntry);
+                i++;
+                j++;
+            }
+        }
+    }
+
+    void removeDirectory(std::size_t a) {
+        std::string_view directory = from.directoryPath(a);
+        for (std::size_t i = 0, end = from.entryCount(a); i < end; i++) {
+            removed(directory, from.entry(a, i));
+        }
+    }
+
+    void addDirectory(std::size_t b) {
+        std::string_view directory = to.directoryPath(b);
+        for (std::size_t j = 0, end = to.entryCount(b); j < end; j++) {
+            added(directory, to.entry(b, j));
+        }
+    }
+
+    void compare(std::string_view directory, const SnapshotIndex::Entry& oldEntry, const SnapshotIndex::Entry& newEntry) {
+        if ((oldEntry.mode & S_IFMT) != (newEntry.mode & S_IFMT)) {
+            removed(directory, oldEntry);
+            added(directory, newEntry);
+            return;
+        }
+
+        // Directory contents are compared through their own directory records
+        if (S_ISDIR(newEntry.mode) || oldEntry.inode == newEntry.inode ||
+            (oldEntry.size == newEntry.size && oldEntry.modifiedNs == newEntry.modifiedNs)) {
+            return;
+        }
+
+        summary.modifiedEntries++;
+        summary.modifiedBytes += newEntry.size;
+        summary.growthBytes += static_cast<std::intmax_t>(newEntry.size) - static_cast<std::intmax_t>(oldEntry.size);
+        report(DiffChange::MODIFIED, joinRelative(directory, newEntry.name), {}, newEntry.mode, oldEntry.size, newEntry.size);
+    }
+
+    void added(std::string_view directory, const SnapshotIndex::Entry& entry) {
+        if (isRenameCandidate(entry)) {
+            addedFiles.emplace_back(RenameKey{entry.size, entry.modifiedNs}, joinRelative(directory, entry.name));
+            return;
+        }
+        reportAdded(joinRelative(directory, entry.name), entry.mode, entry.size);
+    }
+
+    void removed(std::string_view directory, const SnapshotIndex::Entry& entry) {
+        if (isRenameCandidate(entry)) {
+            removedFiles.emplace(RenameKey{entry.size, entry.modifiedNs}, joinRelative(directory, entry.name));
+            return;
+        }
+        reportRemoved(joinRelative(directory, entry.name), entry.mode, entry.size);
+    }
+
+    void pairRenames() {
+        for (auto& [key, path] : addedFiles) {
+            auto match = removedFiles.find(key);
+            if (match == removedFiles.end()) {
+                reportAdded(std::move(path), S_IFREG, key.size);
+                continue;
+            }
+
+            summary.renamedEntries++;
+            summary.renamedBytes += key.size;
+            report(DiffChange::RENAMED, std::move(path), std::move(match->second), S_IFREG, key.size, key.size);
+            removedFiles.erase(match);
+        }
+        addedFiles.clear();
+
+        for (auto& [key, path] : removedFiles) {
+            reportRemoved(std::move(path), S_IFREG, key.size);
+        }
+        removedFiles.clear();
+    }
+
+    void reportAdded(std::string path, mode_t mode, std::uintmax_t size) {
+        summary.addedEntries++;
+        summary.addedBytes += size;
+        summary.growthBytes += static_cast<std::intmax_t>(size);
+        report(DiffChange::ADDED, std::move(path), {}, mode, 0, size);
+    }
+
+    void reportRemoved(std::string path, mode_t mode, std::uintmax_t size) {
+        summary.removedEntries++;
+        summary.removedBytes += size;
+        summary.growthBytes -= static_cast<std::intmax_t>(size);
+        report(DiffChange::REMOVED, std::move(path), {}, mode, size, 0);
+    }
+
+    void report(DiffChange change, std::string path, std::string previousPath, mode_t mode,
+                std::uintmax_t oldSize, std::uintmax_t newSize) {
+        if (!callback) {
+            return;
+        }
+
+        DiffEntry entry;
+        entry.change = change;
+        entry.path = std::move(path);
+        entry.previousPath = std::move(previousPath);
+        entry.type = fileType(mode);
+        entry.oldSize = oldSize;
+        entry.newSize = newSize;
+        callback(entry);
+    }
+};
+
+} // namespace
+
+DiffSummary diffSnapshots(
+    const SnapshotIndex& from,
+    const SnapshotIndex& to,
+    const DiffCallback& callback) {
+    return DiffMerger(from, to, callback).run();
+}
+
+} // namespace utm
@@ -0,0 +1,479 @@
+#include "utm/snapshot_index.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/io_limiter.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::FileHandle;
+using fs::FileStat;
+using fs::isSnapshotMetadata;
+
+namespace {
+
+constexpr char INDEX_MAGIC[8] = {'U', 'T', 'M', 'I', 'D', 'X', '\0', '\0'};
+constexpr std::uint32_t INDEX_VERSION = 1;
+
+// File layout: header, entries, string table, directory table
+struct IndexHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t directoryCount;
+    std::uint64_t entryCount;
+    std::uint64_t directoriesOffset;
+    std::uint64_t entriesOffset;
+    std::uint64_t stringsOffset;
+    std::uint64_t stringsSize;
+};
+
+struct IndexDirectory {
+    std::uint64_t pathOffset;       // into the string table
+    std::uint32_t pathLength;
+    std::uint32_t reserved;
+    std::uint64_t firstEntry;
+    std::uint64_t entryCount;
+};
+
+struct IndexEntry {
+    std::uint64_t nameOffset;       // into the string table
+    std::uint32_t nameLength;
+    std::uint32_t mode;
+    std::uint64_t size;
+    std::int64_t modifiedNs;
+    std::uint64_t inode;
+};
+
+static_assert(sizeof(IndexHeader) % 8 == 0 && sizeof(IndexDirectory) % 8 == 0 && sizeof(IndexEntry) % 8 == 0,
+              "index records must keep 8-byte alignment");
+
+std::uint64_t alignUp(std::uint64_t offset) {
+    return (offset + 7) & ~std::uint64_t(7);
+}
+
+// Buffered sequential writer over a descriptor
+class FileWriter {
+public:
+    FileWriter(int fd, IoLimiter* limiter) : fd(fd), limiter(limiter) {
+        buffer.reserve(capacity);
+    }
+
+    void write(const void* data, std::size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+        written += size;
+        if (buffer.size() >= capacity) {
+            flush();
+        }
+    }
+
+    bool flush() {
+        std::size_t done = 0;
+        while (!failed && done < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                failed = true;
+                break;
+            }
+            done += n;
+        }
+        if (limiter && done > 0) {
+            limiter->write(done);
+        }
+        buffer.clear();
+        return !failed;
+    }
+
+    std::uint64_t position() const noexcept {
+        return written;
+    }
+
+private:
+    static constexpr std::size_t capacity = 1024 * 1024;
+
+    int fd;
+    IoLimiter* limiter;
+    std::vector<char> buffer;
+    std::uint64_t written = 0;
+    bool failed = false;
+};
+
+// Walks a snapshot and streams its entries and names to disk
+class IndexBuilder {
+public:
+    IndexBuilder(int entriesFd, int stringsFd, IoLimiter* limiter)
+        : entries(entriesFd, limiter), strings(stringsFd, limiter), limiter(limiter) {
+    }
+
+    // Index one directory, then its subdirectories
+    bool addDirectory(int dirFd, const std::string& relativeDir) {
+        int fd = ::fcntl(dirFd, F_DUPFD_CLOEXEC, 0);
+        DIR* dir = fd >= 0 ? ::fdopendir(fd) : nullptr;
+        if (!dir) {
+            getLogger().error("Failed to read snapshot directory " + relativeDir + ": " + std::strerror(errno));
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        if (limiter) {
+            limiter->operations();
+        }
+
+        std::vector<std::pair<std::string, FileStat>> items;
+        while (struct dirent* ent = ::readdir(dir)) {
+            std::string_view name(ent->d_name);
+            if (name == "." || name == ".." || (relativeDir.empty() && isSnapshotMetadata(name))) {
+                continue;
+            }
+
+            FileStat st;
+            if (fs::statAt(dirFd, ent->d_name, st, false)) {
+                items.emplace_back(name, st);
+            }
+        }
+        ::closedir(dir);
+
+        std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        directories.push_back({relativeDir, entryCount, items.size()});
+        entryCount += items.size();
+
+        for (const auto& [name, st] : items) {
+            IndexEntry record = {};
+            record.nameOffset = strings.position();
+            record.nameLength = static_cast<std::uint32_t>(name.size());
+            record.mode = st.mode;
+            record.size = S_ISDIR(st.mode) ? 0 : st.size;
+            record.modifiedNs = static_cast<std::int64_t>(st.modified.tv_sec) * 1000000000 + st.modified.tv_nsec;
+            record.inode = st.inode;
+
+            strings.write(name.data(), name.size());
+            entries.write(&record, sizeof(record));
+        }
+
+        for (const auto& [name, st] : items) {
+            if (!S_ISDIR(st.mode)) {
+                continue;
+            }
+
+            std::string childPath = relativeDir.empty() ? name : relativeDir + "/" + name;
+            FileHandle child = fs::openDirectoryAt(dirFd, name.c_str());
+            if (!child.valid()) {
+                getLogger().error("Failed to open snapshot directory " + childPath + ": " + std::strerror(errno));
+                return false;
+            }
+            if (!addDirectory(child.get(), childPath)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Sort the directory table and append its paths to the string table
+    std::vector<IndexDirectory> finishDirectories() {
+        std::sort(directories.begin(), directories.end(),
+                  [](const PendingDirectory& a, const PendingDirectory& b) { return a.path < b.path; });
+
+        std::vector<IndexDirectory> table;
+        table.reserve(directories.size());
+        for (const auto& directory : directories) {
+            IndexDirectory record = {};
+            record.pathOffset = strings.position();
+            record.pathLength = static_cast<std::uint32_t>(directory.path.size());
+            record.firstEntry = directory.firstEntry;
+            record.entryCount = directory.entryCount;
+            table.push_back(record);
+
+            strings.write(directory.path.data(), directory.path.size());
+        }
+        directories.clear();
+        return table;
+    }
+
+    FileWriter entries;
+    FileWriter strings;
+    std::uint64_t entryCount = 0;
+
+private:
+    struct PendingDirectory {
+        std::string path;
+        std::uint64_t firstEntry;
+        std::uint64_t entryCount;
+    };
+
+    IoLimiter* limiter;
+    std::vector<PendingDirectory> directories;
+};
+
+bool writeAt(int fd, const void* data, std::size_t size, std::uint64_t offset) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::pwrite(fd, bytes, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+} // namespace
+
+// Implementation class for SnapshotIndex
+class SnapshotIndex::Impl {
+public:
+    ~Impl() {
+        if (data) {
+            ::munmap(const_cast<char*>(data), length);
+        }
+    }
+
+    // Map an index file and validate its layout
+    bool map(int fd, const std::filesystem::path& indexPath) {
+        FileStat st;
+        if (!fs::statFd(fd, st) || st.size < sizeof(IndexHeader)) {
+            getLogger().error("Invalid snapshot index: " + indexPath.string());
+            return false;
+        }
+
+        void* mapping = ::mmap(nullptr, st.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            getLogger().error("Failed to map snapshot index " + indexPath.string() + ": " + std::strerror(errno));
+            return false;
+        }
+        data = static_cast<const char*>(mapping);
+        length = st.size;
+
+        header = reinterpret_cast<const IndexHeader*>(data);
+        if (std::memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION ||
+            !fits(header->directoriesOffset, header->directoryCount, sizeof(IndexDirectory)) ||
+            !fits(header->entriesOffset, header->entryCount, sizeof(IndexEntry)) ||
+            !fits(header->stringsOffset, header->stringsSize, 1) || header->directoryCount == 0) {
+            getLogger().error("Unsupported or corrupt snapshot index: " + indexPath.string());
+            return false;
+        }
+
+        directories = reinterpret_cast<const IndexDirectory*>(data + header->directoriesOffset);
+        entries = reinterpret_cast<const IndexEntry*>(data + header->entriesOffset);
+        strings = data + header->stringsOffset;
+        return true;
+    }
+
+    std::string_view string(std::uint64_t offset, std::uint32_t size) const {
+        if (offset + size > header->stringsSize) {
+            return {};
+        }
+        return std::string_view(strings + offset, size);
+    }
+
+    std::string_view directoryPath(std::size_t directory) const {
+        return string(directories[directory].pathOffset, directories[directory].pathLength);
+    }
+
+    std::string_view entryName(const IndexEntry& entry) const {
+        return string(entry.nameOffset, entry.nameLength);
+    }
+
+    // Entries of a directory, clamped to the entry table
+    std::pair<const IndexEntry*, const IndexEntry*> entryRange(std::size_t directory) const {
+        const IndexDirectory& record = directories[directory];
+        std::uint64_t first = std::min(record.firstEntry, header->entryCount);
+        std::uint64_t last = std::min(first + record.entryCount, header->entryCount);
+        return {entries + first, entries + last};
+    }
+
+    const char* data = nullptr;
+    std::size_t length = 0;
+    const IndexHeader* header = nullptr;
+    const IndexDirectory* directories = nullptr;
+    const IndexEntry* entries = nullptr;
+    const char* strings = nullptr;
+
+private:
+    bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t recordSize) const {
+        return offset <= length && count <= (length - offset) / recordSize;
+    }
+};
+
+// SnapshotIndex implementation
+
+SnapshotIndex::SnapshotIndex() : pImpl(std::make_unique<Impl>()) {
+}
+
+SnapshotIndex::~SnapshotIndex() = default;
+
+bool SnapshotIndex::build(const std::filesystem::path& snapshotDir, IoLimiter* limiter) {
+    FileHandle root = fs::openDirectoryAt(AT_FDCWD, snapshotDir.c_str());
+    if (!root.valid()) {
+        getLogger().error("Failed to open snapshot " + snapshotDir.string() + ": " + std::strerror(errno));
+        return false;
+    }
+
+    // Build under temporary names so readers only ever see a complete index
+    const std::string tempName = std::string(FILE_NAME) + ".tmp." + std::to_string(::getpid());
+    const std::string stringsName = tempName + ".strings";
+
+    FileHandle out = fs::openAt(root.get(), tempName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    FileHandle stringsFile = fs::openAt(root.get(), stringsName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (!out.valid() || !stringsFile.valid()) {
+        getLogger().error("Failed to create snapshot index in " + snapshotDir.string() + ": " + std::strerror(errno));
+        ::unlinkat(root.get(), tempName.c_str(), 0);
+        ::unlinkat(root.get(), stringsName.c_str(), 0);
+        return false;
+    }
+    ::unlinkat(root.get(), stringsName.c_str(), 0);
+
+    IndexHeader header = {};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.entriesOffset = sizeof(IndexHeader);
+
+    bool ok = ::lseek(out.get(), static_cast<off_t>(header.entriesOffset), SEEK_SET) >= 0;
+
+    IndexBuilder builder(out.get(), stringsFile.get(), limiter);
+    ok = ok && builder.addDirectory(root.get(), std::string());
+
+    std::vector<IndexDirectory> table;
+    if (ok) {
+        table = builder.finishDirectories();
+        ok = builder.entries.flush() && builder.strings.flush();
+    }
+
+    if (ok) {
+        header.directoryCount = table.size();
+        header.entryCount = builder.entryCount;
+        header.stringsOffset = alignUp(header.entriesOffset + builder.entries.position());
+        header.stringsSize = builder.strings.position();
+        header.directoriesOffset = alignUp(header.stringsOffset + header.stringsSize);
+
+        std::vector<char> buffer;
+        ok = ::lseek(stringsFile.get(), 0, SEEK_SET) == 0 &&
+             ::lseek(out.get(), static_cast<off_t>(header.stringsOffset), SEEK_SET) >= 0 &&
+             fs::copyContents(stringsFile.get(), out.get(), buffer, limiter) &&
+             writeAt(out.get(), table.data(), table.size() * sizeof(IndexDirectory), header.directoriesOffset) &&
+             writeAt(out.get(), &header, sizeof(header), 0) &&
+             ::fsync(out.get()) == 0 && out.close() &&
+             fs::renameAt(root.get(), tempName.c_str(), root.get(), FILE_NAME);
+    }
+
+    if (!ok) {
+        getLogger().error("Failed to write snapshot index in " + snapshotDir.string() + ": " + std::strerror(errno));
+        ::unlinkat(root.get(), tempName.c_str(), 0);
+        return false;
+    }
+
+    getLogger().info("Indexed " + std::to_string(header.entryCount) + " entries in " +
+                     std::to_string(header.directoryCount) + " directories of " + snapshotDir.string());
+    return true;
+}
+
+std::shared_ptr<const SnapshotIndex> SnapshotIndex::open(
+    const std::filesystem::path& snapshotDir,
+    bool buildIfMissing) {
+
+    std::filesystem::path indexPath = snapshotDir / FILE_NAME;
+    FileHandle fd = fs::openAt(AT_FDCWD, indexPath.c_str(), O_RDONLY);
+
+    // Snapshots made before indexing existed are indexed on first use; an
+    // incomplete snapshot (no metadata yet) is still being written
+    if (!fd.valid() && errno == ENOENT && buildIfMissing) {
+        if (!std::filesystem::exists(snapshotDir / "backup-info.json")) {
+            getLogger().error("Snapshot is incomplete, not indexing: " + snapshotDir.string());
+            return nullptr;
+        }
+        if (!build(snapshotDir)) {
+            return nullptr;
+        }
+        fd = fs::openAt(AT_FDCWD, indexPath.c_str(), O_RDONLY);
+    }
+
+    if (!fd.valid()) {
+        getLogger().error("Failed to open snapshot index " + indexPath.string() + ": " + std::strerror(errno));
+        return nullptr;
+    }
+
+    std::shared_ptr<SnapshotIndex> index(new SnapshotIndex());
+    if (!index->pImpl->map(fd.get(), indexPath)) {
+        return nullptr;
+    }
+    return index;
+}
+
+std::size_t SnapshotIndex::directoryCount() const noexcept {
+    return pImpl->header->directoryCount;
+}
+
+std::size_t SnapshotIndex::totalEntries() const noexcept {
+    return pImpl->header->entryCount;
+}
+
+std::optional<std::size_t> SnapshotIndex::findDirectory(std::string_view relativeDir) const {
+    const IndexDirectory* first = pImpl->directories;
+    const IndexDirectory* last = first + pImpl->header->directoryCount;
+
+    const IndexDirectory* found = std::lower_bound(first, last, relativeDir,
+        [this](const IndexDirectory& directory, std::string_view path) {
+            return pImpl->string(directory.pathOffset, directory.pathLength) < path;
+        });
+
+    if (found == last || pImpl->string(found->pathOffset, found->pathLength) != relativeDir) {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(found - first);
+}
+
+std::string_view SnapshotIndex::directoryPath(std::size_t directory) const {
+    return pImpl->directoryPath(directory);
+}
+
+std::size_t SnapshotIndex::entryCount(std::size_t directory) const {
+    auto [first, last] = pImpl->entryRange(directory);
+    return static_cast<std::size_t>(last - first);
+}
+
+std::size_t SnapshotIndex::seekAfter(std::size_t directory, std::string_view name) const {
+    auto [first, last] = pImpl->entryRange(directory);
+    if (name.empty()) {
+        return 0;
+    }
+
+    const IndexEntry* found = std::upper_bound(first, last, name,
+        [this](std::string_view key, const IndexEntry& entry) {
+            return key < pImpl->entryName(entry);
+        });
+    return static_cast<std::size_t>(found - first);
+}
+
+SnapshotIndex::Entry SnapshotIndex::entry(std::size_t directory, std::size_t position) const {
+    const IndexEntry& record = pImpl->entryRange(directory).first[position];
+
+    Entry result;
+    result.name = pImpl->entryName(record);
+    result.mode = static_cast<mode_t>(record.mode);
+    result.size = record.size;
+    result.modifiedNs = record.modifiedNs;
+    result.inode = record.inode;
+    return result;
+}
+
+} // namespace utm
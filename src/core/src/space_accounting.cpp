@@ -0,0 +1,92 @@
+#include "utm/space_accounting.hpp"
+#include "utm/snapshot_catalog.hpp"
+#include "utm/snapshot_index.hpp"
+#include "utm/filesystem_utils.hpp"
+#include "utm/logging.hpp"
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/stat.h>
+
+namespace utm {
+
+namespace {
+
+// What the scan knows about one inode of the destination
+struct InodeOwner {
+    std::uintmax_t size = 0;
+    std::int64_t owner = -1;           // position in the deletion order that frees it; -1 if kept
+    std::size_t lastSnapshot = 0;      // last scanned snapshot that links to it
+    bool shared = false;               // linked from more than one snapshot
+};
+
+} // namespace
+
+std::optional<std::vector<ReclaimEstimate>> estimateReclaimableSpace(
+    const std::filesystem::path& destination,
+    const std::vector<std::chrono::system_clock::time_point>& deletionOrder) {
+
+    std::vector<ReclaimEstimate> estimates(deletionOrder.size());
+    const std::set<std::chrono::system_clock::time_point> doomed(deletionOrder.begin(), deletionOrder.end());
+
+    // Kept snapshots first, so whatever they link to is never freed; then the
+    // order backwards, so the first to see an inode is the last to delete it
+    std::vector<std::pair<std::chrono::system_clock::time_point, std::int64_t>> scan;
+    for (const auto& snapshot : SnapshotCatalog::load(destination)->snapshots()) {
+        if (doomed.find(snapshot.timestamp) == doomed.end()) {
+            scan.emplace_back(snapshot.timestamp, -1);
+        }
+    }
+    for (std::size_t position = deletionOrder.size(); position-- > 0; ) {
+        scan.emplace_back(deletionOrder[position], static_cast<std::int64_t>(position));
+    }
+
+    std::unordered_map<std::uint64_t, InodeOwner> inodes;
+    for (std::size_t snapshot = 0; snapshot < scan.size(); snapshot++) {
+        std::filesystem::path snapshotDir = fs::getBackupPath(destination, scan[snapshot].first);
+        auto index = SnapshotIndex::open(snapshotDir);
+        if (!index) {
+            std::error_code ec;
+            if (!std::filesystem::exists(snapshotDir, ec)) {
+                continue;
+            }
+            getLogger().error("Cannot account for the space of " + snapshotDir.string() + " without its index");
+            return std::nullopt;
+        }
+
+        for (std::size_t directory = 0; directory < index->directoryCount(); directory++) {
+            for (std::size_t position = 0, end = index->entryCount(directory); position < end; position++) {
+                SnapshotIndex::Entry entry = index->entry(directory, position);
+                if (S_ISDIR(entry.mode)) {
+                    continue;
+                }
+
+                auto [it, inserted] = inodes.try_emplace(entry.inode);
+                InodeOwner& inode = it->second;
+                if (inserted) {
+                    inode.size = entry.size;
+                    inode.owner = scan[snapshot].second;
+                }
+                else if (inode.lastSnapshot != snapshot) {
+                    inode.shared = true;
+                }
+                inode.lastSnapshot = snapshot;
+            }
+        }
+    }
+
+    for (const auto& [number, inode] : inodes) {
+        if (inode.owner < 0) {
+            continue;
+        }
+        ReclaimEstimate& estimate = estimates[static_cast<std::size_t>(inode.owner)];
+        estimate.reclaimableBytes += inode.size;
+        if (!inode.shared) {
+            estimate.exclusiveBytes += inode.size;
+        }
+    }
+    return estimates;
+}
+
+} // namespace utm
@@ -0,0 +1,263 @@
+#include "utm/stats_counters.hpp"
+#include "utm/backup_engine.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+namespace utm {
+
+namespace {
+
+constexpr std::size_t COUNTERS = static_cast<std::size_t>(StatCounter::COUNT);
+constexpr std::size_t CACHE_LINE = 64;
+
+// Rates are measured over windows at least this long and smoothed across them
+constexpr std::chrono::milliseconds rateWindow{1000};
+constexpr double rateSmoothing = 0.3;
+
+// Threads keep their index for life, so each one keeps its slot in every set of counters
+std::atomic<std::size_t> nextThreadIndex{0};
+
+std::size_t threadIndex() {
+    thread_local const std::size_t index = nextThreadIndex.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+std::size_t index(StatCounter counter) {
+    return static_cast<std::size_t>(counter);
+}
+
+void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+} // namespace
+
+// Implementation class for StatsCounters
+class StatsCounters::Impl {
+public:
+    explicit Impl(std::size_t slots)
+        : slotCount(std::clamp<std::size_t>(slots ? slots : std::thread::hardware_concurrency(), 1, 64)),
+          slots(std::make_unique<Slot[]>(slotCount)) {
+        reset();
+    }
+
+    void reset() {
+        for (std::size_t i = 0; i < slotCount; i++) {
+            for (auto& value : slots[i].values) {
+                value.store(0, std::memory_order_relaxed);
+            }
+        }
+        const auto now = std::chrono::steady_clock::now();
+        started.store(std::chrono::system_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        startedSteady.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        finished.store(0, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock(rateMutex);
+        rates = Rates();
+        rates.sampled = now;
+    }
+
+    void finish() {
+        finished.store(std::chrono::system_clock::now().time_since_epoch().count(), std::memory_order_release);
+    }
+
+    template<typename Apply>
+    void update(Apply&& apply) {
+        Slot& slot = slots[threadIndex() % slotCount];
+
+        // Odd while written; the compare-exchange only fails while another thread shares the slot
+        std::uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        for (;;) {
+            if ((sequence & 1) == 0 &&
+                slot.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                                    std::memory_order_relaxed)) {
+                break;
+            }
+            cpuRelax();
+            sequence = slot.sequence.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        apply(slot.values);
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    Values snapshot() const {
+        Values total{};
+        for (std::size_t i = 0; i < slotCount; i++) {
+            const Slot& slot = slots[i];
+            Values copy;
+            for (;;) {
+                const std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+                if (before & 1) {
+                    cpuRelax();
+                    continue;
+                }
+                for (std::size_t c = 0; c < COUNTERS; c++) {
+                    copy[c] = slot.values[c].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                    break;
+                }
+            }
+            for (std::size_t c = 0; c < COUNTERS; c++) {
+                total[c] += copy[c];
+            }
+        }
+        return total;
+    }
+
+    void fill(BackupStats& stats) const {
+        const Values values = snapshot();
+        stats.totalFiles = values[index(StatCounter::TOTAL_FILES)];
+        stats.totalDirectories = values[index(StatCounter::TOTAL_DIRECTORIES)];
+        stats.totalSize = values[index(StatCounter::TOTAL_SIZE)];
+        stats.processedFiles = values[index(StatCounter::PROCESSED_FILES)];
+        stats.processedSize = values[index(StatCounter::PROCESSED_SIZE)];
+        stats.newFiles = values[index(StatCounter::NEW_FILES)];
+        stats.modifiedFiles = values[index(StatCounter::MODIFIED_FILES)];
+        stats.unchangedFiles = values[index(StatCounter::UNCHANGED_FILES)];
+        stats.skippedFiles = values[index(StatCounter::SKIPPED_FILES)];
+        stats.dedupSavings = values[index(StatCounter::DEDUP_SAVINGS)];
+
+        using SystemClock = std::chrono::system_clock;
+        stats.startTime = SystemClock::time_point(SystemClock::duration(started.load(std::memory_order_relaxed)));
+        const auto end = finished.load(std::memory_order_acquire);
+        stats.endTime.reset();
+        if (end != 0) {
+            stats.endTime = SystemClock::time_point(SystemClock::duration(end));
+        }
+
+        updateRates(stats, end != 0);
+    }
+
+private:
+    struct alignas(CACHE_LINE) Slot {
+        std::atomic<std::uint64_t> sequence{0};
+        std::atomic<std::uint64_t> values[COUNTERS] = {};
+    };
+
+    struct Rates {
+        std::chrono::steady_clock::time_point sampled;
+        std::uint64_t files = 0;
+        std::uint64_t bytes = 0;
+        double filesPerSecond = 0.0;
+        double bytesPerSecond = 0.0;
+        bool measured = false;
+    };
+
+    using SystemClockRep = std::chrono::system_clock::rep;
+    using SteadyClockRep = std::chrono::steady_clock::rep;
+
+    const std::size_t slotCount;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<SystemClockRep> started{0};
+    std::atomic<SteadyClockRep> startedSteady{0};
+    std::atomic<SystemClockRep> finished{0};
+
+    // Only readers take this; workers never wait for it
+    mutable std::mutex rateMutex;
+    mutable Rates rates;
+
+    void updateRates(BackupStats& stats, bool done) const {
+        using SteadyClock = std::chrono::steady_clock;
+        const auto now = SteadyClock::now();
+
+        std::lock_guard<std::mutex> lock(rateMutex);
+        if (!rates.measured) {
+            // Until the first window closes, the average since the start stands in
+            const auto start = SteadyClock::time_point(SteadyClock::duration(startedSteady.load(std::memory_order_relaxed)));
+            const double elapsed = std::chrono::duration<double>(now - start).count();
+            if (elapsed > 0.0) {
+                rates.filesPerSecond = stats.processedFiles / elapsed;
+                rates.bytesPerSecond = stats.processedSize / elapsed;
+            }
+        }
+        if (!done) {
+            if (now - rates.sampled >= rateWindow) {
+                const double seconds = std::chrono::duration<double>(now - rates.sampled).count();
+                const double files = (stats.processedFiles - rates.files) / seconds;
+                const double bytes = (stats.processedSize - rates.bytes) / seconds;
+                rates.filesPerSecond = rates.measured ? rateSmoothing * files + (1.0 - rateSmoothing) * rates.filesPerSecond : files;
+                rates.bytesPerSecond = rates.measured ? rateSmoothing * bytes + (1.0 - rateSmoothing) * rates.bytesPerSecond : bytes;
+                rates.sampled = now;
+                rates.files = stats.processedFiles;
+                rates.bytes = stats.processedSize;
+                rates.measured = true;
+            }
+        }
+
+        stats.filesPerSecond = rates.filesPerSecond;
+        stats.bytesPerSecond = rates.bytesPerSecond;
+        stats.remainingTime.reset();
+        if (done) {
+            stats.remainingTime = std::chrono::seconds(0);
+            return;
+        }
+
+        // Small files cost more than their bytes and large ones more than their count; trust the slower estimate
+        double remaining = -1.0;
+        if (stats.totalSize > stats.processedSize && rates.bytesPerSecond > 0.0) {
+            remaining = (stats.totalSize - stats.processedSize) / rates.bytesPerSecond;
+        }
+        if (stats.totalFiles > stats.processedFiles && rates.filesPerSecond > 0.0) {
+            remaining = std::max(remaining, (stats.totalFiles - stats.processedFiles) / rates.filesPerSecond);
+        }
+        if (remaining >= 0.0) {
+            stats.remainingTime = std::chrono::seconds(static_cast<std::int64_t>(remaining));
+        }
+    }
+};
+
+// StatsCounters implementation
+
+StatsCounters::StatsCounters(std::size_t slots) : pImpl(std::make_unique<Impl>(slots)) {
+}
+
+StatsCounters::~StatsCounters() = default;
+
+void StatsCounters::reset() {
+    pImpl->reset();
+}
+
+void StatsCounters::finish() {
+    pImpl->finish();
+}
+
+void StatsCounters::add(StatCounter counter, std::uint64_t amount) {
+    pImpl->update([counter, amount](std::atomic<std::uint64_t>* values) {
+        auto& value = values[index(counter)];
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    });
+}
+
+void StatsCounters::add(std::initializer_list<StatDelta> deltas) {
+    pImpl->update([deltas](std::atomic<std::uint64_t>* values) {
+        for (const auto& [counter, amount] : deltas) {
+            auto& value = values[index(counter)];
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+    });
+}
+
+StatsCounters::Values StatsCounters::snapshot() const {
+    return pImpl->snapshot();
+}
+
+std::uint64_t StatsCounters::value(StatCounter counter) const {
+    return pImpl->snapshot()[index(counter)];
+}
+
+void StatsCounters::fill(BackupStats& stats) const {
+    pImpl->fill(stats);
+}
+
+} // namespace utm
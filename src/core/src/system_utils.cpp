@@ -6,10 +6,19 @@
 #include <fstream>
 #include <thread>
 #include <array>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <mutex>
 
 #include <boost/process.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <sys/stat.h>
+#include <sys/sysmacros.h>  // For major, minor, makedev
 #include <pwd.h>     // For getpwuid
 #include <sys/statvfs.h>  // For statvfs
 #include <grp.h>     // For getgrgid
@@ -123,6 +132,162 @@ std::uintmax_t getAvailableSpace(const std::filesystem::path& path) {
     }
 }
 
+namespace {
+
+// Undo the octal escapes (\040 for a space) of /proc/self/mountinfo fields
+std::string unescapeMountField(const std::string& field) {
+    std::string result;
+    for (std::size_t i = 0; i < field.size(); i++) {
+        if (field[i] == '\\' && i + 3 < field.size()) {
+            result += static_cast<char>(std::stoi(field.substr(i + 1, 3), nullptr, 8));
+            i += 3;
+        } else {
+            result += field[i];
+        }
+    }
+    return result;
+}
+
+std::string readSysfsLine(const std::filesystem::path& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+// Disk (or array) whose request queue serves a block device, as its sysfs directory
+std::filesystem::path resolveDiskDirectory(dev_t device) {
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::canonical(
+        "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device)), ec);
+    if (ec) {
+        return {};
+    }
+
+    for (int depth = 0; depth < 8; depth++) {
+        if (std::filesystem::exists(dir / "partition", ec)) {
+            dir = dir.parent_path();
+        }
+
+        // LVM or dm-crypt on a single device is served by that device's disk
+        std::vector<std::filesystem::path> slaves;
+        for (std::filesystem::directory_iterator it(dir / "slaves", ec), end; !ec && it != end; it.increment(ec)) {
+            slaves.push_back(std::filesystem::canonical(it->path(), ec));
+        }
+        if (slaves.size() != 1 || dir.filename().string().rfind("dm-", 0) != 0) {
+            break;
+        }
+        dir = slaves.front();
+    }
+    return dir;
+}
+
+std::optional<std::string> findDiskLink(const std::filesystem::path& directory, const std::string& device) {
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code linkError;
+        if (std::filesystem::canonical(it->path(), linkError) == device && !linkError) {
+            return unescapeMountField(it->path().filename().string());
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+// Get information about the mountpoint holding a path
+std::optional<MountpointInfo> getMountpointInfo(const std::filesystem::path& path) {
+    try {
+        std::error_code ec;
+        std::filesystem::path target = std::filesystem::canonical(path, ec);
+        if (ec) {
+            return std::nullopt;
+        }
+
+        // The mount with the longest mountpoint containing the path; later mounts hide earlier ones
+        std::ifstream mountinfo("/proc/self/mountinfo");
+        std::string line;
+        std::optional<MountpointInfo> best;
+        std::string bestDeviceNumber;
+        while (std::getline(mountinfo, line)) {
+            std::istringstream fields(line);
+            std::string id, parent, deviceNumber, root, mountpoint, options, field;
+            fields >> id >> parent >> deviceNumber >> root >> mountpoint >> options;
+            while (fields >> field && field != "-") {
+            }
+            std::string fsType, source;
+            fields >> fsType >> source;
+
+            std::filesystem::path mountPath = unescapeMountField(mountpoint);
+            auto mismatch = std::mismatch(mountPath.begin(), mountPath.end(), target.begin(), target.end());
+            if (mismatch.first != mountPath.end() ||
+                (best && std::distance(mountPath.begin(), mountPath.end()) < std::distance(best->path.begin(), best->path.end()))) {
+                continue;
+            }
+
+            MountpointInfo info;
+            info.path = mountPath;
+            info.device = unescapeMountField(source);
+            info.fsType = fsType;
+            best = info;
+            bestDeviceNumber = deviceNumber;
+        }
+        if (!best) {
+            return std::nullopt;
+        }
+
+        MountpointInfo& info = *best;
+        static const std::vector<std::string> networkTypes = {
+            "nfs", "nfs4", "cifs", "smb3", "smbfs", "fuse.sshfs", "9p", "ceph", "glusterfs", "afs", "davfs"};
+        info.isNetworkMount = std::find(networkTypes.begin(), networkTypes.end(), info.fsType) != networkTypes.end();
+        info.isRemovable = false;
+
+        struct statvfs fsStat;
+        if (statvfs(target.c_str(), &fsStat) == 0) {
+            info.totalSpace = static_cast<uint64_t>(fsStat.f_blocks) * fsStat.f_frsize;
+            info.freeSpace = static_cast<uint64_t>(fsStat.f_bavail) * fsStat.f_frsize;
+        } else {
+            info.totalSpace = 0;
+            info.freeSpace = 0;
+        }
+
+        // The mount's device number, or for filesystems with anonymous device numbers (btrfs) the source device's
+        dev_t device = 0;
+        struct stat sourceStat;
+        if (info.device.rfind("/dev/", 0) == 0 && ::stat(info.device.c_str(), &sourceStat) == 0 && S_ISBLK(sourceStat.st_mode)) {
+            device = sourceStat.st_rdev;
+        } else {
+            unsigned int majorNumber = 0;
+            unsigned int minorNumber = 0;
+            if (std::sscanf(bestDeviceNumber.c_str(), "%u:%u", &majorNumber, &minorNumber) == 2 && majorNumber != 0) {
+                device = makedev(majorNumber, minorNumber);
+            }
+        }
+
+        if (device != 0 && !info.isNetworkMount) {
+            std::filesystem::path disk = resolveDiskDirectory(device);
+            if (!disk.empty()) {
+                info.physicalDevice = disk.filename().string();
+                info.isRotational = readSysfsLine(disk / "queue" / "rotational") == "1";
+                info.isRemovable = readSysfsLine(disk / "removable") == "1" || disk.string().find("/usb") != std::string::npos;
+            }
+
+            std::error_code linkError;
+            std::string devicePath = std::filesystem::canonical(info.device, linkError).string();
+            if (!linkError) {
+                info.label = findDiskLink("/dev/disk/by-label", devicePath);
+                info.uuid = findDiskLink("/dev/disk/by-uuid", devicePath);
+            }
+        }
+
+        return info;
+    }
+    catch (const std::exception& e) {
+        getLogger().error("Failed to get mountpoint information for " + path.string() + ": " + std::string(e.what()));
+        return std::nullopt;
+    }
+}
+
 // Execute a command and return its output
 std::pair<int, std::string> executeCommandWithOutput(const std::string& command) {
     try {
@@ -312,6 +477,188 @@ SystemInfo getSystemInfo() {
     }
 }
 
+// Get the load averages
+std::tuple<double, double, double> getSystemLoad() {
+    double load[3] = {0.0, 0.0, 0.0};
+    if (::getloadavg(load, 3) != 3) {
+        getLogger().warning("Failed to read the system load");
+    }
+    return {load[0], load[1], load[2]};
+}
+
+// Parse one /proc/pressure file
+static bool readPressureStall(const char* path, PressureStall& stall) {
+    std::ifstream in(path);
+    std::string line;
+    bool found = false;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind, field;
+        fields >> kind;
+        bool some = kind == "some";
+        if (!some && kind != "full") {
+            continue;
+        }
+
+        while (fields >> field) {
+            if (field.starts_with("avg10=")) {
+                (some ? stall.someAvg10 : stall.fullAvg10) = std::strtod(field.c_str() + 6, nullptr);
+            } else if (field.starts_with("total=")) {
+                (some ? stall.someTotal : stall.fullTotal) = std::strtoull(field.c_str() + 6, nullptr, 10);
+            }
+        }
+        found = found || some;
+    }
+    return found;
+}
+
+// Get the pressure stall information
+std::optional<SystemPressure> getSystemPressure() {
+    SystemPressure pressure;
+    if (!readPressureStall("/proc/pressure/cpu", pressure.cpu) ||
+        !readPressureStall("/proc/pressure/io", pressure.io) ||
+        !readPressureStall("/proc/pressure/memory", pressure.memory)) {
+        return std::nullopt;
+    }
+    return pressure;
+}
+
+// Read cpu.pressure, io.pressure and memory.pressure of a cgroup
+static bool readCgroupPressure(const std::filesystem::path& dir, SystemPressure& pressure) {
+    return readPressureStall((dir / "cpu.pressure").c_str(), pressure.cpu) &&
+           readPressureStall((dir / "io.pressure").c_str(), pressure.io) &&
+           readPressureStall((dir / "memory.pressure").c_str(), pressure.memory);
+}
+
+// Get the pressure stall information of the cgroups outside the process's own
+std::optional<std::map<std::string, SystemPressure>> getOtherCgroupsPressure() {
+    // Where the unified hierarchy is mounted: /sys/fs/cgroup, or /sys/fs/cgroup/unified on hybrid systems
+    std::filesystem::path mountPoint;
+    std::ifstream mounts("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(mounts, line)) {
+        auto separator = line.find(" - ");
+        if (separator == std::string::npos || line.compare(separator + 3, 8, "cgroup2 ") != 0) {
+            continue;
+        }
+        std::istringstream fields(line.substr(0, separator));
+        std::string id, parent, device, root, target;
+        fields >> id >> parent >> device >> root >> target;
+        mountPoint = unescapeMountField(target);
+        break;
+    }
+
+    std::string cgroup;
+    std::ifstream membership("/proc/self/cgroup");
+    while (std::getline(membership, line)) {
+        if (line.starts_with("0::")) {
+            cgroup = line.substr(3);
+        }
+    }
+
+    if (mountPoint.empty() || cgroup.empty() || cgroup == "/") {
+        return std::nullopt;
+    }
+
+    // Each ancestor's other children cover a part of the tree the process is not in
+    std::map<std::string, SystemPressure> others;
+    std::error_code ec;
+    for (auto dir = mountPoint / std::filesystem::path(cgroup).relative_path();
+         dir != mountPoint && dir.has_relative_path(); dir = dir.parent_path()) {
+        for (const auto& entry : std::filesystem::directory_iterator(dir.parent_path(), ec)) {
+            SystemPressure pressure;
+            if (entry.path() != dir && entry.is_directory(ec) && readCgroupPressure(entry.path(), pressure)) {
+                others.emplace(entry.path().string(), pressure);
+            }
+        }
+    }
+    return others;
+}
+
+// Get the CPU usage since the previous call (or over a short sample on the first call)
+double getCpuUsage() {
+    auto readTimes = [](unsigned long long& busy, unsigned long long& total) {
+        std::ifstream stat("/proc/stat");
+        std::string cpu;
+        unsigned long long user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+        if (!(stat >> cpu >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal) || cpu != "cpu") {
+            return false;
+        }
+        busy = user + nice + system + irq + softirq + steal;
+        total = busy + idle + iowait;
+        return true;
+    };
+
+    static std::mutex mutex;
+    static unsigned long long lastBusy = 0, lastTotal = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (lastTotal == 0) {
+        if (!readTimes(lastBusy, lastTotal)) {
+            getLogger().warning("Failed to read CPU times from /proc/stat");
+            return 0.0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    unsigned long long busy = 0, total = 0;
+    if (!readTimes(busy, total) || total <= lastTotal) {
+        return 0.0;
+    }
+    double usage = 100.0 * static_cast<double>(busy - lastBusy) / static_cast<double>(total - lastTotal);
+    lastBusy = busy;
+    lastTotal = total;
+    return std::clamp(usage, 0.0, 100.0);
+}
+
+// Check for a local session in use through the session files of logind
+bool isDesktopInUse() {
+    const std::filesystem::path sessionsDir = "/run/systemd/sessions";
+    std::error_code ec;
+    if (!std::filesystem::is_directory(sessionsDir, ec)) {
+        return false;
+    }
+
+    for (const auto& file : std::filesystem::directory_iterator(sessionsDir, ec)) {
+        if (file.path().extension() == ".ref") {
+            continue;
+        }
+
+        std::map<std::string, std::string> session;
+        std::ifstream in(file.path());
+        std::string line;
+        while (std::getline(in, line)) {
+            auto eq = line.find('=');
+            if (eq != std::string::npos) {
+                session[line.substr(0, eq)] = line.substr(eq + 1);
+            }
+        }
+
+        if (session["ACTIVE"] != "1" || session["REMOTE"] == "1" || session["STATE"] != "active") {
+            continue;
+        }
+
+        const std::string& type = session["TYPE"];
+        if (type == "x11" || type == "wayland" || type == "mir") {
+            // The idle hint is only published over D-Bus
+            auto [exitCode, output] = executeCommandWithOutput(
+                "loginctl show-session " + file.path().filename().string() + " -p IdleHint --value 2>/dev/null");
+            if (exitCode != 0 || boost::algorithm::trim_copy(output) != "yes") {
+                return true;
+            }
+        }
+        else if (type == "tty" && !session["TTY"].empty()) {
+            // The console's access time moves with every key press
+            struct stat st;
+            std::string tty = session["TTY"].front() == '/' ? session["TTY"] : "/dev/" + session["TTY"];
+            if (::stat(tty.c_str(), &st) == 0 && std::time(nullptr) - st.st_atime < 300) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 // Get hardware-specific information for backup verification
 std::string getHardwareIdentifier() {
     try {
@@ -0,0 +1,159 @@
+#include "utm/thread_pool.hpp"
+#include "utm/resource_governor.hpp"
+#include "utm/logging.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+namespace utm {
+
+// Implementation class for ThreadPool
+class ThreadPool::Impl {
+public:
+    Impl(std::size_t threadCount, bool jobScoped) : jobScoped(jobScoped) {
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        poolSize = threadCount;
+        workers.reserve(threadCount);
+        for (std::size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back(&Impl::workerLoop, this);
+        }
+    }
+
+    ~Impl() {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(Task task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        taskAvailable.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        allIdle.wait(lock, [this] { return tasks.empty() && running == 0; });
+    }
+
+    bool waitFor(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return allIdle.wait_for(lock, timeout, [this] { return tasks.empty() && running == 0; });
+    }
+
+    std::size_t discardPending() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t count = tasks.size();
+        tasks.clear();
+        if (running == 0) {
+            allIdle.notify_all();
+        }
+        return count;
+    }
+
+    std::size_t size() const noexcept {
+        return workers.size();
+    }
+
+private:
+    void workerLoop() {
+        if (jobScoped) {
+            getResourceGovernor().markJobThread();
+        }
+
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+                    if (tasks.empty()) {
+                        return; // stopping
+                    }
+
+                    // Over the CPU limit the governor lets only part of the pool run; the rest re-check shortly
+                    if (running < getResourceGovernor().activeWorkers(poolSize)) {
+                        break;
+                    }
+                    taskAvailable.wait_for(lock, std::chrono::milliseconds(100));
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                running++;
+            }
+
+            try {
+                task();
+            }
+            catch (const std::exception& e) {
+                getLogger().error("Unhandled exception in worker task: " + std::string(e.what()));
+            }
+            getResourceGovernor().throttle();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (tasks.empty() && running == 0) {
+                    allIdle.notify_all();
+                }
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable allIdle;
+    std::deque<Task> tasks;
+    std::vector<std::thread> workers;
+    std::size_t running = 0;
+    std::size_t poolSize = 0;
+    bool jobScoped = false;
+    bool stopping = false;
+};
+
+// ThreadPool implementation
+
+ThreadPool::ThreadPool(std::size_t threadCount, bool jobScoped) : pImpl(std::make_unique<Impl>(threadCount, jobScoped)) {
+}
+
+ThreadPool::~ThreadPool() = default;
+
+void ThreadPool::submit(Task task) {
+    pImpl->submit(std::move(task));
+}
+
+void ThreadPool::wait() {
+    pImpl->wait();
+}
+
+bool ThreadPool::waitFor(std::chrono::milliseconds timeout) {
+    return pImpl->waitFor(timeout);
+}
+
+std::size_t ThreadPool::discardPending() {
+    return pImpl->discardPending();
+}
+
+std::size_t ThreadPool::size() const noexcept {
+    return pImpl->size();
+}
+
+} // namespace utm
@@ -0,0 +1,356 @@
+#include "utm/trash_collector.hpp"
+#include "utm/dir_handle.hpp"
+#include "utm/thread_pool.hpp"
+#include "utm/logging.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utm {
+
+using fs::FileHandle;
+using fs::FileStat;
+
+namespace {
+
+// Unlinks are paid for in batches to keep the throttle off the hot path
+constexpr std::size_t throttleBatch = 64;
+
+// Shared token bucket: callers sleep until their batch fits the rate
+class Throttle {
+public:
+    explicit Throttle(std::size_t perSecond) : perSecond(perSecond) {}
+
+    void acquire(std::size_t count) {
+        if (perSecond == 0) {
+            return;
+        }
+
+        std::chrono::steady_clock::time_point until;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto now = std::chrono::steady_clock::now();
+            if (next < now) {
+                next = now;
+            }
+            until = next;
+            next += std::chrono::nanoseconds(count * 1000000000ULL / perSecond);
+        }
+        std::this_thread::sleep_until(until);
+    }
+
+private:
+    std::size_t perSecond;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point next;
+};
+
+// A directory being deleted. It is removed once its own entries and all of
+// its subdirectories are gone; the last one to finish removes it.
+struct DirectoryNode {
+    std::string path;                                   // relative to the trash directory
+    std::shared_ptr<DirectoryNode> parent;
+    std::atomic<std::size_t> pending{1};                // own scan + unfinished subdirectories
+};
+
+} // namespace
+
+// Implementation class for TrashCollector
+class TrashCollector::Impl {
+public:
+    explicit Impl(const TrashOptions& options)
+        : pool(static_cast<std::size_t>(std::max(1, options.threadCount))),
+          throttle(options.maxUnlinksPerSecond) {}
+
+    ~Impl() {
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            shuttingDown = true;
+        }
+        queueChanged.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void schedule(const std::filesystem::path& destination) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            for (const auto& queued : queue) {
+                if (queued == destination) {
+                    return;
+                }
+            }
+            queue.push_back(destination);
+
+            if (!worker.joinable()) {
+                worker = std::thread(&Impl::workerFunction, this);
+            }
+        }
+        queueChanged.notify_all();
+    }
+
+    bool collect(const std::filesystem::path& destination) {
+        std::lock_guard<std::mutex> lock(collectMutex);
+        const std::size_t generation = stopGeneration.load();
+
+        std::filesystem::path trashDir = destination / "backups" / TRASH_DIR;
+        FileHandle root = fs::openDirectoryAt(AT_FDCWD, trashDir.c_str());
+        if (!root.valid()) {
+            if (errno == ENOENT) {
+                return true;
+            }
+            getLogger().error("Failed to open trash " + trashDir.string() + ": " + std::strerror(errno));
+            return false;
+        }
+
+        const std::size_t failedBefore = failedEntries.load();
+        const std::size_t removedBefore = removedEntries.load();
+        auto start = std::chrono::steady_clock::now();
+
+        rootFd = root.get();
+        currentGeneration = generation;
+        pool.submit([this, node = std::make_shared<DirectoryNode>()] { removeDirectory(node); });
+        pool.wait();
+        rootFd = -1;
+
+        const bool interrupted = stopGeneration.load() != generation;
+        const std::size_t removed = removedEntries.load() - removedBefore;
+        const std::size_t failed = failedEntries.load() - failedBefore;
+        if (removed > 0 || failed > 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            getLogger().info("Removed " + std::to_string(removed) + " trashed entries from " + trashDir.string() +
+                             " in " + std::to_string(elapsed.count()) + " ms" +
+                             (interrupted ? " (interrupted, will resume)" : "") +
+                             (failed > 0 ? ", " + std::to_string(failed) + " failed" : ""));
+        }
+        return !interrupted && failed == 0;
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [this] { return queue.empty() && !busy; });
+    }
+
+    void stop() {
+        stopGeneration++;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.clear();
+        }
+        pool.discardPending();
+        queueChanged.notify_all();
+    }
+
+    TrashStats getStats() const {
+        TrashStats stats;
+        stats.removedEntries = removedEntries.load();
+        stats.removedSnapshots = removedSnapshots.load();
+        stats.failedEntries = failedEntries.load();
+        return stats;
+    }
+
+private:
+    ThreadPool pool;
+    Throttle throttle;
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<std::filesystem::path> queue;
+    std::thread worker;
+    bool busy = false;
+    bool shuttingDown = false;
+
+    // State of the collection in progress; one destination at a time
+    std::mutex collectMutex;
+    int rootFd = -1;
+    std::size_t currentGeneration = 0;
+    std::atomic<std::size_t> stopGeneration{0};
+
+    std::atomic<std::size_t> removedEntries{0};
+    std::atomic<std::size_t> removedSnapshots{0};
+    std::atomic<std::size_t> failedEntries{0};
+
+    void workerFunction() {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while (true) {
+            queueChanged.wait(lock, [this] { return shuttingDown || !queue.empty(); });
+            if (shuttingDown) {
+                return;
+            }
+
+            std::filesystem::path destination = queue.front();
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+
+            collect(destination);
+
+            lock.lock();
+            busy = false;
+            queueChanged.notify_all();
+        }
+    }
+
+    bool stopped() const {
+        return stopGeneration.load() != currentGeneration;
+    }
+
+    // Delete the entries of one directory; subdirectories become tasks of their own
+    void removeDirectory(const std::shared_ptr<DirectoryNode>& node) {
+        if (stopped()) {
+            return;
+        }
+
+        const char* path = node->path.empty() ? "." : node->path.c_str();
+        FileHandle dirFd = fs::openAt(rootFd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        int streamFd = dirFd.valid() ? ::fcntl(dirFd.get(), F_DUPFD_CLOEXEC, 0) : -1;
+        DIR* dir = streamFd >= 0 ? ::fdopendir(streamFd) : nullptr;
+        if (!dir) {
+            if (streamFd >= 0) {
+                ::close(streamFd);
+            }
+            failed(node->path, "open");
+            return;
+        }
+
+        std::size_t unlinked = 0;
+        while (struct dirent* entry = ::readdir(dir)) {
+            const char* name = entry->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            bool isDirectory = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN) {
+                FileStat st;
+                isDirectory = fs::statAt(dirFd.get(), name, st, false) && S_ISDIR(st.mode);
+            }
+
+            if (isDirectory) {
+                auto child = std::make_shared<DirectoryNode>();
+                child->path = node->path.empty() ? std::string(name) : node->path + "/" + name;
+                child->parent = node;
+                node->pending++;
+                pool.submit([this, child] { removeDirectory(child); });
+                continue;
+            }
+
+            if (++unlinked % throttleBatch == 0) {
+                throttle.acquire(throttleBatch);
+                if (stopped()) {
+                    break;
+                }
+            }
+            if (::unlinkat(dirFd.get(), name, 0) == 0) {
+                removedEntries++;
+            } else if (errno != ENOENT) {
+                failed(node->path + "/" + name, "remove");
+            }
+        }
+        ::closedir(dir);
+
+        finish(node);
+    }
+
+    // Remove a directory once nothing below it is left, then tell its parent
+    void finish(std::shared_ptr<DirectoryNode> node) {
+        while (node && --node->pending == 0) {
+            if (stopped() || !node->parent) {
+                return;
+            }
+
+            // Trashed snapshots are the top-level directories of the trash
+            if (::unlinkat(rootFd, node->path.c_str(), AT_REMOVEDIR) == 0) {
+                removedEntries++;
+                if (!node->parent->parent) {
+                    removedSnapshots++;
+                }
+            } else if (errno != ENOENT) {
+                failed(node->path, "remove");
+            }
+            node = node->parent;
+        }
+    }
+
+    void failed(const std::string& path, const char* operation) {
+        // Only the first failure is logged; the count tells the rest
+        if (failedEntries++ == 0) {
+            getLogger().error("Failed to " + std::string(operation) + " trashed entry " + path + ": " + std::strerror(errno));
+        }
+    }
+};
+
+// TrashCollector implementation
+
+TrashCollector::TrashCollector(const TrashOptions& options) : pImpl(std::make_unique<Impl>(options)) {
+}
+
+TrashCollector::~TrashCollector() = default;
+
+bool TrashCollector::moveToTrash(const std::filesystem::path& snapshotDir) {
+    std::filesystem::path backupsDir = snapshotDir.parent_path();
+    std::string name = snapshotDir.filename().string();
+
+    FileHandle backups = fs::openDirectoryAt(AT_FDCWD, backupsDir.c_str());
+    if (!backups.valid() || !fs::mkdirAt(backups.get(), TRASH_DIR, 0700)) {
+        getLogger().error("Failed to create trash in " + backupsDir.string() + ": " + std::strerror(errno));
+        return false;
+    }
+    FileHandle trash = fs::openDirectoryAt(backups.get(), TRASH_DIR);
+    if (!trash.valid()) {
+        getLogger().error("Failed to open trash in " + backupsDir.string() + ": " + std::strerror(errno));
+        return false;
+    }
+
+    // A snapshot of the same name may still be waiting in the trash
+    std::string trashName = name;
+    for (int attempt = 1; ; attempt++) {
+        if (::renameat2(backups.get(), name.c_str(), trash.get(), trashName.c_str(), RENAME_NOREPLACE) == 0) {
+            return true;
+        }
+        if (errno != EEXIST || attempt > 1000) {
+            break;
+        }
+        trashName = name + "." + std::to_string(attempt);
+    }
+
+    getLogger().error("Failed to move " + snapshotDir.string() + " to the trash: " + std::strerror(errno));
+    return false;
+}
+
+void TrashCollector::schedule(const std::filesystem::path& destination) {
+    pImpl->schedule(destination);
+}
+
+bool TrashCollector::collect(const std::filesystem::path& destination) {
+    return pImpl->collect(destination);
+}
+
+void TrashCollector::wait() {
+    pImpl->wait();
+}
+
+void TrashCollector::stop() {
+    pImpl->stop();
+}
+
+TrashStats TrashCollector::getStats() const {
+    return pImpl->getStats();
+}
+
+} // namespace utm
@@ -0,0 +1,165 @@
+#define BOOST_TEST_MODULE BackupJournal
+#include <boost/test/unit_test.hpp>
+
+#include "scratch_dir.hpp"
+#include "utm/backup_engine.hpp"
+#include "utm/backup_journal.hpp"
+#include "utm/filesystem_utils.hpp"
+#include "utm/logging.hpp"
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using utm::BackupJournal;
+using utm::BackupStatus;
+using utm::JournalHeader;
+using utm::SubtreeTotals;
+using utm::test::ScratchDir;
+using utm::test::readFile;
+using utm::test::writeFile;
+
+namespace {
+
+struct QuietLog {
+    QuietLog() { utm::getLogger().setConsoleLevel(utm::LogLevel::CRITICAL); }
+};
+BOOST_GLOBAL_FIXTURE(QuietLog);
+
+// Journal a finished subtree and checkpoint it, as the backup walk does
+void checkpointSubtree(BackupJournal& journal, const std::filesystem::path& stagingDir, std::string_view relative,
+                       const SubtreeTotals& totals) {
+    journal.complete(0, relative, totals);
+    int fd = ::open(stagingDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    BOOST_REQUIRE(fd >= 0);
+    BOOST_TEST(journal.checkpoint(fd));
+    ::close(fd);
+}
+
+// Run a backup to the end
+BackupStatus runBackup(const ScratchDir& scratch, utm::BackupConfig config) {
+    utm::BackupEngine engine;
+    BOOST_REQUIRE(engine.initialize(scratch / "metadata"));
+    config.verifyBackup = false;
+    BOOST_REQUIRE(engine.startBackup(config, nullptr));
+    for (;;) {
+        BackupStatus status = engine.getStatus();
+        if (status == BackupStatus::COMPLETED || status == BackupStatus::FAILED || status == BackupStatus::CANCELLED) {
+            return status;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(only_checkpointed_subtrees_survive_a_session) {
+    ScratchDir scratch;
+    const auto staging = BackupJournal::stagingDirectory(scratch / "backups", {"/home/user"});
+    BOOST_TEST(staging.filename().string().rfind(BackupJournal::STAGING_PREFIX, 0) == 0u);
+    std::filesystem::create_directories(staging);
+
+    JournalHeader header;
+    header.started = std::chrono::system_clock::now();
+    header.catalogSession = 7;
+    header.excludePatterns = {"*.tmp", "cache/"};
+    {
+        BackupJournal journal;
+        BOOST_REQUIRE(journal.open(staging));
+        BOOST_TEST(!journal.previous());
+        BOOST_REQUIRE(journal.start(header));
+        BOOST_TEST(!journal.resuming());
+
+        checkpointSubtree(journal, staging, "docs", {3, 300, 1, 1, 1, 0});
+        journal.complete(0, "music", {9, 900, 9, 0, 0, 0});
+    }
+
+    BackupJournal journal;
+    BOOST_REQUIRE(journal.open(staging));
+    BOOST_REQUIRE(journal.previous());
+    BOOST_TEST(journal.previous()->catalogSession == 7);
+    BOOST_TEST(journal.previous()->excludePatterns == header.excludePatterns, boost::test_tools::per_element());
+    BOOST_TEST(journal.resuming());
+
+    auto docs = journal.completed(0, "docs");
+    BOOST_REQUIRE(docs);
+    BOOST_TEST(docs->files == 3u);
+    BOOST_TEST(docs->size == 300u);
+    BOOST_TEST(docs->unchangedFiles == 1u);
+    BOOST_TEST(!journal.completed(0, "music"));
+    BOOST_TEST(!journal.completed(1, "docs"));
+
+    // Starting over forgets the earlier session
+    BOOST_REQUIRE(journal.start(header));
+    BOOST_TEST(!journal.completed(0, "docs"));
+}
+
+BOOST_AUTO_TEST_CASE(one_backup_at_a_time_per_staging_directory) {
+    ScratchDir scratch;
+    const auto staging = BackupJournal::stagingDirectory(scratch / "backups", {"/data"});
+    std::filesystem::create_directories(staging);
+
+    BackupJournal first;
+    BOOST_REQUIRE(first.open(staging));
+    BackupJournal second;
+    BOOST_TEST(!second.open(staging));
+
+    first.close();
+    BOOST_TEST(second.open(staging));
+}
+
+BOOST_AUTO_TEST_CASE(a_resumed_backup_skips_checkpointed_subtrees) {
+    ScratchDir scratch;
+    writeFile(scratch / "source/done/a.txt", "a");
+    writeFile(scratch / "source/todo/b.txt", "b");
+
+    utm::BackupConfig config;
+    config.sourcePaths = {scratch / "source"};
+    config.destinationPath = scratch / "dest";
+
+    // What an interrupted backup left: "done" is in the journal, with a file the source no longer has
+    const auto staging = BackupJournal::stagingDirectory(scratch / "dest/backups", config.sourcePaths);
+    writeFile(staging / "done/a.txt", "a");
+    writeFile(staging / "done/from-before.txt", "kept");
+    {
+        BackupJournal journal;
+        BOOST_REQUIRE(journal.open(staging));
+        JournalHeader header;
+        header.started = std::chrono::system_clock::now() - std::chrono::minutes(5);
+        BOOST_REQUIRE(journal.start(header));
+        checkpointSubtree(journal, staging, "done", {2, 5, 2, 0, 0, 0});
+    }
+
+    BOOST_REQUIRE((runBackup(scratch, config) == BackupStatus::COMPLETED));
+
+    // Published under its timestamp, with the staging directory and journal gone
+    const auto backups = utm::BackupEngine().listBackups(config.destinationPath);
+    BOOST_REQUIRE(backups.size() == 1u);
+    const auto snapshot = utm::fs::getBackupPath(config.destinationPath, backups.front());
+    BOOST_TEST(!std::filesystem::exists(staging));
+
+    BOOST_TEST(readFile(snapshot / "done/from-before.txt") == "kept");
+    BOOST_TEST(readFile(snapshot / "todo/b.txt") == "b");
+}
+
+BOOST_AUTO_TEST_CASE(publishing_never_replaces_a_snapshot) {
+    ScratchDir scratch;
+    writeFile(scratch / "source/a.txt", "new");
+
+    utm::BackupConfig config;
+    config.sourcePaths = {scratch / "source"};
+    config.destinationPath = scratch / "dest";
+
+    // Something already at every name the backup may publish under; a plain
+    // rename would replace an empty directory without complaint
+    const auto now = std::chrono::system_clock::now();
+    for (int second = -1; second < 30; second++) {
+        std::filesystem::create_directories(utm::fs::getBackupPath(config.destinationPath, now + std::chrono::seconds(second)));
+    }
+
+    BOOST_TEST((runBackup(scratch, config) == BackupStatus::FAILED));
+    for (int second = -1; second < 30; second++) {
+        BOOST_TEST(std::filesystem::is_empty(utm::fs::getBackupPath(config.destinationPath, now + std::chrono::seconds(second))));
+    }
+}
@@ -0,0 +1,129 @@
+#define BOOST_TEST_MODULE Scheduler
+#include <boost/test/unit_test.hpp>
+
+#include "scratch_dir.hpp"
+#include "utm/scheduler.hpp"
+#include <chrono>
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+
+using utm::BackupProfile;
+using utm::Scheduler;
+using utm::ScheduleConfig;
+using utm::ScheduleType;
+using Clock = std::chrono::system_clock;
+
+namespace {
+
+// Local time from its parts; CTest runs this test in UTC
+Clock::time_point at(int year, int month, int day, int hour, int minute) {
+    std::tm tm{};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_isdst = -1;
+    return Clock::from_time_t(std::mktime(&tm));
+}
+
+ScheduleConfig schedule(ScheduleType type, Clock::time_point start) {
+    ScheduleConfig config;
+    config.type = type;
+    config.startTime = start;
+    return config;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(hourly_and_daily_keep_the_start_time_of_day) {
+    const auto start = at(2024, 1, 1, 3, 30);
+
+    const ScheduleConfig hourly = schedule(ScheduleType::HOURLY, start);
+    BOOST_TEST((Scheduler::nextOccurrence(hourly, at(2024, 3, 10, 14, 10)) == at(2024, 3, 10, 14, 30)));
+    BOOST_TEST((Scheduler::nextOccurrence(hourly, at(2024, 3, 10, 14, 30)) == at(2024, 3, 10, 15, 30)));
+    BOOST_TEST((Scheduler::nextOccurrence(hourly, at(2024, 3, 10, 14, 45)) == at(2024, 3, 10, 15, 30)));
+
+    const ScheduleConfig daily = schedule(ScheduleType::DAILY, start);
+    BOOST_TEST((Scheduler::nextOccurrence(daily, at(2024, 3, 10, 2, 0)) == at(2024, 3, 10, 3, 30)));
+    BOOST_TEST((Scheduler::nextOccurrence(daily, at(2024, 3, 10, 3, 30)) == at(2024, 3, 11, 3, 30)));
+    BOOST_TEST((Scheduler::nextOccurrence(daily, at(2024, 12, 31, 23, 0)) == at(2025, 1, 1, 3, 30)));
+}
+
+BOOST_AUTO_TEST_CASE(weekly_and_monthly_pick_their_day) {
+    const auto start = at(2024, 1, 1, 22, 0);
+
+    // 2024-01-10 is a Wednesday
+    ScheduleConfig weekly = schedule(ScheduleType::WEEKLY, start);
+    weekly.dayOfWeek = 0;
+    BOOST_TEST((Scheduler::nextOccurrence(weekly, at(2024, 1, 10, 12, 0)) == at(2024, 1, 14, 22, 0)));
+    BOOST_TEST((Scheduler::nextOccurrence(weekly, at(2024, 1, 14, 22, 0)) == at(2024, 1, 21, 22, 0)));
+    weekly.dayOfWeek = 3;
+    BOOST_TEST((Scheduler::nextOccurrence(weekly, at(2024, 1, 10, 12, 0)) == at(2024, 1, 10, 22, 0)));
+
+    // The day is clamped to the length of the month
+    ScheduleConfig monthly = schedule(ScheduleType::MONTHLY, start);
+    monthly.dayOfMonth = 31;
+    BOOST_TEST((Scheduler::nextOccurrence(monthly, at(2024, 2, 1, 0, 0)) == at(2024, 2, 29, 22, 0)));
+    BOOST_TEST((Scheduler::nextOccurrence(monthly, at(2023, 2, 1, 0, 0)) == at(2023, 2, 28, 22, 0)));
+    BOOST_TEST((Scheduler::nextOccurrence(monthly, at(2024, 1, 31, 23, 0)) == at(2024, 2, 29, 22, 0)));
+}
+
+BOOST_AUTO_TEST_CASE(custom_intervals_count_from_the_start_time) {
+    ScheduleConfig custom = schedule(ScheduleType::CUSTOM, at(2024, 1, 1, 0, 0));
+    custom.interval = std::chrono::hours(6);
+
+    BOOST_TEST((Scheduler::nextOccurrence(custom, at(2023, 12, 31, 0, 0)) == at(2024, 1, 1, 0, 0)));
+    BOOST_TEST((Scheduler::nextOccurrence(custom, at(2024, 1, 1, 0, 0)) == at(2024, 1, 1, 6, 0)));
+    BOOST_TEST((Scheduler::nextOccurrence(custom, at(2024, 1, 1, 7, 0)) == at(2024, 1, 1, 12, 0)));
+}
+
+BOOST_AUTO_TEST_CASE(profiles_run_at_a_stable_jitter_after_their_schedule) {
+    utm::test::ScratchDir scratch;
+    const auto start = at(2024, 1, 1, 0, 0);
+
+    // A day-long custom interval from midnight: the jitter is what a run is past midnight
+    BackupProfile profile;
+    profile.destinationPath = scratch / "nothing-here";
+    profile.schedule = schedule(ScheduleType::CUSTOM, start);
+    profile.schedule.interval = std::chrono::hours(24);
+
+    Scheduler scheduler([](const BackupProfile&) { return true; });
+    std::vector<BackupProfile> profiles;
+    for (int i = 0; i < 20; i++) {
+        profile.name = "profile-" + std::to_string(i);
+        profiles.push_back(profile);
+    }
+
+    const auto before = Clock::now();
+    scheduler.setProfiles(profiles);
+
+    std::set<Clock::duration> offsets;
+    for (const auto& scheduled : profiles) {
+        const auto next = scheduler.nextRun(scheduled.name);
+        BOOST_REQUIRE(next);
+        BOOST_TEST((*next > before));
+        BOOST_TEST((*next - before <= std::chrono::hours(24) + std::chrono::minutes(15)));
+
+        // A twelfth of the period, capped at 15 minutes
+        const auto offset = (*next - start) % std::chrono::hours(24);
+        BOOST_TEST((offset < std::chrono::minutes(15)));
+        offsets.insert(offset);
+    }
+    BOOST_TEST(offsets.size() > 1u, "profiles sharing a schedule all start at the same moment");
+
+    // The same name gets the same jitter, in another scheduler too
+    Scheduler other([](const BackupProfile&) { return true; });
+    other.setProfiles(profiles);
+    for (const auto& scheduled : profiles) {
+        BOOST_TEST((other.nextRun(scheduled.name) == scheduler.nextRun(scheduled.name)));
+    }
+
+    profile.name = "disabled";
+    profile.schedule.enabled = false;
+    scheduler.setProfiles({profile});
+    BOOST_TEST(!scheduler.nextRun("disabled"));
+    BOOST_TEST(!scheduler.nextRun("profile-0"));
+}
@@ -0,0 +1,61 @@
+// Scratch directory and file helpers shared by the tests.
+
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace utm::test {
+
+// Unique directory under the temporary directory, removed with everything in it
+class ScratchDir {
+public:
+    ScratchDir() {
+        std::string pattern = (std::filesystem::temp_directory_path() / "utm-test-XXXXXX").string();
+        if (!::mkdtemp(pattern.data())) {
+            throw std::runtime_error("Failed to create a scratch directory");
+        }
+        root = pattern;
+    }
+
+    ~ScratchDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(root, ec);
+    }
+
+    ScratchDir(const ScratchDir&) = delete;
+    ScratchDir& operator=(const ScratchDir&) = delete;
+
+    const std::filesystem::path& path() const noexcept { return root; }
+
+    std::filesystem::path operator/(const std::filesystem::path& relative) const { return root / relative; }
+
+private:
+    std::filesystem::path root;
+};
+
+// Write a file, creating its parent directories
+inline void writeFile(const std::filesystem::path& path, std::string_view content) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+// Write a file with a given modification time
+inline void writeFile(const std::filesystem::path& path, std::string_view content,
+                      std::filesystem::file_time_type modified) {
+    writeFile(path, content);
+    std::filesystem::last_write_time(path, modified);
+}
+
+inline std::string readFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+} // namespace utm::test
@@ -0,0 +1,113 @@
+#define BOOST_TEST_MODULE SnapshotDiff
+#include <boost/test/unit_test.hpp>
+
+#include "scratch_dir.hpp"
+#include "utm/snapshot_diff.hpp"
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+using utm::DiffChange;
+using utm::DiffEntry;
+using utm::SnapshotIndex;
+using utm::test::ScratchDir;
+using utm::test::writeFile;
+
+namespace {
+
+// Changes reported by a diff, keyed by path
+struct Diff {
+    std::map<std::string, DiffEntry> entries;
+    utm::DiffSummary summary;
+};
+
+Diff diff(const std::filesystem::path& from, const std::filesystem::path& to) {
+    BOOST_REQUIRE(SnapshotIndex::build(from));
+    BOOST_REQUIRE(SnapshotIndex::build(to));
+    auto fromIndex = SnapshotIndex::open(from, false);
+    auto toIndex = SnapshotIndex::open(to, false);
+    BOOST_REQUIRE(fromIndex && toIndex);
+
+    Diff result;
+    result.summary = utm::diffSnapshots(*fromIndex, *toIndex, [&result](const DiffEntry& entry) {
+        BOOST_TEST(result.entries.emplace(entry.path, entry).second, "reported twice: " << entry.path);
+    });
+    return result;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(reports_added_removed_and_modified_entries) {
+    ScratchDir from, to;
+    const auto time = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    writeFile(from / "same.txt", "same", time);
+    writeFile(to / "same.txt", "same", time);
+    writeFile(from / "grown.txt", "short", time);
+    writeFile(to / "grown.txt", "much longer", time);
+    writeFile(from / "gone.txt", "", time);
+    writeFile(to / "new.txt", "", time);
+
+    const Diff result = diff(from.path(), to.path());
+    BOOST_TEST(result.entries.size() == 3u);
+    BOOST_TEST(!result.entries.count("same.txt"));
+
+    BOOST_REQUIRE(result.entries.count("grown.txt"));
+    const DiffEntry& grown = result.entries.at("grown.txt");
+    BOOST_TEST((grown.change == DiffChange::MODIFIED));
+    BOOST_TEST(grown.oldSize == 5u);
+    BOOST_TEST(grown.newSize == 11u);
+
+    // Empty files are never paired into renames
+    BOOST_REQUIRE(result.entries.count("gone.txt") && result.entries.count("new.txt"));
+    BOOST_TEST((result.entries.at("gone.txt").change == DiffChange::REMOVED));
+    BOOST_TEST((result.entries.at("new.txt").change == DiffChange::ADDED));
+
+    BOOST_TEST(result.summary.modifiedEntries == 1u);
+    BOOST_TEST(result.summary.addedEntries == 1u);
+    BOOST_TEST(result.summary.removedEntries == 1u);
+    BOOST_TEST(result.summary.growthBytes == 6);
+}
+
+BOOST_AUTO_TEST_CASE(pairs_moved_files_into_renames) {
+    ScratchDir from, to;
+    const auto time = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    writeFile(from / "old/report.pdf", "0123456789", time);
+    writeFile(to / "new/report-final.pdf", "0123456789", time);
+
+    // Same size, other modification time: not the same file
+    writeFile(from / "draft.txt", "draft", time);
+    writeFile(to / "notes.txt", "notes", time + std::chrono::seconds(5));
+
+    const Diff result = diff(from.path(), to.path());
+
+    BOOST_REQUIRE(result.entries.count("new/report-final.pdf"));
+    const DiffEntry& renamed = result.entries.at("new/report-final.pdf");
+    BOOST_TEST((renamed.change == DiffChange::RENAMED));
+    BOOST_TEST(renamed.previousPath == "old/report.pdf");
+    BOOST_TEST(renamed.newSize == 10u);
+    BOOST_TEST(!result.entries.count("old/report.pdf"));
+
+    BOOST_REQUIRE(result.entries.count("draft.txt") && result.entries.count("notes.txt"));
+    BOOST_TEST((result.entries.at("draft.txt").change == DiffChange::REMOVED));
+    BOOST_TEST((result.entries.at("notes.txt").change == DiffChange::ADDED));
+
+    // The directories themselves come and go
+    BOOST_REQUIRE(result.entries.count("old") && result.entries.count("new"));
+    BOOST_TEST((result.entries.at("old").change == DiffChange::REMOVED));
+    BOOST_TEST((result.entries.at("new").change == DiffChange::ADDED));
+
+    BOOST_TEST(result.summary.renamedEntries == 1u);
+    BOOST_TEST(result.summary.renamedBytes == 10u);
+    BOOST_TEST(result.summary.growthBytes == 0);
+}
+
+BOOST_AUTO_TEST_CASE(hard_linked_files_are_unchanged) {
+    ScratchDir from, to;
+    writeFile(from / "linked.bin", "contents");
+    std::filesystem::create_hard_link(from / "linked.bin", to / "linked.bin");
+
+    const Diff result = diff(from.path(), to.path());
+    BOOST_TEST(result.entries.empty());
+    BOOST_TEST(result.summary.growthBytes == 0);
+}
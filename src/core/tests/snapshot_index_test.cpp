@@ -0,0 +1,115 @@
+#define BOOST_TEST_MODULE SnapshotIndex
+#include <boost/test/unit_test.hpp>
+
+#include "scratch_dir.hpp"
+#include "utm/snapshot_index.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using utm::SnapshotIndex;
+using utm::test::ScratchDir;
+using utm::test::writeFile;
+
+namespace {
+
+std::vector<std::string> names(const SnapshotIndex& index, std::size_t directory) {
+    std::vector<std::string> result;
+    for (std::size_t i = 0; i < index.entryCount(directory); i++) {
+        result.emplace_back(index.entry(directory, i).name);
+    }
+    return result;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(build_sorts_directories_and_entries) {
+    ScratchDir snapshot;
+    writeFile(snapshot / "b.txt", "bb");
+    writeFile(snapshot / "a.txt", "a");
+    writeFile(snapshot / "docs/z.md", "z");
+    writeFile(snapshot / "docs/m.md", "mm");
+    std::filesystem::create_directories(snapshot / "empty");
+
+    BOOST_REQUIRE(SnapshotIndex::build(snapshot.path()));
+    BOOST_REQUIRE(std::filesystem::exists(snapshot / SnapshotIndex::FILE_NAME));
+
+    auto index = SnapshotIndex::open(snapshot.path(), false);
+    BOOST_REQUIRE(index);
+    BOOST_TEST(index->directoryCount() == 3u);
+    BOOST_TEST(index->totalEntries() == 6u);
+
+    auto root = index->findDirectory("");
+    BOOST_REQUIRE(root);
+    BOOST_TEST(names(*index, *root) == std::vector<std::string>({"a.txt", "b.txt", "docs", "empty"}),
+               boost::test_tools::per_element());
+
+    auto docs = index->findDirectory("docs");
+    BOOST_REQUIRE(docs);
+    BOOST_TEST(index->directoryPath(*docs) == "docs");
+    BOOST_TEST(names(*index, *docs) == std::vector<std::string>({"m.md", "z.md"}), boost::test_tools::per_element());
+
+    const SnapshotIndex::Entry m = index->entry(*docs, 0);
+    BOOST_TEST(S_ISREG(m.mode));
+    BOOST_TEST(m.size == 2u);
+
+    auto empty = index->findDirectory("empty");
+    BOOST_REQUIRE(empty);
+    BOOST_TEST(index->entryCount(*empty) == 0u);
+    BOOST_TEST(!index->findDirectory("missing"));
+}
+
+BOOST_AUTO_TEST_CASE(seek_after_pages_through_a_directory) {
+    ScratchDir snapshot;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 25; i++) {
+        std::string name = "file" + std::string(i < 10 ? "0" : "") + std::to_string(i);
+        writeFile(snapshot / name, name);
+        expected.push_back(name);
+    }
+    BOOST_REQUIRE(SnapshotIndex::build(snapshot.path()));
+    auto index = SnapshotIndex::open(snapshot.path(), false);
+    BOOST_REQUIRE(index);
+    const std::size_t root = *index->findDirectory("");
+
+    BOOST_TEST(index->seekAfter(root, "") == 0u);
+    BOOST_TEST(index->seekAfter(root, "file00") == 1u);
+    BOOST_TEST(index->seekAfter(root, "file045") == 5u);
+    BOOST_TEST(index->seekAfter(root, "zzz") == index->entryCount(root));
+
+    // Pages of 10 resumed from the last name seen, as the browsing API does
+    std::vector<std::string> seen;
+    std::string last;
+    int pages = 0;
+    for (;;) {
+        std::size_t position = index->seekAfter(root, last);
+        if (position == index->entryCount(root)) {
+            break;
+        }
+        for (std::size_t end = std::min(position + 10, index->entryCount(root)); position < end; position++) {
+            seen.emplace_back(index->entry(root, position).name);
+        }
+        last = seen.back();
+        pages++;
+    }
+    BOOST_TEST(pages == 3);
+    BOOST_TEST(seen == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(open_builds_a_missing_index_of_a_complete_snapshot) {
+    ScratchDir snapshot;
+    writeFile(snapshot / "a.txt", "a");
+
+    // Without its metadata the snapshot is still being written
+    BOOST_TEST(!SnapshotIndex::open(snapshot.path(), true));
+    BOOST_TEST(!std::filesystem::exists(snapshot / SnapshotIndex::FILE_NAME));
+
+    writeFile(snapshot / "backup-info.json", "{}");
+    BOOST_TEST(!SnapshotIndex::open(snapshot.path(), false));
+    auto index = SnapshotIndex::open(snapshot.path(), true);
+    BOOST_REQUIRE(index);
+    BOOST_TEST(names(*index, *index->findDirectory("")) == std::vector<std::string>({"a.txt"}),
+               boost::test_tools::per_element());
+}
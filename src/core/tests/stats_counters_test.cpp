@@ -0,0 +1,84 @@
+#define BOOST_TEST_MODULE StatsCounters
+#include <boost/test/unit_test.hpp>
+
+#include "utm/backup_engine.hpp"
+#include "utm/stats_counters.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using utm::StatCounter;
+using utm::StatsCounters;
+
+namespace {
+
+constexpr int writers = 6;
+constexpr std::uint64_t filesPerWriter = 200000;
+constexpr std::uint64_t fileSize = 4096;
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(counts_add_up_and_reset) {
+    StatsCounters counters(4);
+    counters.reset();
+    counters.add(StatCounter::TOTAL_FILES, 3);
+    counters.add(StatCounter::TOTAL_FILES);
+    counters.add({{StatCounter::PROCESSED_FILES, 2}, {StatCounter::PROCESSED_SIZE, 2048}});
+
+    BOOST_TEST(counters.value(StatCounter::TOTAL_FILES) == 4u);
+    const StatsCounters::Values values = counters.snapshot();
+    BOOST_TEST(values[static_cast<std::size_t>(StatCounter::PROCESSED_FILES)] == 2u);
+    BOOST_TEST(values[static_cast<std::size_t>(StatCounter::PROCESSED_SIZE)] == 2048u);
+
+    utm::BackupStats stats;
+    counters.fill(stats);
+    BOOST_TEST(stats.totalFiles == 4u);
+    BOOST_TEST(stats.processedFiles == 2u);
+    BOOST_TEST(stats.processedSize == 2048u);
+
+    counters.reset();
+    BOOST_TEST(counters.value(StatCounter::TOTAL_FILES) == 0u);
+}
+
+// More writers than slots, so slots are shared; every snapshot must see each
+// file together with its bytes, and the totals must come out exact
+BOOST_AUTO_TEST_CASE(readers_see_whole_updates_while_writers_run) {
+    StatsCounters counters(2);
+    counters.reset();
+
+    std::atomic<bool> writing{true};
+    std::atomic<std::uint64_t> torn{0};
+    std::atomic<std::uint64_t> reads{0};
+    std::thread reader([&] {
+        std::uint64_t lastFiles = 0;
+        while (writing.load()) {
+            const StatsCounters::Values values = counters.snapshot();
+            const std::uint64_t files = values[static_cast<std::size_t>(StatCounter::PROCESSED_FILES)];
+            const std::uint64_t size = values[static_cast<std::size_t>(StatCounter::PROCESSED_SIZE)];
+            if (size != files * fileSize || files < lastFiles) {
+                torn++;
+            }
+            lastFiles = files;
+            reads++;
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < writers; i++) {
+        threads.emplace_back([&counters] {
+            for (std::uint64_t n = 0; n < filesPerWriter; n++) {
+                counters.add({{StatCounter::PROCESSED_FILES, 1}, {StatCounter::PROCESSED_SIZE, fileSize}});
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    writing = false;
+    reader.join();
+
+    BOOST_TEST(reads.load() > 0u);
+    BOOST_TEST(torn.load() == 0u);
+    BOOST_TEST(counters.value(StatCounter::PROCESSED_FILES) == writers * filesPerWriter);
+    BOOST_TEST(counters.value(StatCounter::PROCESSED_SIZE) == writers * filesPerWriter * fileSize);
+}
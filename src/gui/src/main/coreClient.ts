@@ -0,0 +1,234 @@
+import { EventEmitter } from 'events';
+import * as net from 'net';
+import * as os from 'os';
+import * as path from 'path';
+import * as childProcess from 'child_process';
+import * as electronLog from 'electron-log';
+
+/**
+ * Client of the core daemon's control socket
+ *
+ * Every message is a 32-bit little-endian length followed by that many bytes
+ * of JSON. Requests get one response each; events of the topics the client
+ * subscribed to arrive as `{event, key, data}` and are emitted as 'event'.
+ * The client starts the daemon if nobody listens on the socket and
+ * reconnects (and resubscribes) when the connection drops.
+ */
+
+interface PendingRequest {
+  resolve: (result: any) => void;
+  reject: (error: Error) => void;
+}
+
+const RECONNECT_DELAY_MS = 1000;
+const DAEMON_START_TIMEOUT_MS = 5000;
+
+/**
+ * Socket path used by the daemon; mirrors ControlServer::defaultSocketPath()
+ */
+export function defaultSocketPath(): string {
+  const runtimeDir = process.env.XDG_RUNTIME_DIR;
+  if (runtimeDir) {
+    return path.join(runtimeDir, 'ubuntu-time-machine.sock');
+  }
+  const dataHome = process.env.XDG_DATA_HOME || path.join(os.homedir(), '.local', 'share');
+  return path.join(dataHome, 'ubuntu-time-machine', 'core.sock');
+}
+
+export class CoreClient extends EventEmitter {
+  private socket: net.Socket | null = null;
+  private buffer = Buffer.alloc(0);
+  private nextId = 1;
+  private pending = new Map<number, PendingRequest>();
+  private topics = new Set<string>();
+  private connecting: Promise<void> | null = null;
+  private reconnectTimer: NodeJS.Timeout | null = null;
+  private closed = false;
+  private daemonStarted = false;
+
+  constructor(private coreExecutablePath: string, private socketPath: string = defaultSocketPath()) {
+    super();
+  }
+
+  /**
+   * Send a request and wait for its response
+   */
+  async request(method: string, params: Record<string, string> = {}): Promise<any> {
+    await this.connect();
+    return this.send(method, params);
+  }
+
+  /**
+   * Receive the events of a topic, now and after every reconnect
+   */
+  async subscribe(topic: string): Promise<void> {
+    await this.request('subscribe', { topic });
+    this.topics.add(topic);
+  }
+
+  /**
+   * Disconnect for good
+   */
+  close() {
+    this.closed = true;
+    if (this.reconnectTimer) {
+      clearTimeout(this.reconnectTimer);
+      this.reconnectTimer = null;
+    }
+    if (this.socket) {
+      this.socket.destroy();
+      this.socket = null;
+    }
+  }
+
+  private connect(): Promise<void> {
+    if (this.socket) {
+      return Promise.resolve();
+    }
+    if (!this.connecting) {
+      this.connecting = this.open()
+        .finally(() => { this.connecting = null; });
+    }
+    return this.connecting;
+  }
+
+  private async open(): Promise<void> {
+    let socket: net.Socket;
+    try {
+      socket = await this.dial();
+    } catch (error) {
+      if (this.daemonStarted) {
+        throw error;
+      }
+      this.startDaemon();
+      socket = await this.dialUntil(Date.now() + DAEMON_START_TIMEOUT_MS);
+    }
+
+    electronLog.info(`Connected to core daemon at ${this.socketPath}`);
+    this.socket = socket;
+    this.daemonStarted = false;
+    this.buffer = Buffer.alloc(0);
+    socket.on('data', (chunk) => this.receive(chunk));
+    socket.on('close', () => this.disconnected(socket));
+    socket.on('error', (error) => electronLog.warn(`Core daemon connection error: ${error.message}`));
+
+    for (const topic of this.topics) {
+      this.send('subscribe', { topic }).catch((error) =>
+        electronLog.warn(`Failed to resubscribe to ${topic}: ${error.message}`));
+    }
+  }
+
+  private dial(): Promise<net.Socket> {
+    return new Promise((resolve, reject) => {
+      const socket = net.createConnection(this.socketPath);
+      socket.once('connect', () => {
+        socket.removeAllListeners('error');
+        resolve(socket);
+      });
+      socket.once('error', reject);
+    });
+  }
+
+  private async dialUntil(deadline: number): Promise<net.Socket> {
+    for (;;) {
+      try {
+        return await this.dial();
+      } catch (error) {
+        if (Date.now() >= deadline) {
+          throw error;
+        }
+        await new Promise((resolve) => setTimeout(resolve, 100));
+      }
+    }
+  }
+
+  private startDaemon() {
+    electronLog.info(`Starting core daemon: ${this.coreExecutablePath} --daemon`);
+    this.daemonStarted = true;
+    const daemon = childProcess.spawn(this.coreExecutablePath, ['--daemon', '--socket', this.socketPath], {
+      detached: true,
+      stdio: 'ignore',
+    });
+    daemon.on('error', (error) => electronLog.error(`Failed to start core daemon: ${error.message}`));
+    daemon.unref();
+  }
+
+  private send(method: string, params: Record<string, string>): Promise<any> {
+    const socket = this.socket;
+    if (!socket) {
+      return Promise.reject(new Error('Not connected to the core daemon'));
+    }
+    const id = this.nextId++;
+    const payload = Buffer.from(JSON.stringify({ id, method, params }), 'utf8');
+    const header = Buffer.alloc(4);
+    header.writeUInt32LE(payload.length, 0);
+
+    return new Promise((resolve, reject) => {
+      this.pending.set(id, { resolve, reject });
+      socket.write(Buffer.concat([header, payload]));
+    });
+  }
+
+  private receive(chunk: Buffer) {
+    this.buffer = this.buffer.length ? Buffer.concat([this.buffer, chunk]) : chunk;
+    while (this.buffer.length >= 4) {
+      const length = this.buffer.readUInt32LE(0);
+      if (this.buffer.length < 4 + length) {
+        break;
+      }
+      const frame = this.buffer.subarray(4, 4 + length).toString('utf8');
+      this.buffer = this.buffer.subarray(4 + length);
+
+      let message: any;
+      try {
+        message = JSON.parse(frame);
+      } catch (error) {
+        electronLog.warn(`Invalid message from core daemon: ${frame.substring(0, 100)}`);
+        continue;
+      }
+
+      if (message.event !== undefined) {
+        this.emit('event', message.event, message.key, message.data);
+        continue;
+      }
+      const request = this.pending.get(message.id);
+      if (!request) {
+        continue;
+      }
+      this.pending.delete(message.id);
+      if (message.error !== undefined) {
+        request.reject(new Error(message.error));
+      } else {
+        request.resolve(message.result);
+      }
+    }
+  }
+
+  private disconnected(socket: net.Socket) {
+    if (this.socket !== socket) {
+      return;
+    }
+    electronLog.warn('Disconnected from core daemon');
+    this.socket = null;
+    for (const request of this.pending.values()) {
+      request.reject(new Error('Connection to the core daemon was lost'));
+    }
+    this.pending.clear();
+
+    this.scheduleReconnect();
+  }
+
+  // Events only arrive while connected; the daemon may also have to be started again
+  private scheduleReconnect() {
+    if (this.closed || this.topics.size === 0 || this.reconnectTimer) {
+      return;
+    }
+    this.reconnectTimer = setTimeout(() => {
+      this.reconnectTimer = null;
+      this.connect().catch((error) => {
+        electronLog.warn(`Failed to reconnect to core daemon: ${error.message}`);
+        this.scheduleReconnect();
+      });
+    }, RECONNECT_DELAY_MS);
+  }
+}
@@ -3,6 +3,7 @@ import * as path from 'path';
 import * as fs from 'fs';
 import * as childProcess from 'child_process';
 import * as electronLog from 'electron-log';
+import { CoreClient } from './coreClient';
 
 // Configure logging
 electronLog.transports.console.level = 'debug';
@@ -13,6 +14,7 @@ electronLog.info('Application starting');
 let mainWindow: BrowserWindow | null = null;
 let tray: Tray | null = null;
 let isQuitting = false;
+let coreClient: CoreClient | null = null;
 
 // Path to core binary
 const isDevelopment = process.env.NODE_ENV !== 'production';
@@ -193,6 +195,15 @@ app.whenReady().then(() => {
   }
   electronLog.info('Core binary verified');
 
+  // Talk to the core daemon over its control socket, starting it if needed
+  coreClient = new CoreClient(coreExecutablePath);
+  coreClient.on('event', (topic: string, key: string, data: any) => {
+    sendToRenderer('core-event', topic, key, data);
+  });
+  coreClient.subscribe('progress').catch((error) => {
+    electronLog.error(`Failed to subscribe to core progress events: ${error.message}`);
+  });
+
   // Set up IPC handlers
   setupIpcHandlers();
 
@@ -238,6 +249,10 @@ app.on('before-quit', () => {
 // Clean up
 app.on('quit', () => {
   electronLog.info('Application is quitting');
+  if (coreClient) {
+    coreClient.close();
+    coreClient = null;
+  }
   tray = null;
 });
 
@@ -287,9 +302,27 @@ function setupIpcHandlers() {
     });
   });
 
+  // Request to the core daemon
+  ipcMain.handle('core-request', async (event, method: string, params: Record<string, string> = {}) => {
+    electronLog.debug(`Core request: ${method}`, params);
+    if (!coreClient) {
+      throw new Error('Core daemon is not available');
+    }
+    return coreClient.request(method, params);
+  });
+
   // Get list of available backup profiles
   ipcMain.handle('get-backup-profiles', async () => {
     electronLog.info('Getting backup profiles');
+    if (coreClient) {
+      try {
+        const profiles: string[] = await coreClient.request('listProfiles');
+        electronLog.info(`Found ${profiles.length} profiles`);
+        return profiles;
+      } catch (error: any) {
+        electronLog.warn(`Core daemon did not list profiles, running the core: ${error.message}`);
+      }
+    }
     return new Promise((resolve, reject) => {
       electronLog.debug(`Executing: ${coreExecutablePath} --list-profiles`);
       const command = childProcess.spawn(coreExecutablePath, ['--list-profiles']);
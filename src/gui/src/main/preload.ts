@@ -13,6 +13,10 @@ contextBridge.exposeInMainWorld('electronAPI', {
     console.log('[Preload] Getting backup profiles');
     return ipcRenderer.invoke('get-backup-profiles');
   },
+  coreRequest: (method: string, params: Record<string, string> = {}) => {
+    console.log('[Preload] Core request:', method, params);
+    return ipcRenderer.invoke('core-request', method, params);
+  },
   
   // File system operations
   selectDirectory: () => {
@@ -72,6 +76,18 @@ contextBridge.exposeInMainWorld('electronAPI', {
     };
   },
   
+  onCoreEvent: (callback: (topic: string, key: string, data: any) => void) => {
+    console.log('[Preload] Registering core event listener');
+    const listener = (_event: any, topic: string, key: string, data: any) => {
+      callback(topic, key, data);
+    };
+    ipcRenderer.on('core-event', listener);
+    return () => {
+      console.log('[Preload] Removing core event listener');
+      ipcRenderer.removeListener('core-event', listener);
+    };
+  },
+  
   onTriggerBackup: (callback: () => void) => {
     console.log('[Preload] Registering trigger backup listener');
     const listener = () => {
@@ -94,12 +110,14 @@ declare global {
     electronAPI: {
       executeCore: (args: string[]) => Promise<{ success: boolean, stdout: string, stderr: string }>;
       getBackupProfiles: () => Promise<string[]>;
+      coreRequest: (method: string, params?: Record<string, string>) => Promise<any>;
       selectDirectory: () => Promise<string[]>;
       openExternalUrl: (url: string) => Promise<void>;
       checkForUpdates: () => void;
       onUpdateStatus: (callback: (status: string, data: any) => void) => () => void;
       onCoreCommandOutput: (callback: (output: string) => void) => () => void;
       onCoreCommandError: (callback: (error: string) => void) => () => void;
+      onCoreEvent: (callback: (topic: string, key: string, data: any) => void) => () => void;
       onTriggerBackup: (callback: () => void) => () => void;
     }
   }
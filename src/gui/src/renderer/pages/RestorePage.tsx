@@ -38,6 +38,7 @@ import {
   History as HistoryIcon,
 } from '@mui/icons-material';
 import { useNavigate } from 'react-router-dom';
+import backupService, { BackupDirectoryPage } from '../services/BackupService';
 
 // Mock types
 interface BackupProfile {
@@ -65,6 +66,13 @@ interface FileEntry {
   modifiedTime: Date;
 }
 
+// Directory listings are fetched a page at a time and rendered as a window of rows
+const PAGE_SIZE = 500;
+const ROW_HEIGHT = 72;
+const LIST_HEIGHT = 480;
+const OVERSCAN_ROWS = 10;
+const PREFETCH_ROWS = 100;
+
 const RestorePage: React.FC = () => {
   const navigate = useNavigate();
   
@@ -85,6 +93,10 @@ const RestorePage: React.FC = () => {
   const [pathHistory, setPathHistory] = useState<string[]>([]);
   const [fileEntries, setFileEntries] = useState<FileEntry[]>([]);
   const [selectedFiles, setSelectedFiles] = useState<string[]>([]);
+  const [nextCursor, setNextCursor] = useState<string>('');
+  const [totalEntries, setTotalEntries] = useState(0);
+  const [loadingMore, setLoadingMore] = useState(false);
+  const [scrollTop, setScrollTop] = useState(0);
   
   // State for restore options
   const [restoreOptions, setRestoreOptions] = useState({
@@ -201,153 +213,86 @@ const RestorePage: React.FC = () => {
     fetchBackupVersions();
   }, [selectedProfileId]);
 
-  // Fetch files when version is selected or directory changes
+  // Fetch the first page of a directory when version is selected or directory changes
   useEffect(() => {
     if (!selectedVersionId || activeStep !== 1) return;
     
+    let cancelled = false;
     const fetchFiles = async () => {
       setLoading(true);
+      setFileEntries([]);
+      setNextCursor('');
+      setTotalEntries(0);
+      setScrollTop(0);
       
       try {
-        // In real implementation, would fetch from electronAPI
-        // For now, use mock data
-        await new Promise(resolve => setTimeout(resolve, 800)); // Simulate network delay
-        
-        // Mock files based on the current path
-        let mockFiles: FileEntry[] = [];
-        
-        if (!currentPath) {
-          // Root directory
-          mockFiles = [
-            {
-              name: 'Documents',
-              path: '/Documents',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'Pictures',
-              path: '/Pictures',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'Videos',
-              path: '/Videos',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'notes.txt',
-              path: '/notes.txt',
-              isDirectory: false,
-              size: 1024 * 12, // 12 KB
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'backup-report.pdf',
-              path: '/backup-report.pdf',
-              isDirectory: false,
-              size: 1024 * 1024 * 3.2, // 3.2 MB
-              modifiedTime: new Date(),
-            },
-          ];
-        } else if (currentPath === '/Documents') {
-          mockFiles = [
-            {
-              name: 'Work',
-              path: '/Documents/Work',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'Personal',
-              path: '/Documents/Personal',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'report.docx',
-              path: '/Documents/report.docx',
-              isDirectory: false,
-              size: 1024 * 1024 * 1.7, // 1.7 MB
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'budget.xlsx',
-              path: '/Documents/budget.xlsx',
-              isDirectory: false,
-              size: 1024 * 1024 * 0.5, // 0.5 MB
-              modifiedTime: new Date(),
-            },
-          ];
-        } else if (currentPath === '/Pictures') {
-          mockFiles = [
-            {
-              name: 'Vacation',
-              path: '/Pictures/Vacation',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'Family',
-              path: '/Pictures/Family',
-              isDirectory: true,
-              size: 0,
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'photo1.jpg',
-              path: '/Pictures/photo1.jpg',
-              isDirectory: false,
-              size: 1024 * 1024 * 2.3, // 2.3 MB
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'photo2.jpg',
-              path: '/Pictures/photo2.jpg',
-              isDirectory: false,
-              size: 1024 * 1024 * 3.1, // 3.1 MB
-              modifiedTime: new Date(),
-            },
-          ];
-        } else {
-          // Other paths - show some generic files
-          mockFiles = [
-            {
-              name: 'file1.txt',
-              path: `${currentPath}/file1.txt`,
-              isDirectory: false,
-              size: 1024 * 10, // 10 KB
-              modifiedTime: new Date(),
-            },
-            {
-              name: 'file2.txt',
-              path: `${currentPath}/file2.txt`,
-              isDirectory: false,
-              size: 1024 * 15, // 15 KB
-              modifiedTime: new Date(),
-            },
-          ];
-        }
+        const page = await fetchDirectoryPage(currentPath, '');
+        if (cancelled) return;
         
-        setFileEntries(mockFiles);
-        setLoading(false);
+        setFileEntries(toFileEntries(page));
+        setNextCursor(page.next);
+        setTotalEntries(page.total);
       } catch (error) {
         console.error('Error fetching files:', error);
-        setLoading(false);
+      } finally {
+        if (!cancelled) setLoading(false);
       }
     };
 
     fetchFiles();
+    return () => {
+      cancelled = true;
+    };
   }, [selectedVersionId, currentPath, activeStep]);
 
+  // Fetch one page of the current directory from the backup index
+  const fetchDirectoryPage = (dirPath: string, cursor: string) => {
+    const profile = profiles.find(p => p.id === selectedProfileId);
+    return backupService.browseBackupDirectory(
+      profile ? profile.name : selectedProfileId,
+      selectedVersionId,
+      dirPath || '/',
+      cursor,
+      PAGE_SIZE
+    );
+  };
+
+  const toFileEntries = (page: BackupDirectoryPage): FileEntry[] =>
+    page.entries.map(entry => ({
+      name: entry.name,
+      path: `${currentPath}/${entry.name}`,
+      isDirectory: entry.type === 'directory',
+      size: entry.size,
+      modifiedTime: new Date(entry.modified * 1000),
+    }));
+
+  // Load the next page once the user scrolls close to the end of what is loaded
+  const loadMoreFiles = async () => {
+    if (!nextCursor || loadingMore) return;
+    
+    setLoadingMore(true);
+    try {
+      const page = await fetchDirectoryPage(currentPath, nextCursor);
+      setFileEntries(prev => [...prev, ...toFileEntries(page)]);
+      setNextCursor(page.next);
+      setTotalEntries(page.total);
+    } catch (error) {
+      console.error('Error fetching more files:', error);
+    } finally {
+      setLoadingMore(false);
+    }
+  };
+
+  const handleFileListScroll = (event: React.UIEvent<HTMLDivElement>) => {
+    const target = event.currentTarget;
+    setScrollTop(target.scrollTop);
+    
+    const lastVisibleRow = Math.ceil((target.scrollTop + LIST_HEIGHT) / ROW_HEIGHT);
+    if (lastVisibleRow + PREFETCH_ROWS >= fileEntries.length) {
+      loadMoreFiles();
+    }
+  };
+
   // Handle next step
   const handleNext = () => {
     setActiveStep(prevStep => prevStep + 1);
@@ -554,6 +499,10 @@ const RestorePage: React.FC = () => {
     </Paper>
   );
 
+  // Only the rows in view (plus some overscan) are rendered, so huge directories stay responsive
+  const firstVisibleRow = Math.max(0, Math.floor(scrollTop / ROW_HEIGHT) - OVERSCAN_ROWS);
+  const lastVisibleRow = Math.min(fileEntries.length, Math.ceil((scrollTop + LIST_HEIGHT) / ROW_HEIGHT) + OVERSCAN_ROWS);
+
   const renderSelectFiles = () => (
     <Paper sx={{ p: 3, mb: 3 }}>
       <Typography variant="h6" gutterBottom>
@@ -612,46 +561,61 @@ const RestorePage: React.FC = () => {
         <Typography variant="body1" sx={{ ml: 1 }}>
           Current Directory: <code>{currentPath || '/'}</code>
         </Typography>
+        {totalEntries > 0 && (
+          <Typography variant="body2" color="text.secondary" sx={{ ml: 'auto' }}>
+            {fileEntries.length < totalEntries
+              ? `${fileEntries.length} of ${totalEntries} entries loaded`
+              : `${totalEntries} entries`}
+          </Typography>
+        )}
       </Box>
       
       <Divider sx={{ mb: 2 }} />
       
       {fileEntries.length > 0 ? (
-        <List sx={{ width: '100%', bgcolor: 'background.paper' }}>
-          {fileEntries.map((entry) => (
-            <ListItem
-              key={entry.path}
-              disablePadding
-              secondaryAction={
-                entry.isDirectory ? null : (
-                  <Checkbox
-                    edge="end"
-                    checked={selectedFiles.includes(entry.path)}
-                    onChange={() => toggleFileSelection(entry.path)}
-                  />
-                )
-              }
-            >
-              <ListItemButton
-                onClick={() => {
-                  if (entry.isDirectory) {
-                    navigateToDirectory(entry.path);
-                  } else {
-                    toggleFileSelection(entry.path);
-                  }
-                }}
+        <Box
+          key={currentPath}
+          sx={{ height: LIST_HEIGHT, overflowY: 'auto', bgcolor: 'background.paper' }}
+          onScroll={handleFileListScroll}
+        >
+          <List sx={{ width: '100%', position: 'relative', height: fileEntries.length * ROW_HEIGHT, py: 0 }}>
+            {fileEntries.slice(firstVisibleRow, lastVisibleRow).map((entry, index) => (
+              <ListItem
+                key={entry.path}
+                disablePadding
+                sx={{ position: 'absolute', top: (firstVisibleRow + index) * ROW_HEIGHT, height: ROW_HEIGHT, width: '100%' }}
+                secondaryAction={
+                  entry.isDirectory ? null : (
+                    <Checkbox
+                      edge="end"
+                      checked={selectedFiles.includes(entry.path)}
+                      onChange={() => toggleFileSelection(entry.path)}
+                    />
+                  )
+                }
               >
-                <ListItemIcon>
-                  {entry.isDirectory ? <FolderIcon /> : <FileIcon />}
-                </ListItemIcon>
-                <ListItemText 
-                  primary={entry.name} 
-                  secondary={entry.isDirectory ? 'Directory' : `${formatBytes(entry.size)}, modified ${entry.modifiedTime.toLocaleString()}`} 
-                />
-              </ListItemButton>
-            </ListItem>
-          ))}
-        </List>
+                <ListItemButton
+                  onClick={() => {
+                    if (entry.isDirectory) {
+                      navigateToDirectory(entry.path);
+                    } else {
+                      toggleFileSelection(entry.path);
+                    }
+                  }}
+                >
+                  <ListItemIcon>
+                    {entry.isDirectory ? <FolderIcon /> : <FileIcon />}
+                  </ListItemIcon>
+                  <ListItemText 
+                    primary={entry.name} 
+                    secondary={entry.isDirectory ? 'Directory' : `${formatBytes(entry.size)}, modified ${entry.modifiedTime.toLocaleString()}`} 
+                  />
+                </ListItemButton>
+              </ListItem>
+            ))}
+          </List>
+          {loadingMore && <LinearProgress />}
+        </Box>
       ) : (
         <Typography variant="body1" color="text.secondary">
           No files or directories found in this location.
@@ -48,6 +48,25 @@ export interface BackupListItem {
   fileCount: number;
   status: 'success' | 'error' | 'partial';
   errorMessage?: string;
+  verified?: boolean;
+  newFiles?: number;
+  modifiedFiles?: number;
+  unchangedFiles?: number;
+  duration?: number; // seconds
+}
+
+export interface BackupDirectoryEntry {
+  name: string;
+  type: 'file' | 'directory' | 'symlink' | 'other';
+  size: number;
+  modified: number; // seconds since the epoch
+}
+
+export interface BackupDirectoryPage {
+  path: string;
+  total: number;
+  next: string;
+  entries: BackupDirectoryEntry[];
 }
 
 export interface BackupProgress {
@@ -151,35 +170,18 @@ class BackupService {
 
   /**
    * Start a backup using a profile
+   *
+   * The core daemon queues the backup and reports it with progress events.
    */
   async startBackup(profileId: string, options: { dryRun?: boolean } = {}): Promise<string> {
     console.log(`${this.logPrefix} Starting backup for profile: ${profileId}`, options);
     try {
-      const args = ['start-backup', '--profile-id', profileId];
-      
       if (options.dryRun) {
-        console.log(`${this.logPrefix} Dry run mode enabled`);
-        args.push('--dry-run');
-      }
-      
-      console.log(`${this.logPrefix} Executing start-backup command with args:`, args);
-      const result = await window.electronAPI.executeCore(args);
-      
-      if (!result.success) {
-        console.error(`${this.logPrefix} Backup failed:`, result.stderr || result.error);
-        throw new Error(result.stderr || 'Failed to start backup');
-      }
-      
-      // Return the backup ID from the output
-      try {
-        const parsed = JSON.parse(result.stdout);
-        console.log(`${this.logPrefix} Backup started with ID: ${parsed.backupId}`);
-        return parsed.backupId;
-      } catch (e) {
-        console.error(`${this.logPrefix} Failed to parse backup ID from response:`, e);
-        console.log(`${this.logPrefix} Response content:`, result.stdout);
-        throw new Error('Invalid response format from backup command');
+        console.log(`${this.logPrefix} Dry run is not supported by the daemon, starting a regular backup`);
       }
+      const result = await window.electronAPI.coreRequest('startBackup', { profile: profileId });
+      console.log(`${this.logPrefix} Backup started with ID: ${result.backupId}`);
+      return result.backupId;
     } catch (error) {
       console.error(`${this.logPrefix} Error starting backup:`, error);
       throw error;
@@ -192,15 +194,7 @@ class BackupService {
   async cancelBackup(backupId: string): Promise<boolean> {
     console.log(`${this.logPrefix} Canceling backup: ${backupId}`);
     try {
-      const args = ['cancel-backup', '--backup-id', backupId];
-      console.log(`${this.logPrefix} Executing command with args:`, args);
-      const result = await window.electronAPI.executeCore(args);
-      
-      if (!result.success) {
-        console.error(`${this.logPrefix} Cancel backup failed:`, result.stderr || result.error);
-        throw new Error(result.stderr || 'Failed to cancel backup');
-      }
-      
+      await window.electronAPI.coreRequest('cancelBackup', { profile: backupId });
       console.log(`${this.logPrefix} Backup ${backupId} canceled successfully`);
       return true;
     } catch (error) {
@@ -215,24 +209,10 @@ class BackupService {
   async getBackupsList(profileId: string): Promise<BackupListItem[]> {
     console.log(`${this.logPrefix} Getting backups list for profile: ${profileId}`);
     try {
-      const args = ['list-backups', '--profile-id', profileId];
-      console.log(`${this.logPrefix} Executing command with args:`, args);
-      const result = await window.electronAPI.executeCore(args);
-      
-      if (!result.success) {
-        console.error(`${this.logPrefix} List backups failed:`, result.stderr || result.error);
-        throw new Error(result.stderr || 'Failed to list backups');
-      }
-      
-      try {
-        const parsed = JSON.parse(result.stdout);
-        console.log(`${this.logPrefix} Retrieved ${parsed.backups.length} backups`);
-        return parsed.backups;
-      } catch (e) {
-        console.error(`${this.logPrefix} Failed to parse backups list from response:`, e);
-        console.log(`${this.logPrefix} Response content:`, result.stdout);
-        throw new Error('Invalid response format from list-backups command');
-      }
+      // Served by the daemon from the destination's snapshot catalog
+      const result = await window.electronAPI.coreRequest('listSnapshots', { profile: profileId });
+      console.log(`${this.logPrefix} Retrieved ${result.backups.length} backups`);
+      return result.backups;
     } catch (error) {
       console.error(`${this.logPrefix} Error listing backups:`, error);
       throw error;
@@ -321,59 +301,69 @@ class BackupService {
   }
 
   /**
-   * Browse files in a backup
+   * Browse one page of a directory in a backup
+   *
+   * Pass the `next` cursor of a page to get the following one; an empty
+   * cursor means the directory has no more entries.
    */
-  async browseBackupFiles(backupId: string, path: string = '/'): Promise<any[]> {
-    console.log(`${this.logPrefix} Browsing files in backup ${backupId} at path: ${path}`);
+  async browseBackupDirectory(
+    profileName: string,
+    backupId: string,
+    path: string = '/',
+    cursor: string = '',
+    limit: number = 500
+  ): Promise<BackupDirectoryPage> {
+    console.log(`${this.logPrefix} Browsing backup ${backupId} at path: ${path}${cursor ? ` after ${cursor}` : ''}`);
     try {
-      const args = ['browse-backup', '--backup-id', backupId, '--path', path];
-      console.log(`${this.logPrefix} Executing command with args:`, args);
-      const result = await window.electronAPI.executeCore(args);
-      
-      if (!result.success) {
-        console.error(`${this.logPrefix} Browse backup files failed:`, result.stderr || result.error);
-        throw new Error(result.stderr || 'Failed to browse backup files');
-      }
-      
-      try {
-        const parsed = JSON.parse(result.stdout);
-        console.log(`${this.logPrefix} Retrieved ${parsed.items.length} items from backup`);
-        return parsed.items;
-      } catch (e) {
-        console.error(`${this.logPrefix} Failed to parse file list from response:`, e);
-        console.log(`${this.logPrefix} Response content:`, result.stdout);
-        throw new Error('Invalid response format from browse-backup command');
+      const params: Record<string, string> = {
+        profile: profileName,
+        snapshot: backupId,
+        path: path || '/',
+        limit: String(limit),
+      };
+      if (cursor) {
+        params.cursor = cursor;
       }
+      const parsed: BackupDirectoryPage = await window.electronAPI.coreRequest('listDir', params);
+      console.log(`${this.logPrefix} Retrieved ${parsed.entries.length} of ${parsed.total} entries`);
+      return parsed;
     } catch (error) {
-      console.error(`${this.logPrefix} Error browsing backup files:`, error);
+      console.error(`${this.logPrefix} Error browsing backup:`, error);
       throw error;
     }
   }
 
   /**
    * Register a listener for backup progress events
+   *
+   * The daemon sends the latest progress of each running backup at most ten
+   * times a second.
    */
   registerProgressListener(callback: (progress: BackupProgress) => void): () => void {
     console.log(`${this.logPrefix} Registering progress listener`);
-    const listener = (_event: any, progress: BackupProgress) => {
+    const remove = window.electronAPI.onCoreEvent((topic, _key, data) => {
+      if (topic !== 'progress') {
+        return;
+      }
+      const progress: BackupProgress = {
+        currentFile: '',
+        processedFiles: data.processedFiles,
+        totalFiles: data.totalFiles,
+        processedBytes: data.processedSize,
+        totalBytes: data.totalSize,
+        percentComplete: data.percentComplete,
+        speed: data.bytesPerSecond,
+        remainingTime: data.remainingSeconds ?? 0,
+      };
       console.log(`${this.logPrefix} Progress update: ${progress.percentComplete.toFixed(2)}% complete, ${progress.processedFiles}/${progress.totalFiles} files`);
       callback(progress);
-    };
-    
-    window.electronAPI.onCoreCommandOutput(output => {
-      // Try to parse progress information from output
-      try {
-        if (output.includes('PROGRESS:')) {
-          const progressData = JSON.parse(output.substring(output.indexOf('PROGRESS:') + 9));
-          listener(null, progressData);
-        }
-      } catch (e) {
-        console.error(`${this.logPrefix} Error parsing progress data:`, e);
-      }
     });
     
     console.log(`${this.logPrefix} Progress listener registered`);
-    return () => console.log(`${this.logPrefix} Progress listener removed`);
+    return () => {
+      remove();
+      console.log(`${this.logPrefix} Progress listener removed`);
+    };
   }
 
   /**
@@ -1,6 +1,7 @@
 interface ElectronAPI {
   executeCore: (command: string, args: string[]) => Promise<{ success: boolean; output: string; error?: string }>;
   getBackupProfiles: () => Promise<any[]>;
+  coreRequest: (method: string, params?: Record<string, string>) => Promise<any>;
   selectDirectory: () => Promise<string | null>;
   openExternalUrl: (url: string) => Promise<void>;
   onBackupComplete: (callback: (event: any, status: any) => void) => void;
@@ -8,6 +9,7 @@ interface ElectronAPI {
   onUpdateAvailable: (callback: (event: any, info: any) => void) => void;
   onUpdateDownloaded: (callback: (event: any, info: any) => void) => void;
   onCommandOutput: (callback: (event: any, data: any) => void) => void;
+  onCoreEvent: (callback: (topic: string, key: string, data: any) => void) => () => void;
 }
 
 interface Window {